@@ -0,0 +1,96 @@
+#include "crc32.h"
+#include <stddef.h>
+
+/* Little endian word from any alignment, one load on the Cortex-M7 */
+static uint32_t load_le32(const uint8_t *data)
+{
+    return (uint32_t)data[0] |
+           ((uint32_t)data[1] << 8) |
+           ((uint32_t)data[2] << 16) |
+           ((uint32_t)data[3] << 24);
+}
+
+uint32_t crc32_update_bytewise(
+    uint32_t state,
+    const uint8_t *data,
+    uint32_t length)
+{
+    uint32_t i;
+
+    for (i = 0U; i < length; i++) {
+        state = (state >> 8) ^ g_crc32_table[0][(state ^ data[i]) & 0xFFU];
+    }
+
+    return state;
+}
+
+uint32_t crc32_update_slice8(
+    uint32_t state,
+    const uint8_t *data,
+    uint32_t length)
+{
+    uint32_t low;
+    uint32_t high;
+
+    /* Each byte of the step is looked up in the table for the number of
+     * bytes following it, the eight lookups are independent */
+    while (length >= 8U) {
+        low = state ^ load_le32(data);
+        high = load_le32(&data[4]);
+        state = g_crc32_table[7][low & 0xFFU] ^
+                g_crc32_table[6][(low >> 8) & 0xFFU] ^
+                g_crc32_table[5][(low >> 16) & 0xFFU] ^
+                g_crc32_table[4][low >> 24] ^
+                g_crc32_table[3][high & 0xFFU] ^
+                g_crc32_table[2][(high >> 8) & 0xFFU] ^
+                g_crc32_table[1][(high >> 16) & 0xFFU] ^
+                g_crc32_table[0][high >> 24];
+        data += 8;
+        length -= 8U;
+    }
+
+    return crc32_update_bytewise(state, data, length);
+}
+
+void crc32_init(crc32_t *crc)
+{
+    if (crc == NULL) {
+        return;
+    }
+
+    crc->state = CRC32_INITIAL;
+    crc->length = 0U;
+}
+
+void crc32_update(
+    crc32_t *crc,
+    const uint8_t *data,
+    uint32_t length)
+{
+    if ((crc == NULL) || (data == NULL)) {
+        return;
+    }
+
+    crc->state = crc32_update_slice8(crc->state, data, length);
+    crc->length += length;
+}
+
+uint32_t crc32_value(const crc32_t *crc)
+{
+    if (crc == NULL) {
+        return 0U;
+    }
+
+    return crc->state ^ CRC32_FINAL_XOR;
+}
+
+uint32_t crc32_compute(
+    const uint8_t *data,
+    uint32_t length)
+{
+    if (data == NULL) {
+        return 0U;
+    }
+
+    return crc32_update_slice8(CRC32_INITIAL, data, length) ^ CRC32_FINAL_XOR;
+}
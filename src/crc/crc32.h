@@ -0,0 +1,67 @@
+#ifndef CRC32_H
+#define CRC32_H
+
+#include <stdint.h>
+
+/**
+ * @file crc32.h
+ * @brief CRC-32 (IEEE 802.3, reflected 0xEDB88320) computed in pieces
+ *
+ * Data is fed as it arrives, the CRC of everything so far is available
+ * at any time. The kernel works on 8 bytes per step with eight lookup
+ * tables (slicing-by-8), crc32_update_bytewise() is the one table
+ * reference it has to match.
+ */
+
+#define CRC32_INITIAL               0xFFFFFFFFU
+#define CRC32_FINAL_XOR             0xFFFFFFFFU
+
+/* CRC of "123456789" */
+#define CRC32_CHECK_VALUE           0xCBF43926U
+
+#define CRC32_SLICES                8U
+
+/* Lookup tables (crc32_table.c) */
+extern const uint32_t g_crc32_table[CRC32_SLICES][256];
+
+/* CRC in progress */
+typedef struct {
+    uint32_t state;                     /* Before the final XOR */
+    uint32_t length;                    /* Bytes fed so far */
+} crc32_t;
+
+void crc32_init(
+    crc32_t *crc
+);
+
+void crc32_update(
+    crc32_t *crc,
+    const uint8_t *data,
+    uint32_t length
+);
+
+/* CRC of the data fed since crc32_init() */
+uint32_t crc32_value(
+    const crc32_t *crc
+);
+
+/* CRC of one buffer */
+uint32_t crc32_compute(
+    const uint8_t *data,
+    uint32_t length
+);
+
+/* Kernels on the raw state, CRC32_INITIAL to start */
+uint32_t crc32_update_slice8(
+    uint32_t state,
+    const uint8_t *data,
+    uint32_t length
+);
+
+uint32_t crc32_update_bytewise(
+    uint32_t state,
+    const uint8_t *data,
+    uint32_t length
+);
+
+#endif /* CRC32_H */
@@ -1,12 +1,11 @@
 #include "app_doip_entity.h"
 #include "doip_config.h"
+#include "doip_dispatch.h"
 #include <string.h>
 #include <stdio.h>
-#include "debug_print.h"
 
 static void entity_udp_rx_callback(
-    const char *src_ip,
-    uint16_t src_port,
+    const doip_endpoint_t *src,
     const uint8_t *data,
     uint32_t length,
     void *user_data);
@@ -17,6 +16,14 @@ static void entity_tcp_rx_callback(
     uint32_t length,
     void *user_data);
 
+static bool entity_tcp_stream_callback(
+    int connection_id,
+    doip_stream_event_t event,
+    const doip_stream_info_t *info,
+    const uint8_t *data,
+    uint32_t length,
+    void *user_data);
+
 static void entity_tcp_connected_callback(
     int connection_id,
     void *user_data);
@@ -25,6 +32,42 @@ static void entity_tcp_disconnected_callback(
     int connection_id,
     void *user_data);
 
+/* Timer ids in entity->timers */
+#define ENTITY_TIMER_ANNOUNCEMENT           0U
+#define ENTITY_TIMER_INACTIVITY(conn)       ((uint16_t)(1U + (uint32_t)(conn)))
+#define ENTITY_TIMER_ALIVE_CHECK(conn)      ((uint16_t)(1U + DOIP_MAX_CONNECTIONS + (uint32_t)(conn)))
+
+/* Routing activation decision that waits for alive checks */
+#define ENTITY_ROUTING_ACT_PENDING          0xFFU
+
+/* Number of testers that may be routed at the same time. One connection
+ * more is accepted, so the pool keeps a free one for reclamation. */
+static uint32_t tester_limit(const doip_entity_t *entity)
+{
+    uint32_t limit = (uint32_t)entity->config.max_tester_connections;
+    uint32_t pool = entity->interface->connection_count;
+    
+    if ((limit == 0U) || (pool < 2U)) {
+        limit = 1U;
+    } else if (limit > (pool - 1U)) {
+        limit = pool - 1U;
+    } else {
+        /* Configured limit is valid */
+    }
+    
+    return limit;
+}
+
+/* Initial or general inactivity timeout, counted from now */
+static void start_inactivity_timer(
+    doip_entity_t *entity,
+    int connection_id,
+    uint32_t timeout_ms)
+{
+    doip_timer_start(&entity->timers, ENTITY_TIMER_INACTIVITY(connection_id),
+                     entity->time_ms + timeout_ms);
+}
+
 doip_result_t doip_entity_init(
     doip_entity_t *entity,
     const doip_entity_config_t *config,
@@ -39,17 +82,37 @@ doip_result_t doip_entity_init(
     (void)memcpy(&entity->config, config, sizeof(doip_entity_config_t));
     entity->interface = interface;
     entity->announcement_count = 0U;
-    entity->announcement_timer = 0U;
+    entity->time_ms = 0U;
+    doip_timer_init(&entity->timers);
+    (void)memset(entity->udp_sources, 0, sizeof(entity->udp_sources));
+    (void)memset(&entity->udp_stats, 0, sizeof(entity->udp_stats));
+    entity->uds_callback = NULL;
+    entity->uds_stream_callback = NULL;
+    entity->coalesce_responses = true;
+    entity->route_count = 0U;
+    entity->pending_ack_connection = -1;
+    entity->pending_ack_source = 0U;
+    entity->pending_ack_target = 0U;
+    entity->coalesced_ack_count = 0U;
+    entity->reclaimed_count = 0U;
+    entity->tx_frames_used = 0U;
+    entity->further_action_required = 0x00U; /* No further action */
+    entity->sync_status = 0x00U; /* Complete */
+    entity->vehicle_id_frame_valid = false;
+    (void)memset(entity->tester_slots, 0, sizeof(entity->tester_slots));
+    
+    /* Accept one socket more than testers may be routed, so a new tester
+     * can ask for a slot that stale connections are reclaimed for */
+    doip_interface_set_max_connections(interface, tester_limit(entity) + 1U);
     
     /* Initialize connection contexts */
     for (i = 0U; i < DOIP_MAX_CONNECTIONS; i++) {
         entity->connections[i].connection_id = -1;
         entity->connections[i].source_address = 0U;
         entity->connections[i].is_activated = false;
-        entity->connections[i].initial_inactivity_timer = 0U;
-        entity->connections[i].general_inactivity_timer = 0U;
-        entity->connections[i].alive_check_timer = 0U;
         entity->connections[i].alive_check_pending = false;
+        entity->connections[i].activation_pending = false;
+        entity->connections[i].pending_source_address = 0U;
     }
     
     return DOIP_RESULT_OK;
@@ -75,127 +138,213 @@ doip_result_t doip_entity_start(doip_entity_t *entity)
         return result;
     }
     
+    /* Diagnostic messages larger than the RX buffer are streamed */
+    doip_interface_set_stream_callback(entity->interface,
+                                       entity_tcp_stream_callback,
+                                       (void *)entity);
+    
     /* Send initial vehicle announcements (3 times per ISO 13400) */
     entity->announcement_count = 0U;
-    entity->announcement_timer = 0U; /* Random 0-500ms in real implementation */
+    /* Random 0-500ms in real implementation */
+    doip_timer_start(&entity->timers, ENTITY_TIMER_ANNOUNCEMENT, entity->time_ms);
     
     return DOIP_RESULT_OK;
 }
 
-doip_result_t doip_entity_send_vehicle_announcement(doip_entity_t *entity)
+void doip_entity_set_uds_stream_callback(
+    doip_entity_t *entity,
+    doip_entity_uds_stream_callback_t stream_callback)
+{
+    if (entity != NULL) {
+        entity->uds_stream_callback = stream_callback;
+    }
+}
+
+/* Index of the first route to 'target_address' or where it would go */
+static uint32_t find_route(const doip_entity_t *entity, uint16_t target_address)
+{
+    uint32_t low = 0U;
+    uint32_t high = entity->route_count;
+    uint32_t mid;
+
+    while (low < high) {
+        mid = low + ((high - low) / 2U);
+        if (entity->routes[mid].target_address < target_address) {
+            low = mid + 1U;
+        } else {
+            high = mid;
+        }
+    }
+
+    return low;
+}
+
+doip_result_t doip_entity_add_route(
+    doip_entity_t *entity,
+    uint16_t target_addr,
+    doip_entity_uds_rx_callback_t handler,
+    void *user_data)
+{
+    uint32_t index;
+    uint32_t i;
+
+    if ((entity == NULL) || (handler == NULL)) {
+        return DOIP_RESULT_INVALID_PARAM;
+    }
+    if (entity->route_count >= DOIP_MAX_ROUTES) {
+        return DOIP_RESULT_NO_MEMORY;
+    }
+
+    /* Behind the routes already added for the address, so a functional
+     * request reaches the nodes in the order they were added */
+    index = find_route(entity, target_addr);
+    while ((index < entity->route_count) &&
+           (entity->routes[index].target_address == target_addr)) {
+        index++;
+    }
+    for (i = entity->route_count; i > index; i--) {
+        entity->routes[i] = entity->routes[i - 1U];
+    }
+
+    entity->routes[index].target_address = target_addr;
+    entity->routes[index].handler = handler;
+    entity->routes[index].user_data = user_data;
+    entity->route_count++;
+
+    return DOIP_RESULT_OK;
+}
+
+void doip_entity_set_response_coalescing(
+    doip_entity_t *entity,
+    bool enable)
+{
+    if (entity != NULL) {
+        entity->coalesce_responses = enable;
+    }
+}
+
+void doip_entity_set_vehicle_status(
+    doip_entity_t *entity,
+    uint8_t further_action_required,
+    uint8_t sync_status)
+{
+    if (entity == NULL) {
+        return;
+    }
+    
+    if ((entity->further_action_required != further_action_required) ||
+        (entity->sync_status != sync_status)) {
+        entity->further_action_required = further_action_required;
+        entity->sync_status = sync_status;
+        entity->vehicle_id_frame_valid = false;
+    }
+}
+
+void doip_entity_invalidate_vehicle_id(doip_entity_t *entity)
+{
+    if (entity != NULL) {
+        entity->vehicle_id_frame_valid = false;
+    }
+}
+
+/* Encoded vehicle identification frame, rebuilt only after a change. Its
+ * VIN and EID fields double as the keys for filtered requests. */
+static const uint8_t *get_vehicle_id_frame(doip_entity_t *entity)
 {
-    uint8_t buffer[64];
-    uint32_t encoded_length;
     doip_vehicle_id_response_t response;
-    doip_result_t result;
+    uint32_t encoded_length;
+    
+    if (!entity->vehicle_id_frame_valid) {
+        (void)memcpy(response.vin, entity->config.vin, DOIP_VIN_LENGTH);
+        response.logical_address = entity->config.logical_address;
+        (void)memcpy(response.eid, entity->config.eid, DOIP_EID_LENGTH);
+        (void)memcpy(response.gid, entity->config.gid, DOIP_GID_LENGTH);
+        response.further_action_required = entity->further_action_required;
+        response.sync_status = entity->sync_status;
+        
+        if (doip_encode_vehicle_id_response(&response, entity->vehicle_id_frame,
+                sizeof(entity->vehicle_id_frame), &encoded_length) != DOIP_RESULT_OK) {
+            return NULL;
+        }
+        entity->vehicle_id_frame_valid = true;
+    }
+    
+    return entity->vehicle_id_frame;
+}
+
+doip_result_t doip_entity_send_vehicle_announcement(doip_entity_t *entity)
+{
+    const uint8_t *frame;
     
     if (entity == NULL) {
         return DOIP_RESULT_INVALID_PARAM;
     }
     
-    /* Prepare vehicle identification response */
-    (void)memcpy(response.vin, entity->config.vin, DOIP_VIN_LENGTH);
-    response.logical_address = entity->config.logical_address;
-    (void)memcpy(response.eid, entity->config.eid, DOIP_EID_LENGTH);
-    (void)memcpy(response.gid, entity->config.gid, DOIP_GID_LENGTH);
-    response.further_action_required = 0x00U; /* No further action */
-    response.sync_status = 0x00U; /* Complete */
-    
-    result = doip_encode_vehicle_id_response(&response, buffer,
-                                            sizeof(buffer), &encoded_length);
-    if (result != DOIP_RESULT_OK) {
-        return result;
+    frame = get_vehicle_id_frame(entity);
+    if (frame == NULL) {
+        return DOIP_RESULT_ERROR;
     }
     
-    debug_print("[DOIP TX UDP] Payload type: 0x%04X, length: %u\r\n", DOIP_PAYLOAD_TYPE_VEHICLE_ANNOUNCEMENT, encoded_length);
+    DOIP_TRACE("[DOIP TX UDP] Payload type: 0x%04X, length: %u\r\n", DOIP_PAYLOAD_TYPE_VEHICLE_ANNOUNCEMENT, DOIP_VEHICLE_ID_RESPONSE_SIZE);
     /* Broadcast announcement */
-    return doip_interface_udp_broadcast(entity->interface, buffer,
-                                       encoded_length, DOIP_UDP_DISCOVERY_PORT);
+    return doip_interface_udp_broadcast(entity->interface, frame,
+                                       DOIP_VEHICLE_ID_RESPONSE_SIZE,
+                                       DOIP_UDP_DISCOVERY_PORT);
 }
 
+/* Payload lengths are checked by the dispatch table */
 static void handle_vehicle_id_request(
-    doip_entity_t *entity,
-    const char *src_ip,
-    uint16_t src_port,
-    uint16_t payload_type,
-    const uint8_t *payload,
-    uint32_t payload_length)
+    void *context,
+    const doip_dispatch_msg_t *msg)
 {
-    uint8_t buffer[64];
-    uint32_t encoded_length;
-    doip_vehicle_id_response_t response;
+    doip_entity_t *entity = (doip_entity_t *)context;
+    const uint8_t *frame = get_vehicle_id_frame(entity);
     bool should_respond = false;
     
+    if (frame == NULL) {
+        return;
+    }
+    
     /* Check request type */
-    if (payload_type == DOIP_PAYLOAD_TYPE_VEHICLE_ID_REQ) {
+    if (msg->payload_type == DOIP_PAYLOAD_TYPE_VEHICLE_ID_REQ) {
         should_respond = true;
-    } else if (payload_type == DOIP_PAYLOAD_TYPE_VEHICLE_ID_REQ_VIN) {
-        if ((payload_length >= DOIP_VIN_LENGTH) &&
-            (memcmp(payload, entity->config.vin, DOIP_VIN_LENGTH) == 0)) {
-            should_respond = true;
-        }
-    } else if (payload_type == DOIP_PAYLOAD_TYPE_VEHICLE_ID_REQ_EID) {
-        if ((payload_length >= DOIP_EID_LENGTH) &&
-            (memcmp(payload, entity->config.eid, DOIP_EID_LENGTH) == 0)) {
-            should_respond = true;
-        }
+    } else if (msg->payload_type == DOIP_PAYLOAD_TYPE_VEHICLE_ID_REQ_VIN) {
+        should_respond = (memcmp(msg->payload, &frame[DOIP_VEHICLE_ID_VIN_OFFSET],
+                                 DOIP_VIN_LENGTH) == 0);
     } else {
-        /* Unknown request type */
+        should_respond = (memcmp(msg->payload, &frame[DOIP_VEHICLE_ID_EID_OFFSET],
+                                 DOIP_EID_LENGTH) == 0);
     }
     
     if (should_respond) {
-        (void)memcpy(response.vin, entity->config.vin, DOIP_VIN_LENGTH);
-        response.logical_address = entity->config.logical_address;
-        (void)memcpy(response.eid, entity->config.eid, DOIP_EID_LENGTH);
-        (void)memcpy(response.gid, entity->config.gid, DOIP_GID_LENGTH);
-        response.further_action_required = 0x00U;
-        response.sync_status = 0x00U;
-        
-        if (doip_encode_vehicle_id_response(&response, buffer,
-                sizeof(buffer), &encoded_length) == DOIP_RESULT_OK) {
-            debug_print("[DOIP TX UDP] Payload type: 0x%04X, length: %u\r\n", DOIP_PAYLOAD_TYPE_VEHICLE_ANNOUNCEMENT, encoded_length);
-            (void)doip_interface_udp_send(entity->interface, src_ip,
-                                         src_port, buffer, encoded_length);
-        }
+        DOIP_TRACE("[DOIP TX UDP] Payload type: 0x%04X, length: %u\r\n", DOIP_PAYLOAD_TYPE_VEHICLE_ANNOUNCEMENT, DOIP_VEHICLE_ID_RESPONSE_SIZE);
+        (void)doip_interface_udp_send(entity->interface, msg->src,
+                                     frame, DOIP_VEHICLE_ID_RESPONSE_SIZE);
     }
 }
 
-static void handle_routing_activation_request(
+/* Connection id of an activated tester, -1 if the address is not routed */
+static int find_tester_connection(const doip_entity_t *entity, uint16_t tester_address)
+{
+    if ((tester_address < DOIP_TESTER_ADDRESS_MIN) ||
+        (tester_address > DOIP_TESTER_ADDRESS_MAX)) {
+        return -1;
+    }
+    
+    return (int)entity->tester_slots[tester_address - DOIP_TESTER_ADDRESS_MIN] - 1;
+}
+
+static void send_routing_activation_response(
     doip_entity_t *entity,
     int connection_id,
-    const uint8_t *payload,
-    uint32_t payload_length)
+    uint16_t tester_address,
+    uint8_t response_code)
 {
-    doip_routing_activation_req_t request;
     doip_routing_activation_res_t response;
     uint8_t buffer[32];
     uint32_t encoded_length;
-    uint8_t response_code = DOIP_ROUTING_ACT_RES_SUCCESS;
-    
-    /* Decode request */
-    if (doip_decode_routing_activation_req(payload, payload_length,
-            &request) != DOIP_RESULT_OK) {
-        response_code = DOIP_ROUTING_ACT_RES_UNKNOWN_SOURCE;
-    } else {
-
-        //printf("[DOIP RX] routing_activation_request source_address:%x activation_type:%x oem_specific:%x", request.source_address , request.activation_type , request.oem_specific );
-
-        /* Validate source address (should be in tester range 0x0E00-0x0FFF) */
-        if ((request.source_address < DOIP_TESTER_ADDRESS_MIN) ||
-            (request.source_address > DOIP_TESTER_ADDRESS_MAX)) {
-            response_code = DOIP_ROUTING_ACT_RES_UNKNOWN_SOURCE;
-        } else {
-            /* Activate routing */
-            entity->connections[connection_id].is_activated = true;
-            entity->connections[connection_id].source_address = request.source_address;
-            entity->connections[connection_id].general_inactivity_timer =
-                entity->config.general_inactivity_time;
-            response_code = DOIP_ROUTING_ACT_RES_SUCCESS;
-        }
-    }
     
-    /* Send response */
-    response.tester_address = request.source_address;
+    response.tester_address = tester_address;
     response.entity_address = entity->config.logical_address;
     response.response_code = response_code;
     response.reserved = 0U;
@@ -203,127 +352,597 @@ static void handle_routing_activation_request(
     
     if (doip_encode_routing_activation_res(&response, buffer,
             sizeof(buffer), &encoded_length) == DOIP_RESULT_OK) {
-        debug_print("[DOIP TX TCP] Payload type: 0x%04X, length: %u\r\n", DOIP_PAYLOAD_TYPE_ROUTING_ACTIVATION_RES, encoded_length);
+        DOIP_TRACE("[DOIP TX TCP] Payload type: 0x%04X, length: %u\r\n", DOIP_PAYLOAD_TYPE_ROUTING_ACTIVATION_RES, encoded_length);
         (void)doip_interface_tcp_send(entity->interface, connection_id,
                                      buffer, encoded_length);
     }
 }
 
-static void handle_diagnostic_message(
+/* Send an alive check request, the socket is reclaimed if the tester
+ * does not answer within alive_check_time */
+static void start_alive_check(doip_entity_t *entity, int connection_id)
+{
+    doip_entity_connection_t *conn = &entity->connections[connection_id];
+    doip_header_t header;
+    uint8_t buffer[8];
+    
+    if (conn->alive_check_pending) {
+        return;
+    }
+    
+    header.protocol_version = DOIP_PROTOCOL_VERSION_2019;
+    header.inverse_protocol_version = DOIP_INVERSE_VERSION_2019;
+    header.payload_type = DOIP_PAYLOAD_TYPE_ALIVE_CHECK_REQ;
+    header.payload_length = 0U;
+    
+    if (doip_encode_header(&header, buffer, sizeof(buffer)) == DOIP_RESULT_OK) {
+        DOIP_TRACE("[DOIP TX TCP] Payload type: 0x%04X, length: %u\r\n", DOIP_PAYLOAD_TYPE_ALIVE_CHECK_REQ, 8U);
+        (void)doip_interface_tcp_send(entity->interface, connection_id,
+                                     buffer, sizeof(buffer));
+    }
+    
+    /* A failed send is not retried, the timeout reclaims the socket */
+    conn->alive_check_pending = true;
+    doip_timer_start(&entity->timers, ENTITY_TIMER_ALIVE_CHECK(connection_id),
+                     entity->time_ms + entity->config.alive_check_time);
+}
+
+/* Socket handling of ISO 13400-2 routing activation. With 'may_check'
+ * set, a conflict starts alive checks and the decision is deferred. */
+static uint8_t decide_routing_activation(
     doip_entity_t *entity,
     int connection_id,
-    const uint8_t *payload,
-    uint32_t payload_length)
+    uint16_t source_address,
+    bool may_check)
+{
+    doip_entity_connection_t *conn = &entity->connections[connection_id];
+    int registered = find_tester_connection(entity, source_address);
+    uint32_t activated = 0U;
+    uint32_t i;
+    
+    /* Validate source address (should be in tester range 0x0E00-0x0FFF) */
+    if ((source_address < DOIP_TESTER_ADDRESS_MIN) ||
+        (source_address > DOIP_TESTER_ADDRESS_MAX)) {
+        return DOIP_ROUTING_ACT_RES_UNKNOWN_SOURCE;
+    }
+    
+    if (conn->is_activated) {
+        /* Repeated activation of the same tester just succeeds again */
+        return (conn->source_address == source_address) ?
+            DOIP_ROUTING_ACT_RES_SUCCESS : DOIP_ROUTING_ACT_RES_DIFF_SOURCE;
+    }
+    
+    if ((registered >= 0) && (registered != connection_id)) {
+        /* Tester address routed on another socket, which keeps it only
+         * if it is still alive */
+        if (!may_check) {
+            return DOIP_ROUTING_ACT_RES_ACTIVE;
+        }
+        start_alive_check(entity, registered);
+        return ENTITY_ROUTING_ACT_PENDING;
+    }
+    
+    for (i = 0U; i < DOIP_MAX_CONNECTIONS; i++) {
+        if (entity->connections[i].is_activated) {
+            activated++;
+        }
+    }
+    
+    if (activated >= tester_limit(entity)) {
+        /* All slots taken, check every routed socket in parallel */
+        if (!may_check) {
+            return DOIP_ROUTING_ACT_RES_NO_SOCKETS;
+        }
+        for (i = 0U; i < DOIP_MAX_CONNECTIONS; i++) {
+            if (entity->connections[i].is_activated) {
+                start_alive_check(entity, (int)i);
+            }
+        }
+        return ENTITY_ROUTING_ACT_PENDING;
+    }
+    
+    return DOIP_ROUTING_ACT_RES_SUCCESS;
+}
+
+static void activate_routing(
+    doip_entity_t *entity,
+    int connection_id,
+    uint16_t source_address)
+{
+    doip_entity_connection_t *conn = &entity->connections[connection_id];
+    
+    conn->is_activated = true;
+    conn->source_address = source_address;
+    start_inactivity_timer(entity, connection_id,
+                           entity->config.general_inactivity_time);
+    entity->tester_slots[source_address - DOIP_TESTER_ADDRESS_MIN] =
+        (uint8_t)(connection_id + 1);
+}
+
+/* Answer deferred activations once no alive check is outstanding */
+static void resolve_pending_activations(doip_entity_t *entity)
+{
+    doip_entity_connection_t *conn;
+    uint8_t response_code;
+    uint32_t i;
+    
+    for (i = 0U; i < DOIP_MAX_CONNECTIONS; i++) {
+        if (entity->connections[i].alive_check_pending) {
+            return;
+        }
+    }
+    
+    for (i = 0U; i < DOIP_MAX_CONNECTIONS; i++) {
+        conn = &entity->connections[i];
+        if (conn->activation_pending) {
+            conn->activation_pending = false;
+            response_code = decide_routing_activation(entity, (int)i,
+                                                      conn->pending_source_address,
+                                                      false);
+            if (response_code == DOIP_ROUTING_ACT_RES_SUCCESS) {
+                activate_routing(entity, (int)i, conn->pending_source_address);
+            }
+            send_routing_activation_response(entity, (int)i,
+                                             conn->pending_source_address,
+                                             response_code);
+        }
+    }
+}
+
+static void handle_routing_activation_request(
+    void *context,
+    const doip_dispatch_msg_t *msg)
+{
+    doip_entity_t *entity = (doip_entity_t *)context;
+    int connection_id = msg->connection_id;
+    doip_routing_activation_req_t request;
+    uint8_t response_code;
+    doip_entity_connection_t *conn = &entity->connections[connection_id];
+    
+    /* Decode request */
+    if (doip_decode_routing_activation_req(msg->payload, msg->payload_length,
+            &request) != DOIP_RESULT_OK) {
+        send_routing_activation_response(entity, connection_id, 0U,
+                                         DOIP_ROUTING_ACT_RES_UNKNOWN_SOURCE);
+        return;
+    }
+    
+    /* The first request is still waiting for alive checks */
+    if (conn->activation_pending) {
+        return;
+    }
+    
+    response_code = decide_routing_activation(entity, connection_id,
+                                              request.source_address, true);
+    if (response_code == ENTITY_ROUTING_ACT_PENDING) {
+        conn->activation_pending = true;
+        conn->pending_source_address = request.source_address;
+        return;
+    }
+    
+    if (response_code == DOIP_ROUTING_ACT_RES_SUCCESS) {
+        activate_routing(entity, connection_id, request.source_address);
+    }
+    send_routing_activation_response(entity, connection_id,
+                                     request.source_address, response_code);
+}
+
+/* The ACK comes from the address the request was sent to */
+static void send_diag_message_ack(
+    doip_entity_t *entity,
+    int connection_id,
+    uint16_t source_address,
+    uint16_t target_address,
+    uint8_t ack_code)
 {
-    doip_diagnostic_message_t diag_msg;
     uint8_t ack_buffer[32];
     uint32_t ack_length;
 
-    uint16_t ack_target_address;
+    if (doip_encode_diag_message_ack(source_address, target_address, ack_code, ack_buffer, sizeof(ack_buffer),
+            &ack_length) != DOIP_RESULT_OK) {
+        return;
+    }
+
+    DOIP_TRACE("[DOIP TX TCP] Payload type: 0x%04X, length: %u\r\n",
+                (ack_code == 0x00U) ? DOIP_PAYLOAD_TYPE_DIAG_MESSAGE_ACK :
+                                      DOIP_PAYLOAD_TYPE_DIAG_MESSAGE_NACK,
+                ack_length);
+    (void)doip_interface_tcp_send(entity->interface, connection_id,
+                                 ack_buffer, ack_length);
+}
+
+/* Hold the positive ACK back while the UDS layer runs, so that a response
+ * produced in the callback can carry it in the same TCP write */
+static void defer_diag_message_ack(
+    doip_entity_t *entity,
+    int connection_id,
+    uint16_t source_address,
+    uint16_t target_address)
+{
+    if (entity->coalesce_responses) {
+        entity->pending_ack_connection = connection_id;
+        entity->pending_ack_source = source_address;
+        entity->pending_ack_target = target_address;
+    } else {
+        send_diag_message_ack(entity, connection_id, source_address,
+                              target_address, 0x00U);
+    }
+}
+
+/* Send a deferred ACK on its own, the UDS layer answers asynchronously */
+static void flush_diag_message_ack(doip_entity_t *entity)
+{
+    int connection_id = entity->pending_ack_connection;
+    
+    if (connection_id >= 0) {
+        entity->pending_ack_connection = -1;
+        send_diag_message_ack(entity, connection_id, entity->pending_ack_source,
+                              entity->pending_ack_target, 0x00U);
+    }
+}
+
+static void handle_diagnostic_message(
+    void *context,
+    const doip_dispatch_msg_t *msg)
+{
+    doip_entity_t *entity = (doip_entity_t *)context;
+    int connection_id = msg->connection_id;
+    doip_diagnostic_message_t diag_msg;
+    uint32_t first_route;
+    uint32_t route;
+    uint32_t i;
 
     /* Verify connection is activated */
     if (!entity->connections[connection_id].is_activated) {
         /* Send NACK - routing not activated */
-        (void)doip_encode_diag_message_ack(
-            entity->config.logical_address,
-            0x0000U,
-            DOIP_DIAG_NACK_INVALID_SOURCE,
-            ack_buffer,
-            sizeof(ack_buffer),
-            &ack_length
-        );
-        debug_print("[DOIP TX TCP] Payload type: 0x%04X, length: %u\r\n", DOIP_PAYLOAD_TYPE_DIAG_MESSAGE_NACK, ack_length);
-        (void)doip_interface_tcp_send(entity->interface, connection_id,
-                                     ack_buffer, ack_length);
+        send_diag_message_ack(entity, connection_id,
+                              entity->config.logical_address, 0x0000U,
+                              DOIP_DIAG_NACK_INVALID_SOURCE);
         return;
     }
 
     /* Decode diagnostic message */
-    if (doip_decode_diagnostic_message(payload, payload_length,
+    if (doip_decode_diagnostic_message(msg->payload, msg->payload_length,
             &diag_msg) != DOIP_RESULT_OK) {
         return;
     }
 
-    /* ack address setup */
-    ack_target_address = diag_msg.source_address;
-
-    /* Verify target address matches this entity */
-    if (diag_msg.target_address != entity->config.logical_address) {
-        (void)doip_encode_diag_message_ack(
-            entity->config.logical_address,
-            diag_msg.target_address,
-            DOIP_DIAG_NACK_UNKNOWN_TARGET,
-            ack_buffer,
-            sizeof(ack_buffer),
-            &ack_length
-        );
-        debug_print("[DOIP TX TCP] Payload type: 0x%04X, length: %u\r\n", DOIP_PAYLOAD_TYPE_DIAG_MESSAGE_NACK, ack_length);
-        (void)doip_interface_tcp_send(entity->interface, connection_id,
-                                     ack_buffer, ack_length);
+    /* The target is this entity or a node behind it */
+    first_route = find_route(entity, diag_msg.target_address);
+    route = first_route;
+    while ((route < entity->route_count) &&
+           (entity->routes[route].target_address == diag_msg.target_address)) {
+        route++;
+    }
+    if ((route == first_route) &&
+        (diag_msg.target_address != entity->config.logical_address)) {
+        send_diag_message_ack(entity, connection_id, diag_msg.target_address,
+                              diag_msg.source_address,
+                              DOIP_DIAG_NACK_UNKNOWN_TARGET);
         return;
     }
 
-    /* Send positive ACK */
-    (void)doip_encode_diag_message_ack(
-        entity->config.logical_address,
-        ack_target_address,
-        0x00U, /* ACK */
-        ack_buffer,
-        sizeof(ack_buffer),
-        &ack_length
-    );
-    debug_print("[DOIP TX TCP] Payload type: 0x%04X, length: %u\r\n", DOIP_PAYLOAD_TYPE_DIAG_MESSAGE_ACK, ack_length);
-    (void)doip_interface_tcp_send(entity->interface, connection_id,
-                                 ack_buffer, ack_length);
+    /* Positive ACK, sent with the response if the UDS layer answers now */
+    defer_diag_message_ack(entity, connection_id, diag_msg.target_address,
+                           diag_msg.source_address);
 
-    /* Forward to UDS layer */
-    if (entity->uds_callback != NULL) {
+    if (route > first_route) {
+        /* Every node behind the address gets the request */
+        for (i = first_route; i < route; i++) {
+            entity->routes[i].handler(diag_msg.source_address,
+                                      diag_msg.target_address,
+                                      diag_msg.user_data,
+                                      diag_msg.user_data_length,
+                                      entity->routes[i].user_data);
+        }
+    } else if (entity->uds_callback != NULL) {
+        /* Forward to UDS layer */
         entity->uds_callback(diag_msg.source_address, diag_msg.target_address,
                            diag_msg.user_data, diag_msg.user_data_length,
                            entity);
     }
+    flush_diag_message_ack(entity);
+
+    /* Reset inactivity timer */
+    start_inactivity_timer(entity, connection_id,
+                           entity->config.general_inactivity_time);
+}
+
+static void handle_alive_check_response(
+    void *context,
+    const doip_dispatch_msg_t *msg)
+{
+    doip_entity_t *entity = (doip_entity_t *)context;
+    doip_entity_connection_t *conn = &entity->connections[msg->connection_id];
+    
+    if (!conn->alive_check_pending) {
+        return;
+    }
+    
+    /* Tester is alive, it keeps its socket */
+    conn->alive_check_pending = false;
+    doip_timer_stop(&entity->timers, ENTITY_TIMER_ALIVE_CHECK(msg->connection_id));
+    resolve_pending_activations(entity);
+}
+
+/* Payload types served by the entity, sorted by type. Length errors on
+ * TCP close the socket as ISO 13400-2 requires for header NACK 0x04. */
+static const doip_dispatch_entry_t entity_dispatch_entries[] = {
+    { DOIP_PAYLOAD_TYPE_VEHICLE_ID_REQ,         DOIP_TRANSPORT_UDP,
+      (uint8_t)DOIP_DISPATCH_NACK,       0U,              0U,
+      handle_vehicle_id_request },
+    { DOIP_PAYLOAD_TYPE_VEHICLE_ID_REQ_EID,     DOIP_TRANSPORT_UDP,
+      (uint8_t)DOIP_DISPATCH_NACK,       DOIP_EID_LENGTH, DOIP_EID_LENGTH,
+      handle_vehicle_id_request },
+    { DOIP_PAYLOAD_TYPE_VEHICLE_ID_REQ_VIN,     DOIP_TRANSPORT_UDP,
+      (uint8_t)DOIP_DISPATCH_NACK,       DOIP_VIN_LENGTH, DOIP_VIN_LENGTH,
+      handle_vehicle_id_request },
+    { DOIP_PAYLOAD_TYPE_ROUTING_ACTIVATION_REQ, DOIP_TRANSPORT_TCP,
+      (uint8_t)DOIP_DISPATCH_NACK_CLOSE, 7U,              11U,
+      handle_routing_activation_request },
+    { DOIP_PAYLOAD_TYPE_ALIVE_CHECK_RES,        DOIP_TRANSPORT_TCP,
+      (uint8_t)DOIP_DISPATCH_NACK_CLOSE, 2U,              2U,
+      handle_alive_check_response },
+    { DOIP_PAYLOAD_TYPE_DIAG_MESSAGE,           DOIP_TRANSPORT_TCP,
+      (uint8_t)DOIP_DISPATCH_NACK_CLOSE, 5U,              DOIP_DISPATCH_NO_LIMIT,
+      handle_diagnostic_message }
+};
+
+static const doip_dispatch_table_t entity_dispatch_table = {
+    entity_dispatch_entries,
+    (uint32_t)(sizeof(entity_dispatch_entries) / sizeof(entity_dispatch_entries[0])),
+    (uint8_t)DOIP_DISPATCH_NACK
+};
+
+/* Generic header NACK to the sender of a rejected message */
+static void send_generic_nack(
+    doip_entity_t *entity,
+    const doip_dispatch_msg_t *msg,
+    doip_dispatch_action_t action,
+    uint8_t nack_code)
+{
+    uint8_t buffer[16];
+    uint32_t encoded_length;
+    
+    if (action == DOIP_DISPATCH_DROP) {
+        return;
+    }
+    
+    if (doip_encode_generic_nack(nack_code, buffer, sizeof(buffer),
+            &encoded_length) == DOIP_RESULT_OK) {
+        DOIP_TRACE("[DOIP TX] Generic NACK: 0x%02X\r\n", nack_code);
+        if (msg->transport == DOIP_TRANSPORT_UDP) {
+            (void)doip_interface_udp_send(entity->interface, msg->src,
+                                         buffer, encoded_length);
+        } else {
+            (void)doip_interface_tcp_send(entity->interface, msg->connection_id,
+                                         buffer, encoded_length);
+        }
+    }
+    
+    if ((action == DOIP_DISPATCH_NACK_CLOSE) &&
+        (msg->transport == DOIP_TRANSPORT_TCP)) {
+        doip_interface_close_connection(entity->interface, msg->connection_id);
+        entity_tcp_disconnected_callback(msg->connection_id, entity);
+    }
+}
+
+/* Header NACK code for a header that failed doip_validate_header() */
+static uint8_t header_nack_code(const doip_header_t *header)
+{
+    return doip_validate_protocol_version(header) ? DOIP_NACK_MESSAGE_TOO_LARGE :
+                                                    DOIP_NACK_INCORRECT_PATTERN;
+}
+
+static bool entity_tcp_stream_callback(
+    int connection_id,
+    doip_stream_event_t event,
+    const doip_stream_info_t *info,
+    const uint8_t *data,
+    uint32_t length,
+    void *user_data)
+{
+    doip_entity_t *entity = (doip_entity_t *)user_data;
+    doip_entity_connection_t *conn = &entity->connections[connection_id];
+    doip_dispatch_msg_t msg;
+    bool accepted = true;
+
+    if (event == DOIP_STREAM_EVENT_START) {
+        DOIP_TRACE("[DOIP RX TCP] Streaming payload type: 0x%04X, length: %u\r\n",
+                    info->header.payload_type, info->header.payload_length);
+
+        if (!doip_validate_protocol_version(&info->header)) {
+            /* Same as a reassembled message with a wrong pattern */
+            msg.transport = DOIP_TRANSPORT_TCP;
+            msg.connection_id = connection_id;
+            msg.src = NULL;
+            msg.payload_type = info->header.payload_type;
+            msg.payload = NULL;
+            msg.payload_length = 0U;
+            send_generic_nack(entity, &msg, DOIP_DISPATCH_NACK_CLOSE,
+                              DOIP_NACK_INCORRECT_PATTERN);
+            return false;
+        }
+        if (!conn->is_activated) {
+            send_diag_message_ack(entity, connection_id,
+                                  entity->config.logical_address, 0x0000U,
+                                  DOIP_DIAG_NACK_INVALID_SOURCE);
+            return false;
+        }
+        /* Routed nodes take reassembled messages only */
+        if (info->target_address != entity->config.logical_address) {
+            send_diag_message_ack(entity, connection_id, info->target_address,
+                                  info->source_address,
+                                  DOIP_DIAG_NACK_UNKNOWN_TARGET);
+            return false;
+        }
+    }
+
+    if (entity->uds_stream_callback == NULL) {
+        /* No consumer for chunked delivery, the message is simply too large */
+        if (event == DOIP_STREAM_EVENT_START) {
+            send_diag_message_ack(entity, connection_id, info->target_address,
+                                  info->source_address,
+                                  DOIP_DIAG_NACK_MESSAGE_TOO_LARGE);
+        }
+        return false;
+    }
+
+    /* The ACK confirms the complete message, so it goes out before or
+     * together with any response to the end event */
+    if (event == DOIP_STREAM_EVENT_END) {
+        defer_diag_message_ack(entity, connection_id, info->target_address,
+                               info->source_address);
+    }
+
+    accepted = entity->uds_stream_callback(event, info->source_address,
+                                           info->target_address,
+                                           info->user_data_length, info->offset,
+                                           data, length, entity);
+    flush_diag_message_ack(entity);
+
+    if ((event == DOIP_STREAM_EVENT_START) && !accepted) {
+        send_diag_message_ack(entity, connection_id, info->target_address,
+                              info->source_address,
+                              DOIP_DIAG_NACK_OUT_OF_MEMORY);
+    }
 
     /* Reset inactivity timer */
-    entity->connections[connection_id].general_inactivity_timer =
-        entity->config.general_inactivity_time;
+    if (conn->is_activated) {
+        start_inactivity_timer(entity, connection_id,
+                               entity->config.general_inactivity_time);
+    }
+
+    return accepted;
+}
+
+/* Find the limiter entry of a source address, recycling the least
+ * recently refilled entry for a new source */
+static doip_udp_source_t *get_udp_source(doip_entity_t *entity, uint32_t ip_addr)
+{
+    doip_udp_source_t *source;
+    doip_udp_source_t *oldest = NULL;
+    uint32_t i;
+    
+    for (i = 0U; i < DOIP_UDP_LIMITER_SOURCES; i++) {
+        source = &entity->udp_sources[i];
+        if (!source->in_use) {
+            if ((oldest == NULL) || oldest->in_use) {
+                oldest = source;
+            }
+        } else if (source->ip_addr == ip_addr) {
+            return source;
+        } else if ((oldest == NULL) ||
+                   (oldest->in_use &&
+                    ((entity->time_ms - source->last_refill_time) >
+                     (entity->time_ms - oldest->last_refill_time)))) {
+            oldest = source;
+        } else {
+            /* Keep the current candidate */
+        }
+    }
+    
+    /* New sources start with a full bucket. One taking over a slot in use
+     * keeps its tokens, so more sources than slots cannot mint new ones. */
+    if (!oldest->in_use) {
+        oldest->tokens = DOIP_UDP_RATE_BURST * 1000U;
+        oldest->last_refill_time = entity->time_ms;
+    }
+    oldest->in_use = true;
+    oldest->ip_addr = ip_addr;
+    oldest->last_request_type = 0U;
+    
+    return oldest;
+}
+
+/* Token bucket: returns false if the source has used up its burst */
+static bool udp_source_admit(doip_entity_t *entity, doip_udp_source_t *source)
+{
+    uint32_t elapsed = entity->time_ms - source->last_refill_time;
+    uint32_t refill;
+    
+    /* Clamp before multiplying so that long idle times cannot overflow */
+    if (elapsed > 1000U) {
+        elapsed = 1000U;
+    }
+    refill = elapsed * DOIP_UDP_RATE_PER_SECOND;
+    source->tokens += refill;
+    if (source->tokens > (DOIP_UDP_RATE_BURST * 1000U)) {
+        source->tokens = DOIP_UDP_RATE_BURST * 1000U;
+    }
+    source->last_refill_time = entity->time_ms;
+    
+    if (source->tokens < 1000U) {
+        return false;
+    }
+    source->tokens -= 1000U;
+    
+    return true;
 }
 
 static void entity_udp_rx_callback(
-    const char *src_ip,
-    uint16_t src_port,
+    const doip_endpoint_t *src,
     const uint8_t *data,
     uint32_t length,
     void *user_data)
 {
     doip_entity_t *entity = (doip_entity_t *)user_data;
+    doip_udp_source_t *source;
     doip_header_t header;
+    doip_dispatch_msg_t msg;
+    doip_dispatch_result_t result;
     
-    if (length < 8U) {
+    /* Rate limit before parsing so a flood costs as little as possible */
+    source = get_udp_source(entity, src->ip_addr);
+    if (!udp_source_admit(entity, source)) {
+        entity->udp_stats.rate_limited++;
         return;
     }
     
-    if (doip_decode_header(data, length, &header) != DOIP_RESULT_OK) {
+    if ((length < 8U) ||
+        (doip_decode_header(data, length, &header) != DOIP_RESULT_OK)) {
+        entity->udp_stats.dropped++;
         return;
     }
     
+    msg.transport = DOIP_TRANSPORT_UDP;
+    msg.connection_id = -1;
+    msg.src = src;
+    msg.payload_type = header.payload_type;
+    msg.payload = &data[8];
+    msg.payload_length = length - 8U;
+    
     if (!doip_validate_header(&header)) {
-        /* Send Generic NACK */
+        entity->udp_stats.dropped++;
+        send_generic_nack(entity, &msg, DOIP_DISPATCH_NACK, header_nack_code(&header));
+        return;
+    }
+    
+    /* The header must describe exactly the datagram */
+    if (header.payload_length != msg.payload_length) {
+        entity->udp_stats.dropped++;
+        send_generic_nack(entity, &msg, DOIP_DISPATCH_NACK,
+                          DOIP_NACK_INVALID_PAYLOAD_LENGTH);
         return;
     }
 
-    debug_print("[DOIP RX UDP] Payload type: 0x%04X, length: %u\r\n", header.payload_type, header.payload_length);
+    DOIP_TRACE("[DOIP RX UDP] Payload type: 0x%04X, length: %u\r\n", header.payload_type, header.payload_length);
 
-    switch (header.payload_type) {
-        case DOIP_PAYLOAD_TYPE_VEHICLE_ID_REQ:
-        case DOIP_PAYLOAD_TYPE_VEHICLE_ID_REQ_EID:
-        case DOIP_PAYLOAD_TYPE_VEHICLE_ID_REQ_VIN:
-            handle_vehicle_id_request(entity, src_ip, src_port,
-                header.payload_type, &data[8], header.payload_length);
-            break;
-        
-        default:
-            /* Unsupported payload type on UDP */
-            break;
+    /* A repeated request from the same endpoint gets one answer */
+    if ((source->last_request_type == header.payload_type) &&
+        (source->last_request_port == src->port) &&
+        ((entity->time_ms - source->last_request_time) < DOIP_UDP_DUPLICATE_WINDOW)) {
+        entity->udp_stats.collapsed++;
+        return;
+    }
+    source->last_request_type = header.payload_type;
+    source->last_request_port = src->port;
+    source->last_request_time = entity->time_ms;
+    
+    result = doip_dispatch(&entity_dispatch_table, entity, &msg);
+    if (!result.handled) {
+        entity->udp_stats.dropped++;
+        send_generic_nack(entity, &msg, result.action, result.nack_code);
     }
 }
 
@@ -335,35 +954,31 @@ static void entity_tcp_rx_callback(
 {
     doip_entity_t *entity = (doip_entity_t *)user_data;
     doip_header_t header;
+    doip_dispatch_msg_t msg;
+    doip_dispatch_result_t result;
     
     if (doip_decode_header(data, length, &header) != DOIP_RESULT_OK) {
         return;
     }
     
+    msg.transport = DOIP_TRANSPORT_TCP;
+    msg.connection_id = connection_id;
+    msg.src = NULL;
+    msg.payload_type = header.payload_type;
+    msg.payload = &data[8];
+    msg.payload_length = header.payload_length;
+    
     if (!doip_validate_header(&header)) {
+        send_generic_nack(entity, &msg, DOIP_DISPATCH_NACK_CLOSE,
+                          header_nack_code(&header));
         return;
     }
 
-    debug_print("[DOIP RX TCP] Payload type: 0x%04X, length: %u\r\n", header.payload_type, header.payload_length);
+    DOIP_TRACE("[DOIP RX TCP] Payload type: 0x%04X, length: %u\r\n", header.payload_type, header.payload_length);
 
-    switch (header.payload_type) {
-        case DOIP_PAYLOAD_TYPE_ROUTING_ACTIVATION_REQ:
-            handle_routing_activation_request(entity, connection_id,
-                &data[8], header.payload_length);
-            break;
-        
-        case DOIP_PAYLOAD_TYPE_DIAG_MESSAGE:
-            handle_diagnostic_message(entity, connection_id,
-                &data[8], header.payload_length);
-            break;
-        
-        case DOIP_PAYLOAD_TYPE_ALIVE_CHECK_RES:
-            /* Reset alive check timer */
-            entity->connections[connection_id].alive_check_pending = false;
-            break;
-        
-        default:
-            break;
+    result = doip_dispatch(&entity_dispatch_table, entity, &msg);
+    if (!result.handled) {
+        send_generic_nack(entity, &msg, result.action, result.nack_code);
     }
 }
 
@@ -375,8 +990,8 @@ static void entity_tcp_connected_callback(
 
     /* Start initial inactivity timer */
     entity->connections[connection_id].connection_id = connection_id;
-    entity->connections[connection_id].initial_inactivity_timer =
-        entity->config.initial_inactivity_time;
+    start_inactivity_timer(entity, connection_id,
+                           entity->config.initial_inactivity_time);
     entity->connections[connection_id].is_activated = false;  /* Only activate after routing activation */
     entity->connections[connection_id].source_address = 0U;   /* Clear any stale source address */
 }
@@ -387,16 +1002,24 @@ static void entity_tcp_disconnected_callback(
 {
     doip_entity_t *entity = (doip_entity_t *)user_data;
 
+    if (entity->connections[connection_id].is_activated) {
+        entity->tester_slots[entity->connections[connection_id].source_address -
+                             DOIP_TESTER_ADDRESS_MIN] = 0U;
+    }
+
     /* Reset connection to initial state */
     entity->connections[connection_id].connection_id = -1;
     entity->connections[connection_id].source_address = 0U;
     entity->connections[connection_id].is_activated = false;
-    entity->connections[connection_id].initial_inactivity_timer = 0U;
-    entity->connections[connection_id].general_inactivity_timer = 0U;
-    entity->connections[connection_id].alive_check_timer = 0U;
     entity->connections[connection_id].alive_check_pending = false;
+    entity->connections[connection_id].activation_pending = false;
+    doip_timer_stop(&entity->timers, ENTITY_TIMER_INACTIVITY(connection_id));
+    doip_timer_stop(&entity->timers, ENTITY_TIMER_ALIVE_CHECK(connection_id));
 
-    debug_print("[DOIP] Connection %d disconnected and cleaned up\r\n", connection_id);
+    DOIP_TRACE("[DOIP] Connection %d disconnected and cleaned up\r\n", connection_id);
+
+    /* The socket may have been the last one an activation waited for */
+    resolve_pending_activations(entity);
 }
 
 doip_result_t doip_entity_process(
@@ -419,96 +1042,261 @@ doip_result_t doip_entity_process(
     );
 }
 
+/* Send a diagnostic message to a tester. A deferred ACK for the same
+ * connection leads it in one write. */
+static doip_result_t send_to_tester(
+    doip_entity_t *entity,
+    int connection_id,
+    const doip_iovec_t *iov,
+    uint32_t iovcnt)
+{
+    uint8_t ack[DOIP_DIAG_MESSAGE_HEADER_SIZE + 1U];
+    doip_iovec_t vectors[DOIP_MAX_IOVEC];
+    uint32_t count = 0U;
+    uint32_t ack_length;
+    doip_result_t result;
+    uint32_t i;
+    
+    if ((entity->pending_ack_connection == connection_id) &&
+        (doip_encode_diag_message_ack(entity->pending_ack_source,
+            entity->pending_ack_target, 0x00U, ack, sizeof(ack),
+            &ack_length) == DOIP_RESULT_OK)) {
+        entity->pending_ack_connection = -1;
+        entity->coalesced_ack_count++;
+        DOIP_TRACE("[DOIP TX TCP] Payload type: 0x%04X, length: %u\r\n", DOIP_PAYLOAD_TYPE_DIAG_MESSAGE_ACK, ack_length);
+        vectors[count].data = ack;
+        vectors[count].length = ack_length;
+        count++;
+    } else {
+        /* Responses to other testers must not overtake the ACK */
+        flush_diag_message_ack(entity);
+    }
+    
+    for (i = 0U; (i < iovcnt) && (count < DOIP_MAX_IOVEC); i++) {
+        vectors[count] = iov[i];
+        count++;
+    }
+    
+    result = doip_interface_tcp_sendv(entity->interface, connection_id,
+                                     vectors, count);
+    
+    /* A refused response must not take the ACK with it */
+    if ((result == DOIP_RESULT_NO_MEMORY) && (count > iovcnt)) {
+        (void)doip_interface_tcp_send(entity->interface, connection_id,
+                                     ack, ack_length);
+    }
+    
+    return result;
+}
+
 doip_result_t doip_entity_send_diagnostic_response(
     doip_entity_t *entity,
     uint16_t target_addr,
     const uint8_t *data,
     uint32_t length)
 {
-    doip_diagnostic_message_t diag_msg;
-    uint8_t buffer[DOIP_MAX_PAYLOAD_SIZE + 8U];
+    if (entity == NULL) {
+        return DOIP_RESULT_INVALID_PARAM;
+    }
+    
+    return doip_entity_send_diagnostic_response_from(entity,
+        entity->config.logical_address, target_addr, data, length);
+}
+
+doip_result_t doip_entity_send_diagnostic_response_from(
+    doip_entity_t *entity,
+    uint16_t source_addr,
+    uint16_t target_addr,
+    const uint8_t *data,
+    uint32_t length)
+{
+    uint8_t header[DOIP_DIAG_MESSAGE_HEADER_SIZE];
+    doip_iovec_t iov[2];
     uint32_t encoded_length;
-    uint32_t i;
-    int target_connection = -1;
+    int target_connection;
     
     if ((entity == NULL) || (data == NULL)) {
         return DOIP_RESULT_INVALID_PARAM;
     }
     
-    /* Find connection for target address */
-    for (i = 0U; i < DOIP_MAX_CONNECTIONS; i++) {
-        if (entity->connections[i].is_activated &&
-            (entity->connections[i].source_address == target_addr)) {
-            target_connection = entity->connections[i].connection_id;
-            break;
-        }
-    }
-    
+    target_connection = find_tester_connection(entity, target_addr);
     if (target_connection < 0) {
         return DOIP_RESULT_NOT_READY;
     }
     
-    /* Encode diagnostic message */
-    diag_msg.source_address = entity->config.logical_address;
-    diag_msg.target_address = target_addr;
-    diag_msg.user_data = data;
-    diag_msg.user_data_length = length;
-    
-    if (doip_encode_diagnostic_message(&diag_msg, buffer,
-            sizeof(buffer), &encoded_length) != DOIP_RESULT_OK) {
+    /* Only the 12-byte header is encoded, the UDS data is sent in place */
+    if (doip_encode_diagnostic_message_header(source_addr,
+            target_addr, length, header, sizeof(header),
+            &encoded_length) != DOIP_RESULT_OK) {
         return DOIP_RESULT_ERROR;
     }
+    
+    iov[0].data = header;
+    iov[0].length = encoded_length;
+    iov[1].data = data;
+    iov[1].length = length;
 
-    debug_print("[DOIP TX TCP] Payload type: 0x%04X, length: %u\r\n", DOIP_PAYLOAD_TYPE_DIAG_MESSAGE, encoded_length);
-    return doip_interface_tcp_send(entity->interface, target_connection,
-                                  buffer, encoded_length);
+    DOIP_TRACE("[DOIP TX TCP] Payload type: 0x%04X, length: %u\r\n", DOIP_PAYLOAD_TYPE_DIAG_MESSAGE, encoded_length + length);
+    return send_to_tester(entity, target_connection, iov, 2U);
 }
 
-void doip_entity_update_timers(doip_entity_t *entity, uint32_t elapsed_ms)
+/* Index of the pooled frame whose user data starts at 'user_data' */
+static int get_response_frame(const doip_entity_t *entity, const uint8_t *user_data)
+{
+    uint32_t i;
+    
+    for (i = 0U; i < DOIP_TX_FRAME_COUNT; i++) {
+        if (user_data == &entity->tx_frames[i][DOIP_DIAG_MESSAGE_HEADER_SIZE]) {
+            return ((entity->tx_frames_used & (1UL << i)) != 0U) ? (int)i : -1;
+        }
+    }
+    
+    return -1;
+}
+
+uint8_t *doip_entity_alloc_response_frame(
+    doip_entity_t *entity,
+    uint32_t *capacity)
 {
     uint32_t i;
     
+    if ((entity == NULL) || (capacity == NULL)) {
+        return NULL;
+    }
+    
+    for (i = 0U; i < DOIP_TX_FRAME_COUNT; i++) {
+        if ((entity->tx_frames_used & (1UL << i)) == 0U) {
+            entity->tx_frames_used |= (1UL << i);
+            *capacity = DOIP_TX_FRAME_SIZE - DOIP_DIAG_MESSAGE_HEADER_SIZE;
+            return &entity->tx_frames[i][DOIP_DIAG_MESSAGE_HEADER_SIZE];
+        }
+    }
+    
+    return NULL;
+}
+
+void doip_entity_release_response_frame(
+    doip_entity_t *entity,
+    uint8_t *user_data)
+{
+    int index;
+    
     if (entity == NULL) {
         return;
     }
     
-    /* Update announcement timer */
-    if (entity->announcement_count < 3U) {
-        if (entity->announcement_timer > elapsed_ms) {
-            entity->announcement_timer -= elapsed_ms;
-        } else {
-            entity->announcement_timer = 500U; /* 500ms interval per ISO 13400 */
-            (void)doip_entity_send_vehicle_announcement(entity);
-            entity->announcement_count++;
+    index = get_response_frame(entity, user_data);
+    if (index >= 0) {
+        entity->tx_frames_used &= ~(1UL << (uint32_t)index);
+    }
+}
+
+doip_result_t doip_entity_send_response_frame(
+    doip_entity_t *entity,
+    uint16_t target_addr,
+    uint8_t *user_data,
+    uint32_t length)
+{
+    doip_iovec_t iov;
+    uint32_t frame_length;
+    doip_result_t result;
+    int target_connection;
+    int index;
+    
+    if (entity == NULL) {
+        return DOIP_RESULT_INVALID_PARAM;
+    }
+    
+    index = get_response_frame(entity, user_data);
+    if (index < 0) {
+        return DOIP_RESULT_INVALID_PARAM;
+    }
+    
+    target_connection = find_tester_connection(entity, target_addr);
+    if (target_connection < 0) {
+        result = DOIP_RESULT_NOT_READY;
+    } else {
+        /* Headers go into the headroom, the response is not copied */
+        result = doip_finish_diagnostic_message_frame(
+            entity->config.logical_address, target_addr,
+            entity->tx_frames[index], DOIP_TX_FRAME_SIZE, length,
+            &frame_length);
+        if (result == DOIP_RESULT_OK) {
+            iov.data = entity->tx_frames[index];
+            iov.length = frame_length;
+            DOIP_TRACE("[DOIP TX TCP] Payload type: 0x%04X, length: %u\r\n", DOIP_PAYLOAD_TYPE_DIAG_MESSAGE, frame_length);
+            result = send_to_tester(entity, target_connection, &iov, 1U);
         }
     }
     
-    /* Update connection timers */
-    for (i = 0U; i < DOIP_MAX_CONNECTIONS; i++) {
-        if (entity->connections[i].connection_id >= 0) {
-            if (!entity->connections[i].is_activated) {
-                /* Initial inactivity timer */
-                if (entity->connections[i].initial_inactivity_timer > elapsed_ms) {
-                    entity->connections[i].initial_inactivity_timer -= elapsed_ms;
-                } else {
-                    /* Timeout - close connection */
-                    doip_interface_close_connection(entity->interface,
-                        entity->connections[i].connection_id);
-                }
-            } else {
-                /* General inactivity timer */
-                if (entity->connections[i].general_inactivity_timer > elapsed_ms) {
-                    entity->connections[i].general_inactivity_timer -= elapsed_ms;
-                } else {
-                    /* Timeout - close connection */
-                    doip_interface_close_connection(entity->interface,
-                        entity->connections[i].connection_id);
-                }
+    /* The socket or the TX queue holds its own copy now */
+    entity->tx_frames_used &= ~(1UL << (uint32_t)index);
+    
+    return result;
+}
+
+void doip_entity_run_timers(doip_entity_t *entity, uint32_t now_ms)
+{
+    int id;
+    uint32_t connection_id;
+    
+    if (entity == NULL) {
+        return;
+    }
+    
+    entity->time_ms = now_ms;
+    
+    /* Only timers that are due are touched, idle connections cost nothing */
+    for (id = doip_timer_expire(&entity->timers, now_ms); id >= 0;
+         id = doip_timer_expire(&entity->timers, now_ms)) {
+        if (id == (int)ENTITY_TIMER_ANNOUNCEMENT) {
+            (void)doip_entity_send_vehicle_announcement(entity);
+            entity->announcement_count++;
+            if (entity->announcement_count < DOIP_ANNOUNCEMENT_COUNT) {
+                doip_timer_start(&entity->timers, ENTITY_TIMER_ANNOUNCEMENT,
+                                 now_ms + DOIP_ANNOUNCEMENT_INTERVAL);
             }
+        } else if (id < (int)ENTITY_TIMER_ALIVE_CHECK(0)) {
+            /* Initial or general inactivity timeout - close connection */
+            connection_id = (uint32_t)id - ENTITY_TIMER_INACTIVITY(0);
+            doip_interface_close_connection(entity->interface, (int)connection_id);
+            entity_tcp_disconnected_callback((int)connection_id, entity);
+        } else {
+            /* No alive check response - reclaim the socket */
+            connection_id = (uint32_t)id - ENTITY_TIMER_ALIVE_CHECK(0);
+            entity->reclaimed_count++;
+            doip_interface_close_connection(entity->interface, (int)connection_id);
+            entity_tcp_disconnected_callback((int)connection_id, entity);
         }
     }
 }
 
+void doip_entity_update_timers(doip_entity_t *entity, uint32_t elapsed_ms)
+{
+    if (entity != NULL) {
+        doip_entity_run_timers(entity, entity->time_ms + elapsed_ms);
+    }
+}
+
+uint32_t doip_entity_get_next_timeout(const doip_entity_t *entity)
+{
+    uint32_t deadline;
+    uint32_t remaining;
+    
+    if ((entity == NULL) ||
+        !doip_timer_next_deadline(&entity->timers, &deadline)) {
+        return DOIP_WAIT_FOREVER;
+    }
+    
+    /* Overdue timers wait 0, the subtraction wraps like the clock */
+    remaining = deadline - entity->time_ms;
+    if ((remaining & 0x80000000U) != 0U) {
+        remaining = 0U;
+    }
+    
+    return remaining;
+}
+
 doip_result_t doip_encode_diag_message_ack(
     uint16_t source_address,
     uint16_t target_address,
@@ -3,6 +3,21 @@
 
 #include "doip_protocol.h"
 #include "doip_interface.h"
+#include "doip_timer.h"
+
+/* Frame allocation is tracked in a 32-bit mask */
+#if (DOIP_TX_FRAME_COUNT > 32U)
+#error "DOIP_TX_FRAME_COUNT must not exceed 32"
+#endif
+
+/* A routed tester is reclaimed through the connection left free for the next one */
+#if (DOIP_MAX_CONNECTIONS < 2U)
+#error "DOIP_MAX_CONNECTIONS must be at least 2"
+#endif
+
+/* Number of logical addresses in the tester range */
+#define DOIP_TESTER_ADDRESS_COUNT \
+    ((uint32_t)DOIP_TESTER_ADDRESS_MAX - (uint32_t)DOIP_TESTER_ADDRESS_MIN + 1U)
 
 /* Entity Configuration */
 typedef struct {
@@ -13,16 +28,9 @@ typedef struct {
     uint32_t general_inactivity_time;    /* Default: 5000ms */
     uint32_t initial_inactivity_time;    /* Default: 2000ms */
     uint32_t alive_check_time;           /* Default: 500ms */
-    uint8_t max_tester_connections;      /* Default: 1 */
+    uint8_t max_tester_connections;      /* Default: 1, below the connection pool for reclamation */
 } doip_entity_config_t;
 
-/* Entity Timer Types */
-typedef enum {
-    DOIP_TIMER_INITIAL_INACTIVITY,
-    DOIP_TIMER_GENERAL_INACTIVITY,
-    DOIP_TIMER_ALIVE_CHECK
-} doip_timer_type_t;
-
 /* UDS Callback - Called when diagnostic message received */
 typedef void (*doip_entity_uds_rx_callback_t)(
     uint16_t source_addr,
@@ -32,15 +40,55 @@ typedef void (*doip_entity_uds_rx_callback_t)(
     void *user_data
 );
 
+/* UDS Stream Callback - Called for diagnostic messages too large to be
+ * reassembled; user data arrives in chunks at increasing offsets. Returning
+ * false from START or DATA drops the rest of the message. */
+typedef bool (*doip_entity_uds_stream_callback_t)(
+    doip_stream_event_t event,
+    uint16_t source_addr,
+    uint16_t target_addr,
+    uint32_t total_length,
+    uint32_t offset,
+    const uint8_t *data,
+    uint32_t length,
+    void *user_data
+);
+
+/* Gateway route. Diagnostic messages to 'target_address' are handed to
+ * 'handler' with the route's user data. Routes sharing a functional
+ * address all receive the message. */
+typedef struct {
+    uint16_t target_address;
+    doip_entity_uds_rx_callback_t handler;
+    void *user_data;
+} doip_entity_route_t;
+
+/* Rate limiter and duplicate filter state of one UDP source */
+typedef struct {
+    uint32_t ip_addr;
+    uint32_t tokens;                    /* In 1/1000 of a datagram */
+    uint32_t last_refill_time;
+    uint32_t last_request_time;
+    uint16_t last_request_port;
+    uint16_t last_request_type;         /* 0 if no request answered yet */
+    bool in_use;
+} doip_udp_source_t;
+
+/* UDP discovery counters */
+typedef struct {
+    uint32_t rate_limited;              /* Dropped by the per-source limiter */
+    uint32_t collapsed;                 /* Duplicate requests not answered */
+    uint32_t dropped;                   /* Malformed or unsupported datagrams */
+} doip_entity_udp_stats_t;
+
 /* Entity Connection Context */
 typedef struct {
     int connection_id;
     uint16_t source_address;
     bool is_activated;
-    uint32_t initial_inactivity_timer;
-    uint32_t general_inactivity_timer;
-    uint32_t alive_check_timer;
-    bool alive_check_pending;
+    bool alive_check_pending;           /* Alive check request sent, no response yet */
+    bool activation_pending;            /* Routing activation waits for alive checks */
+    uint16_t pending_source_address;
 } doip_entity_connection_t;
 
 /* Entity Context */
@@ -48,9 +96,28 @@ typedef struct {
     doip_entity_config_t config;
     doip_interface_t *interface;
     doip_entity_connection_t connections[DOIP_MAX_CONNECTIONS];
+    uint8_t tester_slots[DOIP_TESTER_ADDRESS_COUNT]; /* Connection id + 1 per activated tester, 0 if none */
     uint32_t announcement_count;
-    uint32_t announcement_timer;
+    uint32_t time_ms;                   /* Set by doip_entity_run_timers() */
+    doip_timer_queue_t timers;          /* Absolute deadlines, see ENTITY_TIMER_* */
+    doip_udp_source_t udp_sources[DOIP_UDP_LIMITER_SOURCES];
+    doip_entity_udp_stats_t udp_stats;
     doip_entity_uds_rx_callback_t uds_callback;
+    doip_entity_uds_stream_callback_t uds_stream_callback;
+    doip_entity_route_t routes[DOIP_MAX_ROUTES]; /* Sorted by target address */
+    uint32_t route_count;
+    bool coalesce_responses;            /* Send the ACK together with a synchronous response */
+    int pending_ack_connection;         /* Connection owed a positive ACK, -1 if none */
+    uint16_t pending_ack_source;        /* Address the request was sent to */
+    uint16_t pending_ack_target;
+    uint32_t coalesced_ack_count;       /* ACKs that shared a write with the response */
+    uint32_t reclaimed_count;           /* Sockets closed after a missed alive check */
+    uint8_t tx_frames[DOIP_TX_FRAME_COUNT][DOIP_TX_FRAME_SIZE];
+    uint32_t tx_frames_used;            /* Bit per allocated frame */
+    uint8_t further_action_required;    /* Announced further action code */
+    uint8_t sync_status;                /* Announced VIN/GID sync status */
+    uint8_t vehicle_id_frame[DOIP_VEHICLE_ID_RESPONSE_SIZE]; /* Encoded once, sent as is */
+    bool vehicle_id_frame_valid;        /* Cleared when config or status change */
     void *user_data;
 } doip_entity_t;
 
@@ -65,15 +132,49 @@ doip_result_t doip_entity_start(
     doip_entity_t *entity
 );
 
+void doip_entity_set_uds_stream_callback(
+    doip_entity_t *entity,
+    doip_entity_uds_stream_callback_t stream_callback
+);
+
+void doip_entity_set_response_coalescing(
+    doip_entity_t *entity,
+    bool enable
+);
+
 doip_result_t doip_entity_send_vehicle_announcement(
     doip_entity_t *entity
 );
 
+/* Change the further action / sync status fields of announcements */
+void doip_entity_set_vehicle_status(
+    doip_entity_t *entity,
+    uint8_t further_action_required,
+    uint8_t sync_status
+);
+
+/* Must be called after entity->config is modified in place, so the
+ * cached vehicle identification frame is rebuilt */
+void doip_entity_invalidate_vehicle_id(
+    doip_entity_t *entity
+);
+
 doip_result_t doip_entity_process(
     doip_entity_t *entity,
     doip_entity_uds_rx_callback_t uds_callback
 );
 
+/* Route diagnostic messages for 'target_addr' to 'handler' instead of the
+ * UDS callback. The handler runs in the entity task and should queue the
+ * request for its node; a node answers with
+ * doip_entity_send_diagnostic_response_from(). */
+doip_result_t doip_entity_add_route(
+    doip_entity_t *entity,
+    uint16_t target_addr,
+    doip_entity_uds_rx_callback_t handler,
+    void *user_data
+);
+
 doip_result_t doip_entity_send_diagnostic_response(
     doip_entity_t *entity,
     uint16_t target_addr,
@@ -81,9 +182,51 @@ doip_result_t doip_entity_send_diagnostic_response(
     uint32_t length
 );
 
+/* Response of a routed node, sent with the node's logical address */
+doip_result_t doip_entity_send_diagnostic_response_from(
+    doip_entity_t *entity,
+    uint16_t source_addr,
+    uint16_t target_addr,
+    const uint8_t *data,
+    uint32_t length
+);
+
+/* Response frames: the UDS layer writes its response at the returned
+ * pointer and the DoIP headers are filled in front of it on send */
+uint8_t *doip_entity_alloc_response_frame(
+    doip_entity_t *entity,
+    uint32_t *capacity
+);
+
+/* Sends 'length' bytes written at 'user_data' and releases the frame */
+doip_result_t doip_entity_send_response_frame(
+    doip_entity_t *entity,
+    uint16_t target_addr,
+    uint8_t *user_data,
+    uint32_t length
+);
+
+void doip_entity_release_response_frame(
+    doip_entity_t *entity,
+    uint8_t *user_data
+);
+
+/* Advance the entity clock to 'now_ms', a free running millisecond count
+ * such as the scheduler tick, and fire the timers that are due */
+void doip_entity_run_timers(
+    doip_entity_t *entity,
+    uint32_t now_ms
+);
+
+/* Same as doip_entity_run_timers() at time_ms + elapsed_ms */
 void doip_entity_update_timers(
     doip_entity_t *entity,
     uint32_t elapsed_ms
 );
 
+/* Milliseconds from the entity clock to the next deadline */
+uint32_t doip_entity_get_next_timeout(
+    const doip_entity_t *entity
+);
+
 #endif /* APP_DOIP_ENTITY_H */
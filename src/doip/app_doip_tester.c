@@ -1,9 +1,9 @@
 #include "app_doip_tester.h"
+#include "doip_dispatch.h"
 #include <string.h>
 
 static void tester_udp_rx_callback(
-    const char *src_ip,
-    uint16_t src_port,
+    const doip_endpoint_t *src,
     const uint8_t *data,
     uint32_t length,
     void *user_data);
@@ -29,6 +29,8 @@ doip_result_t doip_tester_init(
     tester->tcp_connection_id = -1;
     tester->routing_activated = false;
     tester->timeout_timer = 0U;
+    tester->uds_indication = NULL;
+    tester->user_data = NULL;
     
     return DOIP_RESULT_OK;
 }
@@ -77,27 +79,28 @@ doip_result_t doip_tester_start_discovery(doip_tester_t *tester)
 
 doip_result_t doip_tester_connect(
     doip_tester_t *tester,
-    const char *entity_ip,
-    uint16_t entity_port)
+    const doip_endpoint_t *entity_endpoint)
 {
     int socket_fd;
     
-    if ((tester == NULL) || (entity_ip == NULL)) {
+    if ((tester == NULL) || (entity_endpoint == NULL)) {
         return DOIP_RESULT_INVALID_PARAM;
     }
     
-    socket_fd = tester->interface->net_ops->tcp_connect(entity_ip, entity_port);
+    socket_fd = tester->interface->net_ops->tcp_connect(entity_endpoint);
     if (socket_fd < 0) {
         return DOIP_RESULT_ERROR;
     }
     
-    tester->tcp_connection_id = 0; /* Simplified - should find free slot */
-    tester->interface->connections[0].socket_fd = socket_fd;
-    tester->interface->connections[0].state = DOIP_CONN_STATE_PENDING_ACTIVATION;
+    tester->tcp_connection_id = doip_interface_attach_socket(tester->interface,
+                                                             socket_fd);
+    if (tester->tcp_connection_id < 0) {
+        tester->interface->net_ops->close_socket(socket_fd);
+        return DOIP_RESULT_NO_MEMORY;
+    }
     tester->state = DOIP_TESTER_STATE_CONNECTING;
     
-    (void)strncpy(tester->entity.ip_address, entity_ip, sizeof(tester->entity.ip_address) - 1U);
-    tester->entity.port = entity_port;
+    tester->entity.endpoint = *entity_endpoint;
     
     return DOIP_RESULT_OK;
 }
@@ -146,8 +149,8 @@ doip_result_t doip_tester_send_diagnostic(
     const uint8_t *uds_data,
     uint32_t length)
 {
-    doip_diagnostic_message_t diag_msg;
-    uint8_t buffer[DOIP_MAX_PAYLOAD_SIZE + 8U];
+    uint8_t header[DOIP_DIAG_MESSAGE_HEADER_SIZE];
+    doip_iovec_t iov[2];
     uint32_t encoded_length;
     doip_result_t result;
     
@@ -159,62 +162,65 @@ doip_result_t doip_tester_send_diagnostic(
         return DOIP_RESULT_NOT_READY;
     }
     
-    /* Prepare diagnostic message */
-    diag_msg.source_address = tester->config.logical_address;
-    diag_msg.target_address = target_addr;
-    diag_msg.user_data = uds_data;
-    diag_msg.user_data_length = length;
-    
-    result = doip_encode_diagnostic_message(&diag_msg, buffer,
-                                           sizeof(buffer), &encoded_length);
+    /* Prepare diagnostic message header, UDS data is sent in place */
+    result = doip_encode_diagnostic_message_header(tester->config.logical_address,
+                                                  target_addr, length, header,
+                                                  sizeof(header), &encoded_length);
     if (result != DOIP_RESULT_OK) {
         return result;
     }
     
-    return doip_interface_tcp_send(tester->interface, tester->tcp_connection_id,
-                                  buffer, encoded_length);
+    iov[0].data = header;
+    iov[0].length = encoded_length;
+    iov[1].data = uds_data;
+    iov[1].length = length;
+    
+    return doip_interface_tcp_sendv(tester->interface, tester->tcp_connection_id,
+                                   iov, 2U);
 }
 
+/* Payload lengths are checked by the dispatch table */
 static void handle_vehicle_announcement(
-    doip_tester_t *tester,
-    const char *src_ip,
-    uint16_t src_port,
-    const uint8_t *payload,
-    uint32_t payload_length)
+    void *context,
+    const doip_dispatch_msg_t *msg)
 {
-    if (tester->state != DOIP_TESTER_STATE_DISCOVERY) {
-        return;
-    }
+    doip_tester_t *tester = (doip_tester_t *)context;
+    const uint8_t *payload = msg->payload;
+#ifdef DOIP_DEBUG
+    char endpoint_string[DOIP_ENDPOINT_STRING_SIZE];
+#endif
     
-    if (payload_length < 33U) {
+    if (tester->state != DOIP_TESTER_STATE_DISCOVERY) {
         return;
     }
     
     /* Store discovered entity information */
-    (void)strncpy(tester->entity.ip_address, src_ip, sizeof(tester->entity.ip_address) - 1U);
-    tester->entity.port = DOIP_TCP_DATA_PORT;
+    /* Diagnostic connections go to the data port of the announcing host */
+    tester->entity.endpoint.ip_addr = msg->src->ip_addr;
+    tester->entity.endpoint.port = DOIP_TCP_DATA_PORT;
     (void)memcpy(tester->entity.vin, &payload[0], DOIP_VIN_LENGTH);
     tester->entity.logical_address = (uint16_t)((uint16_t)payload[17] << 8) |
                                     (uint16_t)payload[18];
     (void)memcpy(tester->entity.eid, &payload[19], DOIP_EID_LENGTH);
     
+    DOIP_LOG("Discovered entity 0x%04X at %s", tester->entity.logical_address,
+             doip_endpoint_to_string(&tester->entity.endpoint, endpoint_string,
+                                     sizeof(endpoint_string)));
+    
     tester->state = DOIP_TESTER_STATE_IDLE;
 }
 
 static void handle_routing_activation_response(
-    doip_tester_t *tester,
-    const uint8_t *payload,
-    uint32_t payload_length)
+    void *context,
+    const doip_dispatch_msg_t *msg)
 {
-    if (tester->state != DOIP_TESTER_STATE_ACTIVATING) {
-        return;
-    }
+    doip_tester_t *tester = (doip_tester_t *)context;
     
-    if (payload_length < 13U) {
+    if (tester->state != DOIP_TESTER_STATE_ACTIVATING) {
         return;
     }
     
-    uint8_t response_code = payload[4];
+    uint8_t response_code = msg->payload[4];
     
     if ((response_code == DOIP_ROUTING_ACT_RES_SUCCESS) ||
         (response_code == DOIP_ROUTING_ACT_RES_CONFIRM_REQUIRED)) {
@@ -226,34 +232,80 @@ static void handle_routing_activation_response(
 }
 
 static void handle_diagnostic_message(
-    doip_tester_t *tester,
-    const uint8_t *payload,
-    uint32_t payload_length,
-    doip_tester_uds_indication_t uds_indication)
+    void *context,
+    const doip_dispatch_msg_t *msg)
 {
+    doip_tester_t *tester = (doip_tester_t *)context;
     doip_diagnostic_message_t diag_msg;
     
-    if (doip_decode_diagnostic_message(payload, payload_length,
+    if (doip_decode_diagnostic_message(msg->payload, msg->payload_length,
             &diag_msg) != DOIP_RESULT_OK) {
         return;
     }
     
     /* Forward to UDS indication callback */
-    if (uds_indication != NULL) {
-        uds_indication(diag_msg.source_address, diag_msg.user_data,
-                      diag_msg.user_data_length, tester->user_data);
+    if (tester->uds_indication != NULL) {
+        tester->uds_indication(diag_msg.source_address, diag_msg.user_data,
+                               diag_msg.user_data_length, tester->user_data);
     }
 }
 
+/* The entity checks whether the tester still uses the socket, the answer
+ * carries the tester's logical address */
+static void handle_alive_check_request(
+    void *context,
+    const doip_dispatch_msg_t *msg)
+{
+    doip_tester_t *tester = (doip_tester_t *)context;
+    doip_header_t header;
+    uint8_t buffer[10];
+    
+    header.protocol_version = DOIP_PROTOCOL_VERSION_2019;
+    header.inverse_protocol_version = DOIP_INVERSE_VERSION_2019;
+    header.payload_type = DOIP_PAYLOAD_TYPE_ALIVE_CHECK_RES;
+    header.payload_length = 2U;
+    
+    if (doip_encode_header(&header, buffer, sizeof(buffer)) != DOIP_RESULT_OK) {
+        return;
+    }
+    buffer[8] = (uint8_t)(tester->config.logical_address >> 8);
+    buffer[9] = (uint8_t)tester->config.logical_address;
+    
+    (void)doip_interface_tcp_send(tester->interface, msg->connection_id,
+                                  buffer, sizeof(buffer));
+}
+
+/* Payload types the tester consumes, sorted by type. Anything else from
+ * the entity is dropped. */
+static const doip_dispatch_entry_t tester_dispatch_entries[] = {
+    { DOIP_PAYLOAD_TYPE_VEHICLE_ANNOUNCEMENT,   DOIP_TRANSPORT_UDP,
+      (uint8_t)DOIP_DISPATCH_DROP, 32U, 33U,
+      handle_vehicle_announcement },
+    { DOIP_PAYLOAD_TYPE_ROUTING_ACTIVATION_RES, DOIP_TRANSPORT_TCP,
+      (uint8_t)DOIP_DISPATCH_DROP, 9U,  13U,
+      handle_routing_activation_response },
+    { DOIP_PAYLOAD_TYPE_ALIVE_CHECK_REQ,        DOIP_TRANSPORT_TCP,
+      (uint8_t)DOIP_DISPATCH_DROP, 0U,  0U,
+      handle_alive_check_request },
+    { DOIP_PAYLOAD_TYPE_DIAG_MESSAGE,           DOIP_TRANSPORT_TCP,
+      (uint8_t)DOIP_DISPATCH_DROP, 5U,  DOIP_DISPATCH_NO_LIMIT,
+      handle_diagnostic_message }
+};
+
+static const doip_dispatch_table_t tester_dispatch_table = {
+    tester_dispatch_entries,
+    (uint32_t)(sizeof(tester_dispatch_entries) / sizeof(tester_dispatch_entries[0])),
+    (uint8_t)DOIP_DISPATCH_DROP
+};
+
 static void tester_udp_rx_callback(
-    const char *src_ip,
-    uint16_t src_port,
+    const doip_endpoint_t *src,
     const uint8_t *data,
     uint32_t length,
     void *user_data)
 {
-    doip_tester_t *tester = (doip_tester_t *)user_data;
     doip_header_t header;
+    doip_dispatch_msg_t msg;
     
     if (length < 8U) {
         return;
@@ -263,10 +315,18 @@ static void tester_udp_rx_callback(
         return;
     }
     
-    if (header.payload_type == DOIP_PAYLOAD_TYPE_VEHICLE_ANNOUNCEMENT) {
-        handle_vehicle_announcement(tester, src_ip, src_port,
-                                   &data[8], header.payload_length);
+    if (!doip_validate_header(&header) || (header.payload_length != (length - 8U))) {
+        return;
     }
+    
+    msg.transport = DOIP_TRANSPORT_UDP;
+    msg.connection_id = -1;
+    msg.src = src;
+    msg.payload_type = header.payload_type;
+    msg.payload = &data[8];
+    msg.payload_length = header.payload_length;
+    
+    (void)doip_dispatch(&tester_dispatch_table, user_data, &msg);
 }
 
 static void tester_tcp_rx_callback(
@@ -275,31 +335,25 @@ static void tester_tcp_rx_callback(
     uint32_t length,
     void *user_data)
 {
-    doip_tester_t *tester = (doip_tester_t *)user_data;
     doip_header_t header;
+    doip_dispatch_msg_t msg;
     
     if (doip_decode_header(data, length, &header) != DOIP_RESULT_OK) {
         return;
     }
     
-    switch (header.payload_type) {
-        case DOIP_PAYLOAD_TYPE_ROUTING_ACTIVATION_RES:
-            handle_routing_activation_response(tester, &data[8],
-                                              header.payload_length);
-            break;
-        
-        case DOIP_PAYLOAD_TYPE_DIAG_MESSAGE:
-            handle_diagnostic_message(tester, &data[8],
-                                     header.payload_length, NULL);
-            break;
-        
-        case DOIP_PAYLOAD_TYPE_ALIVE_CHECK_REQ:
-            /* Should send alive check response */
-            break;
-        
-        default:
-            break;
+    if (!doip_validate_header(&header)) {
+        return;
     }
+    
+    msg.transport = DOIP_TRANSPORT_TCP;
+    msg.connection_id = connection_id;
+    msg.src = NULL;
+    msg.payload_type = header.payload_type;
+    msg.payload = &data[8];
+    msg.payload_length = header.payload_length;
+    
+    (void)doip_dispatch(&tester_dispatch_table, user_data, &msg);
 }
 
 doip_result_t doip_tester_process(
@@ -310,7 +364,7 @@ doip_result_t doip_tester_process(
         return DOIP_RESULT_INVALID_PARAM;
     }
     
-    tester->user_data = (void *)uds_indication;
+    tester->uds_indication = uds_indication;
     
     return doip_interface_process(
         tester->interface,
@@ -29,13 +29,20 @@ typedef enum {
 
 /* Discovered Entity Information */
 typedef struct {
-    char ip_address[16];
-    uint16_t port;
+    doip_endpoint_t endpoint;
     uint8_t vin[DOIP_VIN_LENGTH];
     uint16_t logical_address;
     uint8_t eid[DOIP_EID_LENGTH];
 } doip_discovered_entity_t;
 
+/* UDS Indication Callback */
+typedef void (*doip_tester_uds_indication_t)(
+    uint16_t source_addr,
+    const uint8_t *data,
+    uint32_t length,
+    void *user_data
+);
+
 /* Tester Context */
 typedef struct {
     doip_tester_config_t config;
@@ -45,17 +52,10 @@ typedef struct {
     doip_discovered_entity_t entity;
     bool routing_activated;
     uint32_t timeout_timer;
+    doip_tester_uds_indication_t uds_indication;   /* Set by doip_tester_process() */
     void *user_data;
 } doip_tester_t;
 
-/* UDS Indication Callback */
-typedef void (*doip_tester_uds_indication_t)(
-    uint16_t source_addr,
-    const uint8_t *data,
-    uint32_t length,
-    void *user_data
-);
-
 /* Function Prototypes */
 doip_result_t doip_tester_init(
     doip_tester_t *tester,
@@ -69,8 +69,7 @@ doip_result_t doip_tester_start_discovery(
 
 doip_result_t doip_tester_connect(
     doip_tester_t *tester,
-    const char *entity_ip,
-    uint16_t entity_port
+    const doip_endpoint_t *entity_endpoint
 );
 
 doip_result_t doip_tester_activate_routing(
@@ -21,10 +21,62 @@
 #define DOIP_RX_BUFFER_SIZE             (4096U)
 #endif
 
+/* Largest connection pool, connection ids stay below it. The runtime
+ * limit is set per entity. */
 #ifndef DOIP_MAX_CONNECTIONS
 #define DOIP_MAX_CONNECTIONS            (8U)
 #endif
 
+/* Connections kept inside doip_interface_t, each holds its RX ring and
+ * TX queue (about 6 KB). More testers need a caller-supplied pool, see
+ * doip_interface_set_connection_pool(). */
+#ifndef DOIP_DEFAULT_CONNECTIONS
+#define DOIP_DEFAULT_CONNECTIONS        (2U)
+#endif
+
+/* Entity timers: announcements plus inactivity and alive check per connection */
+#ifndef DOIP_TIMER_MAX
+#define DOIP_TIMER_MAX                  (1U + (2U * DOIP_MAX_CONNECTIONS))
+#endif
+
+/* Pooled TX frames for UDS responses built in place */
+#ifndef DOIP_TX_FRAME_COUNT
+#define DOIP_TX_FRAME_COUNT             (2U)
+#endif
+
+/* Frame size, 12 bytes of headers plus the largest UDS response */
+#ifndef DOIP_TX_FRAME_SIZE
+#define DOIP_TX_FRAME_SIZE              (DOIP_MAX_PAYLOAD_SIZE + 8U)
+#endif
+
+/* Gateway routes from a target logical address to an internal node */
+#ifndef DOIP_MAX_ROUTES
+#define DOIP_MAX_ROUTES                 (8U)
+#endif
+
+/* UDP datagrams read per process call */
+#ifndef DOIP_UDP_DRAIN_MAX
+#define DOIP_UDP_DRAIN_MAX              (8U)
+#endif
+
+/* Per-source UDP rate limiter: sources tracked, burst size and refill rate */
+#ifndef DOIP_UDP_LIMITER_SOURCES
+#define DOIP_UDP_LIMITER_SOURCES        (8U)
+#endif
+
+#ifndef DOIP_UDP_RATE_BURST
+#define DOIP_UDP_RATE_BURST             (4U)
+#endif
+
+#ifndef DOIP_UDP_RATE_PER_SECOND
+#define DOIP_UDP_RATE_PER_SECOND        (10U)
+#endif
+
+/* Identical requests from one endpoint within this window get one response */
+#ifndef DOIP_UDP_DUPLICATE_WINDOW
+#define DOIP_UDP_DUPLICATE_WINDOW       (50U)
+#endif
+
 #ifndef DOIP_ANNOUNCEMENT_INTERVAL
 #define DOIP_ANNOUNCEMENT_INTERVAL              (500U)
 #endif
@@ -47,6 +99,20 @@
 #define DOIP_DEFAULT_PROTOCOL_VERSION           (0x03U)  /* ISO 13400-2:2019 */
 #endif
 
+/* Per-message trace on the debug UART. Disable it for timing runs, the
+ * output costs more than the message handling itself, and for builds
+ * without the target debug_print driver. */
+#ifndef DOIP_TRACE_ENABLED
+#define DOIP_TRACE_ENABLED                      1
+#endif
+
+#if DOIP_TRACE_ENABLED
+#include "debug_print.h"
+#define DOIP_TRACE(...) debug_print(__VA_ARGS__)
+#else
+#define DOIP_TRACE(...)
+#endif
+
 /* Debugging */
 #ifdef DOIP_DEBUG
 #include <stdio.h>
@@ -0,0 +1,70 @@
+#include "doip_dispatch.h"
+#include <stddef.h>
+
+const doip_dispatch_entry_t *doip_dispatch_find(
+    const doip_dispatch_table_t *table,
+    uint16_t payload_type)
+{
+    uint32_t low = 0U;
+    uint32_t high;
+    uint32_t mid;
+
+    if (table == NULL) {
+        return NULL;
+    }
+
+    /* Binary search over [low, high) */
+    high = table->count;
+    while (low < high) {
+        mid = low + ((high - low) / 2U);
+        if (table->entries[mid].payload_type == payload_type) {
+            return &table->entries[mid];
+        }
+        if (table->entries[mid].payload_type < payload_type) {
+            low = mid + 1U;
+        } else {
+            high = mid;
+        }
+    }
+
+    return NULL;
+}
+
+doip_dispatch_result_t doip_dispatch(
+    const doip_dispatch_table_t *table,
+    void *context,
+    const doip_dispatch_msg_t *msg)
+{
+    doip_dispatch_result_t result;
+    const doip_dispatch_entry_t *entry;
+
+    result.action = DOIP_DISPATCH_DROP;
+    result.nack_code = 0U;
+    result.handled = false;
+
+    if ((table == NULL) || (msg == NULL)) {
+        return result;
+    }
+
+    /* A type on the wrong transport is as unknown as a missing one */
+    entry = doip_dispatch_find(table, msg->payload_type);
+    if ((entry == NULL) || ((entry->transports & msg->transport) == 0U)) {
+        result.action = (doip_dispatch_action_t)table->unknown_action;
+        result.nack_code = DOIP_NACK_UNKNOWN_PAYLOAD_TYPE;
+        return result;
+    }
+
+    if ((msg->payload_length < entry->min_length) ||
+        (msg->payload_length > entry->max_length)) {
+        result.action = (doip_dispatch_action_t)entry->invalid_action;
+        result.nack_code = DOIP_NACK_INVALID_PAYLOAD_LENGTH;
+        return result;
+    }
+
+    if (entry->handler != NULL) {
+        entry->handler(context, msg);
+    }
+    result.handled = true;
+
+    return result;
+}
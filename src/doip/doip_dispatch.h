@@ -0,0 +1,72 @@
+#ifndef DOIP_DISPATCH_H
+#define DOIP_DISPATCH_H
+
+#include "doip_interface.h"
+
+/* Transports a payload type may arrive on */
+#define DOIP_TRANSPORT_UDP          0x01U
+#define DOIP_TRANSPORT_TCP          0x02U
+
+/* Maximum length of entries without an upper bound */
+#define DOIP_DISPATCH_NO_LIMIT      0xFFFFFFFFU
+
+/* What to do with a message that fails validation */
+typedef enum {
+    DOIP_DISPATCH_DROP = 0,         /* Discard silently */
+    DOIP_DISPATCH_NACK,             /* Send a generic header NACK */
+    DOIP_DISPATCH_NACK_CLOSE        /* Send a generic header NACK, close the socket */
+} doip_dispatch_action_t;
+
+/* Message handed to a dispatch handler */
+typedef struct {
+    uint8_t transport;              /* DOIP_TRANSPORT_* */
+    int connection_id;              /* TCP only, -1 for UDP */
+    const doip_endpoint_t *src;     /* UDP only, NULL for TCP */
+    uint16_t payload_type;
+    const uint8_t *payload;
+    uint32_t payload_length;
+} doip_dispatch_msg_t;
+
+typedef void (*doip_dispatch_handler_t)(
+    void *context,
+    const doip_dispatch_msg_t *msg
+);
+
+/* One supported payload type. A NULL handler accepts and ignores it. */
+typedef struct {
+    uint16_t payload_type;
+    uint8_t transports;             /* Mask of DOIP_TRANSPORT_* */
+    uint8_t invalid_action;         /* doip_dispatch_action_t on length error */
+    uint32_t min_length;
+    uint32_t max_length;
+    doip_dispatch_handler_t handler;
+} doip_dispatch_entry_t;
+
+/* Entries must be sorted by ascending payload type */
+typedef struct {
+    const doip_dispatch_entry_t *entries;
+    uint32_t count;
+    uint8_t unknown_action;         /* doip_dispatch_action_t for other types */
+} doip_dispatch_table_t;
+
+/* Outcome of doip_dispatch() */
+typedef struct {
+    doip_dispatch_action_t action;  /* DROP also after a handled message */
+    uint8_t nack_code;              /* DOIP_NACK_* if action is not DROP */
+    bool handled;
+} doip_dispatch_result_t;
+
+const doip_dispatch_entry_t *doip_dispatch_find(
+    const doip_dispatch_table_t *table,
+    uint16_t payload_type
+);
+
+/* Validates a decoded message against the table and calls its handler.
+ * Header pattern checks are left to the caller. */
+doip_dispatch_result_t doip_dispatch(
+    const doip_dispatch_table_t *table,
+    void *context,
+    const doip_dispatch_msg_t *msg
+);
+
+#endif /* DOIP_DISPATCH_H */
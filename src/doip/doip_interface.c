@@ -1,16 +1,43 @@
 #include "doip_interface.h"
 #include <string.h>
+#include <stdio.h>
 #include <errno.h>
-#include "debug_print.h"
 
 #define INVALID_SOCKET  (-1)
 
+/* Close every pool entry, lowest id on top of the free stack */
+static void reset_connections(doip_interface_t *interface)
+{
+    uint32_t i;
+    
+    interface->free_count = 0U;
+    interface->max_connections = interface->connection_count;
+    for (i = interface->connection_count; i > 0U; i--) {
+        interface->free_slots[interface->free_count] = (uint8_t)(i - 1U);
+        interface->free_count++;
+    }
+    for (i = 0U; i < interface->connection_count; i++) {
+        interface->connections[i].socket_fd = INVALID_SOCKET;
+        interface->connections[i].state = DOIP_CONN_STATE_CLOSED;
+        interface->connections[i].source_address = 0U;
+        interface->connections[i].last_activity_time = 0U;
+        interface->connections[i].rx_read_pos = 0U;
+        interface->connections[i].rx_buffer_used = 0U;
+        interface->connections[i].rx_ready = false;
+        interface->connections[i].stream_state = DOIP_STREAM_STATE_NONE;
+        interface->connections[i].stream_remaining = 0U;
+        interface->connections[i].tx_read_pos = 0U;
+        interface->connections[i].tx_queued = 0U;
+        interface->connections[i].tx_high_water = 0U;
+        interface->connections[i].tx_ready = false;
+        interface->connections[i].rx_pending = false;
+    }
+}
+
 doip_result_t doip_interface_init(
     doip_interface_t *interface,
     doip_network_ops_t *net_ops)
 {
-    uint32_t i;
-    
     if ((interface == NULL) || (net_ops == NULL)) {
         return DOIP_RESULT_INVALID_PARAM;
     }
@@ -18,19 +45,73 @@ doip_result_t doip_interface_init(
     interface->net_ops = net_ops;
     interface->udp_socket = INVALID_SOCKET;
     interface->tcp_listen_socket = INVALID_SOCKET;
+    interface->udp_ready = false;
+    interface->listen_ready = false;
+    interface->events_valid = false;
     
-    /* Initialize all connections */
-    for (i = 0U; i < DOIP_MAX_CONNECTIONS; i++) {
-        interface->connections[i].socket_fd = INVALID_SOCKET;
-        interface->connections[i].state = DOIP_CONN_STATE_CLOSED;
-        interface->connections[i].source_address = 0U;
-        interface->connections[i].last_activity_time = 0U;
-        interface->connections[i].rx_buffer_used = 0U;
+    interface->connections = interface->default_connections;
+    interface->connection_count = DOIP_DEFAULT_CONNECTIONS;
+    reset_connections(interface);
+    interface->rx_message_count = 0U;
+    interface->rx_linearized_count = 0U;
+    interface->udp_drained_count = 0U;
+    interface->tx_backpressure_count = 0U;
+    interface->tx_overflow_count = 0U;
+    interface->stream_callback = NULL;
+    interface->stream_user_data = NULL;
+    
+    return DOIP_RESULT_OK;
+}
+
+void doip_interface_set_max_connections(
+    doip_interface_t *interface,
+    uint32_t max_connections)
+{
+    if (interface == NULL) {
+        return;
     }
     
+    if ((max_connections == 0U) || (max_connections > interface->connection_count)) {
+        max_connections = interface->connection_count;
+    }
+    interface->max_connections = max_connections;
+}
+
+doip_result_t doip_interface_set_connection_pool(
+    doip_interface_t *interface,
+    doip_tcp_connection_t *pool,
+    uint32_t count)
+{
+    if ((interface == NULL) || (pool == NULL) || (count == 0U)) {
+        return DOIP_RESULT_INVALID_PARAM;
+    }
+    
+    /* Open connections would lose their buffers */
+    if (interface->free_count != interface->connection_count) {
+        return DOIP_RESULT_NOT_READY;
+    }
+    
+    if (count > DOIP_MAX_CONNECTIONS) {
+        count = DOIP_MAX_CONNECTIONS;
+    }
+    interface->connections = pool;
+    interface->connection_count = count;
+    reset_connections(interface);
+    
     return DOIP_RESULT_OK;
 }
 
+void doip_interface_set_stream_callback(
+    doip_interface_t *interface,
+    doip_tcp_stream_callback_t stream_callback,
+    void *user_data)
+{
+    if (interface != NULL) {
+        interface->stream_callback = stream_callback;
+        interface->stream_user_data = user_data;
+    }
+}
+
 doip_result_t doip_interface_start_udp(
     doip_interface_t *interface,
     uint16_t port)
@@ -69,18 +150,21 @@ doip_result_t doip_interface_udp_broadcast(
     uint32_t length,
     uint16_t port)
 {
+    doip_endpoint_t dest;
     int result;
     
     if ((interface == NULL) || (data == NULL)) {
         return DOIP_RESULT_INVALID_PARAM;
     }
     
+    dest.ip_addr = DOIP_IP_ADDR_BROADCAST;
+    dest.port = port;
+    
     result = interface->net_ops->udp_sendto(
         interface->udp_socket,
         data,
         length,
-        "255.255.255.255",
-        port
+        &dest
     );
     
     return (result >= 0) ? DOIP_RESULT_OK : DOIP_RESULT_ERROR;
@@ -88,14 +172,13 @@ doip_result_t doip_interface_udp_broadcast(
 
 doip_result_t doip_interface_udp_send(
     doip_interface_t *interface,
-    const char *dest_ip,
-    uint16_t dest_port,
+    const doip_endpoint_t *dest,
     const uint8_t *data,
     uint32_t length)
 {
     int result;
     
-    if ((interface == NULL) || (dest_ip == NULL) || (data == NULL)) {
+    if ((interface == NULL) || (dest == NULL) || (data == NULL)) {
         return DOIP_RESULT_INVALID_PARAM;
     }
     
@@ -103,53 +186,772 @@ doip_result_t doip_interface_udp_send(
         interface->udp_socket,
         data,
         length,
-        dest_ip,
-        dest_port
+        dest
     );
     
     return (result >= 0) ? DOIP_RESULT_OK : DOIP_RESULT_ERROR;
 }
 
+const char *doip_endpoint_to_string(
+    const doip_endpoint_t *endpoint,
+    char *buffer,
+    uint32_t buffer_size)
+{
+    const uint8_t *octets;
+    
+    if ((buffer == NULL) || (buffer_size == 0U)) {
+        return "";
+    }
+    
+    if (endpoint == NULL) {
+        buffer[0] = '\0';
+        return buffer;
+    }
+    
+    /* Network byte order: the first octet is stored first */
+    octets = (const uint8_t *)&endpoint->ip_addr;
+    (void)snprintf(buffer, buffer_size, "%u.%u.%u.%u:%u",
+                   (unsigned int)octets[0], (unsigned int)octets[1],
+                   (unsigned int)octets[2], (unsigned int)octets[3],
+                   (unsigned int)endpoint->port);
+    
+    return buffer;
+}
+
+/* Hand 'iovcnt' elements to the backend, returns the bytes it accepted */
+static int send_vectors(
+    doip_interface_t *interface,
+    int socket_fd,
+    const doip_iovec_t *iov,
+    uint32_t iovcnt)
+{
+    int result;
+    int total = 0;
+    uint32_t i;
+    
+    if (interface->net_ops->tcp_sendv != NULL) {
+        return interface->net_ops->tcp_sendv(socket_fd, iov, iovcnt);
+    }
+    
+    /* Backend without gather support: one send per element */
+    for (i = 0U; i < iovcnt; i++) {
+        if (iov[i].length == 0U) {
+            continue;
+        }
+        result = interface->net_ops->tcp_send(socket_fd, iov[i].data,
+                                              iov[i].length);
+        if (result < 0) {
+            return (total > 0) ? total : result;
+        }
+        total += result;
+        if ((uint32_t)result < iov[i].length) {
+            break;
+        }
+    }
+    
+    return total;
+}
+
+/* Append everything after the first 'skip' bytes of 'iov' to the TX queue.
+ * The caller has checked that it fits. */
+static void tx_enqueue(
+    doip_tcp_connection_t *conn,
+    const doip_iovec_t *iov,
+    uint32_t iovcnt,
+    uint32_t skip)
+{
+    uint32_t offset;
+    uint32_t write_pos;
+    uint32_t span;
+    uint32_t i;
+    
+    for (i = 0U; i < iovcnt; i++) {
+        if (skip >= iov[i].length) {
+            skip -= iov[i].length;
+            continue;
+        }
+        
+        offset = skip;
+        skip = 0U;
+        while (offset < iov[i].length) {
+            write_pos = (conn->tx_read_pos + conn->tx_queued) % DOIP_TX_QUEUE_SIZE;
+            span = DOIP_TX_QUEUE_SIZE - write_pos;
+            if (span > (iov[i].length - offset)) {
+                span = iov[i].length - offset;
+            }
+            (void)memcpy(&conn->tx_queue[write_pos], &iov[i].data[offset], span);
+            conn->tx_queued += span;
+            offset += span;
+        }
+    }
+    
+    if (conn->tx_queued > conn->tx_high_water) {
+        conn->tx_high_water = conn->tx_queued;
+    }
+}
+
+/* Send as much of the TX queue as the socket accepts */
+static int tx_flush(doip_interface_t *interface, doip_tcp_connection_t *conn)
+{
+    doip_iovec_t iov[2];
+    uint32_t iovcnt = 1U;
+    uint32_t first;
+    int result;
+    
+    if (conn->tx_queued == 0U) {
+        return 0;
+    }
+    
+    /* A wrapped queue goes out as two elements of one vectored send */
+    first = DOIP_TX_QUEUE_SIZE - conn->tx_read_pos;
+    iov[0].data = &conn->tx_queue[conn->tx_read_pos];
+    if (first >= conn->tx_queued) {
+        iov[0].length = conn->tx_queued;
+    } else {
+        iov[0].length = first;
+        iov[1].data = conn->tx_queue;
+        iov[1].length = conn->tx_queued - first;
+        iovcnt = 2U;
+    }
+    
+    result = send_vectors(interface, conn->socket_fd, iov, iovcnt);
+    if (result > 0) {
+        conn->tx_read_pos = (conn->tx_read_pos + (uint32_t)result) % DOIP_TX_QUEUE_SIZE;
+        conn->tx_queued -= (uint32_t)result;
+        if (conn->tx_queued == 0U) {
+            conn->tx_read_pos = 0U;
+        }
+    }
+    
+    return result;
+}
+
+static void tx_reset(doip_tcp_connection_t *conn)
+{
+    conn->tx_read_pos = 0U;
+    conn->tx_queued = 0U;
+    conn->tx_ready = false;
+    conn->rx_pending = false;
+}
+
 doip_result_t doip_interface_tcp_send(
     doip_interface_t *interface,
     int connection_id,
     const uint8_t *data,
     uint32_t length)
 {
-    int result;
+    doip_iovec_t iov;
     
     if ((interface == NULL) || (data == NULL)) {
         return DOIP_RESULT_INVALID_PARAM;
     }
     
-    if ((connection_id < 0) || (connection_id >= (int)DOIP_MAX_CONNECTIONS)) {
+    iov.data = data;
+    iov.length = length;
+    
+    return doip_interface_tcp_sendv(interface, connection_id, &iov, 1U);
+}
+
+doip_result_t doip_interface_tcp_sendv(
+    doip_interface_t *interface,
+    int connection_id,
+    const doip_iovec_t *iov,
+    uint32_t iovcnt)
+{
+    doip_tcp_connection_t *conn;
+    uint32_t total = 0U;
+    uint32_t sent;
+    uint32_t i;
+    int result;
+    
+    if ((interface == NULL) || (iov == NULL) ||
+        (iovcnt == 0U) || (iovcnt > DOIP_MAX_IOVEC)) {
         return DOIP_RESULT_INVALID_PARAM;
     }
     
-    if (interface->connections[connection_id].socket_fd < 0) {
+    if ((connection_id < 0) || (connection_id >= (int)interface->connection_count)) {
+        return DOIP_RESULT_INVALID_PARAM;
+    }
+    
+    conn = &interface->connections[connection_id];
+    if ((conn->socket_fd < 0) || (conn->state == DOIP_CONN_STATE_FINALIZE)) {
         return DOIP_RESULT_NOT_READY;
     }
     
-    result = interface->net_ops->tcp_send(
-        interface->connections[connection_id].socket_fd,
-        data,
-        length
-    );
+    for (i = 0U; i < iovcnt; i++) {
+        total += iov[i].length;
+    }
     
-    return (result >= 0) ? DOIP_RESULT_OK : DOIP_RESULT_ERROR;
+    /* Queued bytes are older and must go out first */
+    if ((conn->tx_queued > 0U) && (tx_flush(interface, conn) < 0)) {
+        return DOIP_RESULT_ERROR;
+    }
+    
+    if (conn->tx_queued > 0U) {
+        if (total > (DOIP_TX_QUEUE_SIZE - conn->tx_queued)) {
+            /* Refuse the whole frame rather than send part of it */
+            interface->tx_backpressure_count++;
+            return DOIP_RESULT_NO_MEMORY;
+        }
+        tx_enqueue(conn, iov, iovcnt, 0U);
+        return DOIP_RESULT_OK;
+    }
+    
+    result = send_vectors(interface, conn->socket_fd, iov, iovcnt);
+    if (result < 0) {
+        return DOIP_RESULT_ERROR;
+    }
+    
+    sent = (uint32_t)result;
+    if (sent < total) {
+        if ((total - sent) > DOIP_TX_QUEUE_SIZE) {
+            if (sent == 0U) {
+                interface->tx_backpressure_count++;
+                return DOIP_RESULT_NO_MEMORY;
+            }
+            /* Part of the frame is on the wire and the rest cannot be kept,
+             * the peer would lose DoIP framing: close on the next process */
+            DOIP_LOG("Connection %d: TX queue overflow, closing", connection_id);
+            interface->tx_overflow_count++;
+            conn->state = DOIP_CONN_STATE_FINALIZE;
+            tx_reset(conn);
+            return DOIP_RESULT_ERROR;
+        }
+        tx_enqueue(conn, iov, iovcnt, sent);
+    }
+    
+    return DOIP_RESULT_OK;
+}
+
+doip_result_t doip_interface_get_tx_status(
+    const doip_interface_t *interface,
+    int connection_id,
+    doip_tx_status_t *status)
+{
+    const doip_tcp_connection_t *conn;
+    
+    if ((interface == NULL) || (status == NULL) ||
+        (connection_id < 0) || (connection_id >= (int)interface->connection_count)) {
+        return DOIP_RESULT_INVALID_PARAM;
+    }
+    
+    conn = &interface->connections[connection_id];
+    status->queued = conn->tx_queued;
+    status->free_space = DOIP_TX_QUEUE_SIZE - conn->tx_queued;
+    status->high_water = conn->tx_high_water;
+    
+    return (conn->socket_fd >= 0) ? DOIP_RESULT_OK : DOIP_RESULT_NOT_READY;
+}
+
+/* Return a connection id to the free stack */
+static void free_connection_slot(doip_interface_t *interface, uint32_t index)
+{
+    interface->free_slots[interface->free_count] = (uint8_t)index;
+    interface->free_count++;
+}
+
+int doip_interface_attach_socket(
+    doip_interface_t *interface,
+    int socket_fd)
+{
+    doip_tcp_connection_t *conn;
+    uint32_t index;
+    
+    if ((interface == NULL) || (socket_fd < 0)) {
+        return INVALID_SOCKET;
+    }
+    
+    /* Open connections are the slots missing from the free stack */
+    if ((interface->free_count == 0U) ||
+        ((interface->connection_count - interface->free_count) >= interface->max_connections)) {
+        return INVALID_SOCKET;
+    }
+    
+    interface->free_count--;
+    index = interface->free_slots[interface->free_count];
+    
+    conn = &interface->connections[index];
+    conn->socket_fd = socket_fd;
+    conn->state = DOIP_CONN_STATE_PENDING_ACTIVATION;
+    conn->source_address = 0U;
+    conn->rx_read_pos = 0U;
+    conn->rx_buffer_used = 0U;
+    conn->rx_ready = false;
+    conn->stream_state = DOIP_STREAM_STATE_NONE;
+    conn->stream_remaining = 0U;
+    conn->tx_high_water = 0U;
+    tx_reset(conn);
+    conn->last_activity_time = 0U; /* Should use actual time */
+    
+    return (int)index;
+}
+
+doip_result_t doip_interface_wait_prepare(
+    doip_interface_t *interface,
+    uint32_t timeout_ms,
+    doip_wait_set_t *set)
+{
+    doip_tcp_connection_t *conn;
+    uint32_t i;
+    
+    if ((interface == NULL) || (set == NULL)) {
+        return DOIP_RESULT_INVALID_PARAM;
+    }
+    
+    if (interface->net_ops->socket_select == NULL) {
+        return DOIP_RESULT_NOT_READY;
+    }
+    
+    /* Collect every open DoIP socket: UDP, listener, then connections */
+    set->count = 0U;
+    if (interface->udp_socket >= 0) {
+        set->sockets[set->count] = interface->udp_socket;
+        set->events[set->count] = DOIP_SOCKET_EVENT_READ;
+        set->count++;
+    }
+    if (interface->tcp_listen_socket >= 0) {
+        set->sockets[set->count] = interface->tcp_listen_socket;
+        set->events[set->count] = DOIP_SOCKET_EVENT_READ;
+        set->count++;
+    }
+    set->first_conn = set->count;
+    for (i = 0U; i < interface->connection_count; i++) {
+        conn = &interface->connections[i];
+        if (conn->socket_fd < 0) {
+            continue;
+        }
+        if (conn->state == DOIP_CONN_STATE_FINALIZE) {
+            /* Let the next process call release it without waiting */
+            timeout_ms = 0U;
+        }
+        set->slots[set->count - set->first_conn] = (uint8_t)i;
+        set->sockets[set->count] = conn->socket_fd;
+        set->events[set->count] = 0U;
+        /* Stop reading while the peer is not draining our responses */
+        if (conn->tx_queued <= DOIP_TX_PAUSE_THRESHOLD) {
+            set->events[set->count] |= DOIP_SOCKET_EVENT_READ;
+        }
+        if (conn->tx_queued > 0U) {
+            set->events[set->count] |= DOIP_SOCKET_EVENT_WRITE;
+        }
+        if (conn->rx_pending && (conn->tx_queued <= DOIP_TX_PAUSE_THRESHOLD)) {
+            /* Buffered requests can be delivered right away */
+            timeout_ms = 0U;
+        }
+        set->count++;
+    }
+    set->timeout_ms = timeout_ms;
+    set->ready = 0;
+    
+    return DOIP_RESULT_OK;
+}
+
+doip_result_t doip_interface_wait_select(
+    const doip_interface_t *interface,
+    doip_wait_set_t *set)
+{
+    if ((interface == NULL) || (set == NULL)) {
+        return DOIP_RESULT_INVALID_PARAM;
+    }
+    
+    set->ready = interface->net_ops->socket_select(set->sockets, set->events,
+                                                   set->count, set->timeout_ms);
+    if (set->ready < 0) {
+        return DOIP_RESULT_ERROR;
+    }
+    
+    return (set->ready > 0) ? DOIP_RESULT_OK : DOIP_RESULT_TIMEOUT;
 }
 
-static int find_free_connection(doip_interface_t *interface)
+doip_result_t doip_interface_wait_finish(
+    doip_interface_t *interface,
+    const doip_wait_set_t *set)
 {
+    doip_tcp_connection_t *conn;
     uint32_t i;
     
-    for (i = 0U; i < DOIP_MAX_CONNECTIONS; i++) {
-        if (interface->connections[i].state == DOIP_CONN_STATE_CLOSED) {
-            return (int)i;
+    if ((interface == NULL) || (set == NULL)) {
+        return DOIP_RESULT_INVALID_PARAM;
+    }
+    
+    if (set->ready < 0) {
+        return DOIP_RESULT_ERROR;
+    }
+    
+    /* Record readiness so the next process call only services these sockets */
+    interface->udp_ready = false;
+    interface->listen_ready = false;
+    for (i = 0U; i < interface->connection_count; i++) {
+        interface->connections[i].rx_ready = false;
+        interface->connections[i].tx_ready = false;
+    }
+    for (i = 0U; i < set->count; i++) {
+        if (i >= set->first_conn) {
+            conn = &interface->connections[set->slots[i - set->first_conn]];
+            /* Closed or reused while the select ran */
+            if (conn->socket_fd != set->sockets[i]) {
+                continue;
+            }
+            conn->rx_ready = ((set->events[i] & DOIP_SOCKET_EVENT_READ) != 0U);
+            conn->tx_ready = ((set->events[i] & DOIP_SOCKET_EVENT_WRITE) != 0U);
+        } else if ((set->events[i] & DOIP_SOCKET_EVENT_READ) == 0U) {
+            continue;
+        } else if (set->sockets[i] == interface->udp_socket) {
+            interface->udp_ready = true;
+        } else {
+            interface->listen_ready = true;
+        }
+    }
+    interface->events_valid = true;
+    
+    return (set->ready > 0) ? DOIP_RESULT_OK : DOIP_RESULT_TIMEOUT;
+}
+
+doip_result_t doip_interface_wait(
+    doip_interface_t *interface,
+    uint32_t timeout_ms)
+{
+    doip_wait_set_t set;
+    doip_result_t result;
+    
+    result = doip_interface_wait_prepare(interface, timeout_ms, &set);
+    if (result != DOIP_RESULT_OK) {
+        return result;
+    }
+    
+    (void)doip_interface_wait_select(interface, &set);
+    
+    return doip_interface_wait_finish(interface, &set);
+}
+
+doip_result_t doip_interface_wake(doip_interface_t *interface)
+{
+    if (interface == NULL) {
+        return DOIP_RESULT_INVALID_PARAM;
+    }
+    
+    if (interface->net_ops->socket_wake == NULL) {
+        return DOIP_RESULT_NOT_READY;
+    }
+    
+    interface->net_ops->socket_wake();
+    
+    return DOIP_RESULT_OK;
+}
+
+/* Receive into the free space of the ring, at most two contiguous spans */
+static int ring_receive(doip_interface_t *interface, doip_tcp_connection_t *conn)
+{
+    uint32_t write_pos;
+    uint32_t span;
+    int bytes_received;
+    int total = 0;
+    uint32_t pass;
+    
+    for (pass = 0U; pass < 2U; pass++) {
+        if (conn->rx_buffer_used >= DOIP_RX_BUFFER_SIZE) {
+            break;
+        }
+        
+        write_pos = (conn->rx_read_pos + conn->rx_buffer_used) % DOIP_RX_BUFFER_SIZE;
+        span = DOIP_RX_BUFFER_SIZE - conn->rx_buffer_used;
+        if (span > (DOIP_RX_BUFFER_SIZE - write_pos)) {
+            span = DOIP_RX_BUFFER_SIZE - write_pos;
+        }
+        
+        bytes_received = interface->net_ops->tcp_recv(conn->socket_fd,
+                                                      &conn->rx_buffer[write_pos],
+                                                      span);
+        if (bytes_received <= 0) {
+            /* Report closure only if nothing was read in this call */
+            return (total > 0) ? total : bytes_received;
+        }
+        
+        conn->rx_buffer_used += (uint32_t)bytes_received;
+        total += bytes_received;
+        
+        /* Only continue at the ring start if the tail span was filled */
+        if ((uint32_t)bytes_received < span) {
+            break;
         }
     }
     
-    return INVALID_SOCKET;
+    return total;
+}
+
+/* Copy 'length' bytes starting at ring offset 'offset' into 'dest' */
+static void ring_copy(const doip_tcp_connection_t *conn, uint32_t offset,
+                      uint8_t *dest, uint32_t length)
+{
+    uint32_t pos = (conn->rx_read_pos + offset) % DOIP_RX_BUFFER_SIZE;
+    uint32_t first = DOIP_RX_BUFFER_SIZE - pos;
+    
+    if (first >= length) {
+        (void)memcpy(dest, &conn->rx_buffer[pos], length);
+    } else {
+        (void)memcpy(dest, &conn->rx_buffer[pos], first);
+        (void)memcpy(&dest[first], conn->rx_buffer, length - first);
+    }
+}
+
+/* Drop any unfinished stream on a connection that is going away */
+static void abort_stream(doip_interface_t *interface, uint32_t index)
+{
+    doip_tcp_connection_t *conn = &interface->connections[index];
+    
+    if ((conn->stream_state == DOIP_STREAM_STATE_ACTIVE) &&
+        (interface->stream_callback != NULL)) {
+        (void)interface->stream_callback((int)index, DOIP_STREAM_EVENT_ABORT,
+                                         &conn->stream_info, NULL, 0U,
+                                         interface->stream_user_data);
+    }
+    conn->stream_state = DOIP_STREAM_STATE_NONE;
+    conn->stream_remaining = 0U;
+}
+
+static void release_connection(
+    doip_interface_t *interface,
+    uint32_t index,
+    doip_tcp_disconnected_callback_t disconnected_callback,
+    void *user_data)
+{
+    doip_tcp_connection_t *conn = &interface->connections[index];
+    
+    abort_stream(interface, index);
+    
+    if (disconnected_callback != NULL) {
+        disconnected_callback((int)index, user_data);
+    }
+    
+    interface->net_ops->close_socket(conn->socket_fd);
+    conn->socket_fd = INVALID_SOCKET;
+    conn->state = DOIP_CONN_STATE_CLOSED;
+    conn->rx_read_pos = 0U;
+    conn->rx_buffer_used = 0U;
+    tx_reset(conn);
+    free_connection_slot(interface, index);
+}
+
+/* Advance the ring read position past 'length' stored bytes */
+static void ring_consume(doip_tcp_connection_t *conn, uint32_t length)
+{
+    conn->rx_read_pos = (conn->rx_read_pos + length) % DOIP_RX_BUFFER_SIZE;
+    conn->rx_buffer_used -= length;
+}
+
+/* Generic header NACK for a message the interface does not pass on */
+static void send_header_nack(
+    doip_interface_t *interface,
+    uint32_t index,
+    uint8_t nack_code)
+{
+    uint8_t buffer[16];
+    uint32_t encoded_length;
+    
+    if (doip_encode_generic_nack(nack_code, buffer, sizeof(buffer),
+            &encoded_length) == DOIP_RESULT_OK) {
+        (void)doip_interface_tcp_send(interface, (int)index, buffer,
+                                      encoded_length);
+    }
+}
+
+/* Start streaming (or discarding) a message that does not fit the ring.
+ * Returns false if more bytes are needed before the decision can be made. */
+static bool begin_stream(
+    doip_interface_t *interface,
+    uint32_t index,
+    const doip_header_t *header,
+    doip_tcp_disconnected_callback_t disconnected_callback,
+    void *user_data)
+{
+    doip_tcp_connection_t *conn = &interface->connections[index];
+    uint8_t address_bytes[4];
+    bool accepted = false;
+    
+    if ((header->payload_type == DOIP_PAYLOAD_TYPE_DIAG_MESSAGE) &&
+        (header->payload_length >= 4U) &&
+        (interface->stream_callback != NULL)) {
+        if (conn->rx_buffer_used < 12U) {
+            return false;
+        }
+        
+        ring_copy(conn, 8U, address_bytes, 4U);
+        ring_consume(conn, 12U);
+        
+        conn->stream_info.header = *header;
+        conn->stream_info.source_address =
+            (uint16_t)(((uint16_t)address_bytes[0] << 8) | (uint16_t)address_bytes[1]);
+        conn->stream_info.target_address =
+            (uint16_t)(((uint16_t)address_bytes[2] << 8) | (uint16_t)address_bytes[3]);
+        conn->stream_info.user_data_length = header->payload_length - 4U;
+        conn->stream_info.offset = 0U;
+        conn->stream_remaining = conn->stream_info.user_data_length;
+        
+        accepted = interface->stream_callback((int)index, DOIP_STREAM_EVENT_START,
+                                              &conn->stream_info, NULL, 0U,
+                                              interface->stream_user_data);
+    } else if (!doip_validate_protocol_version(header)) {
+        /* ISO 13400-2: incorrect pattern, NACK and close the socket */
+        send_header_nack(interface, index, DOIP_NACK_INCORRECT_PATTERN);
+        release_connection(interface, index, disconnected_callback, user_data);
+        return true;
+    } else {
+        DOIP_LOG("Connection %u: discarding message of %u bytes",
+                 (unsigned int)index, (unsigned int)header->payload_length);
+        send_header_nack(interface, index, DOIP_NACK_MESSAGE_TOO_LARGE);
+        ring_consume(conn, 8U);
+        conn->stream_remaining = header->payload_length;
+    }
+    
+    /* The START callback may have closed the connection */
+    if (conn->socket_fd >= 0) {
+        conn->stream_state = accepted ? DOIP_STREAM_STATE_ACTIVE :
+                                        DOIP_STREAM_STATE_DISCARD;
+    }
+    return true;
+}
+
+/* Deliver or drop buffered bytes of the message being streamed */
+static void continue_stream(doip_interface_t *interface, uint32_t index)
+{
+    doip_tcp_connection_t *conn = &interface->connections[index];
+    uint32_t span;
+    
+    while ((conn->stream_remaining > 0U) && (conn->rx_buffer_used > 0U)) {
+        span = conn->rx_buffer_used;
+        if (span > conn->stream_remaining) {
+            span = conn->stream_remaining;
+        }
+        if (span > (DOIP_RX_BUFFER_SIZE - conn->rx_read_pos)) {
+            span = DOIP_RX_BUFFER_SIZE - conn->rx_read_pos;
+        }
+        
+        if (conn->stream_state == DOIP_STREAM_STATE_ACTIVE) {
+            /* Chunks are passed in place, straight out of the ring */
+            if (!interface->stream_callback((int)index, DOIP_STREAM_EVENT_DATA,
+                                            &conn->stream_info,
+                                            &conn->rx_buffer[conn->rx_read_pos],
+                                            span, interface->stream_user_data)) {
+                conn->stream_state = DOIP_STREAM_STATE_DISCARD;
+            }
+            conn->stream_info.offset += span;
+        }
+        
+        ring_consume(conn, span);
+        conn->stream_remaining -= span;
+    }
+    
+    if (conn->stream_remaining == 0U) {
+        if (conn->stream_state == DOIP_STREAM_STATE_ACTIVE) {
+            (void)interface->stream_callback((int)index, DOIP_STREAM_EVENT_END,
+                                             &conn->stream_info, NULL, 0U,
+                                             interface->stream_user_data);
+        }
+        conn->stream_state = DOIP_STREAM_STATE_NONE;
+    }
+}
+
+static void process_tcp_connection(
+    doip_interface_t *interface,
+    uint32_t index,
+    doip_tcp_rx_callback_t tcp_callback,
+    doip_tcp_disconnected_callback_t disconnected_callback,
+    void *user_data)
+{
+    doip_tcp_connection_t *conn = &interface->connections[index];
+    uint8_t header_bytes[8];
+    doip_header_t header;
+    uint32_t total_message_size;
+    const uint8_t *message;
+    int bytes_received;
+    
+    if (conn->rx_pending) {
+        /* Deliver what is already buffered before reading more */
+        conn->rx_pending = false;
+    } else {
+        bytes_received = ring_receive(interface, conn);
+        
+        if (bytes_received == 0) {
+            /* Connection closed */
+            release_connection(interface, index, disconnected_callback, user_data);
+            return;
+        }
+        
+        if (bytes_received < 0) {
+            /* Error or would block - continue */
+            /* For non-blocking sockets, EAGAIN/EWOULDBLOCK means no data available */
+            /* Remove immediate disconnection detection here, let inactivity timer handle it */
+            return;
+        }
+    }
+    
+    /* Process complete DoIP messages */
+    while (conn->rx_buffer_used > 0U) {
+        if (conn->tx_queued > DOIP_TX_PAUSE_THRESHOLD) {
+            /* Responses are backing up, continue once the queue drains */
+            conn->rx_pending = true;
+            break;
+        }
+        
+        if (conn->stream_state != DOIP_STREAM_STATE_NONE) {
+            continue_stream(interface, index);
+            if ((conn->socket_fd < 0) || (conn->stream_state != DOIP_STREAM_STATE_NONE)) {
+                return;
+            }
+            continue;
+        }
+        
+        if (conn->rx_buffer_used < 8U) {
+            break;
+        }
+        
+        ring_copy(conn, 0U, header_bytes, 8U);
+        (void)doip_decode_header(header_bytes, 8U, &header);
+        
+        if (header.payload_length > (DOIP_RX_BUFFER_SIZE - 8U)) {
+            /* Too large to reassemble, stream it to the upper layer */
+            if (!begin_stream(interface, index, &header, disconnected_callback,
+                              user_data)) {
+                break;
+            }
+            if (conn->socket_fd < 0) {
+                return;
+            }
+            continue;
+        }
+        
+        total_message_size = 8U + header.payload_length;
+        if (conn->rx_buffer_used < total_message_size) {
+            /* Incomplete message, wait for more data */
+            break;
+        }
+        
+        /* Hand the message over in place unless it wraps the ring end */
+        if ((conn->rx_read_pos + total_message_size) <= DOIP_RX_BUFFER_SIZE) {
+            message = &conn->rx_buffer[conn->rx_read_pos];
+        } else {
+            ring_copy(conn, 0U, interface->rx_linear_buffer, total_message_size);
+            message = interface->rx_linear_buffer;
+            interface->rx_linearized_count++;
+        }
+        interface->rx_message_count++;
+        
+        /* Remove the message before the callback so it may close the connection */
+        ring_consume(conn, total_message_size);
+        
+        if (tcp_callback != NULL) {
+            tcp_callback((int)index, message, total_message_size, user_data);
+        }
+        
+        if (conn->socket_fd < 0) {
+            return;
+        }
+    }
+    
+    /* Restart at the ring start when empty to keep messages contiguous */
+    if (conn->rx_buffer_used == 0U) {
+        conn->rx_read_pos = 0U;
+    }
 }
 
 doip_result_t doip_interface_process(
@@ -162,43 +964,49 @@ doip_result_t doip_interface_process(
 {
     uint32_t i;
     int bytes_received;
-    char src_ip[16];
-    uint16_t src_port;
+    doip_endpoint_t src;
+    doip_tcp_connection_t *conn;
+    bool poll_all;
     
     if (interface == NULL) {
         return DOIP_RESULT_INVALID_PARAM;
     }
     
-    /* Process UDP reception */
-    if ((interface->udp_socket >= 0) && (udp_callback != NULL)) {
-        bytes_received = interface->net_ops->udp_recvfrom(
-            interface->udp_socket,
-            interface->udp_rx_buffer,
-            DOIP_RX_BUFFER_SIZE,
-            src_ip,
-            &src_port
-        );
-        
-        if (bytes_received > 0) {
-            udp_callback(src_ip, src_port, interface->udp_rx_buffer,
+    /* Without a preceding doip_interface_wait() every socket is polled */
+    poll_all = !interface->events_valid;
+    interface->events_valid = false;
+    
+    /* Process UDP reception, draining a burst in one call */
+    if ((interface->udp_socket >= 0) && (udp_callback != NULL) &&
+        (poll_all || interface->udp_ready)) {
+        for (i = 0U; i < DOIP_UDP_DRAIN_MAX; i++) {
+            bytes_received = interface->net_ops->udp_recvfrom(
+                interface->udp_socket,
+                interface->udp_rx_buffer,
+                DOIP_RX_BUFFER_SIZE,
+                &src
+            );
+            
+            if (bytes_received <= 0) {
+                break;
+            }
+            
+            interface->udp_drained_count++;
+            udp_callback(&src, interface->udp_rx_buffer,
                         (uint32_t)bytes_received, user_data);
         }
     }
     
     /* Accept new TCP connections */
-    if (interface->tcp_listen_socket >= 0) {
+    if ((interface->tcp_listen_socket >= 0) &&
+        (poll_all || interface->listen_ready)) {
         int new_socket = interface->net_ops->tcp_accept(
             interface->tcp_listen_socket
         );
         
         if (new_socket >= 0) {
-            int conn_id = find_free_connection(interface);
+            int conn_id = doip_interface_attach_socket(interface, new_socket);
             if (conn_id >= 0) {
-                interface->connections[conn_id].socket_fd = new_socket;
-                interface->connections[conn_id].state = DOIP_CONN_STATE_PENDING_ACTIVATION;
-                interface->connections[conn_id].rx_buffer_used = 0U;
-                interface->connections[conn_id].last_activity_time = 0U; /* Should use actual time */
-                
                 if (connected_callback != NULL) {
                     connected_callback(conn_id, user_data);
                 }
@@ -210,71 +1018,32 @@ doip_result_t doip_interface_process(
     }
     
     /* Process existing TCP connections */
-    for (i = 0U; i < DOIP_MAX_CONNECTIONS; i++) {
-        if (interface->connections[i].socket_fd >= 0) {
-            bytes_received = interface->net_ops->tcp_recv(
-                interface->connections[i].socket_fd,
-                &interface->connections[i].rx_buffer[
-                    interface->connections[i].rx_buffer_used],
-                DOIP_RX_BUFFER_SIZE - interface->connections[i].rx_buffer_used
-            );
-            
-            if (bytes_received > 0) {
-                interface->connections[i].rx_buffer_used += (uint32_t)bytes_received;
-                
-                /* Process complete DoIP messages */
-                while (interface->connections[i].rx_buffer_used >= 8U) {
-                    doip_header_t header;
-                    uint32_t total_message_size;
-                    
-                    if (doip_decode_header(
-                            interface->connections[i].rx_buffer,
-                            interface->connections[i].rx_buffer_used,
-                            &header) != DOIP_RESULT_OK) {
-                        break;
-                    }
-                    
-                    total_message_size = 8U + header.payload_length;
-                    
-                    if (interface->connections[i].rx_buffer_used >= total_message_size) {
-                        /* Complete message received */
-                        if (tcp_callback != NULL) {
-                            tcp_callback((int)i,
-                                       interface->connections[i].rx_buffer,
-                                       total_message_size,
-                                       user_data);
-                        }
-                        
-                        /* Remove processed message from buffer */
-                        if (interface->connections[i].rx_buffer_used > total_message_size) {
-                            (void)memmove(
-                                interface->connections[i].rx_buffer,
-                                &interface->connections[i].rx_buffer[total_message_size],
-                                interface->connections[i].rx_buffer_used - total_message_size
-                            );
-                        }
-                        interface->connections[i].rx_buffer_used -= total_message_size;
-                    } else {
-                        /* Incomplete message, wait for more data */
-                        break;
-                    }
-                }
-            } else if (bytes_received == 0) {
-                /* Connection closed */
-                if (disconnected_callback != NULL) {
-                    disconnected_callback((int)i, user_data);
-                }
-
-                interface->net_ops->close_socket(interface->connections[i].socket_fd);
-                interface->connections[i].socket_fd = INVALID_SOCKET;
-                interface->connections[i].state = DOIP_CONN_STATE_CLOSED;
-                interface->connections[i].rx_buffer_used = 0U;
-            } else {
-                /* Error or would block - continue */
-                /* For non-blocking sockets, EAGAIN/EWOULDBLOCK means no data available */
-                /* Remove immediate disconnection detection here, let inactivity timer handle it */
+    for (i = 0U; i < interface->connection_count; i++) {
+        conn = &interface->connections[i];
+        if (conn->socket_fd < 0) {
+            continue;
+        }
+        
+        if (conn->state == DOIP_CONN_STATE_FINALIZE) {
+            release_connection(interface, i, disconnected_callback, user_data);
+            continue;
+        }
+        
+        /* Drain queued responses first so that replies keep their order */
+        if ((conn->tx_queued > 0U) && (poll_all || conn->tx_ready)) {
+            conn->tx_ready = false;
+            if (tx_flush(interface, conn) < 0) {
+                /* Send failed, the receive path reports the closure */
+                tx_reset(conn);
             }
         }
+        
+        if ((poll_all || conn->rx_ready || conn->rx_pending) &&
+            (conn->tx_queued <= DOIP_TX_PAUSE_THRESHOLD)) {
+            conn->rx_ready = false;
+            process_tcp_connection(interface, i, tcp_callback,
+                                   disconnected_callback, user_data);
+        }
     }
 
     return DOIP_RESULT_OK;
@@ -285,16 +1054,20 @@ void doip_interface_close_connection(
     int connection_id)
 {
     if ((interface == NULL) || (connection_id < 0) ||
-        (connection_id >= (int)DOIP_MAX_CONNECTIONS)) {
+        (connection_id >= (int)interface->connection_count)) {
         return;
     }
     
     if (interface->connections[connection_id].socket_fd >= 0) {
+        abort_stream(interface, (uint32_t)connection_id);
         interface->net_ops->close_socket(
             interface->connections[connection_id].socket_fd
         );
         interface->connections[connection_id].socket_fd = INVALID_SOCKET;
         interface->connections[connection_id].state = DOIP_CONN_STATE_CLOSED;
+        interface->connections[connection_id].rx_read_pos = 0U;
         interface->connections[connection_id].rx_buffer_used = 0U;
+        tx_reset(&interface->connections[connection_id]);
+        free_connection_slot(interface, (uint32_t)connection_id);
     }
 }
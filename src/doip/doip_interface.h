@@ -2,26 +2,82 @@
 #define DOIP_INTERFACE_H
 
 #include "doip_protocol.h"
+#include "doip_config.h"
+
+/* Connection ids are stored in 8 bits, with 0xFF reserved */
+#if (DOIP_MAX_CONNECTIONS > 254U)
+#error "DOIP_MAX_CONNECTIONS must not exceed 254"
+#endif
+#if ((DOIP_DEFAULT_CONNECTIONS == 0U) || (DOIP_DEFAULT_CONNECTIONS > DOIP_MAX_CONNECTIONS))
+#error "DOIP_DEFAULT_CONNECTIONS must be 1 to DOIP_MAX_CONNECTIONS"
+#endif
 
 #define DOIP_UDP_DISCOVERY_PORT    13400U
 #define DOIP_TCP_DATA_PORT         13400U
-#define DOIP_MAX_CONNECTIONS       2U//8U
-#define DOIP_RX_BUFFER_SIZE        4096U
+
+/* Socket readiness events exchanged with socket_select */
+#define DOIP_SOCKET_EVENT_READ     0x01U
+#define DOIP_SOCKET_EVENT_WRITE    0x02U
+
+/* Timeout value that makes socket_select block until a socket is ready */
+#define DOIP_WAIT_FOREVER          0xFFFFFFFFU
+
+/* Per-connection queue for bytes the socket did not accept */
+#ifndef DOIP_TX_QUEUE_SIZE
+#define DOIP_TX_QUEUE_SIZE         2048U
+#endif
+
+/* Reception from a connection pauses while more than this is queued */
+#ifndef DOIP_TX_PAUSE_THRESHOLD
+#define DOIP_TX_PAUSE_THRESHOLD    (DOIP_TX_QUEUE_SIZE / 2U)
+#endif
+
+/* Maximum number of elements in one vectored send */
+#define DOIP_MAX_IOVEC             4U
+
+/* IPv4 address that reaches every host on the local network */
+#define DOIP_IP_ADDR_BROADCAST     0xFFFFFFFFU
+
+/* Buffer size for doip_endpoint_to_string(), "255.255.255.255:65535" */
+#define DOIP_ENDPOINT_STRING_SIZE  22U
+
+/* UDP/TCP endpoint. The address is kept in network byte order, as lwIP and
+ * struct sockaddr_in store it, so backends copy it without conversion. */
+typedef struct {
+    uint32_t ip_addr;
+    uint16_t port;          /* Host byte order */
+} doip_endpoint_t;
+
+/* Scatter-gather element for vectored sends */
+typedef struct {
+    const uint8_t *data;
+    uint32_t length;
+} doip_iovec_t;
 
 /* Network Operations Abstraction */
 typedef struct {
     int (*udp_bind)(uint16_t port);
     int (*udp_sendto)(int sock, const uint8_t *data, uint32_t len, 
-                      const char *ip, uint16_t port);
+                      const doip_endpoint_t *dest);
     int (*udp_recvfrom)(int sock, uint8_t *buf, uint32_t len, 
-                        char *src_ip, uint16_t *src_port);
+                        doip_endpoint_t *src);
     int (*tcp_listen)(uint16_t port);
     int (*tcp_accept)(int listen_sock);
-    int (*tcp_connect)(const char *ip, uint16_t port);
+    int (*tcp_connect)(const doip_endpoint_t *remote);
+    /* TCP sends return the number of bytes accepted, which may be less
+     * than requested, 0 if the socket would block and <0 on error */
     int (*tcp_send)(int sock, const uint8_t *data, uint32_t len);
+    int (*tcp_sendv)(int sock, const doip_iovec_t *iov, uint32_t iovcnt);
     int (*tcp_recv)(int sock, uint8_t *buf, uint32_t len);
     void (*close_socket)(int sock);
-    int (*socket_select)(int max_fd, uint32_t timeout_ms);
+    /* Wait until one of 'count' sockets is ready. events[i] holds the
+     * requested DOIP_SOCKET_EVENT_* mask on entry and the ready mask on
+     * return. Returns the number of ready sockets, 0 on timeout, <0 on error. */
+    int (*socket_select)(const int *sockets, uint8_t *events, uint32_t count,
+                         uint32_t timeout_ms);
+    /* Make a socket_select running in another task return now, or the next
+     * one if none runs. NULL if the backend cannot. */
+    void (*socket_wake)(void);
 } doip_network_ops_t;
 
 /* Connection State */
@@ -33,29 +89,110 @@ typedef enum {
     DOIP_CONN_STATE_FINALIZE
 } doip_connection_state_t;
 
+/* Streaming state of a connection */
+typedef enum {
+    DOIP_STREAM_STATE_NONE = 0,
+    DOIP_STREAM_STATE_ACTIVE,       /* Delivering user data to stream callback */
+    DOIP_STREAM_STATE_DISCARD       /* Dropping the rest of an unwanted message */
+} doip_stream_state_t;
+
+/* Streaming callback events */
+typedef enum {
+    DOIP_STREAM_EVENT_START = 0,    /* Header and SA/TA received, no data yet */
+    DOIP_STREAM_EVENT_DATA,         /* Next chunk of user data */
+    DOIP_STREAM_EVENT_END,          /* Last chunk was delivered */
+    DOIP_STREAM_EVENT_ABORT         /* Connection closed before the end */
+} doip_stream_event_t;
+
+/* Diagnostic message being streamed */
+typedef struct {
+    doip_header_t header;
+    uint16_t source_address;
+    uint16_t target_address;
+    uint32_t user_data_length;      /* Total user data length */
+    uint32_t offset;                /* Offset of the current chunk */
+} doip_stream_info_t;
+
+/* Called for diagnostic messages that do not fit the RX buffer. Returning
+ * false from START or DATA discards the remainder of the message. Other
+ * messages that do not fit get generic header NACK 0x02, or 0x00 and the
+ * connection closed if the pattern is wrong. */
+typedef bool (*doip_tcp_stream_callback_t)(
+    int connection_id,
+    doip_stream_event_t event,
+    const doip_stream_info_t *info,
+    const uint8_t *data,
+    uint32_t length,
+    void *user_data
+);
+
 /* TCP Connection Context */
 typedef struct {
     int socket_fd;
     doip_connection_state_t state;
     uint16_t source_address;
     uint32_t last_activity_time;
-    uint8_t rx_buffer[DOIP_RX_BUFFER_SIZE];
-    uint32_t rx_buffer_used;
+    uint8_t rx_buffer[DOIP_RX_BUFFER_SIZE];   /* Ring buffer */
+    uint32_t rx_read_pos;                    /* Offset of the oldest byte */
+    uint32_t rx_buffer_used;                 /* Bytes stored in the ring */
+    bool rx_ready;
+    bool rx_pending;                         /* Buffered messages held back */
+    doip_stream_state_t stream_state;
+    doip_stream_info_t stream_info;
+    uint32_t stream_remaining;               /* Payload bytes still to consume */
+    uint8_t tx_queue[DOIP_TX_QUEUE_SIZE];     /* Unsent tails, ring buffer */
+    uint32_t tx_read_pos;
+    uint32_t tx_queued;                      /* Bytes waiting in tx_queue */
+    uint32_t tx_high_water;                  /* Largest tx_queued seen */
+    bool tx_ready;
 } doip_tcp_connection_t;
 
+/* Sockets of one wait and their readiness, see doip_interface_wait_prepare() */
+typedef struct {
+    int sockets[DOIP_MAX_CONNECTIONS + 2U];
+    uint8_t events[DOIP_MAX_CONNECTIONS + 2U];
+    uint8_t slots[DOIP_MAX_CONNECTIONS];     /* Connection id per TCP socket */
+    uint32_t count;
+    uint32_t first_conn;                     /* Index of the first TCP socket */
+    uint32_t timeout_ms;
+    int ready;
+} doip_wait_set_t;
+
+/* Transmit queue status of a connection */
+typedef struct {
+    uint32_t queued;                         /* Bytes waiting to be sent */
+    uint32_t free_space;                     /* Bytes that can still be queued */
+    uint32_t high_water;                     /* Largest queue depth seen */
+} doip_tx_status_t;
+
 /* Network Interface Context */
 typedef struct {
     doip_network_ops_t *net_ops;
     int udp_socket;
     int tcp_listen_socket;
-    doip_tcp_connection_t connections[DOIP_MAX_CONNECTIONS];
+    doip_tcp_connection_t *connections;      /* Built-in or caller's pool */
+    uint32_t connection_count;               /* Entries in the pool */
+    doip_tcp_connection_t default_connections[DOIP_DEFAULT_CONNECTIONS];
+    uint8_t free_slots[DOIP_MAX_CONNECTIONS];  /* Stack of closed connection ids */
+    uint32_t free_count;
+    uint32_t max_connections;                /* Runtime limit on open connections */
     uint8_t udp_rx_buffer[DOIP_RX_BUFFER_SIZE];
+    uint8_t rx_linear_buffer[DOIP_RX_BUFFER_SIZE]; /* Messages wrapping the ring end */
+    uint32_t rx_message_count;
+    uint32_t rx_linearized_count;
+    uint32_t udp_drained_count;              /* Datagrams read from the UDP socket */
+    uint32_t tx_backpressure_count;          /* Sends refused with NO_MEMORY */
+    uint32_t tx_overflow_count;              /* Connections closed on overflow */
+    doip_tcp_stream_callback_t stream_callback;
+    void *stream_user_data;
+    bool udp_ready;
+    bool listen_ready;
+    bool events_valid;      /* Readiness from doip_interface_wait() is pending */
 } doip_interface_t;
 
 /* Callback Types */
 typedef void (*doip_udp_rx_callback_t)(
-    const char *src_ip,
-    uint16_t src_port,
+    const doip_endpoint_t *src,
     const uint8_t *data,
     uint32_t length,
     void *user_data
@@ -103,12 +240,18 @@ doip_result_t doip_interface_udp_broadcast(
 
 doip_result_t doip_interface_udp_send(
     doip_interface_t *interface,
-    const char *dest_ip,
-    uint16_t dest_port,
+    const doip_endpoint_t *dest,
     const uint8_t *data,
     uint32_t length
 );
 
+/* Format an endpoint as "a.b.c.d:port", meant for log output only */
+const char *doip_endpoint_to_string(
+    const doip_endpoint_t *endpoint,
+    char *buffer,
+    uint32_t buffer_size
+);
+
 doip_result_t doip_interface_tcp_send(
     doip_interface_t *interface,
     int connection_id,
@@ -116,6 +259,75 @@ doip_result_t doip_interface_tcp_send(
     uint32_t length
 );
 
+void doip_interface_set_max_connections(
+    doip_interface_t *interface,
+    uint32_t max_connections
+);
+
+/* Replace the built-in connection pool, sized for the testers an entity
+ * accepts. Only while no connection is open; count is capped at
+ * DOIP_MAX_CONNECTIONS and the runtime limit is reset to it. */
+doip_result_t doip_interface_set_connection_pool(
+    doip_interface_t *interface,
+    doip_tcp_connection_t *pool,
+    uint32_t count
+);
+
+int doip_interface_attach_socket(
+    doip_interface_t *interface,
+    int socket_fd
+);
+
+void doip_interface_set_stream_callback(
+    doip_interface_t *interface,
+    doip_tcp_stream_callback_t stream_callback,
+    void *user_data
+);
+
+doip_result_t doip_interface_wait(
+    doip_interface_t *interface,
+    uint32_t timeout_ms
+);
+
+/* doip_interface_wait() in three steps for an interface shared between
+ * tasks: prepare and finish read and update the interface and run under
+ * the caller's lock, the select in between only uses the set and runs
+ * without it. Finish skips connections closed in the meantime. */
+doip_result_t doip_interface_wait_prepare(
+    doip_interface_t *interface,
+    uint32_t timeout_ms,
+    doip_wait_set_t *set
+);
+
+doip_result_t doip_interface_wait_select(
+    const doip_interface_t *interface,
+    doip_wait_set_t *set
+);
+
+doip_result_t doip_interface_wait_finish(
+    doip_interface_t *interface,
+    const doip_wait_set_t *set
+);
+
+/* Ends a doip_interface_wait() in another task, so data queued from there
+ * is sent. DOIP_RESULT_NOT_READY without a socket_wake operation. */
+doip_result_t doip_interface_wake(
+    doip_interface_t *interface
+);
+
+doip_result_t doip_interface_tcp_sendv(
+    doip_interface_t *interface,
+    int connection_id,
+    const doip_iovec_t *iov,
+    uint32_t iovcnt
+);
+
+doip_result_t doip_interface_get_tx_status(
+    const doip_interface_t *interface,
+    int connection_id,
+    doip_tx_status_t *status
+);
+
 doip_result_t doip_interface_process(
     doip_interface_t *interface,
     doip_udp_rx_callback_t udp_callback,
@@ -40,15 +40,14 @@ static int lwip_udp_sendto(
     int sock,
     const uint8_t *data,
     uint32_t len,
-    const char *ip,
-    uint16_t port)
+    const doip_endpoint_t *dest)
 {
     struct sockaddr_in dest_addr;
 
     memset(&dest_addr, 0, sizeof(dest_addr));
     dest_addr.sin_family = AF_INET;
-    dest_addr.sin_port = htons(port);
-    inet_pton(AF_INET, ip, &dest_addr.sin_addr);
+    dest_addr.sin_port = htons(dest->port);
+    dest_addr.sin_addr.s_addr = dest->ip_addr;
 
     return sendto(sock, data, len, 0,
                   (struct sockaddr *)&dest_addr, sizeof(dest_addr));
@@ -58,8 +57,7 @@ static int lwip_udp_recvfrom(
     int sock,
     uint8_t *buf,
     uint32_t len,
-    char *src_ip,
-    uint16_t *src_port)
+    doip_endpoint_t *src)
 {
     struct sockaddr_in src_addr;
     socklen_t addr_len = sizeof(src_addr);
@@ -69,8 +67,8 @@ static int lwip_udp_recvfrom(
                    (struct sockaddr *)&src_addr, &addr_len);
 
     if (ret > 0) {
-        inet_ntop(AF_INET, &src_addr.sin_addr, src_ip, 16);
-        *src_port = ntohs(src_addr.sin_port);
+        src->ip_addr = src_addr.sin_addr.s_addr;
+        src->port = ntohs(src_addr.sin_port);
     }
 
     return ret;
@@ -125,7 +123,7 @@ static int lwip_tcp_accept(int listen_sock)
     return client_sock;
 }
 
-static int lwip_tcp_connect(const char *ip, uint16_t port)
+static int lwip_tcp_connect(const doip_endpoint_t *remote)
 {
     int sock;
     struct sockaddr_in addr;
@@ -137,8 +135,8 @@ static int lwip_tcp_connect(const char *ip, uint16_t port)
 
     memset(&addr, 0, sizeof(addr));
     addr.sin_family = AF_INET;
-    addr.sin_port = htons(port);
-    inet_pton(AF_INET, ip, &addr.sin_addr);
+    addr.sin_port = htons(remote->port);
+    addr.sin_addr.s_addr = remote->ip_addr;
 
     if (connect(sock, (struct sockaddr *)&addr, sizeof(addr)) < 0) {
         close(sock);
@@ -148,9 +146,36 @@ static int lwip_tcp_connect(const char *ip, uint16_t port)
     return sock;
 }
 
+/* A full send buffer is not an error, report it as nothing sent */
+static int lwip_send_result(int ret)
+{
+    if ((ret < 0) && ((errno == EWOULDBLOCK) || (errno == EAGAIN))) {
+        return 0;
+    }
+    return ret;
+}
+
 static int lwip_tcp_send(int sock, const uint8_t *data, uint32_t len)
 {
-    return send(sock, data, len, 0);
+    return lwip_send_result(send(sock, data, len, 0));
+}
+
+static int lwip_tcp_sendv(int sock, const doip_iovec_t *iov, uint32_t iovcnt)
+{
+    struct iovec vectors[DOIP_MAX_IOVEC];
+    uint32_t i;
+
+    if (iovcnt > DOIP_MAX_IOVEC) {
+        return -1;
+    }
+
+    /* Gathered into one netconn write, no intermediate copy */
+    for (i = 0U; i < iovcnt; i++) {
+        vectors[i].iov_base = (void *)iov[i].data;
+        vectors[i].iov_len = iov[i].length;
+    }
+
+    return lwip_send_result(writev(sock, vectors, (int)iovcnt));
 }
 
 static int lwip_tcp_recv(int sock, uint8_t *buf, uint32_t len)
@@ -163,6 +188,205 @@ static void lwip_close_socket(int sock)
     close(sock);
 }
 
+/* The wake-up is a UDP socket in every select. On lwIP the tcpip thread
+ * raises a receive event on it, which needs no loopback interface; the
+ * POSIX stand-in of the host build sends it a datagram over 127.0.0.1. */
+#if defined(LWIP_SOCKET)
+#include "lwip/api.h"
+#include "lwip/tcpip.h"
+#include "lwip/priv/sockets_priv.h"
+#define DOIP_LWIP_WAKE_EVENT        1
+#else
+#define DOIP_LWIP_WAKE_EVENT        0
+#endif
+
+/* Opened by the first select, in the waiting task */
+static int s_wake_socket = -1;
+
+#if (DOIP_LWIP_WAKE_EVENT == 1)
+static bool s_wake_posted = false;      /* Event raised or on its way */
+
+static void lwip_wake_open(void)
+{
+    int sock;
+
+    /* Never bound, so nothing is ever received on it */
+    sock = socket(AF_INET, SOCK_DGRAM, 0);
+    if (sock < 0) {
+        return;
+    }
+
+    int flags = fcntl(sock, F_GETFL, 0);
+    fcntl(sock, F_SETFL, flags | O_NONBLOCK);
+
+    s_wake_socket = sock;
+}
+
+/* Netconn event of the wake socket, as lwIP raises it on receive */
+static void lwip_wake_event(enum netconn_evt evt)
+{
+    struct lwip_sock *sock = lwip_socket_dbg_get_socket(s_wake_socket);
+
+    if ((sock != NULL) && (sock->conn != NULL) && (sock->conn->callback != NULL)) {
+        sock->conn->callback(sock->conn, evt, 0U);
+    }
+}
+
+/* tcpip thread: select waiters are only checked there */
+static void lwip_wake_post(void *arg)
+{
+    (void)arg;
+    lwip_wake_event(NETCONN_EVT_RCVPLUS);
+}
+
+static void lwip_socket_wake(void)
+{
+    SYS_ARCH_DECL_PROTECT(lev);
+    bool post;
+
+    if (s_wake_socket < 0) {
+        return;
+    }
+
+    /* One event serves every wake-up until a select has seen it */
+    SYS_ARCH_PROTECT(lev);
+    post = !s_wake_posted;
+    s_wake_posted = true;
+    SYS_ARCH_UNPROTECT(lev);
+
+    if (post && (tcpip_callback(lwip_wake_post, NULL) != ERR_OK)) {
+        SYS_ARCH_PROTECT(lev);
+        s_wake_posted = false;
+        SYS_ARCH_UNPROTECT(lev);
+    }
+}
+
+/* Takes the event back, the next wake-up raises a new one */
+static void lwip_wake_clear(void)
+{
+    SYS_ARCH_DECL_PROTECT(lev);
+
+    SYS_ARCH_PROTECT(lev);
+    s_wake_posted = false;
+    SYS_ARCH_UNPROTECT(lev);
+    lwip_wake_event(NETCONN_EVT_RCVMINUS);
+}
+#else
+static struct sockaddr_in s_wake_addr;
+
+static void lwip_wake_open(void)
+{
+    socklen_t addr_len = sizeof(s_wake_addr);
+    int sock;
+
+    sock = socket(AF_INET, SOCK_DGRAM, 0);
+    if (sock < 0) {
+        return;
+    }
+
+    int flags = fcntl(sock, F_GETFL, 0);
+    fcntl(sock, F_SETFL, flags | O_NONBLOCK);
+
+    memset(&s_wake_addr, 0, sizeof(s_wake_addr));
+    s_wake_addr.sin_family = AF_INET;
+    s_wake_addr.sin_addr.s_addr = htonl(INADDR_LOOPBACK);
+    s_wake_addr.sin_port = 0U;
+
+    /* Port 0 picks a free one, getsockname() tells which */
+    if ((bind(sock, (struct sockaddr *)&s_wake_addr, sizeof(s_wake_addr)) < 0) ||
+        (getsockname(sock, (struct sockaddr *)&s_wake_addr, &addr_len) < 0)) {
+        close(sock);
+        return;
+    }
+
+    s_wake_socket = sock;
+}
+
+static void lwip_socket_wake(void)
+{
+    static const uint8_t token = 0U;
+    int sock = s_wake_socket;
+
+    if (sock >= 0) {
+        (void)sendto(sock, &token, 1U, 0, (struct sockaddr *)&s_wake_addr,
+                     sizeof(s_wake_addr));
+    }
+}
+
+/* One pass serves every wake-up sent so far */
+static void lwip_wake_clear(void)
+{
+    uint8_t token;
+
+    while (recv(s_wake_socket, &token, 1U, 0) > 0) {
+    }
+}
+#endif /* DOIP_LWIP_WAKE_EVENT */
+
+static int lwip_socket_select(
+    const int *sockets,
+    uint8_t *events,
+    uint32_t count,
+    uint32_t timeout_ms)
+{
+    fd_set read_set;
+    fd_set write_set;
+    struct timeval tv;
+    struct timeval *tv_ptr = NULL;
+    int max_fd = -1;
+    uint32_t i;
+    int ret;
+
+    FD_ZERO(&read_set);
+    FD_ZERO(&write_set);
+    for (i = 0U; i < count; i++) {
+        if ((events[i] & DOIP_SOCKET_EVENT_READ) != 0U) {
+            FD_SET(sockets[i], &read_set);
+        }
+        if ((events[i] & DOIP_SOCKET_EVENT_WRITE) != 0U) {
+            FD_SET(sockets[i], &write_set);
+        }
+        if ((events[i] != 0U) && (sockets[i] > max_fd)) {
+            max_fd = sockets[i];
+        }
+    }
+
+    if (s_wake_socket < 0) {
+        lwip_wake_open();
+    }
+    if (s_wake_socket >= 0) {
+        FD_SET(s_wake_socket, &read_set);
+        if (s_wake_socket > max_fd) {
+            max_fd = s_wake_socket;
+        }
+    }
+
+    if (timeout_ms != DOIP_WAIT_FOREVER) {
+        tv.tv_sec = (long)(timeout_ms / 1000U);
+        tv.tv_usec = (long)((timeout_ms % 1000U) * 1000U);
+        tv_ptr = &tv;
+    }
+
+    ret = select(max_fd + 1, &read_set, &write_set, NULL, tv_ptr);
+
+    if ((ret > 0) && (s_wake_socket >= 0) && FD_ISSET(s_wake_socket, &read_set)) {
+        lwip_wake_clear();
+        ret--;
+    }
+
+    for (i = 0U; i < count; i++) {
+        events[i] = 0U;
+        if ((ret > 0) && FD_ISSET(sockets[i], &read_set)) {
+            events[i] |= DOIP_SOCKET_EVENT_READ;
+        }
+        if ((ret > 0) && FD_ISSET(sockets[i], &write_set)) {
+            events[i] |= DOIP_SOCKET_EVENT_WRITE;
+        }
+    }
+
+    return ret;
+}
+
 doip_result_t doip_lwip_adapter_init(void)
 {
     /* Network operations are static, no dynamic initialization needed */
@@ -178,6 +402,9 @@ doip_network_ops_t g_lwip_net_ops = {
     .tcp_accept = lwip_tcp_accept,
     .tcp_connect = lwip_tcp_connect,
     .tcp_send = lwip_tcp_send,
+    .tcp_sendv = lwip_tcp_sendv,
     .tcp_recv = lwip_tcp_recv,
-    .close_socket = lwip_close_socket
+    .close_socket = lwip_close_socket,
+    .socket_select = lwip_socket_select,
+    .socket_wake = lwip_socket_wake
 };
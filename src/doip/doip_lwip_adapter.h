@@ -13,9 +13,25 @@
  * bare-metal environments.
  */
 
+/* Backend selection: BSD socket layer or native netconn API */
+#define DOIP_LWIP_BACKEND_SOCKET    0
+#define DOIP_LWIP_BACKEND_NETCONN   1
+
+#ifndef DOIP_LWIP_BACKEND
+#define DOIP_LWIP_BACKEND           DOIP_LWIP_BACKEND_SOCKET
+#endif
+
 /* lwIP Network Operations Structure */
 extern doip_network_ops_t g_lwip_net_ops;
 
+#if (DOIP_LWIP_BACKEND == DOIP_LWIP_BACKEND_NETCONN)
+/* lwIP netconn Network Operations Structure (doip_lwip_netconn_adapter.c) */
+extern doip_network_ops_t g_lwip_netconn_net_ops;
+#define DOIP_LWIP_NET_OPS           g_lwip_netconn_net_ops
+#else
+#define DOIP_LWIP_NET_OPS           g_lwip_net_ops
+#endif
+
 /**
  * @brief Initialize lwIP adapter
  * @return DOIP_RESULT_OK on success
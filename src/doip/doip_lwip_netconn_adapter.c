@@ -0,0 +1,518 @@
+#include "doip_interface.h"
+#include "doip_lwip_adapter.h"
+
+#if (DOIP_LWIP_BACKEND == DOIP_LWIP_BACKEND_NETCONN)
+
+#include "lwip/api.h"
+#include "lwip/sys.h"
+#include "lwip/pbuf.h"
+#include "lwip/netbuf.h"
+#include "lwip/ip.h"
+#include "lwip/udp.h"
+#include "lwip/ip_addr.h"
+#include "debug_print.h"
+#include <string.h>
+
+/**
+ * @file doip_lwip_netconn_adapter.c
+ * @brief lwIP netconn backend for the DoIP network interface
+ *
+ * Handles are indices into a small netconn table. Received pbuf chains
+ * are kept per handle and copied straight into the caller's buffer, and
+ * readiness is tracked from netconn events instead of the socket layer.
+ *
+ * Received data is not zero-copy: pbuf_copy_partial() moves it into the
+ * RX ring of doip_interface, which hands messages out of the ring in
+ * place and needs them contiguous across pbuf boundaries. That is the
+ * one copy lwip_recv() also makes; passing pbufs through would need a
+ * receive path in doip_interface without the ring.
+ */
+
+#ifndef DOIP_NETCONN_MAX_HANDLES
+#define DOIP_NETCONN_MAX_HANDLES    (DOIP_MAX_CONNECTIONS + 3U)
+#endif
+
+#define DOIP_NETCONN_LISTEN_BACKLOG 5U
+
+typedef struct {
+    struct netconn *conn;
+    struct pbuf *rx_pbuf;       /* Received chain not yet fully consumed */
+    uint16_t rx_offset;         /* Bytes of rx_pbuf already handed out */
+    int16_t rx_events;          /* Pending receive / accept events */
+    bool rx_probe;              /* Read until it would block, see alloc_handle() */
+    bool writable;              /* Cleared by SENDMINUS, set by SENDPLUS */
+} doip_netconn_handle_t;
+
+static doip_netconn_handle_t s_handles[DOIP_NETCONN_MAX_HANDLES];
+static sys_sem_t s_event_sem;
+static bool s_initialized = false;
+static volatile bool s_wake = false;    /* socket_wake() not yet seen by a select */
+
+/* Called from the tcpip thread and from netconn API calls */
+static void netconn_event_callback(struct netconn *conn, enum netconn_evt evt, u16_t len)
+{
+    uint32_t i;
+    SYS_ARCH_DECL_PROTECT(lev);
+
+    (void)len;
+
+#if LWIP_SOCKET
+    /* The socket field is unused by netconn, it carries the handle index */
+    if ((conn->socket < 0) || (conn->socket >= (int)DOIP_NETCONN_MAX_HANDLES) ||
+        (s_handles[conn->socket].conn != conn)) {
+        return;
+    }
+    i = (uint32_t)conn->socket;
+#else
+    for (i = 0U; i < DOIP_NETCONN_MAX_HANDLES; i++) {
+        if (s_handles[i].conn == conn) {
+            break;
+        }
+    }
+    if (i >= DOIP_NETCONN_MAX_HANDLES) {
+        return;
+    }
+#endif
+
+    SYS_ARCH_PROTECT(lev);
+    if ((evt == NETCONN_EVT_RCVPLUS) || (evt == NETCONN_EVT_ERROR)) {
+        s_handles[i].rx_events++;
+    } else if (evt == NETCONN_EVT_RCVMINUS) {
+        if (s_handles[i].rx_events > 0) {
+            s_handles[i].rx_events--;
+        }
+    } else if (evt == NETCONN_EVT_SENDPLUS) {
+        s_handles[i].writable = true;
+    } else {
+        s_handles[i].writable = false;
+    }
+    SYS_ARCH_UNPROTECT(lev);
+
+    if (evt != NETCONN_EVT_RCVMINUS) {
+        sys_sem_signal(&s_event_sem);
+    }
+}
+
+static bool netconn_backend_init(void)
+{
+    if (!s_initialized) {
+        (void)memset(s_handles, 0, sizeof(s_handles));
+        if (sys_sem_new(&s_event_sem, 0U) != ERR_OK) {
+            return false;
+        }
+        s_initialized = true;
+    }
+    return true;
+}
+
+static int alloc_handle(struct netconn *conn)
+{
+    uint32_t i;
+    SYS_ARCH_DECL_PROTECT(lev);
+
+    for (i = 0U; i < DOIP_NETCONN_MAX_HANDLES; i++) {
+        if (s_handles[i].conn == NULL) {
+            SYS_ARCH_PROTECT(lev);
+            s_handles[i].conn = conn;
+            s_handles[i].rx_pbuf = NULL;
+            s_handles[i].rx_offset = 0U;
+            /* Events raised before registration are lost, so selects
+             * report the handle readable until a read would block. The
+             * count starts at 0: a read that would block raises no
+             * RCVMINUS to take back a count it did not consume. */
+            s_handles[i].rx_events = 0;
+            s_handles[i].rx_probe = true;
+            s_handles[i].writable = true;
+#if LWIP_SOCKET
+            conn->socket = (int)i;
+#endif
+            SYS_ARCH_UNPROTECT(lev);
+            return (int)i;
+        }
+    }
+
+    return -1;
+}
+
+static doip_netconn_handle_t *get_handle(int sock)
+{
+    if ((sock < 0) || (sock >= (int)DOIP_NETCONN_MAX_HANDLES) ||
+        (s_handles[sock].conn == NULL)) {
+        return NULL;
+    }
+    return &s_handles[sock];
+}
+
+static int netconn_udp_bind(uint16_t port)
+{
+    struct netconn *conn;
+    int sock;
+
+    if (!netconn_backend_init()) {
+        return -1;
+    }
+
+    conn = netconn_new_with_callback(NETCONN_UDP, netconn_event_callback);
+    if (conn == NULL) {
+        return -1;
+    }
+
+#if IP_SOF_BROADCAST
+    /* Enable broadcast */
+    ip_set_option(conn->pcb.udp, SOF_BROADCAST);
+#endif
+    netconn_set_nonblocking(conn, 1);
+
+    sock = alloc_handle(conn);
+    if ((sock < 0) || (netconn_bind(conn, IP_ADDR_ANY, port) != ERR_OK)) {
+        if (sock >= 0) {
+            s_handles[sock].conn = NULL;
+        }
+        (void)netconn_delete(conn);
+        return -1;
+    }
+
+    return sock;
+}
+
+static int netconn_udp_sendto(
+    int sock,
+    const uint8_t *data,
+    uint32_t len,
+    const doip_endpoint_t *dest)
+{
+    doip_netconn_handle_t *handle = get_handle(sock);
+    struct netbuf *buf;
+    ip_addr_t dest_addr;
+    err_t err;
+
+    if (handle == NULL) {
+        return -1;
+    }
+    ip_addr_set_ip4_u32_val(dest_addr, dest->ip_addr);
+
+    buf = netbuf_new();
+    if (buf == NULL) {
+        return -1;
+    }
+
+    /* Reference the caller's data, lwIP copies it when building the packet */
+    err = netbuf_ref(buf, data, (u16_t)len);
+    if (err == ERR_OK) {
+        err = netconn_sendto(handle->conn, buf, &dest_addr, dest->port);
+    }
+    netbuf_delete(buf);
+
+    return (err == ERR_OK) ? (int)len : -1;
+}
+
+static int netconn_udp_recvfrom(
+    int sock,
+    uint8_t *buf,
+    uint32_t len,
+    doip_endpoint_t *src)
+{
+    doip_netconn_handle_t *handle = get_handle(sock);
+    struct netbuf *nbuf;
+    u16_t copied;
+
+    if (handle == NULL) {
+        return -1;
+    }
+
+    if (netconn_recv_udp_raw_netbuf_flags(handle->conn, &nbuf,
+                                          NETCONN_DONTBLOCK) != ERR_OK) {
+        handle->rx_probe = false;
+        return -1;
+    }
+
+    copied = pbuf_copy_partial(nbuf->p, buf, (u16_t)len, 0U);
+    src->ip_addr = ip_addr_get_ip4_u32(netbuf_fromaddr(nbuf));
+    src->port = netbuf_fromport(nbuf);
+    netbuf_delete(nbuf);
+
+    return (int)copied;
+}
+
+static int netconn_tcp_listen(uint16_t port)
+{
+    struct netconn *conn;
+    int sock;
+
+    if (!netconn_backend_init()) {
+        return -1;
+    }
+
+    conn = netconn_new_with_callback(NETCONN_TCP, netconn_event_callback);
+    if (conn == NULL) {
+        return -1;
+    }
+
+    sock = alloc_handle(conn);
+    if ((sock < 0) ||
+        (netconn_bind(conn, IP_ADDR_ANY, port) != ERR_OK) ||
+        (netconn_listen_with_backlog(conn, DOIP_NETCONN_LISTEN_BACKLOG) != ERR_OK)) {
+        if (sock >= 0) {
+            s_handles[sock].conn = NULL;
+        }
+        (void)netconn_delete(conn);
+        return -1;
+    }
+
+    /* Accept returns ERR_WOULDBLOCK instead of blocking */
+    netconn_set_nonblocking(conn, 1);
+
+    return sock;
+}
+
+static int netconn_tcp_accept(int listen_sock)
+{
+    doip_netconn_handle_t *handle = get_handle(listen_sock);
+    struct netconn *new_conn;
+    int sock;
+
+    if (handle == NULL) {
+        return -1;
+    }
+
+    if (netconn_accept(handle->conn, &new_conn) != ERR_OK) {
+        handle->rx_probe = false;
+        return -1;
+    }
+
+    sock = alloc_handle(new_conn);
+    if (sock < 0) {
+        (void)netconn_close(new_conn);
+        (void)netconn_delete(new_conn);
+        return -1;
+    }
+
+    netconn_set_nonblocking(new_conn, 1);
+    return sock;
+}
+
+static int netconn_tcp_connect(const doip_endpoint_t *remote)
+{
+    struct netconn *conn;
+    ip_addr_t addr;
+    int sock;
+
+    if (!netconn_backend_init()) {
+        return -1;
+    }
+    ip_addr_set_ip4_u32_val(addr, remote->ip_addr);
+
+    conn = netconn_new_with_callback(NETCONN_TCP, netconn_event_callback);
+    if (conn == NULL) {
+        return -1;
+    }
+
+    sock = alloc_handle(conn);
+    if ((sock < 0) || (netconn_connect(conn, &addr, remote->port) != ERR_OK)) {
+        if (sock >= 0) {
+            s_handles[sock].conn = NULL;
+        }
+        (void)netconn_delete(conn);
+        return -1;
+    }
+
+    netconn_set_nonblocking(conn, 1);
+    return sock;
+}
+
+static int netconn_tcp_sendv(int sock, const doip_iovec_t *iov, uint32_t iovcnt)
+{
+    doip_netconn_handle_t *handle = get_handle(sock);
+    struct netvector vectors[DOIP_MAX_IOVEC];
+    size_t written = 0U;
+    uint32_t i;
+    err_t err;
+
+    if ((handle == NULL) || (iovcnt > DOIP_MAX_IOVEC)) {
+        return -1;
+    }
+
+    for (i = 0U; i < iovcnt; i++) {
+        vectors[i].ptr = iov[i].data;
+        vectors[i].len = iov[i].length;
+    }
+
+    /* One write for all vectors: lwIP passes TCP_WRITE_FLAG_MORE for every
+     * vector but the last, so header and payload share segments */
+    err = netconn_write_vectors_partly(handle->conn, vectors, (u16_t)iovcnt,
+                                       NETCONN_COPY | NETCONN_DONTBLOCK,
+                                       &written);
+    if (err == ERR_WOULDBLOCK) {
+        return 0;
+    }
+    if (err != ERR_OK) {
+        return -1;
+    }
+
+    return (int)written;
+}
+
+static int netconn_tcp_send(int sock, const uint8_t *data, uint32_t len)
+{
+    doip_iovec_t iov;
+
+    iov.data = data;
+    iov.length = len;
+    return netconn_tcp_sendv(sock, &iov, 1U);
+}
+
+static int netconn_tcp_recv(int sock, uint8_t *buf, uint32_t len)
+{
+    doip_netconn_handle_t *handle = get_handle(sock);
+    u16_t copied;
+    err_t err;
+
+    if (handle == NULL) {
+        return -1;
+    }
+
+    if (handle->rx_pbuf == NULL) {
+        err = netconn_recv_tcp_pbuf_flags(handle->conn, &handle->rx_pbuf,
+                                          NETCONN_DONTBLOCK);
+        if (err == ERR_WOULDBLOCK) {
+            handle->rx_probe = false;
+            return -1;
+        }
+        if (err != ERR_OK) {
+            /* ERR_CLSD or a connection error: report as closed */
+            handle->rx_pbuf = NULL;
+            return 0;
+        }
+        handle->rx_offset = 0U;
+    }
+
+    /* Copy from the pbuf chain directly into the reassembly buffer */
+    if (len > 0xFFFFU) {
+        len = 0xFFFFU;
+    }
+    copied = pbuf_copy_partial(handle->rx_pbuf, buf, (u16_t)len, handle->rx_offset);
+    handle->rx_offset = (uint16_t)(handle->rx_offset + copied);
+
+    if (handle->rx_offset >= handle->rx_pbuf->tot_len) {
+        (void)pbuf_free(handle->rx_pbuf);
+        handle->rx_pbuf = NULL;
+        handle->rx_offset = 0U;
+    }
+
+    return (int)copied;
+}
+
+static void netconn_close_socket(int sock)
+{
+    doip_netconn_handle_t *handle = get_handle(sock);
+    struct netconn *conn;
+
+    if (handle == NULL) {
+        return;
+    }
+
+    conn = handle->conn;
+    if (handle->rx_pbuf != NULL) {
+        (void)pbuf_free(handle->rx_pbuf);
+    }
+    handle->rx_pbuf = NULL;
+    handle->conn = NULL;
+
+    if (NETCONNTYPE_GROUP(netconn_type(conn)) == NETCONN_TCP) {
+        (void)netconn_close(conn);
+    }
+    (void)netconn_delete(conn);
+}
+
+static int netconn_socket_select(
+    const int *sockets,
+    uint8_t *events,
+    uint32_t count,
+    uint32_t timeout_ms)
+{
+    doip_netconn_handle_t *handle;
+    uint8_t requested[DOIP_MAX_CONNECTIONS + 2U];
+    uint32_t start = sys_now();
+    uint32_t elapsed;
+    uint32_t wait_ms;
+    uint32_t i;
+    int ready;
+
+    if (count > (DOIP_MAX_CONNECTIONS + 2U)) {
+        return -1;
+    }
+    (void)memcpy(requested, events, count);
+
+    /* The semaphore counts every event of every netconn, so a signal may
+     * be stale or for a socket not asked for: check again after each one
+     * until something is ready, a wake-up came or the deadline passed */
+    for (;;) {
+        ready = 0;
+        for (i = 0U; i < count; i++) {
+            handle = get_handle(sockets[i]);
+            events[i] = 0U;
+            if (handle == NULL) {
+                continue;
+            }
+            if (((requested[i] & DOIP_SOCKET_EVENT_READ) != 0U) &&
+                ((handle->rx_events > 0) || handle->rx_probe ||
+                 (handle->rx_pbuf != NULL))) {
+                events[i] |= DOIP_SOCKET_EVENT_READ;
+            }
+            if (((requested[i] & DOIP_SOCKET_EVENT_WRITE) != 0U) && handle->writable) {
+                events[i] |= DOIP_SOCKET_EVENT_WRITE;
+            }
+            if (events[i] != 0U) {
+                ready++;
+            }
+        }
+
+        if ((ready > 0) || s_wake || (timeout_ms == 0U)) {
+            break;
+        }
+
+        /* sys_arch_sem_wait() treats 0 as "wait forever" */
+        if (timeout_ms == DOIP_WAIT_FOREVER) {
+            wait_ms = 0U;
+        } else {
+            elapsed = sys_now() - start;
+            if (elapsed >= timeout_ms) {
+                break;
+            }
+            wait_ms = timeout_ms - elapsed;
+        }
+        (void)sys_arch_sem_wait(&s_event_sem, wait_ms);
+    }
+
+    /* A wake-up is for the wait that returns next, whatever ended it */
+    s_wake = false;
+
+    return ready;
+}
+
+/* Any task: the flag ends the select loop, the semaphore its wait */
+static void netconn_socket_wake(void)
+{
+    if (s_initialized) {
+        s_wake = true;
+        sys_sem_signal(&s_event_sem);
+    }
+}
+
+/* Netconn network operations structure */
+doip_network_ops_t g_lwip_netconn_net_ops = {
+    .udp_bind = netconn_udp_bind,
+    .udp_sendto = netconn_udp_sendto,
+    .udp_recvfrom = netconn_udp_recvfrom,
+    .tcp_listen = netconn_tcp_listen,
+    .tcp_accept = netconn_tcp_accept,
+    .tcp_connect = netconn_tcp_connect,
+    .tcp_send = netconn_tcp_send,
+    .tcp_sendv = netconn_tcp_sendv,
+    .tcp_recv = netconn_tcp_recv,
+    .close_socket = netconn_close_socket,
+    .socket_select = netconn_socket_select,
+    .socket_wake = netconn_socket_wake
+};
+
+#endif /* DOIP_LWIP_BACKEND == DOIP_LWIP_BACKEND_NETCONN */
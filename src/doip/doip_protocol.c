@@ -72,7 +72,7 @@ doip_result_t doip_decode_header(
     return DOIP_RESULT_OK;
 }
 
-bool doip_validate_header(const doip_header_t *header)
+bool doip_validate_protocol_version(const doip_header_t *header)
 {
     bool is_valid = false;
     
@@ -87,11 +87,19 @@ bool doip_validate_header(const doip_header_t *header)
         } else {
             is_valid = false;
         }
-        
-        /* Check payload length is reasonable */
-        if (is_valid && (header->payload_length > DOIP_MAX_PAYLOAD_SIZE)) {
-            is_valid = false;
-        }
+    }
+    
+    return is_valid;
+}
+
+bool doip_validate_header(const doip_header_t *header)
+{
+    bool is_valid = doip_validate_protocol_version(header);
+    
+    /* Check payload length is reasonable; larger diagnostic messages are
+     * only accepted through the streaming path */
+    if (is_valid && (header->payload_length > DOIP_MAX_PAYLOAD_SIZE)) {
+        is_valid = false;
     }
     
     return is_valid;
@@ -111,7 +119,7 @@ doip_result_t doip_encode_vehicle_id_response(
     }
     
     /* Total: 8 (header) + 33 (payload) */
-    if (buffer_size < 41U) {
+    if (buffer_size < DOIP_VEHICLE_ID_RESPONSE_SIZE) {
         return DOIP_RESULT_BUFFER_TOO_SMALL;
     }
     
@@ -194,9 +202,10 @@ doip_result_t doip_decode_routing_activation_req(
         return DOIP_RESULT_INVALID_PARAM;
     }
     
-    //if (payload_length < 11U) {
-    //    return DOIP_RESULT_INVALID_FORMAT;
-    //}
+    /* The OEM specific field is optional */
+    if (payload_length < 7U) {
+        return DOIP_RESULT_INVALID_FORMAT;
+    }
     
     request->source_address = read_be16(&payload[0]);
     request->activation_type = payload[2];
@@ -247,13 +256,75 @@ doip_result_t doip_encode_routing_activation_res(
     return DOIP_RESULT_OK;
 }
 
+doip_result_t doip_encode_diagnostic_message_header(
+    uint16_t source_address,
+    uint16_t target_address,
+    uint32_t user_data_length,
+    uint8_t *buffer,
+    uint32_t buffer_size,
+    uint32_t *encoded_length)
+{
+    doip_header_t header;
+    
+    if ((buffer == NULL) || (encoded_length == NULL)) {
+        return DOIP_RESULT_INVALID_PARAM;
+    }
+    
+    if (buffer_size < DOIP_DIAG_MESSAGE_HEADER_SIZE) {
+        return DOIP_RESULT_BUFFER_TOO_SMALL;
+    }
+    
+    header.protocol_version = DOIP_PROTOCOL_VERSION_2019;
+    header.inverse_protocol_version = DOIP_INVERSE_VERSION_2019;
+    header.payload_type = DOIP_PAYLOAD_TYPE_DIAG_MESSAGE;
+    header.payload_length = 4U + user_data_length;
+    
+    if (doip_encode_header(&header, buffer, buffer_size) != DOIP_RESULT_OK) {
+        return DOIP_RESULT_ERROR;
+    }
+    
+    write_be16(&buffer[8], source_address);
+    write_be16(&buffer[10], target_address);
+    
+    *encoded_length = DOIP_DIAG_MESSAGE_HEADER_SIZE;
+    return DOIP_RESULT_OK;
+}
+
+doip_result_t doip_finish_diagnostic_message_frame(
+    uint16_t source_address,
+    uint16_t target_address,
+    uint8_t *frame,
+    uint32_t frame_size,
+    uint32_t user_data_length,
+    uint32_t *frame_length)
+{
+    uint32_t header_length;
+    
+    if ((frame == NULL) || (frame_length == NULL)) {
+        return DOIP_RESULT_INVALID_PARAM;
+    }
+    
+    if ((frame_size < DOIP_DIAG_MESSAGE_HEADER_SIZE) ||
+        (user_data_length > (frame_size - DOIP_DIAG_MESSAGE_HEADER_SIZE))) {
+        return DOIP_RESULT_BUFFER_TOO_SMALL;
+    }
+    
+    /* The user data is already in place, only the headers are written */
+    if (doip_encode_diagnostic_message_header(source_address, target_address,
+            user_data_length, frame, frame_size, &header_length) != DOIP_RESULT_OK) {
+        return DOIP_RESULT_ERROR;
+    }
+    
+    *frame_length = header_length + user_data_length;
+    return DOIP_RESULT_OK;
+}
+
 doip_result_t doip_encode_diagnostic_message(
     const doip_diagnostic_message_t *message,
     uint8_t *buffer,
     uint32_t buffer_size,
     uint32_t *encoded_length)
 {
-    doip_header_t header;
     uint32_t offset = 0U;
     uint32_t total_length;
     
@@ -265,25 +336,16 @@ doip_result_t doip_encode_diagnostic_message(
         return DOIP_RESULT_INVALID_PARAM;
     }
     
-    total_length = 8U + 4U + message->user_data_length;
+    total_length = DOIP_DIAG_MESSAGE_HEADER_SIZE + message->user_data_length;
     if (buffer_size < total_length) {
         return DOIP_RESULT_BUFFER_TOO_SMALL;
     }
     
-    header.protocol_version = DOIP_PROTOCOL_VERSION_2019;
-    header.inverse_protocol_version = DOIP_INVERSE_VERSION_2019;
-    header.payload_type = DOIP_PAYLOAD_TYPE_DIAG_MESSAGE;
-    header.payload_length = 4U + message->user_data_length;
-    
-    if (doip_encode_header(&header, buffer, buffer_size) != DOIP_RESULT_OK) {
+    if (doip_encode_diagnostic_message_header(message->source_address,
+            message->target_address, message->user_data_length,
+            buffer, buffer_size, &offset) != DOIP_RESULT_OK) {
         return DOIP_RESULT_ERROR;
     }
-    offset = 8U;
-    
-    write_be16(&buffer[offset], message->source_address);
-    offset += 2U;
-    write_be16(&buffer[offset], message->target_address);
-    offset += 2U;
     
     (void)memcpy(&buffer[offset], message->user_data, message->user_data_length);
     offset += message->user_data_length;
@@ -66,6 +66,14 @@
 #define DOIP_EID_LENGTH                             6U
 #define DOIP_GID_LENGTH                             6U
 
+/* Generic header (8) + source/target address (4) of a diagnostic message */
+#define DOIP_DIAG_MESSAGE_HEADER_SIZE               12U
+
+/* Vehicle identification response / announcement frame and field offsets */
+#define DOIP_VEHICLE_ID_RESPONSE_SIZE               41U
+#define DOIP_VEHICLE_ID_VIN_OFFSET                  8U
+#define DOIP_VEHICLE_ID_EID_OFFSET                  27U
+
 /* Result Codes */
 typedef enum {
     DOIP_RESULT_OK = 0,
@@ -168,6 +176,26 @@ doip_result_t doip_encode_routing_activation_res(
     uint32_t *encoded_length
 );
 
+doip_result_t doip_encode_diagnostic_message_header(
+    uint16_t source_address,
+    uint16_t target_address,
+    uint32_t user_data_length,
+    uint8_t *buffer,
+    uint32_t buffer_size,
+    uint32_t *encoded_length
+);
+
+/* Complete a frame whose user data was written in place at offset
+ * DOIP_DIAG_MESSAGE_HEADER_SIZE by filling in the headers in front of it */
+doip_result_t doip_finish_diagnostic_message_frame(
+    uint16_t source_address,
+    uint16_t target_address,
+    uint8_t *frame,
+    uint32_t frame_size,
+    uint32_t user_data_length,
+    uint32_t *frame_length
+);
+
 doip_result_t doip_encode_diagnostic_message(
     const doip_diagnostic_message_t *message,
     uint8_t *buffer,
@@ -199,4 +227,6 @@ doip_result_t doip_encode_diag_message_ack(
 
 bool doip_validate_header(const doip_header_t *header);
 
+bool doip_validate_protocol_version(const doip_header_t *header);
+
 #endif /* DOIP_PROTOCOL_H */
@@ -1,6 +1,7 @@
 #include "doip_task_example.h"
 #include "doip_lwip_adapter.h"
 #include "uds_services.h"
+#include "uds_download_flash.h"
 #include "doip_log.h"
 #include <string.h>
 #include <stdio.h>
@@ -51,6 +52,7 @@ extern err_t ethif_ethernetif_init(struct netif *netif);
 /* Global Variables */
 static doip_entity_t g_doip_entity;
 static doip_interface_t g_doip_interface;
+static doip_tcp_connection_t g_doip_connections[DOIP_ENTITY_MAX_TESTERS + 1U];
 static uds_context_t g_uds_context;
 
 /* Network interfaces global variables for DoIP */
@@ -58,8 +60,77 @@ struct netif doip_network_interfaces[ETHIF_NUMBER];
 
 TaskHandle_t g_doip_entity_task_handle = NULL;
 TaskHandle_t g_doip_tester_task_handle = NULL;
+TaskHandle_t g_doip_uds_task_handle = NULL;
 SemaphoreHandle_t g_doip_mutex = NULL;
 
+/* UDS request handed to the worker task. The entity task fills it while
+ * 'busy' is clear, the worker owns it until it clears 'busy'; 'busy' and
+ * 'pending' are only touched under the DoIP lock. */
+typedef struct {
+    bool busy;
+    uint16_t tester_address;
+    uint32_t length;
+    uint8_t request[DOIP_MAX_PAYLOAD_SIZE];
+    uint8_t *frame;                     /* Pooled TX frame for the response */
+    uint32_t capacity;
+    uds_pending_t pending;
+} uds_job_t;
+
+static uds_job_t g_uds_job;
+static QueueHandle_t g_uds_job_queue = NULL;
+
+/* Download services of the entity's UDS server, owned by the worker */
+static flash_t g_flash;
+static uds_service_table_t g_uds_services;
+static uds_download_t g_uds_download;
+static uds_download_flash_t g_uds_download_flash;
+static uds_download_memory_t g_uds_download_memory;
+static const uds_download_region_t g_uds_download_regions[] = {
+    { DOIP_DOWNLOAD_BANK_ADDRESS, FLASH_BANK_SIZE }
+};
+
+#if (DOIP_GATEWAY_NODE_COUNT > 0)
+/* Request copied out of the RX buffer for a node */
+typedef struct {
+    uint16_t tester_address;
+    uint32_t length;
+    uint8_t data[DOIP_GATEWAY_REQUEST_SIZE];
+} gateway_request_t;
+
+/* Internal node behind the gateway */
+typedef struct {
+    uint16_t logical_address;
+    QueueHandle_t queue;
+    uds_context_t uds_context;
+    TaskHandle_t task;
+} gateway_node_t;
+
+static gateway_node_t g_gateway_nodes[DOIP_GATEWAY_NODE_COUNT];
+#endif /* DOIP_GATEWAY_NODE_COUNT */
+
+/* Free running millisecond clock for the entity timers */
+static uint32_t doip_now_ms(void)
+{
+    return (uint32_t)xTaskGetTickCount() * (uint32_t)portTICK_PERIOD_MS;
+}
+
+/* Keep the tester waiting while a UDS job runs past P2 */
+static void uds_job_poll(doip_entity_t *entity)
+{
+    uint8_t nrc[3];
+    uds_response_t response = {
+        .buffer = nrc,
+        .max_length = sizeof(nrc),
+        .actual_length = 0U
+    };
+
+    if (g_uds_job.busy &&
+        uds_pending_poll(&g_uds_job.pending, doip_now_ms(), &response)) {
+        (void)doip_entity_send_diagnostic_response(entity,
+            g_uds_job.tester_address, nrc, response.actual_length);
+    }
+}
+
 /* Task Implementation */
 void doip_entity_task(void *pvParameters)
 {
@@ -79,15 +150,17 @@ void doip_entity_task(void *pvParameters)
         .general_inactivity_time = 300000U,
         .initial_inactivity_time = 2000U,
         .alive_check_time = 500U,
-        .max_tester_connections = 2U
+        .max_tester_connections = DOIP_ENTITY_MAX_TESTERS
     };
     
     /* Initialize DoIP Interface */
-    if (doip_interface_init(&g_doip_interface, &g_lwip_net_ops) != DOIP_RESULT_OK) {
+    if (doip_interface_init(&g_doip_interface, &DOIP_LWIP_NET_OPS) != DOIP_RESULT_OK) {
         DOIP_LOG_ERROR("Task", "Interface initialization failed");
         vTaskDelete(NULL);
         return;
     }
+    (void)doip_interface_set_connection_pool(&g_doip_interface, g_doip_connections,
+        (uint32_t)(sizeof(g_doip_connections) / sizeof(g_doip_connections[0])));
     
     /* Initialize Entity */
     if (doip_entity_init(&g_doip_entity, &config, &g_doip_interface) != DOIP_RESULT_OK) {
@@ -103,18 +176,98 @@ void doip_entity_task(void *pvParameters)
         return;
     }
     
+#if (DOIP_GATEWAY_NODE_COUNT > 0)
+    /* Each node answers its own address and the functional one */
+    for (uint32_t i = 0U; i < (uint32_t)DOIP_GATEWAY_NODE_COUNT; i++) {
+        (void)doip_entity_add_route(&g_doip_entity,
+                                    g_gateway_nodes[i].logical_address,
+                                    doip_gateway_route_handler,
+                                    &g_gateway_nodes[i]);
+        (void)doip_entity_add_route(&g_doip_entity,
+                                    DOIP_GATEWAY_FUNCTIONAL_ADDRESS,
+                                    doip_gateway_route_handler,
+                                    &g_gateway_nodes[i]);
+    }
+#endif /* DOIP_GATEWAY_NODE_COUNT */
+
+    /* Oversized TransferData goes straight to the download. Without one
+     * oversized messages stay NACKed as too large. */
+    if (g_uds_context.download != NULL) {
+        doip_entity_set_uds_stream_callback(&g_doip_entity,
+                                            doip_entity_uds_stream_handler);
+    }
+
     DOIP_LOG_INFO("Task", "Entity ready at address 0x%04X", config.logical_address);
 
     last_wake_time = xTaskGetTickCount();
+
+    /* Entity timers run on the tick clock, set it before the first accept */
+    if (doip_lock(pdMS_TO_TICKS(100)) == pdTRUE) {
+        doip_entity_run_timers(&g_doip_entity, doip_now_ms());
+        doip_unlock();
+    }
+
+#if (DOIP_ENTITY_EVENT_DRIVEN == 1)
+    /* Event-driven loop, falls back to the polled loop without socket_select */
+    for (;;) {
+        doip_wait_set_t wait_set;
+        uint32_t timeout_ms;
+        uint32_t pending_ms;
+        doip_result_t result;
+
+        /* A failing lock or select returns at once, yield a tick on those
+         * paths instead of spinning */
+        if (doip_lock(pdMS_TO_TICKS(100)) != pdTRUE) {
+            vTaskDelay(1);
+            continue;
+        }
+        timeout_ms = doip_entity_get_next_timeout(&g_doip_entity);
+        pending_ms = uds_pending_timeout(&g_uds_job.pending, doip_now_ms());
+        if (pending_ms < timeout_ms) {
+            timeout_ms = pending_ms;
+        }
+        /* Responses queued by other tasks cannot end the wait without
+         * socket_wake, they go out within a cycle instead */
+        if ((DOIP_LWIP_NET_OPS.socket_wake == NULL) &&
+            (timeout_ms > (uint32_t)DOIP_ENTITY_CYCLE_TIME_MS)) {
+            timeout_ms = (uint32_t)DOIP_ENTITY_CYCLE_TIME_MS;
+        }
+        /* The socket list is taken under the lock, other tasks queue
+         * responses and change connection state while the select runs */
+        result = doip_interface_wait_prepare(&g_doip_interface, timeout_ms, &wait_set);
+        doip_unlock();
+        if (result == DOIP_RESULT_NOT_READY) {
+            break;
+        }
+
+        /* Sleep until a socket is readable, the nearest timer is due or a
+         * response pending has to go out */
+        result = doip_interface_wait_select(&g_doip_interface, &wait_set);
+        if ((result != DOIP_RESULT_OK) && (result != DOIP_RESULT_TIMEOUT)) {
+            vTaskDelay(1);
+        }
+
+        if (doip_lock(pdMS_TO_TICKS(100)) == pdTRUE) {
+            (void)doip_interface_wait_finish(&g_doip_interface, &wait_set);
+            doip_entity_run_timers(&g_doip_entity, doip_now_ms());
+            doip_entity_process(&g_doip_entity, doip_entity_uds_rx_handler);
+            uds_job_poll(&g_doip_entity);
+            doip_unlock();
+        } else {
+            vTaskDelay(1);
+        }
+    }
+#endif /* DOIP_ENTITY_EVENT_DRIVEN */
     
     /* Main processing loop */
     for (;;) {
         if (doip_lock(pdMS_TO_TICKS(100)) == pdTRUE) {
+            /* Fire due timers from the real time, not the nominal cycle */
+            doip_entity_run_timers(&g_doip_entity, doip_now_ms());
+            
             /* Process DoIP messages */
             doip_entity_process(&g_doip_entity, doip_entity_uds_rx_handler);
-            
-            /* Update timers */
-            doip_entity_update_timers(&g_doip_entity, DOIP_ENTITY_CYCLE_TIME_MS);
+            uds_job_poll(&g_doip_entity);
             
             doip_unlock();
         }
@@ -131,33 +284,310 @@ void doip_entity_uds_rx_handler(
     uint32_t length,
     void *user_data)
 {
+    doip_entity_t *entity = (doip_entity_t*)user_data;
+    uds_job_t *job = &g_uds_job;
+    uint8_t nrc[3];
+
+    (void)target_addr;
+
     DOIP_LOG_INFO("UDS", "Request from 0x%04X: SID=0x%02X", source_addr, data[0]);
 
-    /* Process UDS request */
-    uds_request_t request = {
-        .sid = data[0],
-        .data = &data[1],
-        .length = length - 1U
-    };
+    if (job->busy) {
+        /* One request executes at a time, the tester repeats this one */
+        uds_response_t busy = {
+            .buffer = nrc,
+            .max_length = sizeof(nrc),
+            .actual_length = 0U
+        };
+        uds_send_negative_response(data[0], UDS_NRC_BUSY_REPEAT_REQUEST, &busy);
+        (void)doip_entity_send_diagnostic_response(entity, source_addr, nrc,
+                                                   busy.actual_length);
+        return;
+    }
 
-    uint8_t response_buffer[256];
-    uds_response_t response = {
-        .buffer = response_buffer,
-        .max_length = sizeof(response_buffer),
-        .actual_length = 0U
-    };
+    if (length > sizeof(job->request)) {
+        DOIP_LOG_INFO("UDS", "Request from 0x%04X dropped, %u bytes",
+                      source_addr, (unsigned int)length);
+        return;
+    }
+
+    /* The worker builds the response right behind the DoIP header */
+    job->frame = doip_entity_alloc_response_frame(entity, &job->capacity);
+    if (job->frame == NULL) {
+        DOIP_LOG_INFO("UDS", "Request from 0x%04X dropped, no TX frame", source_addr);
+        return;
+    }
+
+    /* The RX buffer is reused by the next process call */
+    (void)memcpy(job->request, data, length);
+    job->length = length;
+    job->tester_address = source_addr;
+    uds_pending_start(&job->pending, data[0], doip_now_ms());
+    job->busy = true;
+
+    if (xQueueSend(g_uds_job_queue, &job, 0) != pdPASS) {
+        uds_pending_stop(&job->pending);
+        job->busy = false;
+        doip_entity_release_response_frame(entity, job->frame);
+    }
+}
+
+bool doip_entity_uds_stream_handler(
+    doip_stream_event_t event,
+    uint16_t source_addr,
+    uint16_t target_addr,
+    uint32_t total_length,
+    uint32_t offset,
+    const uint8_t *data,
+    uint32_t length,
+    void *user_data)
+{
+    doip_entity_t *entity = (doip_entity_t *)user_data;
+    uds_job_t *job = &g_uds_job;
+    uds_response_t response;
+
+    (void)target_addr;
+    (void)offset;
+
+    /* Runs in the entity task under the DoIP lock. The busy job keeps the
+     * worker off the download until the end or abort event. */
+    switch (event) {
+    case DOIP_STREAM_EVENT_START:
+        if (job->busy) {
+            return false;
+        }
+        job->frame = doip_entity_alloc_response_frame(entity, &job->capacity);
+        if (job->frame == NULL) {
+            return false;
+        }
+        if (!uds_download_stream_start(&g_uds_context, total_length)) {
+            doip_entity_release_response_frame(entity, job->frame);
+            return false;
+        }
+        job->tester_address = source_addr;
+        job->busy = true;
+        break;
+
+    case DOIP_STREAM_EVENT_DATA:
+        /* A full staging buffer waits for the write before it, which holds
+         * back reading the socket like TCP flow control */
+        uds_download_stream_data(&g_uds_context, data, length);
+        break;
+
+    case DOIP_STREAM_EVENT_END:
+        response.buffer = job->frame;
+        response.max_length = job->capacity;
+        response.actual_length = 0U;
+        if (uds_download_stream_end(&g_uds_context, &response)) {
+            (void)doip_entity_send_response_frame(entity, job->tester_address,
+                                                  job->frame,
+                                                  response.actual_length);
+        } else {
+            doip_entity_release_response_frame(entity, job->frame);
+        }
+        job->busy = false;
+        break;
+
+    default:
+        uds_download_stream_abort(&g_uds_context);
+        doip_entity_release_response_frame(entity, job->frame);
+        job->busy = false;
+        break;
+    }
+
+    return true;
+}
+
+void doip_uds_worker_task(void *pvParameters)
+{
+    uds_job_t *job;
+    doip_result_t result;
+    TickType_t wait;
+    bool respond;
+    bool outstanding;
+
+    (void)pvParameters;
+
+    for (;;) {
+        /* Staged download blocks move on to flash and sectors are erased
+         * ahead between requests, below the entity and network tasks. The
+         * poll does not block; it takes the lock since a streamed
+         * TransferData fills the staging buffers from the entity task. */
+        while (doip_lock(portMAX_DELAY) != pdTRUE) {
+        }
+        outstanding = g_uds_job.busy || uds_download_poll(&g_uds_download);
+        doip_unlock();
+        wait = outstanding ? (TickType_t)DOIP_DOWNLOAD_POLL_TICKS : portMAX_DELAY;
+        if (xQueueReceive(g_uds_job_queue, &job, wait) != pdPASS) {
+            continue;
+        }
+
+        uds_request_t request = {
+            .sid = job->request[0],
+            .data = &job->request[1],
+            .length = job->length - 1U
+        };
+        uds_response_t response = {
+            .buffer = job->frame,
+            .max_length = job->capacity,
+            .actual_length = 0U
+        };
+
+        /* Runs without the DoIP lock, so reception, timers and other
+         * testers carry on however long the service takes */
+        respond = uds_process_request(&g_uds_context, &request, &response);
+
+        /* Completion is handed back under the lock, so no response
+         * pending can follow the final response */
+        while (doip_lock(portMAX_DELAY) != pdTRUE) {
+        }
+        /* After a response pending the tester waits for the final
+         * response, suppressed or not */
+        if (response.suppressed && (job->pending.sent_count > 0U)) {
+            respond = true;
+        }
+        uds_pending_stop(&job->pending);
+        if (respond) {
+            /* The frame is released either way */
+            result = doip_entity_send_response_frame(&g_doip_entity,
+                job->tester_address, job->frame, response.actual_length);
+            if (result == DOIP_RESULT_NO_MEMORY) {
+                /* Tester is not reading, its requests are held back until the
+                 * TX queue drains, so this only happens for oversized bursts */
+                DOIP_LOG_INFO("UDS", "Response to 0x%04X dropped, TX queue full",
+                              job->tester_address);
+            }
+        } else {
+            doip_entity_release_response_frame(&g_doip_entity, job->frame);
+        }
+        job->busy = false;
+        doip_unlock();
 
-    if (uds_process_request(&g_uds_context, &request, &response)) {
-        /* Send UDS response via DoIP */
-        doip_entity_send_diagnostic_response(
-            (doip_entity_t*)user_data,
-            source_addr,
-            response.buffer,
-            response.actual_length
-        );
+        /* A partial send is flushed by the entity task, which may be
+         * waiting without write interest */
+        if (respond) {
+            (void)doip_interface_wake(&g_doip_interface);
+        }
     }
 }
 
+#if (DOIP_GATEWAY_NODE_COUNT > 0)
+void doip_gateway_route_handler(
+    uint16_t source_addr,
+    uint16_t target_addr,
+    const uint8_t *data,
+    uint32_t length,
+    void *user_data)
+{
+    gateway_node_t *node = (gateway_node_t *)user_data;
+    gateway_request_t request;
+
+    (void)target_addr;
+
+    if ((length == 0U) || (length > DOIP_GATEWAY_REQUEST_SIZE)) {
+        DOIP_LOG_INFO("UDS", "Request for 0x%04X dropped, %u bytes",
+                      node->logical_address, (unsigned int)length);
+        return;
+    }
+
+    /* Runs in the entity task, the node works on a copy */
+    request.tester_address = source_addr;
+    request.length = length;
+    (void)memcpy(request.data, data, length);
+
+    if (xQueueSend(node->queue, &request, 0) != pdPASS) {
+        DOIP_LOG_INFO("UDS", "Request for 0x%04X dropped, node busy",
+                      node->logical_address);
+    }
+}
+
+void doip_gateway_node_task(void *pvParameters)
+{
+    gateway_node_t *node = (gateway_node_t *)pvParameters;
+    gateway_request_t request;
+    uint8_t buffer[DOIP_GATEWAY_RESPONSE_SIZE];
+
+    for (;;) {
+        if (xQueueReceive(node->queue, &request, portMAX_DELAY) != pdPASS) {
+            continue;
+        }
+
+        uds_request_t uds_request = {
+            .sid = request.data[0],
+            .data = &request.data[1],
+            .length = request.length - 1U
+        };
+        uds_response_t response = {
+            .buffer = buffer,
+            .max_length = sizeof(buffer),
+            .actual_length = 0U
+        };
+
+        /* Processing runs without the DoIP lock, only the send takes it */
+        if (!uds_process_request(&node->uds_context, &uds_request, &response)) {
+            continue;
+        }
+
+        if (doip_lock(portMAX_DELAY) == pdTRUE) {
+            (void)doip_entity_send_diagnostic_response_from(&g_doip_entity,
+                node->logical_address, request.tester_address, buffer,
+                response.actual_length);
+            doip_unlock();
+            (void)doip_interface_wake(&g_doip_interface);
+        }
+    }
+}
+
+static void gateway_init(void)
+{
+    for (uint32_t i = 0U; i < (uint32_t)DOIP_GATEWAY_NODE_COUNT; i++) {
+        gateway_node_t *node = &g_gateway_nodes[i];
+
+        node->logical_address = (uint16_t)(DOIP_GATEWAY_NODE_ADDRESS + i);
+        uds_init(&node->uds_context);
+        node->queue = xQueueCreate(DOIP_GATEWAY_QUEUE_LENGTH,
+                                   sizeof(gateway_request_t));
+        if ((node->queue == NULL) ||
+            (xTaskCreate(doip_gateway_node_task, DOIP_GATEWAY_TASK_NAME,
+                         DOIP_GATEWAY_TASK_STACK_SIZE, node,
+                         DOIP_GATEWAY_TASK_PRIORITY, &node->task) != pdPASS)) {
+            DOIP_LOG_ERROR("Task", "Failed to create gateway node");
+            while (1); /* Halt on error */
+        }
+    }
+}
+#endif /* DOIP_GATEWAY_NODE_COUNT */
+
+/* Serve RequestDownload, TransferData and RequestTransferExit from the
+ * download bank. Without flash the server keeps the core services. */
+static void download_init(void)
+{
+#if (FLASH_BACKEND == FLASH_BACKEND_NONE)
+    DOIP_LOG_INFO("Task", "No flash backend, downloads are refused");
+#else
+    if (flash_init(&g_flash, &FLASH_OPS, NULL) != FLASH_RESULT_OK) {
+        DOIP_LOG_ERROR("Task", "Failed to init flash");
+        return;
+    }
+
+    uds_download_flash_init(&g_uds_download_flash, &g_flash,
+                            &g_uds_download_memory);
+    g_uds_download_flash.now_ms = doip_now_ms;
+    uds_download_init(&g_uds_download, &g_uds_download_memory,
+                      g_uds_download_regions,
+                      (uint32_t)(sizeof(g_uds_download_regions) /
+                                 sizeof(g_uds_download_regions[0])));
+    uds_download_set_max_block_length(&g_uds_download,
+                                      DOIP_DOWNLOAD_MAX_BLOCK_LENGTH);
+
+    uds_service_table_init(&g_uds_services);
+    uds_register_core_services(&g_uds_services);
+    uds_register_download_services(&g_uds_services);
+    uds_set_service_table(&g_uds_context, &g_uds_services);
+    uds_download_attach(&g_uds_context, &g_uds_download);
+#endif /* FLASH_BACKEND */
+}
+
 /* This function initializes all network interfaces
  * For DoIP example with simplified network setup
  */
@@ -202,6 +632,7 @@ void doip_application_init(void)
 
     /* Initialize UDS context */
     uds_init(&g_uds_context);
+    download_init();
 
     /* Create mutex for thread safety */
     g_doip_mutex = xSemaphoreCreateMutex();
@@ -210,6 +641,25 @@ void doip_application_init(void)
         while (1); /* Halt on error */
     }
 
+#if (DOIP_GATEWAY_NODE_COUNT > 0)
+    /* Node queues exist before the entity can route to them */
+    gateway_init();
+#endif /* DOIP_GATEWAY_NODE_COUNT */
+
+    /* UDS services run in their own task, one request at a time */
+    g_uds_job_queue = xQueueCreate(1, sizeof(uds_job_t *));
+    if ((g_uds_job_queue == NULL) ||
+        (xTaskCreate(
+            doip_uds_worker_task,
+            DOIP_UDS_TASK_NAME,
+            DOIP_UDS_TASK_STACK_SIZE,
+            NULL,
+            DOIP_UDS_TASK_PRIORITY,
+            &g_doip_uds_task_handle) != pdPASS)) {
+        DOIP_LOG_ERROR("Task", "Failed to create UDS worker");
+        while (1); /* Halt on error */
+    }
+
     /* Create DoIP Entity task */
     if (xTaskCreate(
             doip_entity_task,
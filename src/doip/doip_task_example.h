@@ -4,9 +4,11 @@
 #include "FreeRTOS.h"
 #include "task.h"
 #include "semphr.h"
+#include "queue.h"
 #include "app_doip_entity.h"
 #include "app_doip_tester.h"
 #include "doip_interface.h"
+#include "flash_hal.h"
 
 /**
  * @file doip_task_example.h
@@ -29,11 +31,57 @@
 #define DOIP_NETWORK_RX_TASK_STACK_SIZE (1024)
 #define DOIP_NETWORK_RX_TASK_NAME       "DoIP_NetRX"
 
+/* UDS worker, below the entity task so network reception preempts it */
+#define DOIP_UDS_TASK_PRIORITY          (tskIDLE_PRIORITY + 2)
+#define DOIP_UDS_TASK_STACK_SIZE        (1024)
+#define DOIP_UDS_TASK_NAME              "DoIP_UDS"
+
+/* OTA downloads are programmed into this application bank, which is
+ * erased in the background from the programming session entry on. The
+ * UDS worker wakes every tick while flash work is outstanding. */
+#define DOIP_DOWNLOAD_BANK_ADDRESS      FLASH_BANK_B_ADDRESS
+#define DOIP_DOWNLOAD_POLL_TICKS        (1)
+
+/* maxNumberOfBlockLength of the download, SID and counter included.
+ * TransferData past the RX buffer is streamed by the entity task straight
+ * into the staging buffers. */
+#define DOIP_DOWNLOAD_MAX_BLOCK_LENGTH  (65536U + 2U)
+
+/* Testers routed at the same time. The connection pool holds one more,
+ * so a new tester can still reach the entity while all are routed. */
+#define DOIP_ENTITY_MAX_TESTERS         (2U)
+
 /* Task Cycle Times */
 #define DOIP_ENTITY_CYCLE_TIME_MS       10
 #define DOIP_TESTER_CYCLE_TIME_MS       10
 #define DOIP_NETWORK_CYCLE_TIME_MS      5
 
+/* Event-driven entity loop: block in socket_select until a DoIP socket is
+ * ready or the next entity timer expires instead of polling every cycle */
+#ifndef DOIP_ENTITY_EVENT_DRIVEN
+#define DOIP_ENTITY_EVENT_DRIVEN        1
+#endif
+
+/* Gateway nodes behind the entity at consecutive logical addresses from
+ * DOIP_GATEWAY_NODE_ADDRESS, all members of DOIP_GATEWAY_FUNCTIONAL_ADDRESS.
+ * Each node has its own request queue and worker task, so nodes answer in
+ * parallel. Off by default, since routed targets are limited:
+ * - Requests must fit DOIP_GATEWAY_REQUEST_SIZE, there is no streaming.
+ * - A node answers once, it never sends response pending (0x78).
+ * - The entity itself does not answer the functional address. */
+#ifndef DOIP_GATEWAY_NODE_COUNT
+#define DOIP_GATEWAY_NODE_COUNT         0
+#endif
+#define DOIP_GATEWAY_NODE_ADDRESS       (0x1001U)
+#define DOIP_GATEWAY_FUNCTIONAL_ADDRESS (0xE400U)
+#define DOIP_GATEWAY_QUEUE_LENGTH       (4)
+#define DOIP_GATEWAY_REQUEST_SIZE       (64U)
+#define DOIP_GATEWAY_RESPONSE_SIZE      (64U)
+
+#define DOIP_GATEWAY_TASK_PRIORITY      (tskIDLE_PRIORITY + 2)
+#define DOIP_GATEWAY_TASK_STACK_SIZE    (1024)
+#define DOIP_GATEWAY_TASK_NAME          "DoIP_Node"
+
 /**
  * @brief DoIP Entity Task Handle
  */
@@ -44,6 +92,11 @@ extern TaskHandle_t g_doip_entity_task_handle;
  */
 extern TaskHandle_t g_doip_tester_task_handle;
 
+/**
+ * @brief UDS Worker Task Handle
+ */
+extern TaskHandle_t g_doip_uds_task_handle;
+
 /**
  * @brief Mutex for thread-safe access to DoIP resources
  */
@@ -91,6 +144,8 @@ void doip_network_rx_task(void *pvParameters);
  * @brief UDS Diagnostic Request Handler (Entity side)
  *
  * Callback function called when Entity receives a diagnostic request.
+ * Hands the request to the UDS worker task, or answers busy (NRC 0x21)
+ * while the worker still executes the previous one.
  *
  * @param source_addr Source logical address (Tester)
  * @param target_addr Target logical address (Entity)
@@ -106,6 +161,60 @@ void doip_entity_uds_rx_handler(
     void *user_data
 );
 
+/**
+ * @brief UDS Stream Handler (Entity side)
+ *
+ * Stream callback for diagnostic messages larger than the RX buffer.
+ * TransferData is written into the download staging buffers as it
+ * arrives, while the worker is idle; other testers are answered busy
+ * until the response is sent.
+ */
+bool doip_entity_uds_stream_handler(
+    doip_stream_event_t event,
+    uint16_t source_addr,
+    uint16_t target_addr,
+    uint32_t total_length,
+    uint32_t offset,
+    const uint8_t *data,
+    uint32_t length,
+    void *user_data
+);
+
+/**
+ * @brief UDS Worker Task Function
+ *
+ * Executes queued UDS requests outside the DoIP lock and sends the final
+ * response. The entity task sends response pending (NRC 0x78) meanwhile.
+ *
+ * @param pvParameters Task parameters (unused)
+ */
+void doip_uds_worker_task(void *pvParameters);
+
+#if (DOIP_GATEWAY_NODE_COUNT > 0)
+/**
+ * @brief Gateway Route Handler
+ *
+ * Queues a diagnostic request for the gateway node passed as user data.
+ * Called in the entity task for the node's own and functional address.
+ */
+void doip_gateway_route_handler(
+    uint16_t source_addr,
+    uint16_t target_addr,
+    const uint8_t *data,
+    uint32_t length,
+    void *user_data
+);
+
+/**
+ * @brief Gateway Node Task Function
+ *
+ * Processes the requests queued for one node and sends its responses.
+ *
+ * @param pvParameters Node served by the task
+ */
+void doip_gateway_node_task(void *pvParameters);
+#endif /* DOIP_GATEWAY_NODE_COUNT */
+
 /**
  * @brief UDS Diagnostic Response Handler (Tester side)
  *
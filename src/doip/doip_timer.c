@@ -0,0 +1,177 @@
+#include "doip_timer.h"
+#include <stddef.h>
+
+/* Wrap-safe 'a is earlier than b' for deadlines less than 2^31 ms apart */
+static bool deadline_before(uint32_t a, uint32_t b)
+{
+    return ((a - b) & 0x80000000U) != 0U;
+}
+
+static void heap_place(doip_timer_queue_t *queue, uint32_t index,
+                       const doip_timer_slot_t *slot)
+{
+    queue->heap[index] = *slot;
+    queue->position[slot->id] = (uint16_t)index;
+}
+
+static void sift_up(doip_timer_queue_t *queue, uint32_t index)
+{
+    doip_timer_slot_t slot = queue->heap[index];
+    uint32_t parent;
+
+    while (index > 0U) {
+        parent = (index - 1U) / 2U;
+        if (!deadline_before(slot.deadline, queue->heap[parent].deadline)) {
+            break;
+        }
+        heap_place(queue, index, &queue->heap[parent]);
+        index = parent;
+    }
+    heap_place(queue, index, &slot);
+}
+
+static void sift_down(doip_timer_queue_t *queue, uint32_t index)
+{
+    doip_timer_slot_t slot = queue->heap[index];
+    uint32_t child;
+
+    for (;;) {
+        child = (2U * index) + 1U;
+        if (child >= queue->count) {
+            break;
+        }
+        if (((child + 1U) < queue->count) &&
+            deadline_before(queue->heap[child + 1U].deadline,
+                            queue->heap[child].deadline)) {
+            child++;
+        }
+        if (!deadline_before(queue->heap[child].deadline, slot.deadline)) {
+            break;
+        }
+        heap_place(queue, index, &queue->heap[child]);
+        index = child;
+    }
+    heap_place(queue, index, &slot);
+}
+
+/* Remove the entry at a heap index, keeping the heap ordered */
+static void heap_remove(doip_timer_queue_t *queue, uint32_t index)
+{
+    uint16_t id = queue->heap[index].id;
+
+    queue->count--;
+    queue->position[id] = DOIP_TIMER_NONE;
+    if (index == queue->count) {
+        return;
+    }
+
+    /* The last entry fills the hole and moves whichever way it needs to */
+    heap_place(queue, index, &queue->heap[queue->count]);
+    if ((index > 0U) &&
+        deadline_before(queue->heap[index].deadline,
+                        queue->heap[(index - 1U) / 2U].deadline)) {
+        sift_up(queue, index);
+    } else {
+        sift_down(queue, index);
+    }
+}
+
+void doip_timer_init(doip_timer_queue_t *queue)
+{
+    uint32_t i;
+
+    if (queue == NULL) {
+        return;
+    }
+
+    queue->count = 0U;
+    for (i = 0U; i < DOIP_TIMER_MAX; i++) {
+        queue->position[i] = DOIP_TIMER_NONE;
+    }
+}
+
+void doip_timer_start(
+    doip_timer_queue_t *queue,
+    uint16_t id,
+    uint32_t deadline)
+{
+    doip_timer_slot_t slot;
+    uint32_t index;
+
+    if ((queue == NULL) || (id >= DOIP_TIMER_MAX)) {
+        return;
+    }
+
+    index = queue->position[id];
+    if (index != DOIP_TIMER_NONE) {
+        /* Re-arm in place */
+        if (deadline_before(deadline, queue->heap[index].deadline)) {
+            queue->heap[index].deadline = deadline;
+            sift_up(queue, index);
+        } else {
+            queue->heap[index].deadline = deadline;
+            sift_down(queue, index);
+        }
+        return;
+    }
+
+    slot.deadline = deadline;
+    slot.id = id;
+    heap_place(queue, queue->count, &slot);
+    queue->count++;
+    sift_up(queue, queue->count - 1U);
+}
+
+void doip_timer_stop(
+    doip_timer_queue_t *queue,
+    uint16_t id)
+{
+    if ((queue == NULL) || (id >= DOIP_TIMER_MAX)) {
+        return;
+    }
+
+    if (queue->position[id] != DOIP_TIMER_NONE) {
+        heap_remove(queue, queue->position[id]);
+    }
+}
+
+bool doip_timer_is_active(
+    const doip_timer_queue_t *queue,
+    uint16_t id)
+{
+    if ((queue == NULL) || (id >= DOIP_TIMER_MAX)) {
+        return false;
+    }
+
+    return queue->position[id] != DOIP_TIMER_NONE;
+}
+
+bool doip_timer_next_deadline(
+    const doip_timer_queue_t *queue,
+    uint32_t *deadline)
+{
+    if ((queue == NULL) || (deadline == NULL) || (queue->count == 0U)) {
+        return false;
+    }
+
+    *deadline = queue->heap[0].deadline;
+
+    return true;
+}
+
+int doip_timer_expire(
+    doip_timer_queue_t *queue,
+    uint32_t now)
+{
+    uint16_t id;
+
+    if ((queue == NULL) || (queue->count == 0U) ||
+        deadline_before(now, queue->heap[0].deadline)) {
+        return -1;
+    }
+
+    id = queue->heap[0].id;
+    heap_remove(queue, 0U);
+
+    return (int)id;
+}
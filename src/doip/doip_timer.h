@@ -0,0 +1,60 @@
+#ifndef DOIP_TIMER_H
+#define DOIP_TIMER_H
+
+#include <stdint.h>
+#include <stdbool.h>
+#include "doip_config.h"
+
+/* Marks a timer id that is not armed */
+#define DOIP_TIMER_NONE            0xFFFFU
+
+#if (DOIP_TIMER_MAX >= DOIP_TIMER_NONE)
+#error "DOIP_TIMER_MAX must be below 0xFFFF"
+#endif
+
+/* Armed timer, deadlines are absolute milliseconds that may wrap */
+typedef struct {
+    uint32_t deadline;
+    uint16_t id;
+} doip_timer_slot_t;
+
+/* Binary min-heap of armed timers ordered by deadline. Timer ids are
+ * chosen by the owner, 0 to DOIP_TIMER_MAX - 1. */
+typedef struct {
+    doip_timer_slot_t heap[DOIP_TIMER_MAX];
+    uint16_t position[DOIP_TIMER_MAX];      /* Heap index per id */
+    uint32_t count;
+} doip_timer_queue_t;
+
+void doip_timer_init(doip_timer_queue_t *queue);
+
+/* Arm a timer, or move it if it is already armed */
+void doip_timer_start(
+    doip_timer_queue_t *queue,
+    uint16_t id,
+    uint32_t deadline
+);
+
+void doip_timer_stop(
+    doip_timer_queue_t *queue,
+    uint16_t id
+);
+
+bool doip_timer_is_active(
+    const doip_timer_queue_t *queue,
+    uint16_t id
+);
+
+/* Earliest deadline, false if no timer is armed */
+bool doip_timer_next_deadline(
+    const doip_timer_queue_t *queue,
+    uint32_t *deadline
+);
+
+/* Disarm and return one timer due at 'now', -1 if none is due */
+int doip_timer_expire(
+    doip_timer_queue_t *queue,
+    uint32_t now
+);
+
+#endif /* DOIP_TIMER_H */
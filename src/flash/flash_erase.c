@@ -0,0 +1,162 @@
+#include "flash_erase.h"
+#include <stddef.h>
+
+/* Blank checks read the flash, a step checks at most this many sectors */
+#define FLASH_ERASE_BLANK_CHECKS_PER_STEP   16U
+
+void flash_erase_init(flash_erase_t *erase, flash_t *flash)
+{
+    if (erase == NULL) {
+        return;
+    }
+
+    erase->flash = flash;
+    erase->start = 0U;
+    erase->end = 0U;
+    erase->frontier = 0U;
+    erase->erasing = false;
+    erase->erasing_address = 0U;
+    erase->failed = false;
+    erase->stats.sectors_erased = 0U;
+    erase->stats.sectors_skipped = 0U;
+    erase->stats.errors = 0U;
+}
+
+void flash_erase_request(flash_erase_t *erase, uint32_t address, uint32_t size)
+{
+    uint32_t end;
+
+    if (erase == NULL) {
+        return;
+    }
+
+    /* A running erase is still retired by flash_erase_poll(), it only
+     * moves the frontier if it was erasing the frontier sector */
+    if (size == 0U) {
+        erase->start = 0U;
+        erase->end = 0U;
+        erase->frontier = 0U;
+        erase->failed = false;
+        return;
+    }
+
+    end = flash_sector_address(address + (size - 1U)) + FLASH_SECTOR_SIZE;
+
+    if (!erase->failed && (erase->frontier > erase->start) &&
+        (address >= erase->start) && (address <= erase->frontier)) {
+        erase->end = end;
+        return;
+    }
+
+    erase->start = flash_sector_address(address);
+    erase->frontier = erase->start;
+    erase->end = end;
+    erase->failed = false;
+}
+
+flash_result_t flash_erase_poll(flash_erase_t *erase)
+{
+    flash_result_t result;
+    bool frontier_sector;
+
+    if (erase == NULL) {
+        return FLASH_RESULT_INVALID_PARAM;
+    }
+    if (!erase->erasing) {
+        return erase->failed ? FLASH_RESULT_ERROR : FLASH_RESULT_OK;
+    }
+
+    result = flash_get_status(erase->flash);
+    if (result == FLASH_RESULT_BUSY) {
+        return FLASH_RESULT_BUSY;
+    }
+
+    erase->erasing = false;
+    frontier_sector = (erase->erasing_address == erase->frontier) &&
+                      (erase->frontier < erase->end);
+
+    if (result != FLASH_RESULT_OK) {
+        erase->stats.errors++;
+        if (frontier_sector) {
+            erase->failed = true;
+            return FLASH_RESULT_ERROR;
+        }
+        return FLASH_RESULT_OK;
+    }
+
+    erase->stats.sectors_erased++;
+    if (frontier_sector) {
+        erase->frontier += FLASH_SECTOR_SIZE;
+    }
+
+    return FLASH_RESULT_OK;
+}
+
+flash_result_t flash_erase_next(flash_erase_t *erase)
+{
+    flash_result_t result;
+    uint32_t checks = 0U;
+
+    if (erase == NULL) {
+        return FLASH_RESULT_INVALID_PARAM;
+    }
+    if (erase->failed) {
+        return FLASH_RESULT_ERROR;
+    }
+    if (erase->erasing) {
+        return FLASH_RESULT_BUSY;
+    }
+
+    while (erase->frontier < erase->end) {
+        if (checks >= FLASH_ERASE_BLANK_CHECKS_PER_STEP) {
+            return FLASH_RESULT_BUSY;
+        }
+        checks++;
+
+        if (flash_blank_check(erase->flash, erase->frontier,
+                              FLASH_SECTOR_SIZE) == FLASH_RESULT_OK) {
+            erase->frontier += FLASH_SECTOR_SIZE;
+            erase->stats.sectors_skipped++;
+            continue;
+        }
+
+        result = flash_erase_sector(erase->flash, erase->frontier);
+        if (result == FLASH_RESULT_OK) {
+            erase->erasing = true;
+            erase->erasing_address = erase->frontier;
+            return FLASH_RESULT_BUSY;
+        }
+        if (result != FLASH_RESULT_BUSY) {
+            erase->stats.errors++;
+            erase->failed = true;
+        }
+        return result;
+    }
+
+    return FLASH_RESULT_OK;
+}
+
+flash_result_t flash_erase_step(flash_erase_t *erase)
+{
+    flash_result_t result = flash_erase_poll(erase);
+
+    if (result != FLASH_RESULT_OK) {
+        return result;
+    }
+
+    return flash_erase_next(erase);
+}
+
+bool flash_erase_covers(
+    const flash_erase_t *erase,
+    uint32_t address,
+    uint32_t length)
+{
+    if (erase == NULL) {
+        return false;
+    }
+
+    return (address >= erase->start) &&
+           ((address - erase->start) <= (erase->frontier - erase->start)) &&
+           (length <= (erase->frontier - address));
+}
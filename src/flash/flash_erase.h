@@ -0,0 +1,72 @@
+#ifndef FLASH_ERASE_H
+#define FLASH_ERASE_H
+
+#include "flash_hal.h"
+
+/**
+ * @file flash_erase.h
+ * @brief Background erase of a flash range
+ *
+ * Sectors are erased one at a time from the start of the range, so
+ * everything below the frontier is erased and may be programmed while
+ * the rest is still being erased. Blank sectors are skipped. The
+ * scheduler never waits: it is stepped whenever the flash is idle.
+ */
+
+/* Erase counters */
+typedef struct {
+    uint32_t sectors_erased;
+    uint32_t sectors_skipped;           /* Already blank */
+    uint32_t errors;
+} flash_erase_stats_t;
+
+/* Erase scheduler */
+typedef struct {
+    flash_t *flash;
+    uint32_t start;                     /* First sector of the range */
+    uint32_t end;                       /* Sector aligned end of the range */
+    uint32_t frontier;                  /* [start, frontier) is erased */
+    bool erasing;                       /* An erase of 'erasing_address' runs */
+    uint32_t erasing_address;
+    bool failed;                        /* Range could not be erased */
+    flash_erase_stats_t stats;
+} flash_erase_t;
+
+void flash_erase_init(
+    flash_erase_t *erase,
+    flash_t *flash
+);
+
+/* Erase 'size' bytes from the sector aligned 'address'. A range starting
+ * inside the erased part of the current one keeps its progress. Size 0
+ * drops the range, e.g. once data has been programmed into it. */
+void flash_erase_request(
+    flash_erase_t *erase,
+    uint32_t address,
+    uint32_t size
+);
+
+/* Retire a finished erase. BUSY while it runs, ERROR if it failed. */
+flash_result_t flash_erase_poll(
+    flash_erase_t *erase
+);
+
+/* Start erasing the next sector that is not blank. BUSY once started, OK
+ * when the frontier reached the end. The flash must be idle. */
+flash_result_t flash_erase_next(
+    flash_erase_t *erase
+);
+
+/* flash_erase_poll() followed by flash_erase_next() */
+flash_result_t flash_erase_step(
+    flash_erase_t *erase
+);
+
+/* True if 'length' bytes at 'address' are erased */
+bool flash_erase_covers(
+    const flash_erase_t *erase,
+    uint32_t address,
+    uint32_t length
+);
+
+#endif /* FLASH_ERASE_H */
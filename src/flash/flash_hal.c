@@ -0,0 +1,159 @@
+#include "flash_hal.h"
+#include <stddef.h>
+
+/* Written without address + length, which may wrap */
+static bool range_valid(uint32_t address, uint32_t length)
+{
+    return (address >= FLASH_PFLASH_ADDRESS) &&
+           ((address - FLASH_PFLASH_ADDRESS) < FLASH_PFLASH_SIZE) &&
+           (length <= (FLASH_PFLASH_SIZE - (address - FLASH_PFLASH_ADDRESS)));
+}
+
+uint32_t flash_sector_address(uint32_t address)
+{
+    return address & ~(FLASH_SECTOR_SIZE - 1U);
+}
+
+flash_result_t flash_init(
+    flash_t *flash,
+    const flash_ops_t *ops,
+    void *context)
+{
+    if ((flash == NULL) || (ops == NULL)) {
+        return FLASH_RESULT_INVALID_PARAM;
+    }
+
+    flash->ops = ops;
+    flash->context = context;
+    flash->busy = false;
+    flash->last_result = FLASH_RESULT_OK;
+    flash->stats.erases = 0U;
+    flash->stats.programs = 0U;
+    flash->stats.bytes_programmed = 0U;
+    flash->stats.errors = 0U;
+
+    if (ops->init != NULL) {
+        return ops->init(context);
+    }
+
+    return FLASH_RESULT_OK;
+}
+
+flash_result_t flash_get_status(flash_t *flash)
+{
+    flash_result_t result;
+
+    if (flash == NULL) {
+        return FLASH_RESULT_INVALID_PARAM;
+    }
+    if (!flash->busy) {
+        return flash->last_result;
+    }
+
+    result = flash->ops->get_status(flash->context);
+    if (result != FLASH_RESULT_BUSY) {
+        flash->busy = false;
+        flash->last_result = result;
+        if (result != FLASH_RESULT_OK) {
+            flash->stats.errors++;
+        }
+    }
+
+    return result;
+}
+
+flash_result_t flash_wait(flash_t *flash)
+{
+    flash_result_t result;
+
+    for (;;) {
+        result = flash_get_status(flash);
+        if (result != FLASH_RESULT_BUSY) {
+            return result;
+        }
+        if (flash->ops->wait != NULL) {
+            flash->ops->wait(flash->context);
+        }
+    }
+}
+
+flash_result_t flash_erase_sector(flash_t *flash, uint32_t address)
+{
+    flash_result_t result;
+
+    if ((flash == NULL) || !range_valid(address, 1U)) {
+        return FLASH_RESULT_INVALID_PARAM;
+    }
+    if (flash_get_status(flash) == FLASH_RESULT_BUSY) {
+        return FLASH_RESULT_BUSY;
+    }
+
+    result = flash->ops->erase_start(flash->context, flash_sector_address(address));
+    if (result == FLASH_RESULT_OK) {
+        flash->busy = true;
+        flash->stats.erases++;
+    } else {
+        flash->stats.errors++;
+    }
+
+    return result;
+}
+
+flash_result_t flash_program(
+    flash_t *flash,
+    uint32_t address,
+    const uint8_t *data,
+    uint32_t length)
+{
+    flash_result_t result;
+
+    if ((flash == NULL) || (data == NULL) || (length == 0U) ||
+        !range_valid(address, length)) {
+        return FLASH_RESULT_INVALID_PARAM;
+    }
+    /* Whole units inside one quad-page */
+    if (((address % FLASH_PROGRAM_UNIT) != 0U) ||
+        ((length % FLASH_PROGRAM_UNIT) != 0U) ||
+        (length > (FLASH_QUAD_PAGE_SIZE - (address % FLASH_QUAD_PAGE_SIZE)))) {
+        return FLASH_RESULT_INVALID_PARAM;
+    }
+    if (flash_get_status(flash) == FLASH_RESULT_BUSY) {
+        return FLASH_RESULT_BUSY;
+    }
+
+    result = flash->ops->program_start(flash->context, address, data, length);
+    if (result == FLASH_RESULT_OK) {
+        flash->busy = true;
+        flash->stats.programs++;
+        flash->stats.bytes_programmed += length;
+    } else {
+        flash->stats.errors++;
+    }
+
+    return result;
+}
+
+flash_result_t flash_read(
+    flash_t *flash,
+    uint32_t address,
+    uint8_t *data,
+    uint32_t length)
+{
+    if ((flash == NULL) || (data == NULL) || !range_valid(address, length)) {
+        return FLASH_RESULT_INVALID_PARAM;
+    }
+
+    return flash->ops->read(flash->context, address, data, length);
+}
+
+flash_result_t flash_blank_check(
+    flash_t *flash,
+    uint32_t address,
+    uint32_t length)
+{
+    if ((flash == NULL) || !range_valid(address, length)) {
+        return FLASH_RESULT_INVALID_PARAM;
+    }
+
+    return flash->ops->blank_check(flash->context, address, length);
+}
@@ -0,0 +1,168 @@
+#ifndef FLASH_HAL_H
+#define FLASH_HAL_H
+
+#include <stdint.h>
+#include <stdbool.h>
+
+/**
+ * @file flash_hal.h
+ * @brief Program flash abstraction
+ *
+ * Erase and program run in the background: they are started here and
+ * polled with flash_get_status(). The backend ops drive the C40 flash
+ * controller on target or a file backed simulation on a host.
+ */
+
+/* S32K344 program flash, four 1 MB blocks of 8 KB sectors */
+#define FLASH_PFLASH_ADDRESS        0x00400000U
+#define FLASH_PFLASH_SIZE           0x00400000U
+#define FLASH_BLOCK_SIZE            0x00100000U
+#define FLASH_SECTOR_SIZE           0x00002000U
+
+/* Largest single program operation, programs do not cross it */
+#define FLASH_QUAD_PAGE_SIZE        128U
+
+/* Program granularity: 128 bits are written with one ECC word and can
+ * only be programmed once between erases */
+#define FLASH_PROGRAM_UNIT          16U
+
+#define FLASH_ERASED_VALUE          0xFFU
+
+/* Block 0 holds the bootloader (int_pflash in the linker script), the
+ * next two blocks are the application banks. Block 3 ends with the HSE
+ * firmware and is not used. */
+#define FLASH_BOOT_ADDRESS          FLASH_PFLASH_ADDRESS
+#define FLASH_BOOT_SIZE             FLASH_BLOCK_SIZE
+#define FLASH_BANK_SIZE             FLASH_BLOCK_SIZE
+#define FLASH_BANK_A_ADDRESS        (FLASH_BOOT_ADDRESS + FLASH_BOOT_SIZE)
+#define FLASH_BANK_B_ADDRESS        (FLASH_BANK_A_ADDRESS + FLASH_BANK_SIZE)
+
+/* Flash Operation Results */
+typedef enum {
+    FLASH_RESULT_OK = 0,
+    FLASH_RESULT_BUSY,                  /* An erase or program is running */
+    FLASH_RESULT_INVALID_PARAM,         /* Range or alignment */
+    FLASH_RESULT_NOT_BLANK,
+    FLASH_RESULT_ERROR                  /* Controller reported a failure */
+} flash_result_t;
+
+/* Backend Operations. Addresses are absolute and validated by the HAL,
+ * one erase or program runs at a time. */
+typedef struct {
+    flash_result_t (*init)(void *context);
+    flash_result_t (*erase_start)(void *context, uint32_t sector_address);
+    /* 'data' is read until the program is no longer BUSY */
+    flash_result_t (*program_start)(void *context, uint32_t address,
+                                    const uint8_t *data, uint32_t length);
+    /* BUSY while running, then the result of the last erase or program */
+    flash_result_t (*get_status)(void *context);
+    /* Return when the running operation has finished, e.g. by sleeping */
+    void (*wait)(void *context);
+    flash_result_t (*read)(void *context, uint32_t address,
+                           uint8_t *data, uint32_t length);
+    flash_result_t (*blank_check)(void *context, uint32_t address,
+                                  uint32_t length);
+} flash_ops_t;
+
+/* Backend selection: C40 flash controller or simulated flash on a host.
+ * The RTD tree does not contain the C40_Ip driver yet, so there is no
+ * default backend: without one the HAL has no ops and the firmware
+ * refuses downloads.
+ *
+ * flash_hal_c40.c is written against the C40_Ip API as documented, not
+ * against a driver in this tree. It has never been built for or run on
+ * the target; the host build only compiles it against the stand-in
+ * test/stubs/C40_Ip.h. */
+#define FLASH_BACKEND_C40           0
+#define FLASH_BACKEND_SIM           1
+#define FLASH_BACKEND_NONE          2
+
+#ifndef FLASH_BACKEND
+#define FLASH_BACKEND               FLASH_BACKEND_NONE
+#endif
+
+#if (FLASH_BACKEND == FLASH_BACKEND_SIM)
+/* Flash Operations on a mapped file (flash_sim.c), context is a flash_sim_t */
+extern const flash_ops_t g_flash_sim_ops;
+#define FLASH_OPS                   g_flash_sim_ops
+#elif (FLASH_BACKEND == FLASH_BACKEND_C40)
+/* The driver and its generated C40_Ip_Cfg have to be added to RTD and
+ * flash_hal_c40.c to the build before the backend is usable */
+#ifndef FLASH_C40_DRIVER_AVAILABLE
+#error "FLASH_BACKEND_C40 needs the RTD C40_Ip driver, define FLASH_C40_DRIVER_AVAILABLE once it is in the tree"
+#endif
+/* C40 Flash Operations (flash_hal_c40.c), context is unused */
+extern const flash_ops_t g_flash_c40_ops;
+#define FLASH_OPS                   g_flash_c40_ops
+#elif (FLASH_BACKEND != FLASH_BACKEND_NONE)
+#error "Unknown FLASH_BACKEND"
+#endif
+
+/* Flash counters */
+typedef struct {
+    uint32_t erases;                    /* Sectors erased */
+    uint32_t programs;                  /* Program operations */
+    uint32_t bytes_programmed;
+    uint32_t errors;
+} flash_stats_t;
+
+/* Flash instance */
+typedef struct {
+    const flash_ops_t *ops;
+    void *context;                      /* Backend state */
+    bool busy;                          /* Started operation not yet retired */
+    flash_result_t last_result;         /* Of the last retired operation */
+    flash_stats_t stats;
+} flash_t;
+
+/* Function Prototypes */
+flash_result_t flash_init(
+    flash_t *flash,
+    const flash_ops_t *ops,
+    void *context
+);
+
+/* Start erasing the sector containing 'address' */
+flash_result_t flash_erase_sector(
+    flash_t *flash,
+    uint32_t address
+);
+
+/* Start programming whole program units within one quad-page */
+flash_result_t flash_program(
+    flash_t *flash,
+    uint32_t address,
+    const uint8_t *data,
+    uint32_t length
+);
+
+/* BUSY, or the result of the last erase or program */
+flash_result_t flash_get_status(
+    flash_t *flash
+);
+
+/* Block until the running operation has finished, returns its result */
+flash_result_t flash_wait(
+    flash_t *flash
+);
+
+flash_result_t flash_read(
+    flash_t *flash,
+    uint32_t address,
+    uint8_t *data,
+    uint32_t length
+);
+
+/* OK if every byte of the range is erased */
+flash_result_t flash_blank_check(
+    flash_t *flash,
+    uint32_t address,
+    uint32_t length
+);
+
+/* Start address of the sector containing 'address' */
+uint32_t flash_sector_address(
+    uint32_t address
+);
+
+#endif /* FLASH_HAL_H */
@@ -0,0 +1,166 @@
+#include "flash_hal.h"
+
+#if (FLASH_BACKEND == FLASH_BACKEND_C40)
+
+#include "C40_Ip.h"
+#include <stddef.h>
+
+/**
+ * @file flash_hal_c40.c
+ * @brief C40 flash controller backend of the flash HAL
+ *
+ * Uses the main interface of the RTD C40 IP driver without its optional
+ * callbacks. Code runs from block 0 while blocks 1 and 2 are written, so
+ * no read-while-write handling is needed for the application banks.
+ */
+
+/* Generated by the configuration tool (C40_Ip_Cfg.h) */
+#ifndef FLASH_C40_CONFIG
+#define FLASH_C40_CONFIG            (&C40_Ip_InitCfg)
+#endif
+
+/* Domain ID of the core that owns the main interface */
+#ifndef FLASH_C40_DOMAIN_ID
+#define FLASH_C40_DOMAIN_ID         0U
+#endif
+
+/* Operation whose status is polled */
+typedef enum {
+    C40_OP_NONE = 0,
+    C40_OP_ERASE,
+    C40_OP_PROGRAM
+} c40_op_t;
+
+static c40_op_t s_op = C40_OP_NONE;
+static flash_result_t s_last_result = FLASH_RESULT_OK;
+
+static flash_result_t c40_result(C40_Ip_StatusType status)
+{
+    switch (status) {
+    case C40_IP_STATUS_SUCCESS:
+        return FLASH_RESULT_OK;
+    case C40_IP_STATUS_BUSY:
+        return FLASH_RESULT_BUSY;
+    case C40_IP_STATUS_ERROR_INPUT_PARAM:
+        return FLASH_RESULT_INVALID_PARAM;
+    default:
+        return FLASH_RESULT_ERROR;
+    }
+}
+
+static flash_result_t c40_init(void *context)
+{
+    (void)context;
+
+    s_op = C40_OP_NONE;
+    s_last_result = FLASH_RESULT_OK;
+
+    return c40_result(C40_Ip_Init(FLASH_C40_CONFIG));
+}
+
+/* Sectors are locked after reset */
+static flash_result_t c40_unlock(uint32_t address)
+{
+    return c40_result(C40_Ip_ClearLock(
+        C40_Ip_GetSectorNumberFromAddress(address), FLASH_C40_DOMAIN_ID));
+}
+
+static flash_result_t c40_erase_start(void *context, uint32_t sector_address)
+{
+    flash_result_t result;
+
+    (void)context;
+
+    result = c40_unlock(sector_address);
+    if (result == FLASH_RESULT_OK) {
+        result = c40_result(C40_Ip_MainInterfaceSectorErase(
+            C40_Ip_GetSectorNumberFromAddress(sector_address),
+            FLASH_C40_DOMAIN_ID));
+    }
+    if (result == FLASH_RESULT_OK) {
+        s_op = C40_OP_ERASE;
+    }
+
+    return result;
+}
+
+static flash_result_t c40_program_start(void *context, uint32_t address,
+                                        const uint8_t *data, uint32_t length)
+{
+    flash_result_t result;
+
+    (void)context;
+
+    result = c40_unlock(address);
+    if (result == FLASH_RESULT_OK) {
+        result = c40_result(C40_Ip_MainInterfaceWrite(
+            address, length, data, FLASH_C40_DOMAIN_ID));
+    }
+    if (result == FLASH_RESULT_OK) {
+        s_op = C40_OP_PROGRAM;
+    }
+
+    return result;
+}
+
+static flash_result_t c40_get_status(void *context)
+{
+    flash_result_t result;
+
+    (void)context;
+
+    if (s_op == C40_OP_NONE) {
+        return s_last_result;
+    }
+
+    if (s_op == C40_OP_ERASE) {
+        result = c40_result(C40_Ip_MainInterfaceSectorEraseStatus());
+    } else {
+        result = c40_result(C40_Ip_MainInterfaceWriteStatus());
+    }
+    if (result != FLASH_RESULT_BUSY) {
+        s_op = C40_OP_NONE;
+        s_last_result = result;
+    }
+
+    return result;
+}
+
+static flash_result_t c40_read(void *context, uint32_t address,
+                               uint8_t *data, uint32_t length)
+{
+    (void)context;
+
+    return c40_result(C40_Ip_Read(address, length, data));
+}
+
+static flash_result_t c40_blank_check(void *context, uint32_t address,
+                                      uint32_t length)
+{
+    /* Program flash is memory mapped, erased lines read without ECC errors */
+    const volatile uint8_t *flash = (const volatile uint8_t *)(uintptr_t)address;
+    uint32_t i;
+
+    (void)context;
+
+    for (i = 0U; i < length; i++) {
+        if (flash[i] != FLASH_ERASED_VALUE) {
+            return FLASH_RESULT_NOT_BLANK;
+        }
+    }
+
+    return FLASH_RESULT_OK;
+}
+
+/* No wait hook: status is polled, the controller needs no CPU meanwhile */
+const flash_ops_t g_flash_c40_ops = {
+    .init = c40_init,
+    .erase_start = c40_erase_start,
+    .program_start = c40_program_start,
+    .get_status = c40_get_status,
+    .wait = NULL,
+    .read = c40_read,
+    .blank_check = c40_blank_check
+};
+
+#endif /* FLASH_BACKEND_C40 */
@@ -0,0 +1,245 @@
+/* mmap flags and clock_nanosleep of the host C library */
+#ifndef _DEFAULT_SOURCE
+#define _DEFAULT_SOURCE
+#endif
+
+#include "flash_sim.h"
+
+#if (FLASH_BACKEND == FLASH_BACKEND_SIM)
+
+#include <string.h>
+#include <time.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+
+/**
+ * @file flash_sim.c
+ * @brief Flash operations on a mapped file
+ *
+ * Timing follows the monotonic clock: an operation is complete once its
+ * latency has passed, and its effect on the image is applied by the
+ * first status query after that.
+ */
+
+#define FLASH_SIM_SPIN_NS           200000ULL
+
+static uint64_t now_ns(void)
+{
+    struct timespec ts;
+
+    (void)clock_gettime(CLOCK_MONOTONIC, &ts);
+
+    return ((uint64_t)ts.tv_sec * 1000000000ULL) + (uint64_t)ts.tv_nsec;
+}
+
+static uint8_t *image_at(flash_sim_t *sim, uint32_t address)
+{
+    return &sim->memory[address - FLASH_PFLASH_ADDRESS];
+}
+
+static bool image_blank(const uint8_t *data, uint32_t length)
+{
+    uint32_t i;
+
+    for (i = 0U; i < length; i++) {
+        if (data[i] != FLASH_ERASED_VALUE) {
+            return false;
+        }
+    }
+
+    return true;
+}
+
+static void start_op(flash_sim_t *sim, flash_sim_op_t op, uint32_t address,
+                     const uint8_t *data, uint32_t length, uint32_t latency_us)
+{
+    sim->op = op;
+    sim->op_address = address;
+    sim->op_data = data;
+    sim->op_length = length;
+    sim->op_done_ns = now_ns() + ((uint64_t)latency_us * 1000ULL);
+}
+
+/* Apply the finished operation to the image */
+static void complete_op(flash_sim_t *sim)
+{
+    uint8_t *target = image_at(sim, sim->op_address);
+    uint32_t unit;
+    uint32_t i;
+
+    sim->last_result = FLASH_RESULT_OK;
+
+    if (sim->op == FLASH_SIM_OP_ERASE) {
+        (void)memset(target, FLASH_ERASED_VALUE, FLASH_SECTOR_SIZE);
+    } else {
+        for (unit = 0U; unit < sim->op_length; unit += FLASH_PROGRAM_UNIT) {
+            /* Programming only clears bits, a second program of a unit
+             * leaves a mix and a broken ECC word */
+            if (!image_blank(&target[unit], FLASH_PROGRAM_UNIT)) {
+                sim->last_result = FLASH_RESULT_ERROR;
+            }
+            for (i = unit; i < (unit + FLASH_PROGRAM_UNIT); i++) {
+                target[i] &= sim->op_data[i];
+            }
+        }
+    }
+
+    sim->op = FLASH_SIM_OP_NONE;
+    sim->op_data = NULL;
+}
+
+static flash_result_t sim_erase_start(void *context, uint32_t sector_address)
+{
+    flash_sim_t *sim = (flash_sim_t *)context;
+
+    start_op(sim, FLASH_SIM_OP_ERASE, sector_address, NULL,
+             FLASH_SECTOR_SIZE, sim->erase_us);
+
+    return FLASH_RESULT_OK;
+}
+
+static flash_result_t sim_program_start(void *context, uint32_t address,
+                                        const uint8_t *data, uint32_t length)
+{
+    flash_sim_t *sim = (flash_sim_t *)context;
+
+    start_op(sim, FLASH_SIM_OP_PROGRAM, address, data, length,
+             sim->program_us +
+             ((length / FLASH_PROGRAM_UNIT) * sim->program_unit_us));
+
+    return FLASH_RESULT_OK;
+}
+
+static flash_result_t sim_get_status(void *context)
+{
+    flash_sim_t *sim = (flash_sim_t *)context;
+
+    if (sim->op != FLASH_SIM_OP_NONE) {
+        if (now_ns() < sim->op_done_ns) {
+            return FLASH_RESULT_BUSY;
+        }
+        complete_op(sim);
+    }
+
+    return sim->last_result;
+}
+
+static void sim_wait(void *context)
+{
+    flash_sim_t *sim = (flash_sim_t *)context;
+    struct timespec ts;
+    uint64_t wake_ns;
+
+    if (sim->op == FLASH_SIM_OP_NONE) {
+        return;
+    }
+
+    /* Sleeps overshoot by the timer slack, so the last stretch before
+     * completion is left to the caller's status polling */
+    wake_ns = sim->op_done_ns - FLASH_SIM_SPIN_NS;
+    if ((sim->op_done_ns > FLASH_SIM_SPIN_NS) && (now_ns() < wake_ns)) {
+        ts.tv_sec = (time_t)(wake_ns / 1000000000ULL);
+        ts.tv_nsec = (long)(wake_ns % 1000000000ULL);
+        (void)clock_nanosleep(CLOCK_MONOTONIC, TIMER_ABSTIME, &ts, NULL);
+    }
+}
+
+static flash_result_t sim_read(void *context, uint32_t address,
+                               uint8_t *data, uint32_t length)
+{
+    flash_sim_t *sim = (flash_sim_t *)context;
+
+    (void)memcpy(data, image_at(sim, address), length);
+
+    return FLASH_RESULT_OK;
+}
+
+static flash_result_t sim_blank_check(void *context, uint32_t address,
+                                      uint32_t length)
+{
+    flash_sim_t *sim = (flash_sim_t *)context;
+
+    return image_blank(image_at(sim, address), length) ?
+           FLASH_RESULT_OK : FLASH_RESULT_NOT_BLANK;
+}
+
+const flash_ops_t g_flash_sim_ops = {
+    .init = NULL,
+    .erase_start = sim_erase_start,
+    .program_start = sim_program_start,
+    .get_status = sim_get_status,
+    .wait = sim_wait,
+    .read = sim_read,
+    .blank_check = sim_blank_check
+};
+
+flash_result_t flash_sim_open(flash_sim_t *sim, const char *path)
+{
+    struct stat st;
+    bool erase = true;
+    void *memory;
+
+    if (sim == NULL) {
+        return FLASH_RESULT_INVALID_PARAM;
+    }
+
+    sim->memory = NULL;
+    sim->fd = -1;
+    if (path == NULL) {
+        memory = mmap(NULL, FLASH_PFLASH_SIZE, PROT_READ | PROT_WRITE,
+                      MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+    } else {
+        sim->fd = open(path, O_RDWR | O_CREAT, 0644);
+        if ((sim->fd < 0) || (fstat(sim->fd, &st) != 0)) {
+            flash_sim_close(sim);
+            return FLASH_RESULT_ERROR;
+        }
+        /* An image of the right size is kept as it is */
+        if (st.st_size == (off_t)FLASH_PFLASH_SIZE) {
+            erase = false;
+        } else if (ftruncate(sim->fd, (off_t)FLASH_PFLASH_SIZE) != 0) {
+            flash_sim_close(sim);
+            return FLASH_RESULT_ERROR;
+        }
+        memory = mmap(NULL, FLASH_PFLASH_SIZE, PROT_READ | PROT_WRITE,
+                      MAP_SHARED, sim->fd, 0);
+    }
+    if (memory == MAP_FAILED) {
+        flash_sim_close(sim);
+        return FLASH_RESULT_ERROR;
+    }
+
+    sim->memory = (uint8_t *)memory;
+    if (erase) {
+        (void)memset(sim->memory, FLASH_ERASED_VALUE, FLASH_PFLASH_SIZE);
+    }
+
+    sim->erase_us = FLASH_SIM_ERASE_US;
+    sim->program_us = FLASH_SIM_PROGRAM_US;
+    sim->program_unit_us = FLASH_SIM_PROGRAM_UNIT_US;
+    sim->op = FLASH_SIM_OP_NONE;
+    sim->op_data = NULL;
+    sim->last_result = FLASH_RESULT_OK;
+
+    return FLASH_RESULT_OK;
+}
+
+void flash_sim_close(flash_sim_t *sim)
+{
+    if (sim == NULL) {
+        return;
+    }
+
+    if (sim->memory != NULL) {
+        (void)munmap(sim->memory, FLASH_PFLASH_SIZE);
+        sim->memory = NULL;
+    }
+    if (sim->fd >= 0) {
+        (void)close(sim->fd);
+        sim->fd = -1;
+    }
+}
+
+#endif /* FLASH_BACKEND_SIM */
@@ -0,0 +1,63 @@
+#ifndef FLASH_SIM_H
+#define FLASH_SIM_H
+
+#include "flash_hal.h"
+
+/**
+ * @file flash_sim.h
+ * @brief Simulated program flash for host builds
+ *
+ * The flash image lives in a mapped file, so it survives a run and can be
+ * inspected. Erase and program take as long as configured below and only
+ * change the image when they complete. A program unit that is not blank
+ * fails, as its ECC word would on the C40 controller.
+ */
+
+/* Latencies in the order of the S32K3 datasheet typical values */
+#ifndef FLASH_SIM_ERASE_US
+#define FLASH_SIM_ERASE_US          12000U      /* Per 8 KB sector */
+#endif
+
+#ifndef FLASH_SIM_PROGRAM_US
+#define FLASH_SIM_PROGRAM_US        40U         /* Per program operation */
+#endif
+
+#ifndef FLASH_SIM_PROGRAM_UNIT_US
+#define FLASH_SIM_PROGRAM_UNIT_US   5U          /* Per 128 bit unit */
+#endif
+
+/* Operation in progress */
+typedef enum {
+    FLASH_SIM_OP_NONE = 0,
+    FLASH_SIM_OP_ERASE,
+    FLASH_SIM_OP_PROGRAM
+} flash_sim_op_t;
+
+/* Simulated flash state */
+typedef struct {
+    uint8_t *memory;                    /* FLASH_PFLASH_SIZE bytes image */
+    int fd;                             /* -1 for an anonymous image */
+    uint32_t erase_us;
+    uint32_t program_us;
+    uint32_t program_unit_us;
+    flash_sim_op_t op;
+    uint32_t op_address;
+    const uint8_t *op_data;
+    uint32_t op_length;
+    uint64_t op_done_ns;                /* Monotonic completion time */
+    flash_result_t last_result;
+} flash_sim_t;
+
+/* Map the image in 'path', created erased if it does not exist yet.
+ * A NULL path gives an erased image in memory only. Latencies start at
+ * the FLASH_SIM_* defaults and may be changed in the struct afterwards. */
+flash_result_t flash_sim_open(
+    flash_sim_t *sim,
+    const char *path
+);
+
+void flash_sim_close(
+    flash_sim_t *sim
+);
+
+#endif /* FLASH_SIM_H */
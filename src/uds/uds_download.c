@@ -0,0 +1,685 @@
+#include "uds_download.h"
+#include <string.h>
+
+const uds_service_t uds_service_request_download = {
+    .sid = UDS_SID_REQUEST_DOWNLOAD,
+    .sessions = UDS_SESSION_BIT(UDS_SESSION_PROGRAMMING),
+    .security_level = 1U,
+    .flags = 0U,
+    .min_length = 4U,                   /* Format, address and length format, 1 + 1 */
+    .subfunctions = { 0U, 0U, 0U, 0U },
+    .handler = uds_handle_request_download
+};
+
+const uds_service_t uds_service_transfer_data = {
+    .sid = UDS_SID_TRANSFER_DATA,
+    .sessions = UDS_SESSION_BIT(UDS_SESSION_PROGRAMMING),
+    .security_level = 1U,
+    .flags = 0U,
+    .min_length = 1U,                   /* Block sequence counter */
+    .subfunctions = { 0U, 0U, 0U, 0U },
+    .handler = uds_handle_transfer_data
+};
+
+const uds_service_t uds_service_request_transfer_exit = {
+    .sid = UDS_SID_REQUEST_TRANSFER_EXIT,
+    .sessions = UDS_SESSION_BIT(UDS_SESSION_PROGRAMMING),
+    .security_level = 1U,
+    .flags = 0U,
+    .min_length = 0U,
+    .subfunctions = { 0U, 0U, 0U, 0U },
+    .handler = uds_handle_request_transfer_exit
+};
+
+void uds_download_init(
+    uds_download_t *download,
+    const uds_download_memory_t *memory,
+    const uds_download_region_t *regions,
+    uint32_t region_count)
+{
+    if (download == NULL) {
+        return;
+    }
+
+    download->memory = memory;
+    download->regions = regions;
+    download->region_count = region_count;
+    download->max_block_length = UDS_DOWNLOAD_BLOCK_SIZE + 2U;
+    download->active = false;
+    download->failed = false;
+    download->head = 0U;
+    download->staged = 0U;
+    download->fill = 0U;
+    download->writing = false;
+    download->stream_length = 0U;
+    download->stream_offset = 0U;
+    crc32_init(&download->crc);
+    (void)memset(&download->stats, 0, sizeof(download->stats));
+}
+
+void uds_download_set_max_block_length(
+    uds_download_t *download,
+    uint32_t length)
+{
+    if ((download != NULL) && (length >= 3U)) {
+        download->max_block_length = length;
+    }
+}
+
+void uds_download_attach(
+    uds_context_t *context,
+    uds_download_t *download)
+{
+    if (context != NULL) {
+        context->download = download;
+    }
+}
+
+void uds_register_download_services(uds_service_table_t *table)
+{
+    (void)uds_register_service(table, &uds_service_request_download);
+    (void)uds_register_service(table, &uds_service_transfer_data);
+    (void)uds_register_service(table, &uds_service_request_transfer_exit);
+}
+
+/* Retires finished writes and starts the next staged buffer. Blocks
+ * until at most 'max_staged' buffers are outstanding, so
+ * UDS_DOWNLOAD_BUFFER_COUNT never blocks and 0 drains everything. */
+static bool download_pump(uds_download_t *download, uint32_t max_staged)
+{
+    const uds_download_memory_t *memory = download->memory;
+    uds_download_memory_status_t status;
+    uint32_t head;
+
+    while (!download->failed) {
+        if (download->writing) {
+            status = memory->write_status(memory->context,
+                                          download->staged > max_staged);
+            if (status == UDS_DOWNLOAD_MEMORY_BUSY) {
+                return true;
+            }
+            download->writing = false;
+            if (status == UDS_DOWNLOAD_MEMORY_ERROR) {
+                download->failed = true;
+                break;
+            }
+            download->head = (download->head + 1U) % UDS_DOWNLOAD_BUFFER_COUNT;
+            download->staged--;
+            download->stats.blocks++;
+        }
+
+        if (download->staged == 0U) {
+            return true;
+        }
+
+        head = download->head;
+        if (!memory->write_start(memory->context,
+                download->buffer_address[head], download->buffers[head],
+                download->buffer_length[head])) {
+            download->failed = true;
+            break;
+        }
+        download->writing = true;
+
+        if (download->staged <= max_staged) {
+            return true;
+        }
+    }
+
+    /* Staged data of a failed download is dropped */
+    download->staged = 0U;
+    download->fill = 0U;
+
+    return false;
+}
+
+/* Hands the buffer being filled to memory */
+static bool download_commit(uds_download_t *download)
+{
+    uint32_t slot = (download->head + download->staged) % UDS_DOWNLOAD_BUFFER_COUNT;
+
+    if (download->fill == 0U) {
+        return !download->failed;
+    }
+    download->buffer_length[slot] = download->fill;
+    download->fill = 0U;
+    download->staged++;
+
+    /* Starts the write if memory is idle, the response does not wait */
+    return download_pump(download, UDS_DOWNLOAD_BUFFER_COUNT);
+}
+
+/* Copies block data into the staging buffers, each full buffer goes to
+ * memory. False if programming failed. */
+static bool download_stage(
+    uds_download_t *download,
+    const uint8_t *data,
+    uint32_t length)
+{
+    uint32_t slot;
+    uint32_t span;
+
+    while (length > 0U) {
+        slot = (download->head + download->staged) % UDS_DOWNLOAD_BUFFER_COUNT;
+        if (download->fill == 0U) {
+            /* Wait for a free staging buffer, the other one is being written */
+            if (download->staged >= UDS_DOWNLOAD_BUFFER_COUNT) {
+                download->stats.stalls++;
+            }
+            if (!download_pump(download, UDS_DOWNLOAD_BUFFER_COUNT - 1U)) {
+                return false;
+            }
+            slot = (download->head + download->staged) % UDS_DOWNLOAD_BUFFER_COUNT;
+            download->buffer_address[slot] = download->address;
+        }
+
+        span = UDS_DOWNLOAD_BLOCK_SIZE - download->fill;
+        if (span > length) {
+            span = length;
+        }
+        (void)memcpy(&download->buffers[slot][download->fill], data, span);
+
+        /* Checked at exit without reading the memory back */
+        crc32_update(&download->crc, &download->buffers[slot][download->fill], span);
+
+        download->fill += span;
+        download->address += span;
+        download->remaining -= span;
+        download->stats.bytes += span;
+        data = &data[span];
+        length -= span;
+
+        if ((download->fill == UDS_DOWNLOAD_BLOCK_SIZE) && !download_commit(download)) {
+            return false;
+        }
+    }
+
+    return true;
+}
+
+bool uds_download_poll(uds_download_t *download)
+{
+    const uds_download_memory_t *memory;
+    bool outstanding = false;
+    uint32_t pass;
+
+    if ((download == NULL) || (download->memory == NULL)) {
+        return false;
+    }
+
+    memory = download->memory;
+    /* A pass retires the written block and starts the next staged one */
+    for (pass = 0U; pass <= UDS_DOWNLOAD_BUFFER_COUNT; pass++) {
+        if (download->active) {
+            (void)download_pump(download, UDS_DOWNLOAD_BUFFER_COUNT);
+        }
+        outstanding = (memory->poll != NULL) && memory->poll(memory->context);
+        if (!download->active || !download->writing) {
+            break;
+        }
+    }
+
+    return outstanding || (download->active && download->writing);
+}
+
+void uds_download_session(uds_download_t *download, bool programming)
+{
+    const uds_download_memory_t *memory;
+
+    if ((download == NULL) || (download->memory == NULL)) {
+        return;
+    }
+
+    memory = download->memory;
+    if (!programming) {
+        uds_download_abort(download);
+        if (memory->prepare_ahead != NULL) {
+            memory->prepare_ahead(memory->context, 0U, 0U);
+        }
+    } else if (!download->active && (download->region_count > 0U) &&
+               (memory->prepare_ahead != NULL)) {
+        memory->prepare_ahead(memory->context, download->regions[0].address,
+                              download->regions[0].size);
+    }
+}
+
+void uds_download_abort(uds_download_t *download)
+{
+    if ((download == NULL) || !download->active) {
+        return;
+    }
+
+    /* The memory may still read the head buffer */
+    if (download->writing) {
+        (void)download->memory->write_status(download->memory->context, true);
+        download->writing = false;
+    }
+    download->staged = 0U;
+    download->fill = 0U;
+    download->active = false;
+}
+
+/* Big endian field of 1 to 4 bytes */
+static uint32_t read_field(const uint8_t *data, uint32_t length)
+{
+    uint32_t value = 0U;
+    uint32_t i;
+
+    for (i = 0U; i < length; i++) {
+        value = (value << 8) | (uint32_t)data[i];
+    }
+
+    return value;
+}
+
+static bool region_allowed(
+    const uds_download_t *download,
+    uint32_t address,
+    uint32_t size)
+{
+    const uds_download_region_t *region;
+    uint32_t i;
+
+    for (i = 0U; i < download->region_count; i++) {
+        region = &download->regions[i];
+        /* Written without address + size, which may wrap */
+        if ((address >= region->address) &&
+            ((address - region->address) < region->size) &&
+            (size <= (region->size - (address - region->address)))) {
+            return true;
+        }
+    }
+
+    return false;
+}
+
+void uds_handle_request_download(
+    uds_context_t *context,
+    const uds_request_t *request,
+    uds_response_t *response)
+{
+    uds_download_t *download;
+    uint8_t *resp_data;
+    uint32_t address_length;
+    uint32_t size_length;
+    uint32_t address;
+    uint32_t size;
+    uint32_t block_length;
+    uint32_t length_bytes;
+    uint32_t i;
+
+    if ((request == NULL) || (response == NULL) || (context == NULL)) {
+        return;
+    }
+
+    download = context->download;
+    if ((download != NULL) && download->failed) {
+        /* A new download replaces one that failed programming */
+        uds_download_abort(download);
+    }
+    if ((download == NULL) || (download->memory == NULL) || download->active) {
+        uds_send_negative_response(UDS_SID_REQUEST_DOWNLOAD,
+                                  UDS_NRC_CONDITIONS_NOT_CORRECT,
+                                  response);
+        return;
+    }
+
+    /* addressAndLengthFormatIdentifier: size bytes high, address bytes low */
+    address_length = (uint32_t)request->data[1] & 0x0FU;
+    size_length = (uint32_t)request->data[1] >> 4;
+    if ((address_length == 0U) || (address_length > 4U) ||
+        (size_length == 0U) || (size_length > 4U)) {
+        uds_send_negative_response(UDS_SID_REQUEST_DOWNLOAD,
+                                  UDS_NRC_REQUEST_OUT_OF_RANGE,
+                                  response);
+        return;
+    }
+    if (request->length != (2U + address_length + size_length)) {
+        uds_send_negative_response(UDS_SID_REQUEST_DOWNLOAD,
+                                  UDS_NRC_INCORRECT_MESSAGE_LENGTH,
+                                  response);
+        return;
+    }
+
+    address = read_field(&request->data[2], address_length);
+    size = read_field(&request->data[2U + address_length], size_length);
+
+    /* Plain data only, no compression or encryption method */
+    if ((request->data[0] != 0x00U) || (size == 0U) ||
+        !region_allowed(download, address, size)) {
+        uds_send_negative_response(UDS_SID_REQUEST_DOWNLOAD,
+                                  UDS_NRC_REQUEST_OUT_OF_RANGE,
+                                  response);
+        return;
+    }
+
+    if ((download->memory->prepare != NULL) &&
+        !download->memory->prepare(download->memory->context, address, size)) {
+        uds_send_negative_response(UDS_SID_REQUEST_DOWNLOAD,
+                                  UDS_NRC_UPLOAD_DOWNLOAD_NOT_ACCEPTED,
+                                  response);
+        return;
+    }
+
+    download->active = true;
+    download->failed = false;
+    download->address = address;
+    download->remaining = size;
+    download->next_counter = 0x01U;
+    download->block_received = false;
+    download->head = 0U;
+    download->staged = 0U;
+    download->fill = 0U;
+    download->writing = false;
+    crc32_init(&download->crc);
+    (void)memset(&download->stats, 0, sizeof(download->stats));
+
+    /* lengthFormatIdentifier: bytes of maxNumberOfBlockLength in the high
+     * nibble, two unless the transport takes more than 0xFFFF */
+    block_length = download->max_block_length;
+    length_bytes = 2U;
+    while ((length_bytes < 4U) && ((block_length >> (8U * length_bytes)) != 0U)) {
+        length_bytes++;
+    }
+    resp_data = uds_begin_positive_response(UDS_SID_REQUEST_DOWNLOAD,
+                                            1U + length_bytes, response);
+    if (resp_data != NULL) {
+        resp_data[0] = (uint8_t)(length_bytes << 4);
+        for (i = 0U; i < length_bytes; i++) {
+            resp_data[1U + i] = (uint8_t)(block_length >> (8U * (length_bytes - 1U - i)));
+        }
+    }
+}
+
+/* NRC for block 'counter' of 'length' data bytes, 0 if it is taken.
+ * 'repeat' is set for a repeat of the last block. */
+static uint8_t transfer_data_check(
+    uds_download_t *download,
+    uint8_t counter,
+    uint32_t length,
+    bool *repeat)
+{
+    *repeat = false;
+
+    if ((download == NULL) || !download->active) {
+        return UDS_NRC_REQUEST_SEQUENCE_ERROR;
+    }
+
+    if (counter != download->next_counter) {
+        /* The tester lost our response and repeats the last block, which
+         * is acknowledged again but not written twice */
+        if (download->block_received &&
+            (counter == (uint8_t)(download->next_counter - 1U))) {
+            download->stats.repeated_blocks++;
+            *repeat = true;
+            return 0U;
+        }
+        return UDS_NRC_WRONG_BLOCK_SEQUENCE_COUNTER;
+    }
+
+    if ((length == 0U) || (length > (download->max_block_length - 2U))) {
+        return UDS_NRC_INCORRECT_MESSAGE_LENGTH;
+    }
+    if (length > download->remaining) {
+        return UDS_NRC_TRANSFER_DATA_SUSPENDED;
+    }
+
+    return 0U;
+}
+
+/* The staged block is complete. A block ends its last buffer, so buffers
+ * never straddle blocks. */
+static uint8_t transfer_data_complete(uds_download_t *download)
+{
+    if (!download_commit(download)) {
+        return UDS_NRC_GENERAL_PROGRAMMING_FAILURE;
+    }
+    download->next_counter++;           /* 0xFF wraps to 0x00 */
+    download->block_received = true;
+
+    return 0U;
+}
+
+static void transfer_data_respond(
+    uint8_t sid,
+    uint8_t counter,
+    uint8_t nrc,
+    uds_response_t *response)
+{
+    uint8_t *resp_data;
+
+    if (nrc != 0U) {
+        uds_send_negative_response(sid, nrc, response);
+        return;
+    }
+
+    resp_data = uds_begin_positive_response(UDS_SID_TRANSFER_DATA, 1U, response);
+    if (resp_data != NULL) {
+        resp_data[0] = counter;
+    }
+}
+
+void uds_handle_transfer_data(
+    uds_context_t *context,
+    const uds_request_t *request,
+    uds_response_t *response)
+{
+    uds_download_t *download;
+    uint8_t counter;
+    uint32_t length;
+    uint8_t nrc;
+    bool repeat;
+
+    if ((request == NULL) || (response == NULL) || (context == NULL)) {
+        return;
+    }
+
+    download = context->download;
+    counter = request->data[0];
+    length = request->length - 1U;
+
+    nrc = transfer_data_check(download, counter, length, &repeat);
+    if ((nrc == 0U) && !repeat) {
+        if (download_stage(download, &request->data[1], length)) {
+            nrc = transfer_data_complete(download);
+        } else {
+            nrc = UDS_NRC_GENERAL_PROGRAMMING_FAILURE;
+        }
+    }
+
+    transfer_data_respond(UDS_SID_TRANSFER_DATA, counter, nrc, response);
+}
+
+bool uds_download_stream_start(
+    uds_context_t *context,
+    uint32_t length)
+{
+    uds_download_t *download;
+
+    if ((context == NULL) || (context->download == NULL) || (length < 2U)) {
+        return false;
+    }
+
+    download = context->download;
+    download->stream_length = length;
+    download->stream_offset = 0U;
+    download->stream_nrc = 0U;
+    download->stream_repeat = false;
+
+    return true;
+}
+
+/* SID and counter are in: the same checks as a reassembled request */
+static uint8_t stream_check(uds_context_t *context)
+{
+    uds_download_t *download = context->download;
+    uds_request_t request = {
+        .sid = download->stream_header[0],
+        .data = &download->stream_header[1],
+        .length = download->stream_length - 1U
+    };
+    uint8_t nrc;
+
+    nrc = uds_request_nrc(context, &request);
+    if ((nrc == 0U) && (request.sid != UDS_SID_TRANSFER_DATA)) {
+        /* No other service takes a request of this size */
+        nrc = UDS_NRC_INCORRECT_MESSAGE_LENGTH;
+    }
+    if (nrc == 0U) {
+        nrc = transfer_data_check(download, download->stream_header[1],
+                                  download->stream_length - 2U,
+                                  &download->stream_repeat);
+    }
+
+    return nrc;
+}
+
+void uds_download_stream_data(
+    uds_context_t *context,
+    const uint8_t *data,
+    uint32_t length)
+{
+    uds_download_t *download;
+
+    if ((context == NULL) || (context->download == NULL) || (data == NULL)) {
+        return;
+    }
+
+    download = context->download;
+    if (length > (download->stream_length - download->stream_offset)) {
+        length = download->stream_length - download->stream_offset;
+    }
+
+    /* The header may be split across parts like anything else */
+    while ((length > 0U) && (download->stream_offset < 2U)) {
+        download->stream_header[download->stream_offset] = data[0];
+        download->stream_offset++;
+        data = &data[1];
+        length--;
+        if (download->stream_offset == 2U) {
+            download->stream_nrc = stream_check(context);
+        }
+    }
+
+    if ((length > 0U) && (download->stream_nrc == 0U) && !download->stream_repeat &&
+        !download_stage(download, data, length)) {
+        download->stream_nrc = UDS_NRC_GENERAL_PROGRAMMING_FAILURE;
+    }
+    download->stream_offset += length;
+}
+
+bool uds_download_stream_end(
+    uds_context_t *context,
+    uds_response_t *response)
+{
+    uds_download_t *download;
+    uint8_t nrc;
+
+    if ((context == NULL) || (context->download == NULL) || (response == NULL)) {
+        return false;
+    }
+
+    download = context->download;
+    response->actual_length = 0U;
+    response->suppressed = false;
+
+    nrc = download->stream_nrc;
+    if (download->stream_offset != download->stream_length) {
+        nrc = UDS_NRC_INCORRECT_MESSAGE_LENGTH;
+    } else if ((nrc == 0U) && !download->stream_repeat) {
+        nrc = transfer_data_complete(download);
+    } else {
+        /* Refused or repeated, nothing was staged */
+    }
+
+    transfer_data_respond(download->stream_header[0], download->stream_header[1],
+                          nrc, response);
+    download->stream_length = 0U;
+    download->stream_offset = 0U;
+
+    return (response->actual_length > 0U);
+}
+
+void uds_download_stream_abort(uds_context_t *context)
+{
+    uds_download_t *download;
+
+    if ((context == NULL) || (context->download == NULL)) {
+        return;
+    }
+
+    download = context->download;
+    if ((download->stream_offset > 2U) && (download->stream_nrc == 0U) &&
+        !download->stream_repeat) {
+        uds_download_abort(download);
+    }
+    download->stream_length = 0U;
+    download->stream_offset = 0U;
+}
+
+void uds_handle_request_transfer_exit(
+    uds_context_t *context,
+    const uds_request_t *request,
+    uds_response_t *response)
+{
+    uds_download_t *download;
+    uint8_t *resp_data;
+    uint32_t crc;
+    uint32_t expected;
+    bool written;
+
+    if ((request == NULL) || (response == NULL) || (context == NULL)) {
+        return;
+    }
+
+    /* No parameter record, or the CRC of the download */
+    if ((request->length != 0U) && (request->length != UDS_DOWNLOAD_CRC_LENGTH)) {
+        uds_send_negative_response(UDS_SID_REQUEST_TRANSFER_EXIT,
+                                  UDS_NRC_INCORRECT_MESSAGE_LENGTH,
+                                  response);
+        return;
+    }
+
+    download = context->download;
+    if ((download == NULL) || !download->active ||
+        (download->remaining != 0U)) {
+        uds_send_negative_response(UDS_SID_REQUEST_TRANSFER_EXIT,
+                                  UDS_NRC_REQUEST_SEQUENCE_ERROR,
+                                  response);
+        return;
+    }
+
+    /* Everything staged has to be in memory before the exit is confirmed */
+    written = download_pump(download, 0U);
+    if (written && (download->memory->finish != NULL)) {
+        written = download->memory->finish(download->memory->context);
+    }
+    download->active = false;
+
+    crc = crc32_value(&download->crc);
+    if (request->length == UDS_DOWNLOAD_CRC_LENGTH) {
+        expected = ((uint32_t)request->data[0] << 24) |
+                   ((uint32_t)request->data[1] << 16) |
+                   ((uint32_t)request->data[2] << 8) |
+                   (uint32_t)request->data[3];
+        if (crc != expected) {
+            written = false;
+        }
+    }
+
+    if (!written) {
+        uds_send_negative_response(UDS_SID_REQUEST_TRANSFER_EXIT,
+                                  UDS_NRC_GENERAL_PROGRAMMING_FAILURE,
+                                  response);
+        return;
+    }
+
+    resp_data = uds_begin_positive_response(UDS_SID_REQUEST_TRANSFER_EXIT,
+                                            UDS_DOWNLOAD_CRC_LENGTH, response);
+    if (resp_data != NULL) {
+        resp_data[0] = (uint8_t)(crc >> 24);
+        resp_data[1] = (uint8_t)(crc >> 16);
+        resp_data[2] = (uint8_t)(crc >> 8);
+        resp_data[3] = (uint8_t)crc;
+    }
+}
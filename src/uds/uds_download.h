@@ -0,0 +1,190 @@
+#ifndef UDS_DOWNLOAD_H
+#define UDS_DOWNLOAD_H
+
+#include <stdint.h>
+#include <stdbool.h>
+#include "uds_services.h"
+#include "crc32.h"
+
+/* Bytes per staging buffer and per write to memory. The default
+ * maxNumberOfBlockLength is this plus SID and block sequence counter,
+ * which fits a 4096 byte DoIP payload; larger blocks span buffers. */
+#ifndef UDS_DOWNLOAD_BLOCK_SIZE
+#define UDS_DOWNLOAD_BLOCK_SIZE                 4080U
+#endif
+
+/* Staging buffers: one is written to memory while the next is received */
+#define UDS_DOWNLOAD_BUFFER_COUNT               2U
+
+/* transferRequestParameterRecord of RequestTransferExit: CRC-32 of the
+ * downloaded data, most significant byte first. The response returns the
+ * CRC of the data received in the same form. */
+#define UDS_DOWNLOAD_CRC_LENGTH                 4U
+
+/* Download specific NRCs */
+#define UDS_NRC_UPLOAD_DOWNLOAD_NOT_ACCEPTED    0x70U
+#define UDS_NRC_TRANSFER_DATA_SUSPENDED         0x71U
+#define UDS_NRC_GENERAL_PROGRAMMING_FAILURE     0x72U
+#define UDS_NRC_WRONG_BLOCK_SEQUENCE_COUNTER    0x73U
+
+/* State of the memory behind a download */
+typedef enum {
+    UDS_DOWNLOAD_MEMORY_IDLE = 0,       /* Last write finished */
+    UDS_DOWNLOAD_MEMORY_BUSY,
+    UDS_DOWNLOAD_MEMORY_ERROR           /* Last write failed */
+} uds_download_memory_status_t;
+
+/* Memory a download is written to. Writes run in the background: the
+ * data passed to write_start stays untouched until write_status no
+ * longer reports BUSY. */
+typedef struct {
+    /* RequestDownload accepted for 'size' bytes at 'address', e.g. to
+     * start erasing. False refuses the download. */
+    bool (*prepare)(void *context, uint32_t address, uint32_t size);
+
+    bool (*write_start)(void *context, uint32_t address,
+                        const uint8_t *data, uint32_t length);
+
+    /* With 'wait' set, blocks until the write is no longer busy */
+    uds_download_memory_status_t (*write_status)(void *context, bool wait);
+
+    /* All data written, RequestTransferExit. False fails the transfer. */
+    bool (*finish)(void *context);
+
+    /* Optional: the programming session was entered, 'size' bytes at
+     * 'address' may be prepared in the background. Size 0 stops it. */
+    void (*prepare_ahead)(void *context, uint32_t address, uint32_t size);
+
+    /* Optional: background work between requests, such as finishing the
+     * running write. True while some is left. */
+    bool (*poll)(void *context);
+
+    void *context;
+} uds_download_memory_t;
+
+/* Address range a download may target */
+typedef struct {
+    uint32_t address;
+    uint32_t size;
+} uds_download_region_t;
+
+/* Download counters */
+typedef struct {
+    uint32_t blocks;                    /* Staging buffers written */
+    uint32_t repeated_blocks;           /* Retransmissions answered without writing */
+    uint32_t stalls;                    /* TransferData waited for a staging buffer */
+    uint32_t bytes;
+} uds_download_stats_t;
+
+/* Download engine of one UDS server */
+typedef struct uds_download {
+    const uds_download_memory_t *memory;
+    const uds_download_region_t *regions;
+    uint32_t region_count;
+    uint32_t max_block_length;          /* maxNumberOfBlockLength, SID and counter included */
+    bool active;
+    bool failed;                        /* A write failed, the download is lost */
+    uint32_t address;                   /* Where the next block goes */
+    uint32_t remaining;                 /* Bytes still expected */
+    uint8_t next_counter;               /* blockSequenceCounter of the next block */
+    bool block_received;                /* A repeat of next_counter - 1 is valid */
+    uint8_t buffers[UDS_DOWNLOAD_BUFFER_COUNT][UDS_DOWNLOAD_BLOCK_SIZE];
+    uint32_t buffer_address[UDS_DOWNLOAD_BUFFER_COUNT];
+    uint32_t buffer_length[UDS_DOWNLOAD_BUFFER_COUNT];
+    uint32_t head;                      /* Oldest staged buffer */
+    uint32_t staged;                    /* Buffers waiting or being written */
+    uint32_t fill;                      /* Bytes in the buffer after the staged ones */
+    bool writing;                       /* The head buffer is being written */
+    crc32_t crc;                        /* Of the data received so far */
+    uint32_t stream_length;             /* Streamed request, SID included */
+    uint32_t stream_offset;             /* Bytes of it received */
+    uint8_t stream_header[2];           /* SID and blockSequenceCounter */
+    uint8_t stream_nrc;                 /* Answer once refused, the rest is dropped */
+    bool stream_repeat;                 /* Repeated block, acknowledged without writing */
+    uds_download_stats_t stats;
+} uds_download_t;
+
+extern const uds_service_t uds_service_request_download;
+extern const uds_service_t uds_service_transfer_data;
+extern const uds_service_t uds_service_request_transfer_exit;
+
+void uds_download_init(
+    uds_download_t *download,
+    const uds_download_memory_t *memory,
+    const uds_download_region_t *regions,
+    uint32_t region_count
+);
+
+/* Serve 0x34, 0x36 and 0x37 of 'context' from 'download' */
+void uds_download_attach(
+    uds_context_t *context,
+    uds_download_t *download
+);
+
+/* Largest TransferData request the transport delivers, SID and counter
+ * included, announced by RequestDownload. UDS_DOWNLOAD_BLOCK_SIZE + 2
+ * until set, at least 3. */
+void uds_download_set_max_block_length(
+    uds_download_t *download,
+    uint32_t length
+);
+
+/* Adds RequestDownload, TransferData and RequestTransferExit */
+void uds_register_download_services(uds_service_table_t *table);
+
+/* The session changed: entering programming prepares the first region
+ * ahead of a download, leaving it aborts the download */
+void uds_download_session(uds_download_t *download, bool programming);
+
+/* Moves staged blocks to memory and runs background preparation without
+ * blocking, for a caller that is idle between requests. True while work
+ * is still outstanding. */
+bool uds_download_poll(uds_download_t *download);
+
+/* TransferData delivered in parts, for requests larger than the transport
+ * reassembles. The block goes straight into the staging buffers, a full
+ * one waits for the write before it. Start announces 'length' bytes, SID
+ * included, and is false without a download engine; the data follows in
+ * order and end builds the response, true if there is one to send. */
+bool uds_download_stream_start(
+    uds_context_t *context,
+    uint32_t length
+);
+
+void uds_download_stream_data(
+    uds_context_t *context,
+    const uint8_t *data,
+    uint32_t length
+);
+
+bool uds_download_stream_end(
+    uds_context_t *context,
+    uds_response_t *response
+);
+
+/* The request was cut off. Part of a block may be staged, so that drops
+ * the download. */
+void uds_download_stream_abort(uds_context_t *context);
+
+/* Drops a running download once its outstanding write has finished */
+void uds_download_abort(uds_download_t *download);
+
+void uds_handle_request_download(
+    uds_context_t *context,
+    const uds_request_t *request,
+    uds_response_t *response
+);
+
+void uds_handle_transfer_data(
+    uds_context_t *context,
+    const uds_request_t *request,
+    uds_response_t *response
+);
+
+void uds_handle_request_transfer_exit(
+    uds_context_t *context,
+    const uds_request_t *request,
+    uds_response_t *response
+);
+
+#endif /* UDS_DOWNLOAD_H */
@@ -0,0 +1,349 @@
+#include "uds_download_flash.h"
+#include <string.h>
+
+/* Where the next program goes and how long it is: the quad-page the
+ * held bytes belong to once the block fills it, 0 while it does not.
+ * On exit the rest is padded to whole program units. */
+static void next_program(
+    const uds_download_flash_t *download_flash,
+    uint32_t *address,
+    uint32_t *length)
+{
+    uint32_t start = download_flash->address - download_flash->held_length;
+    uint32_t limit = FLASH_QUAD_PAGE_SIZE - (start % FLASH_QUAD_PAGE_SIZE);
+    uint32_t total = download_flash->held_length + download_flash->remaining;
+
+    *address = start;
+    if (total >= limit) {
+        *length = limit;
+    } else if (download_flash->flushing) {
+        *length = (total + (FLASH_PROGRAM_UNIT - 1U)) &
+                  ~(FLASH_PROGRAM_UNIT - 1U);
+    } else {
+        *length = 0U;
+    }
+}
+
+/* Keep the rest of a block short of a quad-page for the next block */
+static void hold_rest(uds_download_flash_t *download_flash)
+{
+    (void)memcpy(&download_flash->line[download_flash->held_length],
+                 download_flash->data, download_flash->remaining);
+    download_flash->held_length += download_flash->remaining;
+    download_flash->data += download_flash->remaining;
+    download_flash->address += download_flash->remaining;
+    download_flash->remaining = 0U;
+}
+
+static flash_result_t program_start(
+    uds_download_flash_t *download_flash,
+    uint32_t address,
+    uint32_t length)
+{
+    uint32_t held = download_flash->held_length;
+    uint32_t consumed = length - held;  /* Bytes taken from the block */
+    const uint8_t *source = download_flash->data;
+    flash_result_t result;
+
+    if (consumed > download_flash->remaining) {
+        consumed = download_flash->remaining;
+    }
+
+    /* A full quad-page of the block is programmed in place */
+    if (consumed != length) {
+        if (consumed > 0U) {
+            (void)memcpy(&download_flash->line[held], download_flash->data, consumed);
+        }
+        (void)memset(&download_flash->line[held + consumed], FLASH_ERASED_VALUE,
+                     length - (held + consumed));
+        source = download_flash->line;
+    }
+
+    result = flash_program(download_flash->flash, address, source, length);
+    if (result == FLASH_RESULT_OK) {
+        download_flash->data += consumed;
+        download_flash->address += consumed;
+        download_flash->remaining -= consumed;
+        download_flash->held_length = 0U;
+        download_flash->programmed = true;
+        download_flash->stats.programs++;
+        download_flash->stats.bytes += held + consumed;
+        if (held > 0U) {
+            download_flash->stats.combined++;
+        }
+    }
+
+    return result;
+}
+
+static void stall_begin(uds_download_flash_t *download_flash)
+{
+    if (!download_flash->stalled) {
+        download_flash->stalled = true;
+        download_flash->stats.stalls++;
+        if (download_flash->now_ms != NULL) {
+            download_flash->stall_start_ms = download_flash->now_ms();
+        }
+    }
+}
+
+static void stall_end(uds_download_flash_t *download_flash)
+{
+    if (download_flash->stalled) {
+        download_flash->stalled = false;
+        if (download_flash->now_ms != NULL) {
+            download_flash->stats.stall_ms +=
+                download_flash->now_ms() - download_flash->stall_start_ms;
+        }
+    }
+}
+
+/* Erase the next sector now: freely before the download writes data,
+ * then only as far ahead of the data as needed */
+static bool erase_wanted(const uds_download_flash_t *download_flash)
+{
+    const flash_erase_t *erase = &download_flash->erase;
+
+    if (erase->failed || erase->erasing || (erase->frontier >= erase->end)) {
+        return false;
+    }
+
+    return !download_flash->downloading ||
+           (erase->frontier <= download_flash->address) ||
+           ((erase->frontier - download_flash->address) <
+            UDS_DOWNLOAD_FLASH_ERASE_LEAD);
+}
+
+/* The flash runs one operation at a time. The block is programmed as
+ * soon as the erase frontier covers it, the flash erases otherwise.
+ * Returns the state of the block, not of the erase. */
+static uds_download_memory_status_t download_flash_run(
+    uds_download_flash_t *download_flash)
+{
+    flash_result_t result;
+    uint32_t address;
+    uint32_t length;
+    bool pending;
+    bool covered;
+
+    if (download_flash->programming) {
+        result = flash_get_status(download_flash->flash);
+        if (result == FLASH_RESULT_BUSY) {
+            return UDS_DOWNLOAD_MEMORY_BUSY;
+        }
+        download_flash->programming = false;
+        if (result != FLASH_RESULT_OK) {
+            download_flash->failed = true;
+        }
+    }
+    if (download_flash->failed) {
+        return UDS_DOWNLOAD_MEMORY_ERROR;
+    }
+
+    result = flash_erase_poll(&download_flash->erase);
+    next_program(download_flash, &address, &length);
+    if ((length == 0U) && (download_flash->remaining > 0U)) {
+        hold_rest(download_flash);
+    }
+    pending = length > 0U;
+    covered = pending &&
+        flash_erase_covers(&download_flash->erase, address, length);
+
+    if (pending && !covered) {
+        stall_begin(download_flash);
+    } else if (covered && (result != FLASH_RESULT_BUSY)) {
+        stall_end(download_flash);
+        if (program_start(download_flash, address, length) != FLASH_RESULT_OK) {
+            download_flash->failed = true;
+            return UDS_DOWNLOAD_MEMORY_ERROR;
+        }
+        download_flash->programming = true;
+        return UDS_DOWNLOAD_MEMORY_BUSY;
+    }
+
+    if ((result != FLASH_RESULT_BUSY) && erase_wanted(download_flash)) {
+        result = flash_erase_next(&download_flash->erase);
+    }
+
+    if (!pending) {
+        return UDS_DOWNLOAD_MEMORY_IDLE;
+    }
+    if (result == FLASH_RESULT_BUSY) {
+        return UDS_DOWNLOAD_MEMORY_BUSY;
+    }
+
+    /* The frontier will not reach the block */
+    stall_end(download_flash);
+    download_flash->failed = true;
+
+    return UDS_DOWNLOAD_MEMORY_ERROR;
+}
+
+/* The erased part of the range is only blank while nothing has been
+ * programmed into it, a new request then has to check it again */
+static void drop_programmed_range(uds_download_flash_t *download_flash)
+{
+    if (download_flash->programmed) {
+        flash_erase_request(&download_flash->erase, 0U, 0U);
+        download_flash->programmed = false;
+    }
+}
+
+static bool download_flash_prepare(void *context, uint32_t address, uint32_t size)
+{
+    uds_download_flash_t *download_flash = (uds_download_flash_t *)context;
+
+    /* Erasing a partial sector would lose data in front of the download */
+    if ((address % FLASH_SECTOR_SIZE) != 0U) {
+        return false;
+    }
+
+    /* Keeps what was erased ahead since the session started, unless a
+     * download that did not finish has programmed into it since */
+    drop_programmed_range(download_flash);
+    flash_erase_request(&download_flash->erase, address, size);
+    download_flash->downloading = true;
+    download_flash->address = address;
+    download_flash->remaining = 0U;
+    download_flash->held_length = 0U;
+    download_flash->failed = false;
+    (void)memset(&download_flash->stats, 0, sizeof(download_flash->stats));
+    (void)download_flash_run(download_flash);
+
+    return true;
+}
+
+static void download_flash_prepare_ahead(void *context, uint32_t address,
+                                         uint32_t size)
+{
+    uds_download_flash_t *download_flash = (uds_download_flash_t *)context;
+
+    drop_programmed_range(download_flash);
+    flash_erase_request(&download_flash->erase, address, size);
+    if (size == 0U) {
+        download_flash->downloading = false;
+    }
+    (void)download_flash_run(download_flash);
+}
+
+static bool download_flash_poll(void *context)
+{
+    uds_download_flash_t *download_flash = (uds_download_flash_t *)context;
+    const flash_erase_t *erase = &download_flash->erase;
+
+    /* Programs are short and run back to back, an erase is left running */
+    while ((download_flash_run(download_flash) == UDS_DOWNLOAD_MEMORY_BUSY) &&
+           download_flash->programming) {
+        (void)flash_wait(download_flash->flash);
+    }
+
+    return download_flash->programming || erase->erasing ||
+           erase_wanted(download_flash);
+}
+
+static bool download_flash_write_start(void *context, uint32_t address,
+                                       const uint8_t *data, uint32_t length)
+{
+    uds_download_flash_t *download_flash = (uds_download_flash_t *)context;
+
+    /* Held bytes belong right in front of the block */
+    if ((download_flash->held_length > 0U) ?
+            (address != download_flash->address) :
+            ((address % FLASH_PROGRAM_UNIT) != 0U)) {
+        return false;
+    }
+
+    download_flash->data = data;
+    download_flash->address = address;
+    download_flash->remaining = length;
+    download_flash->failed = false;
+
+    return download_flash_run(download_flash) != UDS_DOWNLOAD_MEMORY_ERROR;
+}
+
+static uds_download_memory_status_t download_flash_write_status(void *context, bool wait)
+{
+    uds_download_flash_t *download_flash = (uds_download_flash_t *)context;
+    uds_download_memory_status_t status;
+
+    for (;;) {
+        status = download_flash_run(download_flash);
+        if ((status != UDS_DOWNLOAD_MEMORY_BUSY) || !wait) {
+            return status;
+        }
+        (void)flash_wait(download_flash->flash);
+    }
+}
+
+static bool download_flash_finish(void *context)
+{
+    uds_download_flash_t *download_flash = (uds_download_flash_t *)context;
+    uds_download_memory_status_t status;
+
+    /* The held end of the download goes to flash padded */
+    download_flash->flushing = true;
+    for (;;) {
+        status = download_flash_run(download_flash);
+        if (status != UDS_DOWNLOAD_MEMORY_BUSY) {
+            break;
+        }
+        (void)flash_wait(download_flash->flash);
+    }
+    download_flash->flushing = false;
+
+    /* Data is in the range now, a later download checks it again */
+    flash_erase_request(&download_flash->erase, 0U, 0U);
+    download_flash->programmed = false;
+    download_flash->downloading = false;
+    while (download_flash->erase.erasing) {
+        (void)flash_wait(download_flash->flash);
+        (void)flash_erase_poll(&download_flash->erase);
+    }
+
+    return status == UDS_DOWNLOAD_MEMORY_IDLE;
+}
+
+void uds_download_flash_init(
+    uds_download_flash_t *download_flash,
+    flash_t *flash,
+    uds_download_memory_t *memory)
+{
+    if ((download_flash == NULL) || (memory == NULL)) {
+        return;
+    }
+
+    download_flash->flash = flash;
+    flash_erase_init(&download_flash->erase, flash);
+    download_flash->downloading = false;
+    download_flash->programmed = false;
+    download_flash->data = NULL;
+    download_flash->address = 0U;
+    download_flash->remaining = 0U;
+    download_flash->programming = false;
+    download_flash->held_length = 0U;
+    download_flash->flushing = false;
+    download_flash->failed = false;
+    download_flash->stalled = false;
+    download_flash->stall_start_ms = 0U;
+    download_flash->now_ms = NULL;
+    (void)memset(&download_flash->stats, 0, sizeof(download_flash->stats));
+
+    memory->prepare = download_flash_prepare;
+    memory->write_start = download_flash_write_start;
+    memory->write_status = download_flash_write_status;
+    memory->finish = download_flash_finish;
+    memory->prepare_ahead = download_flash_prepare_ahead;
+    memory->poll = download_flash_poll;
+    memory->context = download_flash;
+}
+
+uint32_t uds_download_flash_programs_per_mb(
+    const uds_download_flash_t *download_flash)
+{
+    if ((download_flash == NULL) || (download_flash->stats.bytes == 0U)) {
+        return 0U;
+    }
+
+    return (uint32_t)(((uint64_t)download_flash->stats.programs << 20) /
+                      download_flash->stats.bytes);
+}
@@ -0,0 +1,64 @@
+#ifndef UDS_DOWNLOAD_FLASH_H
+#define UDS_DOWNLOAD_FLASH_H
+
+#include "uds_download.h"
+#include "flash_hal.h"
+#include "flash_erase.h"
+
+/* While data is written, erasing stays this far ahead of it. Erasing
+ * further ahead would hold the flash while blocks wait to be written. */
+#ifndef UDS_DOWNLOAD_FLASH_ERASE_LEAD
+#define UDS_DOWNLOAD_FLASH_ERASE_LEAD       (2U * FLASH_SECTOR_SIZE)
+#endif
+
+/* Download counters, reset by RequestDownload */
+typedef struct {
+    uint32_t stalls;                    /* Blocks that waited for the erase frontier */
+    uint32_t stall_ms;                  /* Time spent waiting, needs a clock */
+    uint32_t programs;                  /* Program operations */
+    uint32_t combined;                  /* Programs of held bytes */
+    uint32_t bytes;                     /* Download bytes programmed */
+} uds_download_flash_stats_t;
+
+/* Download memory on program flash. Sectors are erased in the background
+ * from the programming session entry or RequestDownload on, and each
+ * block is programmed one quad-page at a time as soon as the erase
+ * frontier has passed it. The flash is shared: a block being written
+ * comes first, sectors are erased otherwise.
+ *
+ * Blocks of any size are combined into whole quad-pages: full ones are
+ * programmed straight from the block, the bytes of a block that do not
+ * fill one are held and completed by the next block. On exit the held
+ * bytes are programmed padded to a program unit. */
+typedef struct {
+    flash_t *flash;
+    flash_erase_t erase;
+    bool downloading;                   /* Between RequestDownload and exit */
+    bool programmed;                    /* Data went into the erase range */
+    const uint8_t *data;                /* Rest of the block being written */
+    uint32_t address;                   /* Where 'data' goes */
+    uint32_t remaining;
+    bool programming;                   /* A program of the block runs */
+    uint8_t line[FLASH_QUAD_PAGE_SIZE]; /* Quad-page at address - held_length */
+    uint32_t held_length;               /* Bytes of it held from earlier blocks */
+    bool flushing;                      /* Exit: program the held bytes padded */
+    bool failed;                        /* Last block could not be written */
+    bool stalled;                       /* The block waits for the frontier */
+    uint32_t stall_start_ms;
+    uint32_t (*now_ms)(void);           /* Millisecond clock, NULL if none */
+    uds_download_flash_stats_t stats;
+} uds_download_flash_t;
+
+/* Fills 'memory' to write a download to 'flash' through 'download_flash' */
+void uds_download_flash_init(
+    uds_download_flash_t *download_flash,
+    flash_t *flash,
+    uds_download_memory_t *memory
+);
+
+/* Program operations per MB of the current download, 0 before any */
+uint32_t uds_download_flash_programs_per_mb(
+    const uds_download_flash_t *download_flash
+);
+
+#endif /* UDS_DOWNLOAD_FLASH_H */
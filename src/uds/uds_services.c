@@ -1,7 +1,121 @@
 #include "uds_services.h"
+#include "uds_download.h"
 #include <string.h>
 #include <stdio.h>
 
+const uds_service_t uds_service_diagnostic_session_control = {
+    .sid = UDS_SID_DIAGNOSTIC_SESSION_CONTROL,
+    .sessions = UDS_SESSIONS_ALL,
+    .security_level = 0U,
+    .flags = UDS_SERVICE_FLAG_SUBFUNCTION,
+    .min_length = 1U,
+    .subfunctions = { UDS_SUBFUNCTION_BIT(UDS_SESSION_DEFAULT) |
+                      UDS_SUBFUNCTION_BIT(UDS_SESSION_PROGRAMMING) |
+                      UDS_SUBFUNCTION_BIT(UDS_SESSION_EXTENDED), 0U, 0U, 0U },
+    .handler = uds_handle_diagnostic_session_control
+};
+
+const uds_service_t uds_service_ecu_reset = {
+    .sid = UDS_SID_ECU_RESET,
+    .sessions = UDS_SESSIONS_ALL,
+    .security_level = 0U,
+    .flags = UDS_SERVICE_FLAG_SUBFUNCTION,
+    .min_length = 1U,
+    .subfunctions = { UDS_SUBFUNCTION_BIT(UDS_RESET_HARD) |
+                      UDS_SUBFUNCTION_BIT(UDS_RESET_KEY_OFF_ON) |
+                      UDS_SUBFUNCTION_BIT(UDS_RESET_SOFT), 0U, 0U, 0U },
+    .handler = uds_handle_ecu_reset
+};
+
+const uds_service_t uds_service_security_access = {
+    .sid = UDS_SID_SECURITY_ACCESS,
+    .sessions = UDS_SESSIONS_NON_DEFAULT,
+    .security_level = 0U,
+    .flags = UDS_SERVICE_FLAG_SUBFUNCTION,
+    .min_length = 1U,
+    .subfunctions = { UDS_SUBFUNCTION_BIT(UDS_SECURITY_REQUEST_SEED_LEVEL_1) |
+                      UDS_SUBFUNCTION_BIT(UDS_SECURITY_SEND_KEY_LEVEL_1), 0U, 0U, 0U },
+    .handler = uds_handle_security_access
+};
+
+const uds_service_t uds_service_tester_present = {
+    .sid = UDS_SID_TESTER_PRESENT,
+    .sessions = UDS_SESSIONS_ALL,
+    .security_level = 0U,
+    .flags = UDS_SERVICE_FLAG_SUBFUNCTION,
+    .min_length = 1U,
+    .subfunctions = { UDS_SUBFUNCTION_BIT(0x00U), 0U, 0U, 0U },
+    .handler = uds_handle_tester_present
+};
+
+const uds_service_t uds_service_read_data_by_id = {
+    .sid = UDS_SID_READ_DATA_BY_IDENTIFIER,
+    .sessions = UDS_SESSIONS_ALL,
+    .security_level = 0U,
+    .flags = 0U,
+    .min_length = 2U,
+    .subfunctions = { 0U, 0U, 0U, 0U },
+    .handler = uds_handle_read_data_by_id
+};
+
+/* Built-in service set of every context after uds_init() */
+static const uds_service_table_t uds_core_service_table = {
+    .services = {
+        [UDS_SID_DIAGNOSTIC_SESSION_CONTROL] = &uds_service_diagnostic_session_control,
+        [UDS_SID_ECU_RESET] = &uds_service_ecu_reset,
+        [UDS_SID_SECURITY_ACCESS] = &uds_service_security_access,
+        [UDS_SID_TESTER_PRESENT] = &uds_service_tester_present,
+        [UDS_SID_READ_DATA_BY_IDENTIFIER] = &uds_service_read_data_by_id
+    }
+};
+
+static const uint8_t uds_core_vin[17] = {
+    'W', 'V', 'W', 'Z', 'Z', 'Z', '1', 'K', 'Z', '1', 'A', '2', '3', '4', '5', '6', '7'
+};
+static const uint8_t uds_core_serial_number[11] = {
+    'S', 'N', '1', '2', '3', '4', '5', '6', '7', '8', '9'
+};
+static const uint8_t uds_core_software_number[3] = {
+    0x01U, 0x00U, 0x05U                 /* Major, minor, patch */
+};
+
+static const uds_did_t uds_did_ecu_serial_number = {
+    .did = UDS_DID_ECU_SERIAL_NUMBER,
+    .sessions = UDS_SESSIONS_ALL,
+    .security_level = 0U,
+    .length = sizeof(uds_core_serial_number),
+    .data = uds_core_serial_number,
+    .read = NULL
+};
+
+static const uds_did_t uds_did_vin = {
+    .did = UDS_DID_VIN,
+    .sessions = UDS_SESSIONS_ALL,
+    .security_level = 0U,
+    .length = sizeof(uds_core_vin),
+    .data = uds_core_vin,
+    .read = NULL
+};
+
+static const uds_did_t uds_did_ecu_software_number = {
+    .did = UDS_DID_ECU_SOFTWARE_NUMBER,
+    .sessions = UDS_SESSIONS_ALL,
+    .security_level = 0U,
+    .length = sizeof(uds_core_software_number),
+    .data = uds_core_software_number,
+    .read = NULL
+};
+
+/* Built-in DIDs of every context after uds_init(), sorted */
+static const uds_did_registry_t uds_core_did_registry = {
+    .entries = {
+        &uds_did_ecu_serial_number,
+        &uds_did_vin,
+        &uds_did_ecu_software_number
+    },
+    .count = 3U
+};
+
 void uds_init(uds_context_t *context)
 {
     if (context != NULL) {
@@ -11,6 +125,207 @@ void uds_init(uds_context_t *context)
         context->seed = 0U;
         context->failed_security_attempts = 0U;
         context->last_tester_present_time = 0U;
+        context->services = &uds_core_service_table;
+        context->dids = &uds_core_did_registry;
+        context->download = NULL;
+    }
+}
+
+void uds_service_table_init(uds_service_table_t *table)
+{
+    uint32_t i;
+
+    if (table != NULL) {
+        for (i = 0U; i < 256U; i++) {
+            table->services[i] = NULL;
+        }
+    }
+}
+
+bool uds_register_service(
+    uds_service_table_t *table,
+    const uds_service_t *service)
+{
+    if ((table == NULL) || (service == NULL) || (service->handler == NULL) ||
+        (table->services[service->sid] != NULL)) {
+        return false;
+    }
+
+    table->services[service->sid] = service;
+
+    return true;
+}
+
+void uds_register_core_services(uds_service_table_t *table)
+{
+    (void)uds_register_service(table, &uds_service_diagnostic_session_control);
+    (void)uds_register_service(table, &uds_service_ecu_reset);
+    (void)uds_register_service(table, &uds_service_security_access);
+    (void)uds_register_service(table, &uds_service_tester_present);
+    (void)uds_register_service(table, &uds_service_read_data_by_id);
+}
+
+void uds_set_service_table(
+    uds_context_t *context,
+    const uds_service_table_t *table)
+{
+    if ((context != NULL) && (table != NULL)) {
+        context->services = table;
+    }
+}
+
+void uds_pending_start(
+    uds_pending_t *pending,
+    uint8_t sid,
+    uint32_t now_ms)
+{
+    if (pending != NULL) {
+        pending->active = true;
+        pending->sid = sid;
+        pending->deadline = now_ms +
+            (UDS_P2_SERVER_MAX_MS - UDS_RESPONSE_PENDING_MARGIN_MS);
+        pending->sent_count = 0U;
+    }
+}
+
+void uds_pending_stop(uds_pending_t *pending)
+{
+    if (pending != NULL) {
+        pending->active = false;
+    }
+}
+
+bool uds_pending_poll(
+    uds_pending_t *pending,
+    uint32_t now_ms,
+    uds_response_t *response)
+{
+    if ((pending == NULL) || !pending->active ||
+        (uds_pending_timeout(pending, now_ms) > 0U)) {
+        return false;
+    }
+
+    /* Counted from now, a late poll must not cause a burst */
+    pending->deadline = now_ms +
+        (UDS_P2_STAR_SERVER_MAX_MS - UDS_RESPONSE_PENDING_MARGIN_MS);
+    pending->sent_count++;
+    uds_send_negative_response(pending->sid, UDS_NRC_RESPONSE_PENDING,
+                               response);
+
+    return true;
+}
+
+uint32_t uds_pending_timeout(
+    const uds_pending_t *pending,
+    uint32_t now_ms)
+{
+    uint32_t remaining;
+
+    if ((pending == NULL) || !pending->active) {
+        return 0xFFFFFFFFU;
+    }
+
+    /* Wrap-safe, a deadline in the past is due now */
+    remaining = pending->deadline - now_ms;
+    if ((remaining & 0x80000000U) != 0U) {
+        return 0U;
+    }
+
+    return remaining;
+}
+
+/* Index of the first entry not below 'did' */
+static uint32_t uds_did_lower_bound(
+    const uds_did_registry_t *registry,
+    uint16_t did)
+{
+    uint32_t low = 0U;
+    uint32_t high = registry->count;
+    uint32_t mid;
+
+    while (low < high) {
+        mid = low + ((high - low) / 2U);
+        if (registry->entries[mid]->did < did) {
+            low = mid + 1U;
+        } else {
+            high = mid;
+        }
+    }
+
+    return low;
+}
+
+void uds_did_registry_init(uds_did_registry_t *registry)
+{
+    if (registry != NULL) {
+        registry->count = 0U;
+    }
+}
+
+bool uds_did_register(
+    uds_did_registry_t *registry,
+    const uds_did_t *did)
+{
+    uint32_t index;
+    uint32_t i;
+
+    if ((registry == NULL) || (did == NULL) ||
+        ((did->data == NULL) && (did->read == NULL)) ||
+        (registry->count >= UDS_MAX_DIDS)) {
+        return false;
+    }
+
+    index = uds_did_lower_bound(registry, did->did);
+    if ((index < registry->count) && (registry->entries[index]->did == did->did)) {
+        return false;
+    }
+
+    for (i = registry->count; i > index; i--) {
+        registry->entries[i] = registry->entries[i - 1U];
+    }
+    registry->entries[index] = did;
+    registry->count++;
+
+    return true;
+}
+
+void uds_register_core_dids(uds_did_registry_t *registry)
+{
+    uint32_t i;
+
+    if (registry == NULL) {
+        return;
+    }
+
+    for (i = 0U; i < uds_core_did_registry.count; i++) {
+        (void)uds_did_register(registry, uds_core_did_registry.entries[i]);
+    }
+}
+
+const uds_did_t *uds_did_find(
+    const uds_did_registry_t *registry,
+    uint16_t did)
+{
+    uint32_t index;
+
+    if (registry == NULL) {
+        return NULL;
+    }
+
+    index = uds_did_lower_bound(registry, did);
+    if ((index < registry->count) && (registry->entries[index]->did == did)) {
+        return registry->entries[index];
+    }
+
+    return NULL;
+}
+
+void uds_set_did_registry(
+    uds_context_t *context,
+    const uds_did_registry_t *registry)
+{
+    if ((context != NULL) && (registry != NULL)) {
+        context->dids = registry;
     }
 }
 
@@ -47,6 +362,21 @@ void uds_send_positive_response(
     }
 }
 
+uint8_t *uds_begin_positive_response(
+    uint8_t sid,
+    uint32_t length,
+    uds_response_t *response)
+{
+    if ((response == NULL) || (response->max_length < (1U + length))) {
+        return NULL;
+    }
+    
+    response->buffer[0] = sid + UDS_POSITIVE_RESPONSE_OFFSET;
+    response->actual_length = 1U + length;
+    
+    return &response->buffer[1];
+}
+
 void uds_handle_diagnostic_session_control(
     uds_context_t *context,
     const uds_request_t *request,
@@ -56,39 +386,28 @@ void uds_handle_diagnostic_session_control(
         return;
     }
     
-    /* Check message length */
-    if (request->length < 1U) {
-        uds_send_negative_response(UDS_SID_DIAGNOSTIC_SESSION_CONTROL,
-                                  UDS_NRC_INCORRECT_MESSAGE_LENGTH,
-                                  response);
-        return;
-    }
-    
-    uint8_t session_type = request->data[0];
+    /* Length and session type are checked against the service table */
+    uint8_t session_type = UDS_SUBFUNCTION(request);
     
-    /* Validate session type */
-    if ((session_type != UDS_SESSION_DEFAULT) &&
-        (session_type != UDS_SESSION_PROGRAMMING) &&
-        (session_type != UDS_SESSION_EXTENDED)) {
-        uds_send_negative_response(UDS_SID_DIAGNOSTIC_SESSION_CONTROL,
-                                  UDS_NRC_SUB_FUNCTION_NOT_SUPPORTED,
-                                  response);
-        return;
-    }
+    /* A download does not survive leaving the programming session, and
+     * entering it starts preparing the download memory */
+    uds_download_session(context->download,
+                         session_type == UDS_SESSION_PROGRAMMING);
     
     /* Switch session */
     context->current_session = session_type;
     
     /* Send positive response */
-    uint8_t resp_data[5];
-    resp_data[0] = session_type;
-    resp_data[1] = 0x00U;  /* P2 Server Max (high byte) */
-    resp_data[2] = 0x32U;  /* P2 Server Max (low byte) = 50ms */
-    resp_data[3] = 0x01U;  /* P2* Server Max (high byte) */
-    resp_data[4] = 0xF4U;  /* P2* Server Max (low byte) = 5000ms */
-    
-    uds_send_positive_response(UDS_SID_DIAGNOSTIC_SESSION_CONTROL,
-                              resp_data, sizeof(resp_data), response);
+    uint8_t *resp_data = uds_begin_positive_response(
+        UDS_SID_DIAGNOSTIC_SESSION_CONTROL, 5U, response);
+    if (resp_data != NULL) {
+        resp_data[0] = session_type;
+        /* P2 Server Max in 1 ms, P2* Server Max in 10 ms units */
+        resp_data[1] = (uint8_t)(UDS_P2_SERVER_MAX_MS >> 8);
+        resp_data[2] = (uint8_t)(UDS_P2_SERVER_MAX_MS & 0xFFU);
+        resp_data[3] = (uint8_t)((UDS_P2_STAR_SERVER_MAX_MS / 10U) >> 8);
+        resp_data[4] = (uint8_t)((UDS_P2_STAR_SERVER_MAX_MS / 10U) & 0xFFU);
+    }
 }
 
 void uds_handle_ecu_reset(
@@ -100,38 +419,14 @@ void uds_handle_ecu_reset(
         return;
     }
     
-    if (request->length < 1U) {
-        uds_send_negative_response(UDS_SID_ECU_RESET,
-                                  UDS_NRC_INCORRECT_MESSAGE_LENGTH,
-                                  response);
-        return;
-    }
-    
-    uint8_t reset_type = request->data[0];
-    
-    /* Validate reset type */
-    if ((reset_type != UDS_RESET_HARD) &&
-        (reset_type != UDS_RESET_KEY_OFF_ON) &&
-        (reset_type != UDS_RESET_SOFT)) {
-        uds_send_negative_response(UDS_SID_ECU_RESET,
-                                  UDS_NRC_SUB_FUNCTION_NOT_SUPPORTED,
-                                  response);
-        return;
-    }
-    
-    /* Check security access */
-    if (!context->security_unlocked &&
-        (context->current_session != UDS_SESSION_DEFAULT)) {
-        uds_send_negative_response(UDS_SID_ECU_RESET,
-                                  UDS_NRC_SECURITY_ACCESS_DENIED,
-                                  response);
-        return;
-    }
+    /* Reset type and access are checked against the service table */
+    uint8_t reset_type = UDS_SUBFUNCTION(request);
     
     /* Send positive response first */
-    uint8_t resp_data[1];
-    resp_data[0] = reset_type;
-    uds_send_positive_response(UDS_SID_ECU_RESET, resp_data, 1U, response);
+    uint8_t *resp_data = uds_begin_positive_response(UDS_SID_ECU_RESET, 1U, response);
+    if (resp_data != NULL) {
+        resp_data[0] = reset_type;
+    }
     
     /* TODO: Trigger actual ECU reset after response is sent */
     /* NVIC_SystemReset(); */
@@ -146,43 +441,36 @@ void uds_handle_security_access(
         return;
     }
     
-    if (request->length < 1U) {
-        uds_send_negative_response(UDS_SID_SECURITY_ACCESS,
-                                  UDS_NRC_INCORRECT_MESSAGE_LENGTH,
-                                  response);
-        return;
-    }
-    
-    uint8_t sub_function = request->data[0];
+    uint8_t sub_function = UDS_SUBFUNCTION(request);
     
     if (sub_function == UDS_SECURITY_REQUEST_SEED_LEVEL_1) {
         /* Check if already unlocked */
+        uint8_t *resp_data = uds_begin_positive_response(
+            UDS_SID_SECURITY_ACCESS, 5U, response);
+        if (resp_data == NULL) {
+            return;
+        }
+        
         if (context->security_unlocked) {
-            uint8_t resp_data[5];
+            /* Zero seed: already unlocked */
             resp_data[0] = sub_function;
             resp_data[1] = 0x00U;
             resp_data[2] = 0x00U;
             resp_data[3] = 0x00U;
             resp_data[4] = 0x00U;
-            uds_send_positive_response(UDS_SID_SECURITY_ACCESS,
-                                      resp_data, 5U, response);
             return;
         }
         
         /* Generate seed (simplified - should use proper random generation) */
         context->seed = 0x12345678U;
         
-        uint8_t resp_data[5];
         resp_data[0] = sub_function;
         resp_data[1] = (uint8_t)(context->seed >> 24);
         resp_data[2] = (uint8_t)(context->seed >> 16);
         resp_data[3] = (uint8_t)(context->seed >> 8);
         resp_data[4] = (uint8_t)(context->seed & 0xFFU);
-        
-        uds_send_positive_response(UDS_SID_SECURITY_ACCESS,
-                                  resp_data, 5U, response);
     }
-    else if (sub_function == UDS_SECURITY_SEND_KEY_LEVEL_1) {
+    else {
         /* Verify key */
         if (request->length < 5U) {
             uds_send_negative_response(UDS_SID_SECURITY_ACCESS,
@@ -203,12 +491,14 @@ void uds_handle_security_access(
         if (received_key == expected_key) {
             /* Unlock security */
             context->security_unlocked = true;
+            context->security_level = 1U;
             context->failed_security_attempts = 0U;
             
-            uint8_t resp_data[1];
-            resp_data[0] = sub_function;
-            uds_send_positive_response(UDS_SID_SECURITY_ACCESS,
-                                      resp_data, 1U, response);
+            uint8_t *resp_data = uds_begin_positive_response(
+                UDS_SID_SECURITY_ACCESS, 1U, response);
+            if (resp_data != NULL) {
+                resp_data[0] = sub_function;
+            }
         } else {
             /* Invalid key */
             context->failed_security_attempts++;
@@ -224,11 +514,6 @@ void uds_handle_security_access(
             }
         }
     }
-    else {
-        uds_send_negative_response(UDS_SID_SECURITY_ACCESS,
-                                  UDS_NRC_SUB_FUNCTION_NOT_SUPPORTED,
-                                  response);
-    }
 }
 
 void uds_handle_tester_present(
@@ -240,20 +525,15 @@ void uds_handle_tester_present(
         return;
     }
     
-    if (request->length < 1U) {
-        uds_send_negative_response(UDS_SID_TESTER_PRESENT,
-                                  UDS_NRC_INCORRECT_MESSAGE_LENGTH,
-                                  response);
-        return;
-    }
-    
     /* Update last tester present time */
     /* context->last_tester_present_time = get_system_time_ms(); */
     
     /* Send positive response */
-    uint8_t resp_data[1];
-    resp_data[0] = request->data[0];  /* Sub-function (0x00 or 0x80) */
-    uds_send_positive_response(UDS_SID_TESTER_PRESENT, resp_data, 1U, response);
+    uint8_t *resp_data = uds_begin_positive_response(UDS_SID_TESTER_PRESENT,
+                                                     1U, response);
+    if (resp_data != NULL) {
+        resp_data[0] = UDS_SUBFUNCTION(request);
+    }
 }
 
 void uds_handle_read_data_by_id(
@@ -261,56 +541,131 @@ void uds_handle_read_data_by_id(
     const uds_request_t *request,
     uds_response_t *response)
 {
+    const uds_did_t *entry;
+    uint8_t *resp_data;
+    uint32_t capacity;
+    uint32_t position = 0U;
+    uint32_t record_length;
+    uint32_t i;
+    uint16_t did;
+    uint8_t nrc = UDS_NRC_REQUEST_OUT_OF_RANGE;
+    
     if ((request == NULL) || (response == NULL) || (context == NULL)) {
         return;
     }
     
-    if (request->length < 2U) {
+    /* Any number of DIDs, two bytes each */
+    if ((request->length % 2U) != 0U) {
         uds_send_negative_response(UDS_SID_READ_DATA_BY_IDENTIFIER,
                                   UDS_NRC_INCORRECT_MESSAGE_LENGTH,
                                   response);
         return;
     }
     
-    uint16_t did = ((uint16_t)request->data[0] << 8) | (uint16_t)request->data[1];
-    
-    uint8_t resp_data[32];
-    uint32_t resp_length = 0U;
-    
-    /* Store DID in response */
-    resp_data[0] = request->data[0];
-    resp_data[1] = request->data[1];
-    resp_length = 2U;
+    /* Records are written straight into the response behind their DID */
+    resp_data = uds_begin_positive_response(UDS_SID_READ_DATA_BY_IDENTIFIER,
+                                            0U, response);
+    if (resp_data == NULL) {
+        return;
+    }
+    capacity = response->max_length - 1U;
     
-    switch (did) {
-        case UDS_DID_VIN:
-            /* Return VIN */
-            (void)memcpy(&resp_data[resp_length], "WVWZZZ1KZ1A234567", 17U);
-            resp_length += 17U;
-            break;
+    for (i = 0U; i < request->length; i += 2U) {
+        did = (uint16_t)(((uint16_t)request->data[i] << 8) |
+                         (uint16_t)request->data[i + 1U]);
         
-        case UDS_DID_ECU_SERIAL_NUMBER:
-            /* Return serial number */
-            (void)memcpy(&resp_data[resp_length], "SN123456789", 11U);
-            resp_length += 11U;
+        /* DIDs this session cannot read are left out like unknown ones */
+        entry = uds_did_find(context->dids, did);
+        if ((entry == NULL) || (context->current_session > 7U) ||
+            ((entry->sessions & UDS_SESSION_BIT(context->current_session)) == 0U)) {
+            continue;
+        }
+        if (context->security_level < entry->security_level) {
+            nrc = UDS_NRC_SECURITY_ACCESS_DENIED;
             break;
-        
-        case UDS_DID_ECU_SOFTWARE_NUMBER:
-            /* Return software version */
-            resp_data[resp_length++] = 0x01U;  /* Major */
-            resp_data[resp_length++] = 0x00U;  /* Minor */
-            resp_data[resp_length++] = 0x05U;  /* Patch */
+        }
+        if ((capacity - position) < (2U + entry->length)) {
+            nrc = UDS_NRC_RESPONSE_TOO_LONG;
             break;
+        }
         
-        default:
-            uds_send_negative_response(UDS_SID_READ_DATA_BY_IDENTIFIER,
-                                      UDS_NRC_REQUEST_OUT_OF_RANGE,
-                                      response);
-            return;
+        resp_data[position] = request->data[i];
+        resp_data[position + 1U] = request->data[i + 1U];
+        if (entry->read != NULL) {
+            record_length = entry->read(context, did, &resp_data[position + 2U],
+                                        entry->length);
+            if ((record_length == 0U) || (record_length > entry->length)) {
+                nrc = UDS_NRC_CONDITIONS_NOT_CORRECT;
+                break;
+            }
+        } else {
+            (void)memcpy(&resp_data[position + 2U], entry->data, entry->length);
+            record_length = entry->length;
+        }
+        position += 2U + record_length;
     }
     
-    uds_send_positive_response(UDS_SID_READ_DATA_BY_IDENTIFIER,
-                              resp_data, resp_length, response);
+    /* Positive if every DID passed and at least one was known */
+    if ((i < request->length) || (position == 0U)) {
+        uds_send_negative_response(UDS_SID_READ_DATA_BY_IDENTIFIER, nrc,
+                                  response);
+        return;
+    }
+    response->actual_length = 1U + position;
+}
+
+/* NRC for a request the service cannot take, 0 if the handler may run.
+ * The order is the ISO 14229-1 server response behaviour. */
+static uint8_t uds_check_request(
+    const uds_context_t *context,
+    const uds_service_t *service,
+    const uds_request_t *request)
+{
+    uint8_t subfunction;
+
+    if (service == NULL) {
+        return UDS_NRC_SERVICE_NOT_SUPPORTED;
+    }
+
+    if ((context->current_session > 7U) ||
+        ((service->sessions & UDS_SESSION_BIT(context->current_session)) == 0U)) {
+        return UDS_NRC_SERVICE_NOT_SUPPORTED_IN_ACTIVE_SESSION;
+    }
+
+    if (context->security_level < service->security_level) {
+        return UDS_NRC_SECURITY_ACCESS_DENIED;
+    }
+
+    if (request->length < service->min_length) {
+        return UDS_NRC_INCORRECT_MESSAGE_LENGTH;
+    }
+
+    if ((service->flags & UDS_SERVICE_FLAG_SUBFUNCTION) != 0U) {
+        subfunction = UDS_SUBFUNCTION(request);
+        if ((service->subfunctions[subfunction >> 5] &
+             UDS_SUBFUNCTION_BIT(subfunction)) == 0U) {
+            return UDS_NRC_SUB_FUNCTION_NOT_SUPPORTED;
+        }
+    }
+
+    return 0U;
+}
+
+uint8_t uds_request_nrc(
+    const uds_context_t *context,
+    const uds_request_t *request)
+{
+    const uds_service_t *service = NULL;
+
+    if ((context == NULL) || (request == NULL)) {
+        return UDS_NRC_GENERAL_REJECT;
+    }
+
+    if (context->services != NULL) {
+        service = context->services->services[request->sid];
+    }
+
+    return uds_check_request(context, service, request);
 }
 
 bool uds_process_request(
@@ -318,38 +673,35 @@ bool uds_process_request(
     const uds_request_t *request,
     uds_response_t *response)
 {
+    const uds_service_t *service = NULL;
+    uint8_t nrc;
+    
     if ((context == NULL) || (request == NULL) || (response == NULL)) {
         return false;
     }
     
-    /* Route to appropriate service handler */
-    switch (request->sid) {
-        case UDS_SID_DIAGNOSTIC_SESSION_CONTROL:
-            uds_handle_diagnostic_session_control(context, request, response);
-            break;
-        
-        case UDS_SID_ECU_RESET:
-            uds_handle_ecu_reset(context, request, response);
-            break;
-        
-        case UDS_SID_SECURITY_ACCESS:
-            uds_handle_security_access(context, request, response);
-            break;
-        
-        case UDS_SID_TESTER_PRESENT:
-            uds_handle_tester_present(context, request, response);
-            break;
-        
-        case UDS_SID_READ_DATA_BY_IDENTIFIER:
-            uds_handle_read_data_by_id(context, request, response);
-            break;
-        
-        default:
-            uds_send_negative_response(request->sid,
-                                      UDS_NRC_SERVICE_NOT_SUPPORTED,
-                                      response);
-            break;
+    response->actual_length = 0U;
+    response->suppressed = false;
+    if (context->services != NULL) {
+        service = context->services->services[request->sid];
+    }
+    
+    nrc = uds_check_request(context, service, request);
+    if (nrc != 0U) {
+        uds_send_negative_response(request->sid, nrc, response);
+        return (response->actual_length > 0U);
+    }
+    
+    service->handler(context, request, response);
+    
+    /* Suppressed positive responses are not sent, negative ones are. The
+     * response stays, a caller that already sent a response pending has
+     * to send it anyway (ISO 14229-1) */
+    if (((service->flags & UDS_SERVICE_FLAG_SUBFUNCTION) != 0U) &&
+        ((request->data[0] & UDS_SUPPRESS_POS_RESPONSE_BIT) != 0U) &&
+        (response->actual_length > 0U) && (response->buffer[0] != 0x7FU)) {
+        response->suppressed = true;
     }
     
-    return (response->actual_length > 0U);
+    return (response->actual_length > 0U) && !response->suppressed;
 }
@@ -32,6 +32,8 @@
 #define UDS_NRC_SERVICE_NOT_SUPPORTED           0x11U
 #define UDS_NRC_SUB_FUNCTION_NOT_SUPPORTED      0x12U
 #define UDS_NRC_INCORRECT_MESSAGE_LENGTH        0x13U
+#define UDS_NRC_RESPONSE_TOO_LONG               0x14U
+#define UDS_NRC_BUSY_REPEAT_REQUEST             0x21U
 #define UDS_NRC_CONDITIONS_NOT_CORRECT          0x22U
 #define UDS_NRC_REQUEST_SEQUENCE_ERROR          0x24U
 #define UDS_NRC_REQUEST_OUT_OF_RANGE            0x31U
@@ -39,12 +41,38 @@
 #define UDS_NRC_INVALID_KEY                     0x35U
 #define UDS_NRC_EXCEEDED_NUMBER_OF_ATTEMPTS     0x36U
 #define UDS_NRC_REQUIRED_TIME_DELAY_NOT_EXPIRED 0x37U
+#define UDS_NRC_RESPONSE_PENDING                0x78U
+#define UDS_NRC_SUB_FUNCTION_NOT_SUPPORTED_IN_ACTIVE_SESSION 0x7EU
+#define UDS_NRC_SERVICE_NOT_SUPPORTED_IN_ACTIVE_SESSION     0x7FU
+
+/* Server timing advertised by DiagnosticSessionControl */
+#define UDS_P2_SERVER_MAX_MS                    50U
+#define UDS_P2_STAR_SERVER_MAX_MS               5000U
+
+/* Response pending is sent this long before P2 / P2* run out, so it is on
+ * the wire before the tester gives up */
+#define UDS_RESPONSE_PENDING_MARGIN_MS          10U
 
 /* Diagnostic Session Types */
 #define UDS_SESSION_DEFAULT                     0x01U
 #define UDS_SESSION_PROGRAMMING                 0x02U
 #define UDS_SESSION_EXTENDED                    0x03U
 
+/* Session masks of the service table, sessions 0x01 to 0x07 */
+#define UDS_SESSION_BIT(session)                ((uint8_t)(1U << (session)))
+#define UDS_SESSIONS_ALL                        (UDS_SESSION_BIT(UDS_SESSION_DEFAULT) | \
+                                                 UDS_SESSION_BIT(UDS_SESSION_PROGRAMMING) | \
+                                                 UDS_SESSION_BIT(UDS_SESSION_EXTENDED))
+#define UDS_SESSIONS_NON_DEFAULT                (UDS_SESSION_BIT(UDS_SESSION_PROGRAMMING) | \
+                                                 UDS_SESSION_BIT(UDS_SESSION_EXTENDED))
+
+/* Sub-function byte: bit 7 asks to suppress the positive response */
+#define UDS_SUPPRESS_POS_RESPONSE_BIT           0x80U
+#define UDS_SUBFUNCTION(request)                ((uint8_t)((request)->data[0] & 0x7FU))
+
+/* Bit of sub-function 'sf' within word sf / 32 of a support mask */
+#define UDS_SUBFUNCTION_BIT(sf)                 (1UL << ((uint32_t)(sf) & 0x1FU))
+
 /* ECU Reset Types */
 #define UDS_RESET_HARD                          0x01U
 #define UDS_RESET_KEY_OFF_ON                    0x02U
@@ -67,6 +95,11 @@
 #define UDS_DID_ECU_HARDWARE_NUMBER             0xF191U
 #define UDS_DID_FINGERPRINT                     0xF15BU
 
+/* Capacity of a DID registry */
+#ifndef UDS_MAX_DIDS
+#define UDS_MAX_DIDS                            32U
+#endif
+
 /* UDS Message Structure */
 typedef struct {
     uint8_t sid;
@@ -78,27 +111,180 @@ typedef struct {
     uint8_t *buffer;
     uint32_t max_length;
     uint32_t actual_length;
+    bool suppressed;                    /* Positive response the tester asked to suppress */
 } uds_response_t;
 
+struct uds_service_table;
+struct uds_did_registry;
+struct uds_download;
+
 /* UDS Context */
 typedef struct {
     uint8_t current_session;
-    uint8_t security_level;
+    uint8_t security_level;             /* Unlocked level, 0 if locked */
     bool security_unlocked;
     uint32_t seed;
     uint8_t failed_security_attempts;
     uint32_t last_tester_present_time;
+    const struct uds_service_table *services;
+    const struct uds_did_registry *dids;
+    struct uds_download *download;      /* NULL without a download engine */
 } uds_context_t;
 
+typedef void (*uds_service_handler_t)(
+    uds_context_t *context,
+    const uds_request_t *request,
+    uds_response_t *response
+);
+
+/* Service flags */
+#define UDS_SERVICE_FLAG_SUBFUNCTION            0x01U   /* First byte is a sub-function */
+
+/* One UDS service. uds_process_request() checks the request against it in
+ * ISO 14229-1 NRC order (0x11, 0x7F, 0x33, 0x13, 0x12) before the handler
+ * runs. Handlers of sub-function services see the suppress bit via
+ * UDS_SUBFUNCTION() stripped; a positive response is then kept in the
+ * buffer, flagged suppressed and not reported for sending. */
+typedef struct {
+    uint8_t sid;
+    uint8_t sessions;                   /* UDS_SESSION_BIT() of allowed sessions */
+    uint8_t security_level;             /* Level that must be unlocked, 0 if none */
+    uint8_t flags;                      /* UDS_SERVICE_FLAG_* */
+    uint32_t min_length;                /* Bytes after the SID, sub-function included */
+    uint32_t subfunctions[4];           /* UDS_SUBFUNCTION_BIT() of 0x00 to 0x7F */
+    uds_service_handler_t handler;
+} uds_service_t;
+
+/* Services a context dispatches to, indexed by SID */
+typedef struct uds_service_table {
+    const uds_service_t *services[256];
+} uds_service_table_t;
+
+/* Writes the record of 'did', at most 'max_length' bytes, straight into
+ * the response. Returns the record length, 0 if it cannot be read now. */
+typedef uint32_t (*uds_did_read_t)(
+    uds_context_t *context,
+    uint16_t did,
+    uint8_t *buffer,
+    uint32_t max_length
+);
+
+/* One data identifier. Records of constant or flash data set 'data' and
+ * are copied from there; others set 'read'. */
+typedef struct {
+    uint16_t did;
+    uint8_t sessions;                   /* UDS_SESSION_BIT() where it can be read */
+    uint8_t security_level;             /* Level that must be unlocked, 0 if none */
+    uint32_t length;                    /* Record length, the maximum for 'read' */
+    const uint8_t *data;
+    uds_did_read_t read;
+} uds_did_t;
+
+/* Data identifiers ReadDataByIdentifier serves, sorted by DID */
+typedef struct uds_did_registry {
+    const uds_did_t *entries[UDS_MAX_DIDS];
+    uint32_t count;
+} uds_did_registry_t;
+
+/* Built-in services, for composing service tables */
+extern const uds_service_t uds_service_diagnostic_session_control;
+extern const uds_service_t uds_service_ecu_reset;
+extern const uds_service_t uds_service_security_access;
+extern const uds_service_t uds_service_tester_present;
+extern const uds_service_t uds_service_read_data_by_id;
+
+/* Response pending schedule of a request that is still executing */
+typedef struct {
+    bool active;
+    uint8_t sid;
+    uint32_t deadline;                  /* Next NRC 0x78 is due, absolute ms */
+    uint32_t sent_count;
+} uds_pending_t;
+
 /* Function Prototypes */
+
+/* Resets the session state, the context dispatches to the built-in
+ * services until uds_set_service_table() selects another set */
 void uds_init(uds_context_t *context);
 
+void uds_service_table_init(uds_service_table_t *table);
+
+/* Adds a service, false if its SID is already taken */
+bool uds_register_service(
+    uds_service_table_t *table,
+    const uds_service_t *service
+);
+
+/* Adds the built-in services */
+void uds_register_core_services(uds_service_table_t *table);
+
+void uds_set_service_table(
+    uds_context_t *context,
+    const uds_service_table_t *table
+);
+
+void uds_did_registry_init(uds_did_registry_t *registry);
+
+/* Adds a DID in sorted position, false if full or already present */
+bool uds_did_register(
+    uds_did_registry_t *registry,
+    const uds_did_t *did
+);
+
+/* Adds the built-in identification DIDs */
+void uds_register_core_dids(uds_did_registry_t *registry);
+
+const uds_did_t *uds_did_find(
+    const uds_did_registry_t *registry,
+    uint16_t did
+);
+
+/* The built-in DIDs are served until another registry is selected */
+void uds_set_did_registry(
+    uds_context_t *context,
+    const uds_did_registry_t *registry
+);
+
+/* A request started executing at 'now_ms', the first response pending
+ * falls due shortly before P2 */
+void uds_pending_start(
+    uds_pending_t *pending,
+    uint8_t sid,
+    uint32_t now_ms
+);
+
+void uds_pending_stop(
+    uds_pending_t *pending
+);
+
+/* Builds 0x7F sid 0x78 into 'response' if one is due at 'now_ms' and
+ * schedules the next one shortly before P2* */
+bool uds_pending_poll(
+    uds_pending_t *pending,
+    uint32_t now_ms,
+    uds_response_t *response
+);
+
+/* Milliseconds until the next response pending, 0xFFFFFFFF if inactive */
+uint32_t uds_pending_timeout(
+    const uds_pending_t *pending,
+    uint32_t now_ms
+);
+
 bool uds_process_request(
     uds_context_t *context,
     const uds_request_t *request,
     uds_response_t *response
 );
 
+/* NRC uds_process_request() answers before the handler runs, 0 if the
+ * service takes the request. Only the first data byte is read, so a
+ * transport delivering the request in parts can check it early. */
+uint8_t uds_request_nrc(
+    const uds_context_t *context,
+    const uds_request_t *request
+);
+
 /* Service Handlers */
 void uds_handle_diagnostic_session_control(
     uds_context_t *context,
@@ -156,4 +342,12 @@ void uds_send_positive_response(
     uds_response_t *response
 );
 
+/* Start a positive response of 'length' data bytes and return where the
+ * data goes, so handlers write it in place. NULL if it does not fit. */
+uint8_t *uds_begin_positive_response(
+    uint8_t sid,
+    uint32_t length,
+    uds_response_t *response
+);
+
 #endif /* UDS_SERVICES_H */
@@ -0,0 +1,2072 @@
+#include "test_util.h"
+#include "doip_protocol.h"
+#include "doip_interface.h"
+#include "app_doip_entity.h"
+#include "doip_dispatch.h"
+#include "uds_download_flash.h"
+#include "flash_sim.h"
+#include "crc32.h"
+#include <arpa/inet.h>
+#include <stdlib.h>
+#include <string.h>
+
+/* Encode and decode functions, the TCP receive path, UDS services and
+ * the CRC kernels, one JSON object per line:
+ *
+ *   {"bench":"...","iterations":N,"ns_per_op":T,
+ *    "bytes_copied_per_op":B,"allocs_per_op":A}
+ *
+ * Benchmarks that process a buffer add "mb_per_s" and run fewer
+ * iterations, BULK_DIVISOR times less. interface_rx_pipelined_* read
+ * back-to-back messages in random TCP-sized pieces:
+ *
+ *   {"bench":"...","messages":N,"mb_per_s":R,"bytes_copied_per_msg":B,
+ *    "linearized_per_msg":L}
+ *
+ * interface_tx_slow_receiver sends to a peer slower than the sender and
+ * fails with "error" if a frame is lost, cut or reordered:
+ *
+ *   {"bench":"...","frames":N,"cycles":C,"refused_per_frame":F,
+ *    "tx_high_water":H,"tx_queue_size":Q,"ns_per_frame":T}
+ *
+ * Whole downloads through the
+ * entity report once per download:
+ *
+ *   {"bench":"...","bytes":N,"blocks":K,"ns":T,"mb_per_s":R,
+ *    "bytes_copied_per_byte":C}
+ *
+ * Bytes copied are counted in memcpy and memmove, allocations in the
+ * allocator; both are wrapped at link time (see test/CMakeLists.txt). */
+
+/* Counters behind the wrapped functions */
+static uint64_t bytes_copied;
+static uint64_t allocations;
+
+void *__real_memcpy(void *dest, const void *src, size_t n);
+void *__real_memmove(void *dest, const void *src, size_t n);
+void *__real_malloc(size_t size);
+void *__real_calloc(size_t count, size_t size);
+void *__real_realloc(void *ptr, size_t size);
+void __real_free(void *ptr);
+
+void *__wrap_memcpy(void *dest, const void *src, size_t n)
+{
+    bytes_copied += n;
+    return __real_memcpy(dest, src, n);
+}
+
+void *__wrap_memmove(void *dest, const void *src, size_t n)
+{
+    bytes_copied += n;
+    return __real_memmove(dest, src, n);
+}
+
+void *__wrap_malloc(size_t size)
+{
+    allocations++;
+    return __real_malloc(size);
+}
+
+void *__wrap_calloc(size_t count, size_t size)
+{
+    allocations++;
+    return __real_calloc(count, size);
+}
+
+void *__wrap_realloc(void *ptr, size_t size)
+{
+    allocations++;
+    return __real_realloc(ptr, size);
+}
+
+void __wrap_free(void *ptr)
+{
+    __real_free(ptr);
+}
+
+static uint32_t iterations = 1000000U;
+static volatile uint32_t sink;
+
+#define BULK_DIVISOR        64U
+
+typedef void (*bench_op_t)(void);
+
+/* 'bytes' per op, 0 if the op does not process a buffer */
+static void run_bytes(const char *name, bench_op_t op, uint32_t bytes)
+{
+    uint32_t count = iterations;
+    uint64_t start;
+    uint64_t elapsed;
+    uint64_t copied;
+    uint64_t allocated;
+    uint32_t i;
+
+    if (bytes > 0U) {
+        count = (iterations > BULK_DIVISOR) ? (iterations / BULK_DIVISOR) : 1U;
+    }
+
+    bytes_copied = 0U;
+    allocations = 0U;
+    start = test_now_ns();
+    for (i = 0U; i < count; i++) {
+        op();
+    }
+    elapsed = test_now_ns() - start;
+    copied = bytes_copied;
+    allocated = allocations;
+    if (elapsed == 0U) {
+        elapsed = 1U;
+    }
+
+    printf("{\"bench\":\"%s\",\"iterations\":%u,\"ns_per_op\":%.2f,"
+           "\"bytes_copied_per_op\":%.2f,\"allocs_per_op\":%.4f",
+           name, count,
+           (double)elapsed / (double)count,
+           (double)copied / (double)count,
+           (double)allocated / (double)count);
+    if (bytes > 0U) {
+        printf(",\"mb_per_s\":%.1f",
+               ((double)bytes * (double)count * 1000.0) / (double)elapsed);
+    }
+    printf("}\n");
+}
+
+static void run(const char *name, bench_op_t op)
+{
+    run_bytes(name, op, 0U);
+}
+
+/* Encode and decode */
+
+static uint8_t frame[DOIP_TX_FRAME_SIZE];
+static uint8_t user_data[DOIP_MAX_PAYLOAD_SIZE];
+static uint32_t encoded;
+
+static void encode_header(void)
+{
+    static const doip_header_t header = { 0x03U, 0xFCU, DOIP_PAYLOAD_TYPE_DIAG_MESSAGE, 64U };
+
+    (void)doip_encode_header(&header, frame, sizeof(frame));
+    sink += frame[7];
+}
+
+static void decode_header(void)
+{
+    doip_header_t header;
+
+    (void)doip_decode_header(frame, sizeof(frame), &header);
+    sink += header.payload_length;
+}
+
+static void validate_header(void)
+{
+    static const doip_header_t header = { 0x03U, 0xFCU, DOIP_PAYLOAD_TYPE_DIAG_MESSAGE, 64U };
+
+    sink += doip_validate_header(&header) ? 1U : 0U;
+}
+
+static void encode_vehicle_id_response(void)
+{
+    static const doip_vehicle_id_response_t response = {
+        "WVWZZZ1JZXW000001", 0x1000U, { 1U, 2U, 3U, 4U, 5U, 6U },
+        { 1U, 2U, 3U, 4U, 5U, 6U }, 0U, 0U
+    };
+
+    (void)doip_encode_vehicle_id_response(&response, frame, sizeof(frame), &encoded);
+    sink += encoded;
+}
+
+static void encode_routing_activation_req(void)
+{
+    static const doip_routing_activation_req_t request = { 0x0E80U, 0x00U, 0U, 0U };
+
+    (void)doip_encode_routing_activation_req(&request, frame, sizeof(frame), &encoded);
+    sink += encoded;
+}
+
+static void decode_routing_activation_req(void)
+{
+    static const uint8_t payload[] = { 0x0EU, 0x80U, 0x00U, 0U, 0U, 0U, 0U };
+    doip_routing_activation_req_t request;
+
+    (void)doip_decode_routing_activation_req(payload, sizeof(payload), &request);
+    sink += request.source_address;
+}
+
+static void encode_routing_activation_res(void)
+{
+    static const doip_routing_activation_res_t response = { 0x0E80U, 0x1000U, 0x10U, 0U, 0U };
+
+    (void)doip_encode_routing_activation_res(&response, frame, sizeof(frame), &encoded);
+    sink += encoded;
+}
+
+static void encode_diagnostic_message_64(void)
+{
+    doip_diagnostic_message_t message = { 0x1000U, 0x0E80U, 64U, user_data };
+
+    (void)doip_encode_diagnostic_message(&message, frame, sizeof(frame), &encoded);
+    sink += encoded;
+}
+
+static void encode_diagnostic_message_4092(void)
+{
+    doip_diagnostic_message_t message = { 0x1000U, 0x0E80U,
+                                          DOIP_MAX_PAYLOAD_SIZE - 4U, user_data };
+
+    (void)doip_encode_diagnostic_message(&message, frame, sizeof(frame), &encoded);
+    sink += encoded;
+}
+
+/* The response is built in the frame, only the header is added */
+static void finish_diagnostic_message_frame(void)
+{
+    (void)doip_finish_diagnostic_message_frame(0x1000U, 0x0E80U, frame, sizeof(frame),
+                                               DOIP_MAX_PAYLOAD_SIZE - 4U, &encoded);
+    sink += encoded;
+}
+
+static void decode_diagnostic_message(void)
+{
+    doip_diagnostic_message_t message;
+
+    (void)doip_decode_diagnostic_message(&frame[8], 68U, &message);
+    sink += message.user_data_length;
+}
+
+static void encode_generic_nack(void)
+{
+    (void)doip_encode_generic_nack(DOIP_NACK_MESSAGE_TOO_LARGE, frame, sizeof(frame),
+                                   &encoded);
+    sink += encoded;
+}
+
+static void encode_diag_message_ack(void)
+{
+    (void)doip_encode_diag_message_ack(0x1000U, 0x0E80U, 0x00U, frame, sizeof(frame),
+                                       &encoded);
+    sink += encoded;
+}
+
+/* Payload type decode: header decode and validation, then the table
+ * lookup with its length checks, as the entity does for every message.
+ * The table has the entity's layout, the messages are taken in turn. */
+
+static void payload_handler(void *context, const doip_dispatch_msg_t *msg)
+{
+    (void)context;
+    sink += msg->payload_length;
+}
+
+static const doip_dispatch_entry_t payload_entries[] = {
+    { DOIP_PAYLOAD_TYPE_VEHICLE_ID_REQ,         DOIP_TRANSPORT_UDP,
+      (uint8_t)DOIP_DISPATCH_NACK,       0U,              0U,              payload_handler },
+    { DOIP_PAYLOAD_TYPE_VEHICLE_ID_REQ_EID,     DOIP_TRANSPORT_UDP,
+      (uint8_t)DOIP_DISPATCH_NACK,       DOIP_EID_LENGTH, DOIP_EID_LENGTH, payload_handler },
+    { DOIP_PAYLOAD_TYPE_VEHICLE_ID_REQ_VIN,     DOIP_TRANSPORT_UDP,
+      (uint8_t)DOIP_DISPATCH_NACK,       DOIP_VIN_LENGTH, DOIP_VIN_LENGTH, payload_handler },
+    { DOIP_PAYLOAD_TYPE_ROUTING_ACTIVATION_REQ, DOIP_TRANSPORT_TCP,
+      (uint8_t)DOIP_DISPATCH_NACK_CLOSE, 7U,              11U,             payload_handler },
+    { DOIP_PAYLOAD_TYPE_ALIVE_CHECK_RES,        DOIP_TRANSPORT_TCP,
+      (uint8_t)DOIP_DISPATCH_NACK_CLOSE, 2U,              2U,              payload_handler },
+    { DOIP_PAYLOAD_TYPE_DIAG_MESSAGE,           DOIP_TRANSPORT_TCP,
+      (uint8_t)DOIP_DISPATCH_NACK_CLOSE, 5U,              DOIP_DISPATCH_NO_LIMIT,
+      payload_handler }
+};
+
+static const doip_dispatch_table_t payload_table = {
+    payload_entries,
+    (uint32_t)(sizeof(payload_entries) / sizeof(payload_entries[0])),
+    (uint8_t)DOIP_DISPATCH_NACK
+};
+
+typedef struct {
+    uint8_t transport;
+    uint8_t header[8];
+} payload_message_t;
+
+#define PAYLOAD_HEADER(type, length) \
+    { 0x02U, 0xFDU, (uint8_t)((type) >> 8), (uint8_t)(type), 0U, 0U, 0U, (length) }
+
+static const payload_message_t payload_valid[] = {
+    { DOIP_TRANSPORT_UDP, PAYLOAD_HEADER(DOIP_PAYLOAD_TYPE_VEHICLE_ID_REQ, 0U) },
+    { DOIP_TRANSPORT_UDP, PAYLOAD_HEADER(DOIP_PAYLOAD_TYPE_VEHICLE_ID_REQ_VIN, 17U) },
+    { DOIP_TRANSPORT_TCP, PAYLOAD_HEADER(DOIP_PAYLOAD_TYPE_ROUTING_ACTIVATION_REQ, 7U) },
+    { DOIP_TRANSPORT_TCP, PAYLOAD_HEADER(DOIP_PAYLOAD_TYPE_ALIVE_CHECK_RES, 2U) }
+};
+
+/* Unknown type, wrong transport, length out of range, wrong pattern */
+static const payload_message_t payload_invalid[] = {
+    { DOIP_TRANSPORT_TCP, PAYLOAD_HEADER(0x4005U, 0U) },
+    { DOIP_TRANSPORT_TCP, PAYLOAD_HEADER(DOIP_PAYLOAD_TYPE_VEHICLE_ID_REQ, 0U) },
+    { DOIP_TRANSPORT_TCP, PAYLOAD_HEADER(DOIP_PAYLOAD_TYPE_DIAG_MESSAGE, 3U) },
+    { DOIP_TRANSPORT_UDP, { 0x02U, 0xFCU, 0x00U, 0x01U, 0U, 0U, 0U, 0U } }
+};
+
+static const payload_message_t *payload_messages;
+static uint32_t payload_next;
+
+static void payload_dispatch_op(void)
+{
+    const payload_message_t *message = &payload_messages[payload_next & 3U];
+    doip_dispatch_result_t result;
+    doip_dispatch_msg_t msg;
+    doip_header_t header;
+
+    payload_next++;
+    (void)doip_decode_header(message->header, sizeof(message->header), &header);
+    if (!doip_validate_header(&header)) {
+        sink++;
+        return;
+    }
+    msg.transport = message->transport;
+    msg.connection_id = -1;
+    msg.src = NULL;
+    msg.payload_type = header.payload_type;
+    msg.payload = user_data;
+    msg.payload_length = header.payload_length;
+    result = doip_dispatch(&payload_table, NULL, &msg);
+    sink += result.nack_code;
+}
+
+/* TCP receive path: one diagnostic message per process call, read from a
+ * socket that hands out a prepared stream */
+
+#define RX_SOCKET           5
+
+static doip_interface_t itf;
+static doip_network_ops_t ops;
+static uint8_t rx_stream[DOIP_TX_FRAME_SIZE];
+static const uint8_t *rx_source = rx_stream;
+static uint32_t rx_length;
+static uint32_t rx_position;
+static bool rx_accepted;
+static uint32_t rx_piece_max;       /* Random TCP segments of 1 to this, 0: all */
+static uint32_t rx_seed = 1U;
+
+static int mock_recv(int sock, uint8_t *buf, uint32_t len)
+{
+    uint32_t n = rx_length - rx_position;
+
+    (void)sock;
+    if (n == 0U) {
+        return -1;
+    }
+    if ((rx_piece_max > 0U) && (n > rx_piece_max)) {
+        n = 1U + (test_random(&rx_seed) % rx_piece_max);
+    }
+    if (n > len) {
+        n = len;
+    }
+    /* The socket's copy is not counted, only copies of the interface */
+    (void)__real_memcpy(buf, &rx_source[rx_position], n);
+    rx_position += n;
+    return (int)n;
+}
+
+static int mock_accept(int listen_sock)
+{
+    (void)listen_sock;
+    if (rx_accepted) {
+        return -1;
+    }
+    rx_accepted = true;
+    return RX_SOCKET;
+}
+
+static int mock_listen(uint16_t port)
+{
+    (void)port;
+    return 3;
+}
+
+static void mock_close(int sock)
+{
+    (void)sock;
+}
+
+static void on_message(int connection_id, const uint8_t *data, uint32_t length,
+                       void *user)
+{
+    (void)connection_id;
+    (void)user;
+    sink += data[length - 1U];
+}
+
+static void interface_rx(uint32_t user_length)
+{
+    doip_diagnostic_message_t message = { 0x0E80U, 0x1000U, user_length, user_data };
+
+    rx_source = rx_stream;
+    (void)memset(&ops, 0, sizeof(ops));
+    ops.tcp_recv = mock_recv;
+    ops.tcp_accept = mock_accept;
+    ops.tcp_listen = mock_listen;
+    ops.close_socket = mock_close;
+    (void)doip_interface_init(&itf, &ops);
+    (void)doip_interface_start_tcp_server(&itf, 13400U);
+    rx_accepted = false;
+    (void)doip_encode_diagnostic_message(&message, rx_stream, sizeof(rx_stream),
+                                         &rx_length);
+    rx_position = rx_length;
+    /* Accept the connection */
+    (void)doip_interface_process(&itf, NULL, on_message, NULL, NULL, NULL);
+}
+
+static void interface_rx_op(void)
+{
+    rx_position = 0U;
+    (void)doip_interface_process(&itf, NULL, on_message, NULL, NULL, NULL);
+}
+
+/* Back-to-back messages read in random pieces of up to one TCP segment:
+ * TesterPresent only, or three of them for every 4080 byte TransferData */
+
+#define PIPELINE_SIZE       (1U << 20)
+#define PIPELINE_SEGMENT    1460U
+
+static uint8_t pipeline_stream[PIPELINE_SIZE];
+
+static uint32_t pipeline_build(bool transfer_data_mixed)
+{
+    static const uint8_t tester_present[] = { 0x3EU, 0x80U };
+    static const uint8_t transfer_data[UDS_DOWNLOAD_BLOCK_SIZE + 2U] = { 0x36U, 0x01U };
+    doip_diagnostic_message_t message = { 0x0E80U, 0x1000U, 0U, NULL };
+    uint32_t messages = 0U;
+    uint32_t length;
+
+    rx_length = 0U;
+    for (;;) {
+        if (transfer_data_mixed && ((messages % 4U) == 3U)) {
+            message.user_data = transfer_data;
+            message.user_data_length = sizeof(transfer_data);
+        } else {
+            message.user_data = tester_present;
+            message.user_data_length = sizeof(tester_present);
+        }
+        if (doip_encode_diagnostic_message(&message, &pipeline_stream[rx_length],
+                                           PIPELINE_SIZE - rx_length,
+                                           &length) != DOIP_RESULT_OK) {
+            break;
+        }
+        rx_length += length;
+        messages++;
+    }
+    return messages;
+}
+
+static void pipelined_rx(const char *name, bool transfer_data_mixed)
+{
+    uint32_t passes = iterations / 10000U;
+    uint32_t messages;
+    uint32_t linearized;
+    uint64_t start;
+    uint64_t elapsed;
+    uint64_t copied;
+    uint32_t i;
+
+    if (passes == 0U) {
+        passes = 1U;
+    }
+    if (passes > 50U) {
+        passes = 50U;
+    }
+    interface_rx(64U);
+    messages = pipeline_build(transfer_data_mixed);
+    rx_source = pipeline_stream;
+    rx_piece_max = PIPELINE_SEGMENT;
+    linearized = itf.rx_linearized_count;
+
+    bytes_copied = 0U;
+    start = test_now_ns();
+    for (i = 0U; i < passes; i++) {
+        rx_position = 0U;
+        while (rx_position < rx_length) {
+            (void)doip_interface_process(&itf, NULL, on_message, NULL, NULL, NULL);
+        }
+    }
+    elapsed = test_now_ns() - start;
+    copied = bytes_copied;
+    linearized = itf.rx_linearized_count - linearized;
+    messages *= passes;
+    if (elapsed == 0U) {
+        elapsed = 1U;
+    }
+
+    printf("{\"bench\":\"%s\",\"messages\":%u,\"mb_per_s\":%.1f,"
+           "\"bytes_copied_per_msg\":%.2f,\"linearized_per_msg\":%.4f}\n",
+           name, messages,
+           ((double)rx_length * (double)passes * 1000.0) / (double)elapsed,
+           (double)copied / (double)messages,
+           (double)linearized / (double)messages);
+
+    rx_piece_max = 0U;
+    rx_source = rx_stream;
+}
+
+static void bench_pipelined_rx(void)
+{
+    pipelined_rx("interface_rx_pipelined_tester_present", false);
+    pipelined_rx("interface_rx_pipelined_transfer_data", true);
+}
+
+/* Responses to a receiver that takes 2 KB per cycle while 4 responses of
+ * 20 to 1500 bytes are offered: refused frames are offered again next
+ * cycle, and the receiver checks that every frame arrives whole, once
+ * and in order */
+
+#define SLOW_WINDOW         2048U
+#define SLOW_BURST          4U
+
+static uint8_t slow_rx[DOIP_TX_FRAME_SIZE * 2U];
+static uint32_t slow_rx_length;
+static uint32_t slow_window;
+static uint32_t slow_expected;
+static uint32_t slow_corrupt;
+
+/* Frames carry their index in the first 4 bytes of user data */
+static void slow_parse(void)
+{
+    uint32_t position = 0U;
+    uint32_t length;
+    uint32_t index;
+
+    while ((position + 12U) <= slow_rx_length) {
+        length = ((uint32_t)slow_rx[position + 6U] << 8) |
+                 (uint32_t)slow_rx[position + 7U];
+        if ((slow_rx[position] != 0x03U) || (slow_rx[position + 1U] != 0xFCU) ||
+            (length < 8U) || (length > DOIP_MAX_PAYLOAD_SIZE)) {
+            slow_corrupt++;
+            slow_rx_length = 0U;
+            return;
+        }
+        if ((position + 8U + length) > slow_rx_length) {
+            break;
+        }
+        index = ((uint32_t)slow_rx[position + 12U] << 24) |
+                ((uint32_t)slow_rx[position + 13U] << 16) |
+                ((uint32_t)slow_rx[position + 14U] << 8) |
+                (uint32_t)slow_rx[position + 15U];
+        if (index != slow_expected) {
+            slow_corrupt++;
+        }
+        slow_expected = index + 1U;
+        position += 8U + length;
+    }
+    slow_rx_length -= position;
+    (void)__real_memmove(slow_rx, &slow_rx[position], slow_rx_length);
+}
+
+static int slow_send(int sock, const uint8_t *data, uint32_t len)
+{
+    (void)sock;
+    if (len > slow_window) {
+        len = slow_window;
+    }
+    (void)__real_memcpy(&slow_rx[slow_rx_length], data, len);
+    slow_rx_length += len;
+    slow_window -= len;
+    slow_parse();
+    return (int)len;
+}
+
+static void bench_slow_receiver(void)
+{
+    uint32_t frames = iterations / 100U;
+    uint32_t seed = 3U;
+    uint32_t sent = 0U;
+    uint32_t refused = 0U;
+    uint32_t cycles = 0U;
+    uint32_t length = 0U;
+    uint32_t encoded_length = 0U;
+    uint32_t i;
+    uint64_t start;
+    uint64_t elapsed;
+    doip_diagnostic_message_t message = { 0x1000U, 0x0E80U, 0U, user_data };
+    int conn;
+
+    if (frames < 1000U) {
+        frames = 1000U;
+    }
+    if (frames > 100000U) {
+        frames = 100000U;
+    }
+    (void)memset(&ops, 0, sizeof(ops));
+    ops.tcp_recv = mock_recv;
+    ops.tcp_send = slow_send;
+    ops.close_socket = mock_close;
+    (void)doip_interface_init(&itf, &ops);
+    conn = doip_interface_attach_socket(&itf, RX_SOCKET);
+    rx_length = 0U;
+    rx_position = 0U;
+    slow_rx_length = 0U;
+    slow_window = 0U;
+    slow_expected = 0U;
+    slow_corrupt = 0U;
+
+    start = test_now_ns();
+    while ((sent < frames) && (cycles < (frames * 4U))) {
+        for (i = 0U; (i < SLOW_BURST) && (sent < frames); i++) {
+            if (length == 0U) {
+                length = 20U + (test_random(&seed) % 1481U);
+                user_data[0] = (uint8_t)(sent >> 24);
+                user_data[1] = (uint8_t)(sent >> 16);
+                user_data[2] = (uint8_t)(sent >> 8);
+                user_data[3] = (uint8_t)sent;
+                message.user_data_length = length;
+                (void)doip_encode_diagnostic_message(&message, frame, sizeof(frame),
+                                                     &encoded_length);
+            }
+            if (doip_interface_tcp_send(&itf, conn, frame, encoded_length) !=
+                DOIP_RESULT_OK) {
+                /* Backpressure: offer the same frame next cycle */
+                refused++;
+                break;
+            }
+            length = 0U;
+            sent++;
+        }
+        slow_window = SLOW_WINDOW;
+        (void)doip_interface_process(&itf, NULL, on_message, NULL, NULL, NULL);
+        cycles++;
+    }
+    /* Drain what is still queued */
+    for (i = 0U; (i < 64U) && (slow_expected < sent); i++) {
+        slow_window = SLOW_WINDOW;
+        (void)doip_interface_process(&itf, NULL, on_message, NULL, NULL, NULL);
+    }
+    elapsed = test_now_ns() - start;
+    if (elapsed == 0U) {
+        elapsed = 1U;
+    }
+
+    if ((slow_corrupt > 0U) || (slow_expected != frames) || (itf.tx_overflow_count > 0U)) {
+        printf("{\"bench\":\"interface_tx_slow_receiver\",\"error\":"
+               "\"%u of %u frames in order, %u corrupt, %u overflows\"}\n",
+               slow_expected, frames, slow_corrupt, itf.tx_overflow_count);
+    } else {
+        printf("{\"bench\":\"interface_tx_slow_receiver\",\"frames\":%u,\"cycles\":%u,"
+               "\"refused_per_frame\":%.3f,\"tx_high_water\":%u,\"tx_queue_size\":%u,"
+               "\"ns_per_frame\":%.1f}\n",
+               frames, cycles, (double)refused / (double)frames,
+               itf.connections[conn].tx_high_water, DOIP_TX_QUEUE_SIZE,
+               (double)elapsed / (double)frames);
+    }
+    doip_interface_close_connection(&itf, conn);
+}
+
+/* UDS services */
+
+static uds_context_t context;
+static uds_service_table_t table;
+static uds_download_t download;
+static uint8_t response_buffer[64];
+static uds_request_t request;
+static uint8_t request_data[UDS_DOWNLOAD_BLOCK_SIZE + 1U];
+
+static void uds_call(void)
+{
+    uds_response_t response = { response_buffer, sizeof(response_buffer), 0U, false };
+
+    (void)uds_process_request(&context, &request, &response);
+    sink += response.actual_length;
+}
+
+static void uds_request(uint8_t sid, const uint8_t *data, uint32_t length)
+{
+    request.sid = sid;
+    request.data = data;
+    request.length = length;
+}
+
+/* Memory that accepts a write at once without touching the data */
+static bool null_prepare(void *ctx, uint32_t address, uint32_t size)
+{
+    (void)ctx;
+    (void)address;
+    (void)size;
+    return true;
+}
+
+static bool null_write_start(void *ctx, uint32_t address, const uint8_t *data,
+                             uint32_t length)
+{
+    (void)ctx;
+    (void)address;
+    (void)data;
+    (void)length;
+    return true;
+}
+
+static uds_download_memory_status_t null_write_status(void *ctx, bool wait)
+{
+    (void)ctx;
+    (void)wait;
+    return UDS_DOWNLOAD_MEMORY_IDLE;
+}
+
+static bool null_finish(void *ctx)
+{
+    (void)ctx;
+    return true;
+}
+
+static void request_download_op(void)
+{
+    uds_call();
+    uds_download_abort(&download);
+}
+
+static void transfer_data_op(void)
+{
+    request_data[0] = download.next_counter;
+    uds_call();
+}
+
+static void uds_setup(void)
+{
+    static const uds_download_memory_t memory = {
+        null_prepare, null_write_start, null_write_status, null_finish, NULL, NULL, NULL
+    };
+    static const uds_download_region_t region = { 0x00000000U, 0xFFFFF000U };
+
+    uds_init(&context);
+    uds_service_table_init(&table);
+    uds_register_core_services(&table);
+    uds_register_download_services(&table);
+    uds_set_service_table(&context, &table);
+    uds_download_init(&download, &memory, &region, 1U);
+    uds_download_attach(&context, &download);
+}
+
+static void bench_uds(void)
+{
+    static const uint8_t default_session[] = { 0x01U };
+    static const uint8_t extended_session[] = { 0x03U };
+    static const uint8_t programming_session[] = { 0x02U };
+    static const uint8_t tester_present[] = { 0x00U };
+    static const uint8_t read_vin[] = { 0xF1U, 0x90U };
+    static const uint8_t request_seed[] = { 0x01U };
+    static const uint8_t ecu_reset[] = { 0x01U };
+    uint8_t request_download[10];
+    uint64_t size = (uint64_t)iterations * UDS_DOWNLOAD_BLOCK_SIZE;
+    uint32_t i;
+
+    uds_setup();
+
+    uds_request(0x10U, default_session, sizeof(default_session));
+    run("uds_diagnostic_session_control", uds_call);
+    uds_request(0x11U, ecu_reset, sizeof(ecu_reset));
+    run("uds_ecu_reset", uds_call);
+    uds_request(0x3EU, tester_present, sizeof(tester_present));
+    run("uds_tester_present", uds_call);
+    uds_request(0x22U, read_vin, sizeof(read_vin));
+    run("uds_read_data_by_id_vin", uds_call);
+
+    uds_request(0x10U, extended_session, sizeof(extended_session));
+    uds_call();
+    uds_request(0x27U, request_seed, sizeof(request_seed));
+    run("uds_security_access_seed", uds_call);
+
+    /* One RequestDownload for all blocks, capped to the region */
+    uds_request(0x10U, programming_session, sizeof(programming_session));
+    uds_call();
+    context.security_level = 1U;
+    if (size > 0xFFFFF000U) {
+        size = 0xFFFFF000U;
+    }
+    request_download[0] = 0x00U;
+    request_download[1] = 0x44U;
+    for (i = 0U; i < 4U; i++) {
+        request_download[2U + i] = 0U;
+        request_download[6U + i] = (uint8_t)(size >> (24U - (8U * i)));
+    }
+    uds_request(0x34U, request_download, sizeof(request_download));
+    run("uds_request_download", request_download_op);
+    uds_call();
+    uds_request(0x36U, request_data, sizeof(request_data));
+    run("uds_transfer_data_4080", transfer_data_op);
+    uds_download_abort(&download);
+}
+
+/* ReadDataByIdentifier of the 20 identification DIDs a tester reads at
+ * session start: one request for all of them against 20 requests of one
+ * DID each, which also cost 19 more round trips on the network */
+
+#define RDBI_DIDS           20U
+#define RDBI_RECORD_LENGTH  16U
+
+static uds_did_registry_t rdbi_registry;
+static uds_did_t rdbi_dids[RDBI_DIDS];
+static uint8_t rdbi_records[RDBI_DIDS][RDBI_RECORD_LENGTH];
+static uint8_t rdbi_all[RDBI_DIDS * 2U];
+static uint8_t rdbi_response[1U + (RDBI_DIDS * (2U + RDBI_RECORD_LENGTH))];
+static uint32_t rdbi_next;
+
+static void rdbi_all_op(void)
+{
+    uds_response_t response = { rdbi_response, sizeof(rdbi_response), 0U, false };
+
+    (void)uds_process_request(&context, &request, &response);
+    sink += response.actual_length;
+}
+
+static void rdbi_single_op(void)
+{
+    uds_response_t response = { rdbi_response, sizeof(rdbi_response), 0U, false };
+    uint32_t i;
+
+    for (i = 0U; i < RDBI_DIDS; i++) {
+        request.data = &rdbi_all[2U * i];
+        (void)uds_process_request(&context, &request, &response);
+        sink += response.actual_length;
+    }
+}
+
+static void did_lookup_op(void)
+{
+    rdbi_next = (rdbi_next + 1U) % RDBI_DIDS;
+    sink += (uint32_t)(uintptr_t)uds_did_find(&rdbi_registry, rdbi_dids[rdbi_next].did);
+}
+
+static void bench_rdbi(void)
+{
+    uds_response_t response = { rdbi_response, sizeof(rdbi_response), 0U, false };
+    uint32_t i;
+
+    uds_setup();
+    uds_did_registry_init(&rdbi_registry);
+    for (i = 0U; i < RDBI_DIDS; i++) {
+        rdbi_dids[i].did = (uint16_t)(0xF180U + i);
+        rdbi_dids[i].sessions = UDS_SESSIONS_ALL;
+        rdbi_dids[i].security_level = 0U;
+        rdbi_dids[i].length = RDBI_RECORD_LENGTH;
+        rdbi_dids[i].data = rdbi_records[i];
+        rdbi_dids[i].read = NULL;
+        (void)memset(rdbi_records[i], (int)('A' + i), RDBI_RECORD_LENGTH);
+        (void)uds_did_register(&rdbi_registry, &rdbi_dids[i]);
+        rdbi_all[2U * i] = (uint8_t)(rdbi_dids[i].did >> 8);
+        rdbi_all[(2U * i) + 1U] = (uint8_t)rdbi_dids[i].did;
+    }
+    uds_set_did_registry(&context, &rdbi_registry);
+
+    uds_request(UDS_SID_READ_DATA_BY_IDENTIFIER, rdbi_all, sizeof(rdbi_all));
+    (void)uds_process_request(&context, &request, &response);
+    if (response.actual_length != sizeof(rdbi_response)) {
+        printf("{\"bench\":\"uds_rdbi_20_dids\",\"error\":\"%u response bytes\"}\n",
+               response.actual_length);
+        return;
+    }
+    run("uds_rdbi_20_dids_one_request", rdbi_all_op);
+    uds_request(UDS_SID_READ_DATA_BY_IDENTIFIER, rdbi_all, 2U);
+    run("uds_rdbi_20_dids_single_requests", rdbi_single_op);
+    run("uds_did_lookup", did_lookup_op);
+}
+
+/* CRC-32 kernels over one TransferData block and over 64 KB */
+
+#define CRC_LARGE_SIZE      65536U
+
+static uint8_t crc_data[CRC_LARGE_SIZE];
+static uint32_t crc_length;
+
+static void crc_slice8_op(void)
+{
+    sink += crc32_update_slice8(CRC32_INITIAL, crc_data, crc_length);
+}
+
+static void crc_bytewise_op(void)
+{
+    sink += crc32_update_bytewise(CRC32_INITIAL, crc_data, crc_length);
+}
+
+static void bench_crc(void)
+{
+    uint32_t seed = 1U;
+    uint32_t i;
+
+    for (i = 0U; i < CRC_LARGE_SIZE; i++) {
+        crc_data[i] = (uint8_t)test_random(&seed);
+    }
+
+    crc_length = UDS_DOWNLOAD_BLOCK_SIZE;
+    run_bytes("crc32_slice8_4080", crc_slice8_op, crc_length);
+    run_bytes("crc32_bytewise_4080", crc_bytewise_op, crc_length);
+    crc_length = CRC_LARGE_SIZE;
+    run_bytes("crc32_slice8_64k", crc_slice8_op, crc_length);
+    run_bytes("crc32_bytewise_64k", crc_bytewise_op, crc_length);
+}
+
+/* Downloads through the entity onto the file-backed simulated flash, the
+ * tester's requests prepared ahead and read as fast as the entity takes
+ * them. With the datasheet flash timings this is the end-to-end rate;
+ * with zero timings it is what the stack alone can move. */
+
+#define DOWNLOAD_MIN_SIZE   65536U
+#define DOWNLOAD_MAX_SIZE   (1024U * 1024U)
+#define DOWNLOAD_IMAGE      "bench_flash.img"
+
+/* Room for the 14 byte request header of blocks averaging 9 bytes */
+static uint8_t download_script[DOWNLOAD_MAX_SIZE * 3U];
+static uint8_t download_image[DOWNLOAD_MAX_SIZE];
+static uint8_t download_sent[65536];
+static uint32_t download_sent_length;
+static uint32_t download_positive;
+static uint32_t download_negative;
+static uint32_t download_block_min;     /* Random blocks of this to 'block', 0: all 'block' */
+static uint32_t download_block_seed = 9U;
+static uint32_t download_block_pages;   /* Quad-pages the blocks touch on their own */
+
+static int mock_udp_bind(uint16_t port)
+{
+    (void)port;
+    return 2;
+}
+
+static int mock_udp_sendto(int sock, const uint8_t *data, uint32_t len,
+                           const doip_endpoint_t *dst)
+{
+    (void)sock;
+    (void)data;
+    (void)dst;
+    return (int)len;
+}
+
+static int mock_udp_recvfrom(int sock, uint8_t *buf, uint32_t len,
+                             doip_endpoint_t *src)
+{
+    (void)sock;
+    (void)buf;
+    (void)len;
+    (void)src;
+    return -1;
+}
+
+static int mock_send(int sock, const uint8_t *data, uint32_t len)
+{
+    (void)sock;
+    if ((download_sent_length + len) > sizeof(download_sent)) {
+        return -1;
+    }
+    (void)__real_memcpy(&download_sent[download_sent_length], data, len);
+    download_sent_length += len;
+    return (int)len;
+}
+
+/* Counts the UDS responses sent since the last call */
+static void download_responses(void)
+{
+    uint32_t position = 0U;
+    uint32_t length;
+
+    while ((position + 13U) <= download_sent_length) {
+        length = ((uint32_t)download_sent[position + 6U] << 8) |
+                 (uint32_t)download_sent[position + 7U];
+        if ((download_sent[position + 2U] == 0x80U) &&
+            (download_sent[position + 3U] == 0x01U)) {
+            if (download_sent[position + 12U] == 0x7FU) {
+                download_negative++;
+            } else {
+                download_positive++;
+            }
+        }
+        position += 8U + length;
+    }
+    download_sent_length = 0U;
+}
+
+static uint8_t *script_header(uint16_t type, uint32_t length)
+{
+    uint8_t *h = &download_script[rx_length];
+
+    h[0] = 0x03U;
+    h[1] = 0xFCU;
+    h[2] = (uint8_t)(type >> 8);
+    h[3] = (uint8_t)type;
+    h[4] = (uint8_t)(length >> 24);
+    h[5] = (uint8_t)(length >> 16);
+    h[6] = (uint8_t)(length >> 8);
+    h[7] = (uint8_t)length;
+    rx_length += 8U + length;
+    return &h[8];
+}
+
+static void script_request(const uint8_t *uds, uint32_t uds_length,
+                           const uint8_t *data, uint32_t length)
+{
+    uint8_t *p = script_header(DOIP_PAYLOAD_TYPE_DIAG_MESSAGE,
+                               4U + uds_length + length);
+
+    p[0] = 0x0EU;
+    p[1] = 0x80U;
+    p[2] = 0x10U;
+    p[3] = 0x00U;
+    (void)__real_memcpy(&p[4], uds, uds_length);
+    if (length > 0U) {
+        (void)__real_memcpy(&p[4U + uds_length], data, length);
+    }
+}
+
+/* Routing activation, programming session, unlock, then the download */
+static uint32_t download_script_build(uint32_t size, uint32_t block)
+{
+    static const uint8_t session[] = { 0x10U, 0x02U };
+    static const uint8_t seed[] = { 0x27U, 0x01U };
+    static const uint8_t key[] = { 0x27U, 0x02U, 0xB7U, 0x91U, 0xF3U, 0xDDU };
+    uint8_t request[11];
+    uint32_t crc;
+    uint32_t offset;
+    uint32_t length;
+    uint32_t blocks = 0U;
+    uint32_t i;
+    uint8_t *p;
+
+    rx_length = 0U;
+    p = script_header(DOIP_PAYLOAD_TYPE_ROUTING_ACTIVATION_REQ, 7U);
+    p[0] = 0x0EU;
+    p[1] = 0x80U;
+    (void)memset(&p[2], 0, 5U);
+    script_request(session, sizeof(session), NULL, 0U);
+    script_request(seed, sizeof(seed), NULL, 0U);
+    script_request(key, sizeof(key), NULL, 0U);
+
+    request[0] = 0x34U;
+    request[1] = 0x00U;
+    request[2] = 0x44U;
+    for (i = 0U; i < 4U; i++) {
+        request[3U + i] = (uint8_t)(FLASH_BANK_B_ADDRESS >> (24U - (8U * i)));
+        request[7U + i] = (uint8_t)(size >> (24U - (8U * i)));
+    }
+    script_request(request, sizeof(request), NULL, 0U);
+
+    download_block_pages = 0U;
+    for (offset = 0U; offset < size; offset += length) {
+        length = block;
+        if (download_block_min > 0U) {
+            length = download_block_min +
+                     (test_random(&download_block_seed) % ((block - download_block_min) + 1U));
+        }
+        if (length > (size - offset)) {
+            length = size - offset;
+        }
+        download_block_pages += (((offset + length) - 1U) / FLASH_QUAD_PAGE_SIZE) -
+                                (offset / FLASH_QUAD_PAGE_SIZE) + 1U;
+        blocks++;
+        request[0] = 0x36U;
+        request[1] = (uint8_t)blocks;
+        script_request(request, 2U, &download_image[offset], length);
+    }
+
+    crc = crc32_compute(download_image, size);
+    request[0] = 0x37U;
+    request[1] = (uint8_t)(crc >> 24);
+    request[2] = (uint8_t)(crc >> 16);
+    request[3] = (uint8_t)(crc >> 8);
+    request[4] = (uint8_t)crc;
+    script_request(request, 5U, NULL, 0U);
+
+    return blocks;
+}
+
+static doip_entity_t download_entity;
+static uds_download_flash_t download_flash;
+static uds_download_memory_t download_memory;
+
+static void download_request(uint16_t source_addr, uint16_t target_addr,
+                             const uint8_t *data, uint32_t length, void *user_data)
+{
+    uds_request_t uds = { data[0], &data[1], length - 1U };
+    uds_response_t response = { response_buffer, sizeof(response_buffer), 0U, false };
+
+    (void)target_addr;
+    if (uds_process_request(&context, &uds, &response)) {
+        (void)doip_entity_send_diagnostic_response((doip_entity_t *)user_data,
+            source_addr, response_buffer, response.actual_length);
+    }
+}
+
+static bool download_stream(doip_stream_event_t event, uint16_t source_addr,
+                            uint16_t target_addr, uint32_t total_length,
+                            uint32_t offset, const uint8_t *data, uint32_t length,
+                            void *user_data)
+{
+    uds_response_t response = { response_buffer, sizeof(response_buffer), 0U, false };
+
+    (void)target_addr;
+    (void)offset;
+    if (event == DOIP_STREAM_EVENT_START) {
+        return uds_download_stream_start(&context, total_length);
+    }
+    if (event == DOIP_STREAM_EVENT_DATA) {
+        uds_download_stream_data(&context, data, length);
+    } else if (event == DOIP_STREAM_EVENT_END) {
+        if (uds_download_stream_end(&context, &response)) {
+            (void)doip_entity_send_diagnostic_response((doip_entity_t *)user_data,
+                source_addr, response_buffer, response.actual_length);
+        }
+    } else {
+        uds_download_stream_abort(&context);
+    }
+    return true;
+}
+
+static flash_sim_t download_sim;
+static flash_t download_flash_device;
+
+/* Entity, UDS and flash download memory on a fresh map of the image */
+static bool download_open(const char *name, uint32_t block, bool flash_timing)
+{
+    static const uds_download_region_t region = { FLASH_BANK_B_ADDRESS, FLASH_BANK_SIZE };
+    doip_entity_config_t config;
+
+    if (flash_sim_open(&download_sim, DOWNLOAD_IMAGE) != FLASH_RESULT_OK) {
+        printf("{\"bench\":\"%s\",\"error\":\"flash image\"}\n", name);
+        return false;
+    }
+    if (!flash_timing) {
+        download_sim.erase_us = 0U;
+        download_sim.program_us = 0U;
+        download_sim.program_unit_us = 0U;
+    }
+    (void)flash_init(&download_flash_device, &g_flash_sim_ops, &download_sim);
+    uds_download_flash_init(&download_flash, &download_flash_device, &download_memory);
+
+    uds_init(&context);
+    uds_service_table_init(&table);
+    uds_register_core_services(&table);
+    uds_register_download_services(&table);
+    uds_set_service_table(&context, &table);
+    uds_download_init(&download, &download_memory, &region, 1U);
+    uds_download_set_max_block_length(&download, block + 2U);
+    uds_download_attach(&context, &download);
+
+    (void)memset(&ops, 0, sizeof(ops));
+    ops.udp_bind = mock_udp_bind;
+    ops.udp_sendto = mock_udp_sendto;
+    ops.udp_recvfrom = mock_udp_recvfrom;
+    ops.tcp_listen = mock_listen;
+    ops.tcp_accept = mock_accept;
+    ops.tcp_recv = mock_recv;
+    ops.tcp_send = mock_send;
+    ops.close_socket = mock_close;
+    (void)memset(&config, 0, sizeof(config));
+    config.logical_address = 0x1000U;
+    config.general_inactivity_time = 300000U;
+    config.initial_inactivity_time = 300000U;
+    config.alive_check_time = 500U;
+    config.max_tester_connections = 1U;
+    (void)doip_interface_init(&itf, &ops);
+    (void)doip_entity_init(&download_entity, &config, &itf);
+    (void)doip_entity_start(&download_entity);
+    doip_entity_set_uds_stream_callback(&download_entity, download_stream);
+
+    rx_source = download_script;
+    rx_position = 0U;
+    rx_accepted = false;
+    download_sent_length = 0U;
+    download_positive = 0U;
+    download_negative = 0U;
+    return true;
+}
+
+static void download_close(void)
+{
+    rx_source = rx_stream;
+    flash_sim_close(&download_sim);
+}
+
+/* Feeds the script as fast as the entity takes it. False, and printed,
+ * unless all 'expected' responses were positive. */
+static bool download_drive(const char *name, uint32_t expected)
+{
+    while (((download_positive + download_negative) < expected) &&
+           ((rx_position < rx_length) || uds_download_poll(&download))) {
+        doip_entity_run_timers(&download_entity, test_now_ms());
+        (void)doip_entity_process(&download_entity, download_request);
+        download_responses();
+        (void)uds_download_poll(&download);
+    }
+    if (download_positive != expected) {
+        printf("{\"bench\":\"%s\",\"error\":\"%u of %u responses positive\"}\n",
+               name, download_positive, expected);
+        return false;
+    }
+    return true;
+}
+
+static void run_download(const char *name, uint32_t size, uint32_t block,
+                         bool flash_timing)
+{
+    uint32_t blocks;
+    uint64_t start;
+    uint64_t elapsed;
+    uint64_t copied;
+    bool ok;
+
+    if (!download_open(name, block, flash_timing)) {
+        return;
+    }
+    blocks = download_script_build(size, block);
+
+    bytes_copied = 0U;
+    start = test_now_ns();
+    /* Session, seed, key, RequestDownload, blocks, exit */
+    ok = download_drive(name, blocks + 5U);
+    elapsed = test_now_ns() - start;
+    copied = bytes_copied;
+    if (elapsed == 0U) {
+        elapsed = 1U;
+    }
+
+    if (ok) {
+        printf("{\"bench\":\"%s\",\"bytes\":%u,\"blocks\":%u,\"ns\":%llu,"
+               "\"mb_per_s\":%.2f,\"bytes_copied_per_byte\":%.2f}\n",
+               name, size, blocks, (unsigned long long)elapsed,
+               ((double)size * 1000.0) / (double)elapsed,
+               (double)copied / (double)size);
+    }
+
+    download_close();
+}
+
+/* Program operations per MB for blocks of 'min_block' to 'block' bytes,
+ * 0 for all 'block', against programming each block on its own with its
+ * partial quad-pages padded. The ideal is one per 128 byte quad-page. */
+static void run_programs(const char *name, uint32_t size, uint32_t min_block,
+                         uint32_t block)
+{
+    uint32_t blocks;
+
+    if (!download_open(name, block, false)) {
+        return;
+    }
+    download_block_min = min_block;
+    blocks = download_script_build(size, block);
+    download_block_min = 0U;
+
+    if (download_drive(name, blocks + 5U)) {
+        printf("{\"bench\":\"%s\",\"bytes\":%u,\"blocks\":%u,"
+               "\"programs_per_mb\":%u,\"combined\":%u,"
+               "\"per_block_programs_per_mb\":%u,\"ideal_programs_per_mb\":%u}\n",
+               name, size, blocks,
+               uds_download_flash_programs_per_mb(&download_flash),
+               download_flash.stats.combined,
+               (uint32_t)(((uint64_t)download_block_pages << 20) / size),
+               (uint32_t)(((uint64_t)((size + FLASH_QUAD_PAGE_SIZE) - 1U) /
+                           FLASH_QUAD_PAGE_SIZE << 20) / size));
+    }
+
+    download_close();
+}
+
+/* OTA time against the network rate with the datasheet flash timings. The
+ * tester waits for each response before it sends the next request, every
+ * request takes its length at the network rate on the wire, and seed and
+ * key take OTA_UNLOCK_MS after the session was entered. Erasing starts at
+ * the session entry, at RequestDownload, or blocks RequestDownload until
+ * the range is erased, as it did before the background erase. */
+
+#define OTA_UNLOCK_MS       300U
+
+typedef enum {
+    OTA_ERASE_BLOCKING = 0,
+    OTA_ERASE_FROM_REQUEST,
+    OTA_ERASE_FROM_SESSION,
+    OTA_NO_ERASE
+} ota_erase_t;
+
+/* Milliseconds for the download, 0 if it failed. 'erase_ms' is the time
+ * the sectors it erased took, 'stall_ms' how long blocks waited for them. */
+static uint32_t run_ota(const char *name, uint32_t size, uint32_t kb_per_s,
+                        ota_erase_t erase, uint32_t *erase_ms, uint32_t *stall_ms)
+{
+    uint32_t script_length;
+    uint32_t blocks;
+    uint32_t expected;
+    uint32_t requests = 1U;             /* The session comes with activation */
+    uint32_t next_length = 0U;
+    uint64_t next_ns = 0U;
+    uint64_t unlock_ns = (uint64_t)OTA_UNLOCK_MS * 1000000U;
+    uint64_t start;
+    uint64_t now;
+    uint32_t erased;
+    uint32_t elapsed_ms;
+    const uint8_t *h;
+
+    if (!download_open(name, UDS_DOWNLOAD_BLOCK_SIZE, true)) {
+        return 0U;
+    }
+    if (erase == OTA_NO_ERASE) {
+        download_sim.erase_us = 0U;
+    }
+    if (erase != OTA_ERASE_FROM_SESSION) {
+        download_memory.prepare_ahead = NULL;
+    }
+    download_flash.now_ms = test_now_ms;
+    blocks = download_script_build(size, UDS_DOWNLOAD_BLOCK_SIZE);
+    expected = blocks + 5U;
+    script_length = rx_length;
+    erased = download_flash.erase.stats.sectors_erased;
+
+    /* Routing activation and session request */
+    rx_length = 8U + 7U + 8U + 4U + 2U;
+    start = test_now_ns();
+    while ((download_positive + download_negative) < expected) {
+        if ((next_length != 0U) && (test_now_ns() >= next_ns)) {
+            rx_length = next_length;
+            next_length = 0U;
+        }
+        doip_entity_run_timers(&download_entity, test_now_ms());
+        (void)doip_entity_process(&download_entity, download_request);
+        download_responses();
+        if (download_negative > 0U) {
+            break;
+        }
+
+        /* The tester sends as soon as the response is out, while the
+         * worker below may still be programming */
+        if ((next_length == 0U) && (rx_position == rx_length) &&
+            (rx_length < script_length) && (download_positive == requests)) {
+            now = test_now_ns();
+            h = &download_script[rx_length];
+            next_length = rx_length + 8U +
+                (((uint32_t)h[4] << 24) | ((uint32_t)h[5] << 16) |
+                 ((uint32_t)h[6] << 8) | (uint32_t)h[7]);
+            next_ns = now + (((uint64_t)(next_length - rx_length) * 1000000U) /
+                             kb_per_s);
+            if ((requests == 1U) && (next_ns < (start + unlock_ns))) {
+                next_ns = start + unlock_ns;
+            }
+            /* The first block follows the positive response, which the
+             * blocking RequestDownload only sends once all is erased */
+            if ((requests == 4U) && (erase == OTA_ERASE_BLOCKING)) {
+                while (flash_erase_step(&download_flash.erase) == FLASH_RESULT_BUSY) {
+                    (void)flash_wait(&download_flash_device);
+                }
+                next_ns += test_now_ns() - now;
+            }
+            requests++;
+        }
+        (void)uds_download_poll(&download);
+    }
+    elapsed_ms = (uint32_t)((test_now_ns() - start) / 1000000U);
+    erased = download_flash.erase.stats.sectors_erased - erased;
+    *erase_ms = (erased * download_sim.erase_us) / 1000U;
+    *stall_ms = download_flash.stats.stall_ms;
+
+    if (download_positive != expected) {
+        printf("{\"bench\":\"%s\",\"error\":\"%u of %u responses positive\"}\n",
+               name, download_positive, expected);
+        elapsed_ms = 0U;
+    }
+
+    download_close();
+    return elapsed_ms;
+}
+
+/* Each line has the OTA time with the transfer alone, onto flash that
+ * needs no erase, and the erase alone: ideally their maximum, the sum
+ * if nothing overlaps */
+static void bench_ota(uint32_t size, uint32_t kb_per_s)
+{
+    static const char *const modes[] = { "blocking", "from_request", "from_session" };
+    char name[64];
+    uint32_t transfer_ms;
+    uint32_t erase_ms;
+    uint32_t stall_ms;
+    uint32_t ota_ms;
+    uint32_t m;
+
+    (void)snprintf(name, sizeof(name), "ota_%u_kb_s_transfer_only", kb_per_s);
+    transfer_ms = run_ota(name, size, kb_per_s, OTA_NO_ERASE, &erase_ms, &stall_ms);
+    if (transfer_ms == 0U) {
+        return;
+    }
+    for (m = 0U; m < (sizeof(modes) / sizeof(modes[0])); m++) {
+        (void)snprintf(name, sizeof(name), "ota_%u_kb_s_erase_%s", kb_per_s, modes[m]);
+        ota_ms = run_ota(name, size, kb_per_s, (ota_erase_t)m, &erase_ms, &stall_ms);
+        if (ota_ms != 0U) {
+            printf("{\"bench\":\"%s\",\"bytes\":%u,\"network_mb_per_s\":%.1f,"
+                   "\"ota_ms\":%u,\"transfer_ms\":%u,\"erase_ms\":%u,"
+                   "\"max_ms\":%u,\"sum_ms\":%u,\"stall_ms\":%u}\n",
+                   name, size, (double)kb_per_s / 1000.0, ota_ms, transfer_ms,
+                   erase_ms, (transfer_ms > erase_ms) ? transfer_ms : erase_ms,
+                   transfer_ms + erase_ms, stall_ms);
+        }
+    }
+}
+
+static void bench_download(void)
+{
+    uint32_t size = iterations;
+    uint32_t seed = 5U;
+    uint32_t i;
+
+    /* Scaled with --iterations, so a smoke run stays short */
+    if (size < DOWNLOAD_MIN_SIZE) {
+        size = DOWNLOAD_MIN_SIZE;
+    }
+    if (size > DOWNLOAD_MAX_SIZE) {
+        size = DOWNLOAD_MAX_SIZE;
+    }
+    for (i = 0U; i < size; i++) {
+        download_image[i] = (uint8_t)test_random(&seed);
+    }
+
+    run_download("download_cpu_4080", size, UDS_DOWNLOAD_BLOCK_SIZE, false);
+    run_download("download_cpu_65536", size, 65536U, false);
+    run_download("download_flash_4080", size, UDS_DOWNLOAD_BLOCK_SIZE, true);
+    run_download("download_flash_65536", size, 65536U, true);
+
+    run_programs("download_programs_fixed_4080", size, 0U, 4080U);
+    run_programs("download_programs_fixed_4001", size, 0U, 4001U);
+    run_programs("download_programs_random_1_4080", size, 1U, 4080U);
+    run_programs("download_programs_random_1_255", size, 1U, 255U);
+    run_programs("download_programs_random_1_17", size, 1U, 17U);
+
+    bench_ota(size, 8000U);
+    bench_ota(size, 1000U);
+    bench_ota(size, 500U);
+}
+
+/* Dispatch against the number of open connections: every tester is routed
+ * on its own connection of a pool of DOIP_MAX_CONNECTIONS, one of them
+ * receives a request or is sent a response, the others stay idle */
+
+#define DISPATCH_SOCKET     20
+#define DISPATCH_ACTIVATION 15U
+
+static doip_entity_t dispatch_entity;
+static doip_tcp_connection_t dispatch_pool[DOIP_MAX_CONNECTIONS];
+static uint8_t dispatch_rx[DOIP_MAX_CONNECTIONS][64];
+static uint32_t dispatch_rx_length[DOIP_MAX_CONNECTIONS];
+static uint32_t dispatch_rx_position[DOIP_MAX_CONNECTIONS];
+static uint32_t dispatch_open;
+static uint32_t dispatch_accepted;
+static uint16_t dispatch_tester;
+
+static int dispatch_recv(int sock, uint8_t *buf, uint32_t len)
+{
+    uint32_t k = (uint32_t)(sock - DISPATCH_SOCKET);
+    uint32_t n = dispatch_rx_length[k] - dispatch_rx_position[k];
+
+    if (n == 0U) {
+        return -1;
+    }
+    if (n > len) {
+        n = len;
+    }
+    (void)__real_memcpy(buf, &dispatch_rx[k][dispatch_rx_position[k]], n);
+    dispatch_rx_position[k] += n;
+    return (int)n;
+}
+
+static int dispatch_accept(int listen_sock)
+{
+    (void)listen_sock;
+    if (dispatch_accepted >= dispatch_open) {
+        return -1;
+    }
+    dispatch_accepted++;
+    return DISPATCH_SOCKET + (int)dispatch_accepted - 1;
+}
+
+static uint32_t admission_tester = DOIP_MAX_CONNECTIONS; /* Connection of the tester being admitted */
+static uint8_t admission_code;      /* Its routing activation response code */
+static bool admission_answer;       /* Routed testers answer alive checks */
+
+static int dispatch_send(int sock, const uint8_t *data, uint32_t len)
+{
+    uint32_t k = (uint32_t)(sock - DISPATCH_SOCKET);
+    uint16_t tester = (uint16_t)(0x0E80U + k);
+    uint8_t *p;
+
+    if (len < 8U) {
+        return (int)len;
+    }
+    if ((data[3] == (uint8_t)DOIP_PAYLOAD_TYPE_ROUTING_ACTIVATION_RES) && (len >= 13U) &&
+        (k == admission_tester)) {
+        admission_code = data[12];
+    } else if ((data[3] == (uint8_t)DOIP_PAYLOAD_TYPE_ALIVE_CHECK_REQ) && admission_answer) {
+        p = &dispatch_rx[k][dispatch_rx_length[k]];
+        p[0] = 0x02U;
+        p[1] = 0xFDU;
+        p[2] = 0x00U;
+        p[3] = (uint8_t)DOIP_PAYLOAD_TYPE_ALIVE_CHECK_RES;
+        (void)memset(&p[4], 0, 3U);
+        p[7] = 2U;
+        p[8] = (uint8_t)(tester >> 8);
+        p[9] = (uint8_t)tester;
+        dispatch_rx_length[k] += 10U;
+    } else {
+        /* Other frames are not looked at */
+    }
+    return (int)len;
+}
+
+/* Ready are the connections with bytes left and a pending listener */
+static int dispatch_select(const int *sockets, uint8_t *events, uint32_t count,
+                           uint32_t timeout_ms)
+{
+    uint32_t ready = 0U;
+    uint32_t k;
+    uint32_t i;
+
+    (void)timeout_ms;
+    for (i = 0U; i < count; i++) {
+        events[i] = 0U;
+        if (sockets[i] >= DISPATCH_SOCKET) {
+            k = (uint32_t)(sockets[i] - DISPATCH_SOCKET);
+            if (dispatch_rx_position[k] < dispatch_rx_length[k]) {
+                events[i] = DOIP_SOCKET_EVENT_READ;
+            }
+        } else if ((sockets[i] == 3) && (dispatch_accepted < dispatch_open)) {
+            events[i] = DOIP_SOCKET_EVENT_READ;
+        } else {
+            /* UDP stays idle */
+        }
+        if (events[i] != 0U) {
+            ready++;
+        }
+    }
+    return (int)ready;
+}
+
+static void dispatch_request(uint16_t source_addr, uint16_t target_addr,
+                             const uint8_t *data, uint32_t length, void *user)
+{
+    (void)source_addr;
+    (void)target_addr;
+    (void)user;
+    sink += data[length - 1U];
+}
+
+/* Routing activation, then a request that is replayed on every op */
+static void dispatch_script(uint32_t k)
+{
+    static const uint8_t header[8] = { 0x03U, 0xFCU, 0x00U, 0x05U, 0x00U, 0x00U, 0x00U, 0x07U };
+    uint16_t tester = (uint16_t)(0x0E80U + k);
+    doip_diagnostic_message_t message = { tester, 0x1000U, 16U, user_data };
+    uint8_t *p = dispatch_rx[k];
+    uint32_t length = 0U;
+
+    (void)__real_memcpy(p, header, sizeof(header));
+    p[8] = (uint8_t)(tester >> 8);
+    p[9] = (uint8_t)tester;
+    (void)memset(&p[10], 0, 5U);
+    (void)doip_encode_diagnostic_message(&message, &p[DISPATCH_ACTIVATION],
+                                         sizeof(dispatch_rx[k]) - DISPATCH_ACTIVATION,
+                                         &length);
+    dispatch_rx_length[k] = DISPATCH_ACTIVATION;
+    dispatch_rx_position[k] = 0U;
+}
+
+static bool dispatch_setup(uint32_t open)
+{
+    doip_entity_config_t config;
+    uint32_t k;
+
+    (void)memset(&ops, 0, sizeof(ops));
+    ops.udp_bind = mock_udp_bind;
+    ops.udp_sendto = mock_udp_sendto;
+    ops.udp_recvfrom = mock_udp_recvfrom;
+    ops.tcp_listen = mock_listen;
+    ops.tcp_accept = dispatch_accept;
+    ops.tcp_recv = dispatch_recv;
+    ops.tcp_send = dispatch_send;
+    ops.close_socket = mock_close;
+    ops.socket_select = dispatch_select;
+    (void)memset(&config, 0, sizeof(config));
+    config.logical_address = 0x1000U;
+    config.general_inactivity_time = 300000U;
+    config.initial_inactivity_time = 300000U;
+    config.alive_check_time = 500U;
+    config.max_tester_connections = (uint8_t)(DOIP_MAX_CONNECTIONS - 1U);
+    (void)doip_interface_init(&itf, &ops);
+    (void)doip_interface_set_connection_pool(&itf, dispatch_pool, DOIP_MAX_CONNECTIONS);
+    (void)doip_entity_init(&dispatch_entity, &config, &itf);
+    (void)doip_entity_start(&dispatch_entity);
+
+    dispatch_open = open;
+    dispatch_accepted = 0U;
+    for (k = 0U; k < open; k++) {
+        dispatch_script(k);
+    }
+    /* One accept per call, activations are read on the next one */
+    for (k = 0U; k <= open; k++) {
+        (void)doip_interface_wait(&itf, 0U);
+        (void)doip_entity_process(&dispatch_entity, dispatch_request);
+    }
+
+    /* Sending only works once the last tester is routed */
+    dispatch_tester = (uint16_t)(0x0E80U + open - 1U);
+    return doip_entity_send_diagnostic_response(&dispatch_entity, dispatch_tester,
+                                                user_data, 16U) == DOIP_RESULT_OK;
+}
+
+static void dispatch_response_op(void)
+{
+    (void)doip_entity_send_diagnostic_response(&dispatch_entity, dispatch_tester,
+                                               user_data, 16U);
+}
+
+static void dispatch_rx_op(void)
+{
+    uint32_t k = dispatch_open - 1U;
+
+    dispatch_rx_length[k] = DISPATCH_ACTIVATION + 28U;
+    dispatch_rx_position[k] = DISPATCH_ACTIVATION;
+    (void)doip_interface_wait(&itf, 0U);
+    (void)doip_entity_process(&dispatch_entity, dispatch_request);
+}
+
+/* A 10 ms task cycle with every connection idle: nothing is due, so the
+ * cost must not grow with the open connections. The clock stays within
+ * 10 s of the setup, far from the inactivity timeouts. */
+static void dispatch_timers_op(void)
+{
+    static uint32_t cycle;
+
+    cycle = (cycle + 1U) % 1000U;
+    doip_entity_run_timers(&dispatch_entity, cycle * 10U);
+}
+
+static void bench_dispatch(void)
+{
+    const uint32_t counts[] = { 1U, DOIP_MAX_CONNECTIONS / 2U, DOIP_MAX_CONNECTIONS - 1U };
+    char name[48];
+    uint32_t i;
+
+    for (i = 0U; i < (sizeof(counts) / sizeof(counts[0])); i++) {
+        if (!dispatch_setup(counts[i])) {
+            printf("{\"bench\":\"dispatch_%u\",\"error\":\"activation\"}\n", counts[i]);
+            continue;
+        }
+        (void)snprintf(name, sizeof(name), "dispatch_response_%u_open", counts[i]);
+        run(name, dispatch_response_op);
+        (void)snprintf(name, sizeof(name), "dispatch_rx_%u_open", counts[i]);
+        run(name, dispatch_rx_op);
+        (void)snprintf(name, sizeof(name), "dispatch_timers_%u_open", counts[i]);
+        run(name, dispatch_timers_op);
+        /* No tester may have timed out meanwhile */
+        if (doip_entity_send_diagnostic_response(&dispatch_entity, dispatch_tester,
+                                                 user_data, 16U) != DOIP_RESULT_OK) {
+            printf("{\"bench\":\"%s\",\"error\":\"closed\"}\n", name);
+        }
+    }
+}
+
+/* Tester admission with routed testers that went stale, or still answer:
+ * a new tester asks for routing activation, the entity alive-checks the
+ * routed sockets and decides once they answered or alive_check_time ran
+ * out. The clock moves in 10 ms task cycles, the latency is the time to
+ * the routing activation response. */
+static void admission(const char *name, uint32_t routed, bool same_address, bool answer)
+{
+    uint32_t now = 0U;
+    uint8_t *p = dispatch_rx[routed];
+
+    if (!dispatch_setup(routed)) {
+        printf("{\"bench\":\"%s\",\"error\":\"activation\"}\n", name);
+        return;
+    }
+    admission_tester = routed;
+    admission_code = 0xFFU;
+    admission_answer = answer;
+    dispatch_open = routed + 1U;
+    dispatch_script(routed);
+    if (same_address) {
+        /* The address of the first routed tester, from a new socket */
+        p[8] = 0x0EU;
+        p[9] = 0x80U;
+    }
+
+    while ((admission_code == 0xFFU) && (now < 10000U)) {
+        now += 10U;
+        doip_entity_run_timers(&dispatch_entity, now);
+        (void)doip_interface_wait(&itf, 0U);
+        (void)doip_entity_process(&dispatch_entity, dispatch_request);
+    }
+    admission_answer = false;
+    admission_tester = DOIP_MAX_CONNECTIONS;
+
+    printf("{\"bench\":\"%s\",\"routed\":%u,\"admission_ms\":%u,\"code\":%u,"
+           "\"reclaimed\":%u}\n",
+           name, routed, now - 10U, admission_code, dispatch_entity.reclaimed_count);
+}
+
+static void bench_admission(void)
+{
+    admission("admission_same_address_stale", 1U, true, false);
+    admission("admission_all_slots_stale", DOIP_MAX_CONNECTIONS - 1U, false, false);
+    admission("admission_all_slots_alive", DOIP_MAX_CONNECTIONS - 1U, false, true);
+}
+
+/* Response paths from the UDS handler to the socket of a routed tester:
+ * built in place in a pooled TX frame, built in a buffer of its own and
+ * gathered behind the headers, or copied behind them by the encoder. The
+ * tree has no ReadMemoryByAddress service, the bench registers one that
+ * reads RMBA_SIZE bytes of memory into the response; that read is the
+ * one copy a response cannot avoid. */
+
+#define RMBA_SIZE           1024U
+
+static uint8_t rmba_memory[RMBA_SIZE];
+static uint8_t response_own_buffer[DOIP_TX_FRAME_SIZE];
+
+static void rmba_handler(uds_context_t *ctx, const uds_request_t *req,
+                         uds_response_t *response)
+{
+    uint8_t *resp_data = uds_begin_positive_response(UDS_SID_READ_MEMORY_BY_ADDRESS,
+                                                     RMBA_SIZE, response);
+
+    (void)ctx;
+    (void)req;
+    if (resp_data != NULL) {
+        (void)memcpy(resp_data, rmba_memory, RMBA_SIZE);
+    }
+}
+
+static const uds_service_t rmba_service = {
+    .sid = UDS_SID_READ_MEMORY_BY_ADDRESS,
+    .sessions = UDS_SESSIONS_ALL,
+    .security_level = 0U,
+    .flags = 0U,
+    .min_length = 7U,
+    .subfunctions = { 0U, 0U, 0U, 0U },
+    .handler = rmba_handler
+};
+
+static int dispatch_sendv(int sock, const doip_iovec_t *iov, uint32_t iovcnt)
+{
+    uint32_t total = 0U;
+    uint32_t i;
+
+    (void)sock;
+    for (i = 0U; i < iovcnt; i++) {
+        total += iov[i].length;
+    }
+    return (int)total;
+}
+
+static void response_frame_op(void)
+{
+    uds_response_t response = { NULL, 0U, 0U, false };
+
+    response.buffer = doip_entity_alloc_response_frame(&dispatch_entity,
+                                                       &response.max_length);
+    (void)uds_process_request(&context, &request, &response);
+    (void)doip_entity_send_response_frame(&dispatch_entity, dispatch_tester,
+                                          response.buffer, response.actual_length);
+}
+
+static void response_buffer_op(void)
+{
+    uds_response_t response = { response_own_buffer, sizeof(response_own_buffer), 0U, false };
+
+    (void)uds_process_request(&context, &request, &response);
+    (void)doip_entity_send_diagnostic_response(&dispatch_entity, dispatch_tester,
+                                               response.buffer, response.actual_length);
+}
+
+static void response_encoded_op(void)
+{
+    uds_response_t response = { response_own_buffer, sizeof(response_own_buffer), 0U, false };
+    doip_diagnostic_message_t message = { 0x1000U, 0U, 0U, response_own_buffer };
+    uint32_t length = 0U;
+
+    (void)uds_process_request(&context, &request, &response);
+    message.target_address = dispatch_tester;
+    message.user_data_length = response.actual_length;
+    (void)doip_encode_diagnostic_message(&message, frame, sizeof(frame), &length);
+    (void)doip_interface_tcp_send(&itf, 0, frame, length);
+}
+
+static void bench_response(void)
+{
+    static const uint8_t read_vin[] = { 0xF1U, 0x90U };
+    static const uint8_t read_memory[] = {
+        0x24U, 0x00U, 0x00U, 0x00U, 0x00U, (uint8_t)(RMBA_SIZE >> 8), (uint8_t)RMBA_SIZE
+    };
+
+    if (!dispatch_setup(1U)) {
+        printf("{\"bench\":\"response\",\"error\":\"activation\"}\n");
+        return;
+    }
+    ops.tcp_sendv = dispatch_sendv;
+    uds_setup();
+    (void)uds_register_service(&table, &rmba_service);
+
+    uds_request(UDS_SID_READ_DATA_BY_IDENTIFIER, read_vin, sizeof(read_vin));
+    run("response_rdbi_vin_frame", response_frame_op);
+    run("response_rdbi_vin_buffer", response_buffer_op);
+    run("response_rdbi_vin_encoded", response_encoded_op);
+    uds_request(UDS_SID_READ_MEMORY_BY_ADDRESS, read_memory, sizeof(read_memory));
+    run("response_rmba_1024_frame", response_frame_op);
+    run("response_rmba_1024_buffer", response_buffer_op);
+    run("response_rmba_1024_encoded", response_encoded_op);
+}
+
+/* UDP discovery through the entity: recvfrom hands out queued datagrams,
+ * sendto counts the answers. The clock is moved on by the benchmarks, so
+ * the rate limiter and duplicate filter only act where they are meant to. */
+
+#define UDP_QUEUE_MAX       256U
+
+typedef struct {
+    doip_endpoint_t src;
+    uint32_t length;
+    uint8_t data[32];
+} udp_datagram_t;
+
+static doip_entity_t udp_entity;
+static udp_datagram_t udp_queue[UDP_QUEUE_MAX];
+static uint32_t udp_queue_head;
+static uint32_t udp_queue_count;
+static uint32_t udp_answers;
+static uint32_t udp_time;
+
+static int udp_queue_recvfrom(int sock, uint8_t *buf, uint32_t len,
+                              doip_endpoint_t *src)
+{
+    const udp_datagram_t *datagram = &udp_queue[udp_queue_head];
+
+    (void)sock;
+    if ((udp_queue_count == 0U) || (datagram->length > len)) {
+        return -1;
+    }
+    (void)__real_memcpy(buf, datagram->data, datagram->length);
+    *src = datagram->src;
+    udp_queue_head = (udp_queue_head + 1U) % UDP_QUEUE_MAX;
+    udp_queue_count--;
+    return (int)datagram->length;
+}
+
+static int udp_count_sendto(int sock, const uint8_t *data, uint32_t len,
+                            const doip_endpoint_t *dst)
+{
+    (void)sock;
+    (void)data;
+    (void)dst;
+    udp_answers++;
+    return (int)len;
+}
+
+/* Vehicle identification request, plain or with the entity's VIN */
+static void udp_queue_request(uint32_t ip_addr, uint16_t port, bool with_vin)
+{
+    udp_datagram_t *datagram = &udp_queue[(udp_queue_head + udp_queue_count) % UDP_QUEUE_MAX];
+    uint8_t *p = datagram->data;
+
+    p[0] = 0x03U;
+    p[1] = 0xFCU;
+    p[2] = 0x00U;
+    p[3] = with_vin ? 0x03U : 0x01U;
+    p[4] = 0x00U;
+    p[5] = 0x00U;
+    p[6] = 0x00U;
+    p[7] = with_vin ? (uint8_t)DOIP_VIN_LENGTH : 0x00U;
+    if (with_vin) {
+        (void)__real_memcpy(&p[8], udp_entity.config.vin, DOIP_VIN_LENGTH);
+    }
+    datagram->length = with_vin ? (8U + DOIP_VIN_LENGTH) : 8U;
+    datagram->src.ip_addr = ip_addr;
+    datagram->src.port = port;
+    udp_queue_count++;
+}
+
+static void udp_setup(void)
+{
+    doip_entity_config_t config;
+
+    (void)memset(&ops, 0, sizeof(ops));
+    ops.udp_bind = mock_udp_bind;
+    ops.udp_sendto = udp_count_sendto;
+    ops.udp_recvfrom = udp_queue_recvfrom;
+    ops.tcp_listen = mock_listen;
+    ops.tcp_accept = dispatch_accept;
+    ops.close_socket = mock_close;
+    (void)memset(&config, 0, sizeof(config));
+    (void)memcpy(config.vin, "WVWZZZ1KZ1A234567", DOIP_VIN_LENGTH);
+    config.logical_address = 0x1000U;
+    config.general_inactivity_time = 300000U;
+    config.initial_inactivity_time = 300000U;
+    config.alive_check_time = 500U;
+    config.max_tester_connections = 1U;
+    (void)doip_interface_init(&itf, &ops);
+    (void)doip_entity_init(&udp_entity, &config, &itf);
+    (void)doip_entity_start(&udp_entity);
+    dispatch_open = 0U;
+    udp_queue_head = 0U;
+    udp_queue_count = 0U;
+    /* Past the announcements */
+    for (udp_time = 0U; udp_time < 10000U; udp_time += 100U) {
+        doip_entity_run_timers(&udp_entity, udp_time);
+    }
+    udp_answers = 0U;
+}
+
+/* One request per wake-up, a second apart */
+static void udp_vehicle_id_op(void)
+{
+    udp_queue_request(0x0A000001U, 50000U, false);
+    udp_time += 1000U;
+    doip_entity_run_timers(&udp_entity, udp_time);
+    (void)doip_entity_process(&udp_entity, dispatch_request);
+}
+
+/* The same request with the vehicle identification frame encoded anew */
+static void udp_vehicle_id_rebuilt_op(void)
+{
+    doip_entity_invalidate_vehicle_id(&udp_entity);
+    udp_vehicle_id_op();
+}
+
+static void udp_announcement_op(void)
+{
+    (void)doip_entity_send_vehicle_announcement(&udp_entity);
+}
+
+static void udp_announcement_rebuilt_op(void)
+{
+    doip_entity_invalidate_vehicle_id(&udp_entity);
+    (void)doip_entity_send_vehicle_announcement(&udp_entity);
+}
+
+/* What every datagram cost before: the source to a dotted quad and the
+ * reply address back */
+static void udp_endpoint_strings_op(void)
+{
+    struct in_addr addr = { htonl(0x0A000001U) };
+    char ip[16];
+
+    (void)inet_ntop(AF_INET, &addr, ip, sizeof(ip));
+    (void)inet_pton(AF_INET, ip, &addr);
+    sink += addr.s_addr;
+}
+
+/* A storm of 256 identification requests from 'sources' testers, all
+ * queued before the entity wakes up. Wake-ups are 10 ms apart; the storm
+ * repeats after 10 s of quiet. Mixed storms alternate plain and
+ * VIN-filtered requests, so none of them is a duplicate. */
+#define STORM_DATAGRAMS     256U
+
+static void udp_storm(const char *name, uint32_t sources, bool mixed)
+{
+    uint32_t passes = iterations / 1000U;
+    uint32_t wakeups = 0U;
+    uint32_t drained;
+    uint64_t start;
+    uint64_t elapsed = 0U;
+    uint32_t pass;
+    uint32_t r;
+    uint32_t k;
+
+    if (passes == 0U) {
+        passes = 1U;
+    }
+    if (passes > 1000U) {
+        passes = 1000U;
+    }
+    udp_setup();
+    drained = itf.udp_drained_count;
+    for (pass = 0U; pass < passes; pass++) {
+        for (r = 0U; r < (STORM_DATAGRAMS / sources); r++) {
+            for (k = 0U; k < sources; k++) {
+                udp_queue_request(0x0A000100U + k, (uint16_t)(50000U + k),
+                                  mixed && ((r % 2U) == 1U));
+            }
+        }
+        start = test_now_ns();
+        while (udp_queue_count > 0U) {
+            udp_time += 10U;
+            doip_entity_run_timers(&udp_entity, udp_time);
+            (void)doip_entity_process(&udp_entity, dispatch_request);
+            wakeups++;
+        }
+        elapsed += test_now_ns() - start;
+        udp_time += 10000U;
+        doip_entity_run_timers(&udp_entity, udp_time);
+    }
+    drained = itf.udp_drained_count - drained;
+
+    printf("{\"bench\":\"%s\",\"datagrams\":%u,\"wakeups\":%u,"
+           "\"drained_per_wakeup\":%.2f,\"answered\":%u,\"rate_limited\":%u,"
+           "\"collapsed\":%u,\"dropped\":%u,\"ns_per_datagram\":%.1f}\n",
+           name, STORM_DATAGRAMS, wakeups / passes,
+           (double)drained / (double)wakeups, udp_answers / passes,
+           udp_entity.udp_stats.rate_limited / passes,
+           udp_entity.udp_stats.collapsed / passes,
+           udp_entity.udp_stats.dropped / passes,
+           (double)elapsed / (double)drained);
+}
+
+static void bench_udp(void)
+{
+    udp_setup();
+    run("udp_vehicle_id_request", udp_vehicle_id_op);
+    if (udp_answers != iterations) {
+        printf("{\"bench\":\"udp_vehicle_id_request\",\"error\":\"%u of %u answered\"}\n",
+               udp_answers, iterations);
+    }
+    run("udp_vehicle_id_request_rebuilt", udp_vehicle_id_rebuilt_op);
+    run("udp_vehicle_announcement", udp_announcement_op);
+    run("udp_vehicle_announcement_rebuilt", udp_announcement_rebuilt_op);
+    run("udp_endpoint_strings", udp_endpoint_strings_op);
+    udp_storm("udp_storm_4_testers_mixed", 4U, true);
+    udp_storm("udp_storm_16_testers_repeated", 16U, false);
+}
+
+int main(int argc, char **argv)
+{
+    int i;
+
+    for (i = 1; i < argc; i++) {
+        if ((strcmp(argv[i], "--iterations") == 0) && ((i + 1) < argc)) {
+            iterations = (uint32_t)strtoul(argv[i + 1], NULL, 0);
+            i++;
+        }
+    }
+    if (iterations == 0U) {
+        iterations = 1U;
+    }
+
+    (void)memset(user_data, 0x5A, sizeof(user_data));
+    run("encode_header", encode_header);
+    run("decode_header", decode_header);
+    run("validate_header", validate_header);
+    run("encode_vehicle_id_response", encode_vehicle_id_response);
+    run("encode_routing_activation_req", encode_routing_activation_req);
+    run("decode_routing_activation_req", decode_routing_activation_req);
+    run("encode_routing_activation_res", encode_routing_activation_res);
+    run("encode_diagnostic_message_64", encode_diagnostic_message_64);
+    run("encode_diagnostic_message_4092", encode_diagnostic_message_4092);
+    run("finish_diagnostic_message_frame", finish_diagnostic_message_frame);
+    encode_diagnostic_message_64();
+    run("decode_diagnostic_message", decode_diagnostic_message);
+    run("encode_generic_nack", encode_generic_nack);
+    run("encode_diag_message_ack", encode_diag_message_ack);
+    payload_messages = payload_valid;
+    run("payload_dispatch_valid", payload_dispatch_op);
+    payload_messages = payload_invalid;
+    run("payload_dispatch_invalid", payload_dispatch_op);
+
+    interface_rx(64U);
+    run("interface_rx_diagnostic_64", interface_rx_op);
+    /* Largest message that is not streamed */
+    interface_rx(DOIP_RX_BUFFER_SIZE - 12U);
+    run("interface_rx_diagnostic_4084", interface_rx_op);
+    bench_pipelined_rx();
+    bench_slow_receiver();
+
+    bench_uds();
+    bench_rdbi();
+    bench_crc();
+    bench_download();
+    bench_dispatch();
+    bench_admission();
+    bench_response();
+    bench_udp();
+
+    return 0;
+}
@@ -0,0 +1,462 @@
+#include "test_util.h"
+#include "test_lwip.h"
+#include "doip_protocol.h"
+#include "doip_lwip_adapter.h"
+#include "app_doip_entity.h"
+#include "lwip/sockets.h"
+#include <stdlib.h>
+#include <string.h>
+
+/* Socket and netconn backends on the host lwIP stack: a tester thread
+ * sends diagnostic messages over 127.0.0.1 and the entity receives them
+ * through doip_interface, waiting in socket_select between reads. One
+ * JSON object per line:
+ *
+ *   {"bench":"...","messages":N,"ns_per_msg":T,"mb_per_s":R,
+ *    "entity_cpu_ns_per_msg":E,"total_cpu_ns_per_msg":C}
+ *
+ * Entity CPU is the receiving thread, total CPU includes the tcpip
+ * thread and the sender. Wake-ups from another thread while the entity
+ * waits in doip_interface_wait_select():
+ *
+ *   {"bench":"...","wakeups":N,"ns_per_wake":T,"max_ns":M,"missed":K}
+ *
+ * Request to response round trips of a tester through the entity, with
+ * the diagnostic message ACK coalesced into the response write or sent
+ * on its own. Writes are the entity's send calls per request:
+ *
+ *   {"bench":"...","requests":N,"writes_per_request":W,"p50_us":P,
+ *    "p99_us":Q,"coalesced":C} */
+
+#define PORT                13400U
+#define MAX_USER_LENGTH     (DOIP_RX_BUFFER_SIZE - 12U)
+
+extern doip_network_ops_t g_lwip_netconn_net_ops;
+
+static uint32_t messages = 100000U;
+static uint8_t stream[DOIP_TX_FRAME_SIZE];
+static uint32_t stream_length;
+static uint8_t user_data[MAX_USER_LENGTH];
+static sys_sem_t sender_close;
+static sys_sem_t sender_done;
+static uint16_t sender_port;
+static uint32_t received;
+
+static uint64_t cpu_now_ns(clockid_t clock)
+{
+    struct timespec now;
+
+    (void)clock_gettime(clock, &now);
+    return ((uint64_t)now.tv_sec * 1000000000U) + (uint64_t)now.tv_nsec;
+}
+
+static void on_message(int connection_id, const uint8_t *data, uint32_t length,
+                       void *user)
+{
+    (void)connection_id;
+    (void)data;
+    (void)length;
+    (void)user;
+    received++;
+}
+
+/* Tester side through lwIP sockets, blocking sends */
+static void sender(void *arg)
+{
+    struct sockaddr_in addr;
+    uint32_t i;
+    uint32_t sent;
+    int sock;
+    int n;
+
+    (void)arg;
+    (void)memset(&addr, 0, sizeof(addr));
+    addr.sin_family = AF_INET;
+    addr.sin_port = htons(sender_port);
+    addr.sin_addr.s_addr = htonl(INADDR_LOOPBACK);
+
+    sock = socket(AF_INET, SOCK_STREAM, 0);
+    if ((sock >= 0) && (connect(sock, (struct sockaddr *)&addr, sizeof(addr)) == 0)) {
+        for (i = 0U; i < messages; i++) {
+            for (sent = 0U; sent < stream_length; sent += (uint32_t)n) {
+                n = send(sock, &stream[sent], stream_length - sent, 0);
+                if (n <= 0) {
+                    i = messages;
+                    break;
+                }
+            }
+        }
+    }
+    /* Closed after the entity has everything, the close is not measured */
+    (void)sys_arch_sem_wait(&sender_close, 0U);
+    if (sock >= 0) {
+        (void)close(sock);
+    }
+    sys_sem_signal(&sender_done);
+}
+
+static void run(const char *name, doip_network_ops_t *ops, uint16_t port,
+                uint32_t user_length)
+{
+    static doip_interface_t itf;
+    doip_diagnostic_message_t message = { 0x0E80U, 0x1000U, user_length, user_data };
+    uint64_t start;
+    uint64_t entity_start;
+    uint64_t total_start;
+    uint64_t elapsed;
+    uint64_t entity_cpu;
+    uint64_t total_cpu;
+    uint32_t idle = 0U;
+    uint32_t i;
+
+    (void)doip_encode_diagnostic_message(&message, stream, sizeof(stream), &stream_length);
+    (void)doip_interface_init(&itf, ops);
+    if (doip_interface_start_tcp_server(&itf, port) != DOIP_RESULT_OK) {
+        printf("{\"bench\":\"%s\",\"error\":\"listen\"}\n", name);
+        return;
+    }
+
+    received = 0U;
+    sender_port = port;
+    start = test_now_ns();
+    entity_start = cpu_now_ns(CLOCK_THREAD_CPUTIME_ID);
+    total_start = cpu_now_ns(CLOCK_PROCESS_CPUTIME_ID);
+    (void)sys_thread_new("sender", sender, NULL, 0, 0);
+
+    while ((received < messages) && (idle < 10U)) {
+        if (doip_interface_wait(&itf, 100U) == DOIP_RESULT_TIMEOUT) {
+            idle++;
+            continue;
+        }
+        idle = 0U;
+        (void)doip_interface_process(&itf, NULL, on_message, NULL, NULL, NULL);
+    }
+
+    elapsed = test_now_ns() - start;
+    entity_cpu = cpu_now_ns(CLOCK_THREAD_CPUTIME_ID) - entity_start;
+    total_cpu = cpu_now_ns(CLOCK_PROCESS_CPUTIME_ID) - total_start;
+
+    sys_sem_signal(&sender_close);
+    (void)sys_arch_sem_wait(&sender_done, 0U);
+
+    if (received == 0U) {
+        received = 1U;
+    }
+    printf("{\"bench\":\"%s\",\"messages\":%u,\"ns_per_msg\":%.0f,\"mb_per_s\":%.1f,"
+           "\"entity_cpu_ns_per_msg\":%.0f,\"total_cpu_ns_per_msg\":%.0f}\n",
+           name, received,
+           (double)elapsed / (double)received,
+           ((double)stream_length * (double)received * 1000.0) / (double)elapsed,
+           (double)entity_cpu / (double)received,
+           (double)total_cpu / (double)received);
+
+    /* Closes the listener and the connection */
+    for (i = 0U; i < itf.connection_count; i++) {
+        doip_interface_close_connection(&itf, (int)i);
+    }
+    ops->close_socket(itf.tcp_listen_socket);
+}
+
+/* Wake-up latency: another thread calls doip_interface_wake() 1 ms into
+ * each wait and the time until the select returns is taken */
+
+static doip_interface_t wake_itf;
+static sys_sem_t wake_waiting;
+static volatile uint64_t wake_sent_ns;
+static volatile bool wake_stop;
+
+static void waker(void *arg)
+{
+    (void)arg;
+    for (;;) {
+        (void)sys_arch_sem_wait(&wake_waiting, 0U);
+        if (wake_stop) {
+            break;
+        }
+        sys_msleep(1U);
+        wake_sent_ns = test_now_ns();
+        (void)doip_interface_wake(&wake_itf);
+    }
+    sys_sem_signal(&sender_done);
+}
+
+static void run_wake(const char *name, doip_network_ops_t *ops, uint16_t port)
+{
+    doip_wait_set_t set;
+    uint32_t count = messages / 100U;
+    uint32_t missed = 0U;
+    uint64_t total = 0U;
+    uint64_t worst = 0U;
+    uint64_t latency;
+    uint32_t i;
+
+    if (count < 10U) {
+        count = 10U;
+    }
+    if (count > 1000U) {
+        count = 1000U;
+    }
+    (void)doip_interface_init(&wake_itf, ops);
+    if (doip_interface_start_tcp_server(&wake_itf, port) != DOIP_RESULT_OK) {
+        printf("{\"bench\":\"%s\",\"error\":\"listen\"}\n", name);
+        return;
+    }
+
+    /* A new netconn handle reads as ready until it was read once */
+    (void)doip_interface_process(&wake_itf, NULL, NULL, NULL, NULL, NULL);
+
+    wake_stop = false;
+    (void)sys_thread_new("waker", waker, NULL, 0, 0);
+    for (i = 0U; i < count; i++) {
+        (void)doip_interface_wait_prepare(&wake_itf, 1000U, &set);
+        sys_sem_signal(&wake_waiting);
+        if (doip_interface_wait_select(&wake_itf, &set) != DOIP_RESULT_TIMEOUT) {
+            missed++;
+            continue;
+        }
+        latency = test_now_ns() - wake_sent_ns;
+        (void)doip_interface_wait_finish(&wake_itf, &set);
+        /* A wait that ran out its timeout was not woken */
+        if (latency > 500000000U) {
+            missed++;
+            continue;
+        }
+        total += latency;
+        if (latency > worst) {
+            worst = latency;
+        }
+    }
+    wake_stop = true;
+    sys_sem_signal(&wake_waiting);
+    (void)sys_arch_sem_wait(&sender_done, 0U);
+
+    printf("{\"bench\":\"%s\",\"wakeups\":%u,\"ns_per_wake\":%.0f,"
+           "\"max_ns\":%llu,\"missed\":%u}\n",
+           name, count - missed,
+           (count > missed) ? ((double)total / (double)(count - missed)) : 0.0,
+           (unsigned long long)worst, missed);
+
+    ops->close_socket(wake_itf.tcp_listen_socket);
+}
+
+/* ACK coalescing: the tester sends ReadDataByIdentifier and waits for the
+ * response, the entity answers from its UDS callback. Without coalescing
+ * the ACK and the response are two writes and Nagle holds the second one
+ * back until the tester acknowledges the first. */
+
+static doip_network_ops_t count_ops;
+static uint32_t entity_writes;
+static volatile bool tester_finished;
+static uint64_t latencies[1000];
+static uint32_t latency_count;
+
+static int count_send(int sock, const uint8_t *data, uint32_t len)
+{
+    entity_writes++;
+    return g_lwip_net_ops.tcp_send(sock, data, len);
+}
+
+static int count_sendv(int sock, const doip_iovec_t *iov, uint32_t iovcnt)
+{
+    entity_writes++;
+    return g_lwip_net_ops.tcp_sendv(sock, iov, iovcnt);
+}
+
+static void rdbi_respond(uint16_t source_addr, uint16_t target_addr,
+                         const uint8_t *data, uint32_t length, void *user)
+{
+    uint8_t response[20] = { 0x62U, 0xF1U, 0x90U };
+
+    (void)target_addr;
+    (void)length;
+    (void)memset(&response[3], 'W', sizeof(response) - 3U);
+    response[1] = data[1];
+    response[2] = data[2];
+    (void)doip_entity_send_diagnostic_response((doip_entity_t *)user, source_addr,
+                                               response, sizeof(response));
+}
+
+/* Reads one DoIP message, returns its payload type or 0 */
+static uint16_t read_message(int sock, uint8_t *buf, uint32_t size)
+{
+    uint32_t length;
+    uint32_t got;
+    int n;
+
+    for (got = 0U; got < 8U; got += (uint32_t)n) {
+        n = recv(sock, &buf[got], 8U - got, 0);
+        if (n <= 0) {
+            return 0U;
+        }
+    }
+    length = ((uint32_t)buf[4] << 24) | ((uint32_t)buf[5] << 16) |
+             ((uint32_t)buf[6] << 8) | (uint32_t)buf[7];
+    if ((length + 8U) > size) {
+        return 0U;
+    }
+    for (got = 0U; got < length; got += (uint32_t)n) {
+        n = recv(sock, &buf[8U + got], length - got, 0);
+        if (n <= 0) {
+            return 0U;
+        }
+    }
+    return (uint16_t)(((uint16_t)buf[2] << 8) | buf[3]);
+}
+
+static void tester(void *arg)
+{
+    static const uint8_t activation[] = {
+        0x02U, 0xFDU, 0x00U, 0x05U, 0x00U, 0x00U, 0x00U, 0x07U,
+        0x0EU, 0x80U, 0x00U, 0x00U, 0x00U, 0x00U, 0x00U
+    };
+    static const uint8_t request[] = {
+        0x02U, 0xFDU, 0x80U, 0x01U, 0x00U, 0x00U, 0x00U, 0x07U,
+        0x0EU, 0x80U, 0x10U, 0x00U, 0x22U, 0xF1U, 0x90U
+    };
+    uint32_t count = *(const uint32_t *)arg;
+    struct sockaddr_in addr;
+    uint8_t buf[64];
+    uint64_t start;
+    uint16_t type;
+    uint32_t i;
+    int sock;
+
+    (void)memset(&addr, 0, sizeof(addr));
+    addr.sin_family = AF_INET;
+    addr.sin_port = htons(DOIP_TCP_DATA_PORT);
+    addr.sin_addr.s_addr = htonl(INADDR_LOOPBACK);
+
+    latency_count = 0U;
+    sock = socket(AF_INET, SOCK_STREAM, 0);
+    if ((sock >= 0) && (connect(sock, (struct sockaddr *)&addr, sizeof(addr)) == 0) &&
+        (send(sock, activation, sizeof(activation), 0) == (int)sizeof(activation)) &&
+        (read_message(sock, buf, sizeof(buf)) == DOIP_PAYLOAD_TYPE_ROUTING_ACTIVATION_RES)) {
+        for (i = 0U; i < count; i++) {
+            start = test_now_ns();
+            if (send(sock, request, sizeof(request), 0) != (int)sizeof(request)) {
+                break;
+            }
+            /* The ACK comes first, the response ends the round trip */
+            do {
+                type = read_message(sock, buf, sizeof(buf));
+            } while (type == DOIP_PAYLOAD_TYPE_DIAG_MESSAGE_ACK);
+            if (type != DOIP_PAYLOAD_TYPE_DIAG_MESSAGE) {
+                break;
+            }
+            latencies[latency_count] = test_now_ns() - start;
+            latency_count++;
+        }
+    }
+    if (sock >= 0) {
+        (void)close(sock);
+    }
+    tester_finished = true;
+    sys_sem_signal(&sender_done);
+}
+
+static int compare_latency(const void *a, const void *b)
+{
+    uint64_t x = *(const uint64_t *)a;
+    uint64_t y = *(const uint64_t *)b;
+
+    return (x > y) - (x < y);
+}
+
+static void run_coalescing(const char *name, bool coalesce)
+{
+    static doip_interface_t itf;
+    static doip_entity_t entity;
+    doip_entity_config_t config;
+    uint32_t count = messages / 1000U;
+    uint32_t writes;
+    uint32_t idle = 0U;
+
+    if (count < 20U) {
+        count = 20U;
+    }
+    if (count > (sizeof(latencies) / sizeof(latencies[0]))) {
+        count = sizeof(latencies) / sizeof(latencies[0]);
+    }
+    count_ops = g_lwip_net_ops;
+    count_ops.tcp_send = count_send;
+    count_ops.tcp_sendv = count_sendv;
+    (void)memset(&config, 0, sizeof(config));
+    config.logical_address = 0x1000U;
+    config.general_inactivity_time = 300000U;
+    config.initial_inactivity_time = 300000U;
+    config.alive_check_time = 500U;
+    config.max_tester_connections = 1U;
+    (void)doip_interface_init(&itf, &count_ops);
+    (void)doip_entity_init(&entity, &config, &itf);
+    doip_entity_set_response_coalescing(&entity, coalesce);
+    if (doip_entity_start(&entity) != DOIP_RESULT_OK) {
+        printf("{\"bench\":\"%s\",\"error\":\"start\"}\n", name);
+        return;
+    }
+
+    tester_finished = false;
+    (void)sys_thread_new("tester", tester, &count, 0, 0);
+    /* Runs until the tester is done and its connection was closed */
+    while ((!tester_finished || (itf.connections[0].socket_fd >= 0)) && (idle < 10U)) {
+        if (doip_interface_wait(&itf, 100U) == DOIP_RESULT_TIMEOUT) {
+            idle++;
+            continue;
+        }
+        idle = 0U;
+        (void)doip_entity_process(&entity, rdbi_respond);
+    }
+    (void)sys_arch_sem_wait(&sender_done, 0U);
+    /* Less the routing activation response */
+    writes = (entity_writes > 0U) ? (entity_writes - 1U) : 0U;
+    entity_writes = 0U;
+
+    if (latency_count == 0U) {
+        printf("{\"bench\":\"%s\",\"error\":\"no responses\"}\n", name);
+    } else {
+        qsort(latencies, latency_count, sizeof(latencies[0]), compare_latency);
+        printf("{\"bench\":\"%s\",\"requests\":%u,\"writes_per_request\":%.2f,"
+               "\"p50_us\":%.1f,\"p99_us\":%.1f,\"coalesced\":%u}\n",
+               name, latency_count, (double)writes / (double)latency_count,
+               (double)latencies[latency_count / 2U] / 1000.0,
+               (double)latencies[(latency_count * 99U) / 100U] / 1000.0,
+               entity.coalesced_ack_count);
+    }
+
+    doip_interface_close_connection(&itf, 0);
+    count_ops.close_socket(itf.tcp_listen_socket);
+    count_ops.close_socket(itf.udp_socket);
+}
+
+int main(int argc, char **argv)
+{
+    int i;
+
+    for (i = 1; i < argc; i++) {
+        if ((strcmp(argv[i], "--messages") == 0) && ((i + 1) < argc)) {
+            messages = (uint32_t)strtoul(argv[i + 1], NULL, 0);
+            i++;
+        }
+    }
+    if (messages == 0U) {
+        messages = 1U;
+    }
+
+    test_lwip_start();
+    (void)sys_sem_new(&sender_close, 0U);
+    (void)sys_sem_new(&sender_done, 0U);
+    (void)sys_sem_new(&wake_waiting, 0U);
+    (void)memset(user_data, 0x5A, sizeof(user_data));
+
+    /* First, the entity listens on the DoIP port */
+    run_coalescing("lwip_ack_coalesced", true);
+    run_coalescing("lwip_ack_separate", false);
+    run("lwip_socket_rx_64", &g_lwip_net_ops, (uint16_t)PORT, 64U);
+    run("lwip_netconn_rx_64", &g_lwip_netconn_net_ops, (uint16_t)(PORT + 1U), 64U);
+    run("lwip_socket_rx_4084", &g_lwip_net_ops, (uint16_t)(PORT + 2U), MAX_USER_LENGTH);
+    run("lwip_netconn_rx_4084", &g_lwip_netconn_net_ops, (uint16_t)(PORT + 3U),
+        MAX_USER_LENGTH);
+    run_wake("lwip_socket_wake", &g_lwip_net_ops, (uint16_t)(PORT + 4U));
+    run_wake("lwip_netconn_wake", &g_lwip_netconn_net_ops, (uint16_t)(PORT + 5U));
+
+    return 0;
+}
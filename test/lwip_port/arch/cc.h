@@ -0,0 +1,25 @@
+#ifndef LWIP_HOST_ARCH_CC_H
+#define LWIP_HOST_ARCH_CC_H
+
+/* Compiler and C library glue for lwIP on a Linux host. struct timeval,
+ * fd_set, errno and ssize_t come from the C library as on the unix port. */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <limits.h>
+#include <sys/types.h>
+#include <sys/time.h>
+
+#define LWIP_TIMEVAL_PRIVATE        0
+#define LWIP_ERRNO_STDINCLUDE       1
+
+#define LWIP_PLATFORM_DIAG(x)       do { (void)printf x; } while (0)
+#define LWIP_PLATFORM_ASSERT(x)     do { \
+        (void)fprintf(stderr, "lwIP assertion \"%s\" failed at %s:%d\n", \
+                      x, __FILE__, __LINE__); \
+        abort(); \
+    } while (0)
+
+#define LWIP_RAND()                 ((u32_t)rand())
+
+#endif /* LWIP_HOST_ARCH_CC_H */
@@ -0,0 +1,30 @@
+#ifndef LWIP_HOST_ARCH_SYS_ARCH_H
+#define LWIP_HOST_ARCH_SYS_ARCH_H
+
+/* lwIP OS layer on POSIX threads (sys_arch.c). Semaphores, mutexes and
+ * mailboxes are allocated, a NULL pointer is the invalid value. */
+
+struct host_sem;
+struct host_mutex;
+struct host_mbox;
+
+typedef struct host_sem *sys_sem_t;
+typedef struct host_mutex *sys_mutex_t;
+typedef struct host_mbox *sys_mbox_t;
+typedef unsigned long sys_thread_t;
+typedef int sys_prot_t;
+
+#define sys_sem_valid(sem)              (((sem) != NULL) && (*(sem) != NULL))
+#define sys_sem_valid_val(sem)          ((sem) != NULL)
+#define sys_sem_set_invalid(sem)        do { if ((sem) != NULL) { *(sem) = NULL; } } while (0)
+#define sys_sem_set_invalid_val(sem)    do { (sem) = NULL; } while (0)
+
+#define sys_mutex_valid(mutex)          (((mutex) != NULL) && (*(mutex) != NULL))
+#define sys_mutex_set_invalid(mutex)    do { if ((mutex) != NULL) { *(mutex) = NULL; } } while (0)
+
+#define sys_mbox_valid(mbox)            (((mbox) != NULL) && (*(mbox) != NULL))
+#define sys_mbox_valid_val(mbox)        ((mbox) != NULL)
+#define sys_mbox_set_invalid(mbox)      do { if ((mbox) != NULL) { *(mbox) = NULL; } } while (0)
+#define sys_mbox_set_invalid_val(mbox)  do { (mbox) = NULL; } while (0)
+
+#endif /* LWIP_HOST_ARCH_SYS_ARCH_H */
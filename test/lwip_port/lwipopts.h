@@ -0,0 +1,70 @@
+#ifndef LWIP_HOST_LWIPOPTS_H
+#define LWIP_HOST_LWIPOPTS_H
+
+/* lwIP configuration of the host build: the stack runs in its own tcpip
+ * thread with the socket and netconn APIs over the 127.0.0.1 loopback
+ * interface. Buffers are sized for throughput, not for the target. */
+
+#define NO_SYS                          0
+#define SYS_LIGHTWEIGHT_PROT            1
+#define LWIP_TCPIP_CORE_LOCKING         1
+
+#define LWIP_IPV4                       1
+#define LWIP_IPV6                       0
+#define LWIP_ARP                        0
+#define LWIP_ETHERNET                   0
+#define LWIP_ICMP                       1
+#define LWIP_RAW                        0
+#define LWIP_DHCP                       0
+#define LWIP_AUTOIP                     0
+#define LWIP_IGMP                       0
+#define LWIP_DNS                        0
+#define LWIP_UDP                        1
+#define LWIP_TCP                        1
+
+/* 127.0.0.1, define LWIP_NETIF_LOOPBACK=0 for a stack without it */
+#ifndef LWIP_NETIF_LOOPBACK
+#define LWIP_NETIF_LOOPBACK             1
+#endif
+#define LWIP_LOOPBACK_MAX_PBUFS         0
+
+#define LWIP_NETCONN                    1
+#define LWIP_SOCKET                     1
+#define LWIP_COMPAT_SOCKETS             1
+#define LWIP_POSIX_SOCKETS_IO_NAMES     1
+#define LWIP_SOCKET_SELECT              1
+#define LWIP_SOCKET_POLL                0
+#define SO_REUSE                        1
+#define LWIP_SO_RCVBUF                  0
+#define LWIP_NETIF_API                  0
+#define LWIP_STATS                      0
+
+#define MEM_ALIGNMENT                   8U
+#define MEM_SIZE                        (1024 * 1024)
+#define MEMP_NUM_PBUF                   64
+#define PBUF_POOL_SIZE                  256
+#define MEMP_NUM_NETBUF                 32
+#define MEMP_NUM_NETCONN                32
+#define MEMP_NUM_TCP_PCB                16
+#define MEMP_NUM_TCP_PCB_LISTEN         4
+#define MEMP_NUM_UDP_PCB                8
+#define MEMP_NUM_TCP_SEG                256
+#define MEMP_NUM_TCPIP_MSG_API          64
+#define MEMP_NUM_TCPIP_MSG_INPKT        64
+#define MEMP_NUM_SELECT_CB              8
+
+#define TCP_MSS                         1460
+#define TCP_WND                         (32 * TCP_MSS)
+#define TCP_SND_BUF                     (32 * TCP_MSS)
+#define TCP_SND_QUEUELEN                (4 * TCP_SND_BUF / TCP_MSS)
+#define LWIP_WND_SCALE                  1
+#define TCP_RCV_SCALE                   2
+
+#define TCPIP_MBOX_SIZE                 128
+#define DEFAULT_TCP_RECVMBOX_SIZE       128
+#define DEFAULT_UDP_RECVMBOX_SIZE       32
+#define DEFAULT_ACCEPTMBOX_SIZE         8
+#define TCPIP_THREAD_STACKSIZE          0
+#define TCPIP_THREAD_PRIO               0
+
+#endif /* LWIP_HOST_LWIPOPTS_H */
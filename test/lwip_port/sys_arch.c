@@ -0,0 +1,358 @@
+#include "lwip/opt.h"
+#include "lwip/sys.h"
+#include "lwip/err.h"
+#include "lwip/debug.h"
+#include <pthread.h>
+#include <string.h>
+#include <time.h>
+
+/* lwIP OS layer on POSIX threads for the host tests and benchmarks.
+ * Timed waits use CLOCK_MONOTONIC, the same clock as sys_now(). */
+
+struct host_sem {
+    pthread_mutex_t lock;
+    pthread_cond_t cond;
+    u32_t count;
+};
+
+struct host_mutex {
+    pthread_mutex_t lock;
+};
+
+struct host_mbox {
+    pthread_mutex_t lock;
+    pthread_cond_t not_empty;
+    pthread_cond_t not_full;
+    void **slots;
+    u32_t size;
+    u32_t head;
+    u32_t count;
+};
+
+static pthread_mutex_t s_protect;
+static pthread_once_t s_protect_once = PTHREAD_ONCE_INIT;
+
+static void protect_init(void)
+{
+    pthread_mutexattr_t attr;
+
+    (void)pthread_mutexattr_init(&attr);
+    (void)pthread_mutexattr_settype(&attr, PTHREAD_MUTEX_RECURSIVE);
+    (void)pthread_mutex_init(&s_protect, &attr);
+    (void)pthread_mutexattr_destroy(&attr);
+}
+
+static void cond_init(pthread_cond_t *cond)
+{
+    pthread_condattr_t attr;
+
+    (void)pthread_condattr_init(&attr);
+    (void)pthread_condattr_setclock(&attr, CLOCK_MONOTONIC);
+    (void)pthread_cond_init(cond, &attr);
+    (void)pthread_condattr_destroy(&attr);
+}
+
+static void deadline_after(struct timespec *deadline, u32_t timeout_ms)
+{
+    (void)clock_gettime(CLOCK_MONOTONIC, deadline);
+    deadline->tv_sec += (time_t)(timeout_ms / 1000U);
+    deadline->tv_nsec += (long)(timeout_ms % 1000U) * 1000000L;
+    if (deadline->tv_nsec >= 1000000000L) {
+        deadline->tv_sec++;
+        deadline->tv_nsec -= 1000000000L;
+    }
+}
+
+/* Waits on 'cond' until 'ready' or the timeout, 0 waits forever.
+ * Returns the milliseconds waited or SYS_ARCH_TIMEOUT. */
+static u32_t cond_wait(pthread_cond_t *cond, pthread_mutex_t *lock,
+                       const u32_t *ready, u32_t timeout_ms)
+{
+    struct timespec deadline;
+    u32_t start = sys_now();
+
+    if (timeout_ms != 0U) {
+        deadline_after(&deadline, timeout_ms);
+    }
+    while (*ready == 0U) {
+        if (timeout_ms == 0U) {
+            (void)pthread_cond_wait(cond, lock);
+        } else if (pthread_cond_timedwait(cond, lock, &deadline) != 0) {
+            if (*ready == 0U) {
+                return SYS_ARCH_TIMEOUT;
+            }
+        }
+    }
+
+    return sys_now() - start;
+}
+
+void sys_init(void)
+{
+    (void)pthread_once(&s_protect_once, protect_init);
+}
+
+u32_t sys_now(void)
+{
+    struct timespec now;
+
+    (void)clock_gettime(CLOCK_MONOTONIC, &now);
+    return (u32_t)(((u64_t)now.tv_sec * 1000U) + ((u64_t)now.tv_nsec / 1000000U));
+}
+
+sys_prot_t sys_arch_protect(void)
+{
+    (void)pthread_once(&s_protect_once, protect_init);
+    (void)pthread_mutex_lock(&s_protect);
+    return 0;
+}
+
+void sys_arch_unprotect(sys_prot_t pval)
+{
+    (void)pval;
+    (void)pthread_mutex_unlock(&s_protect);
+}
+
+/* Semaphores */
+
+err_t sys_sem_new(sys_sem_t *sem, u8_t count)
+{
+    struct host_sem *s = (struct host_sem *)calloc(1U, sizeof(*s));
+
+    if (s == NULL) {
+        return ERR_MEM;
+    }
+    (void)pthread_mutex_init(&s->lock, NULL);
+    cond_init(&s->cond);
+    s->count = count;
+    *sem = s;
+    return ERR_OK;
+}
+
+void sys_sem_free(sys_sem_t *sem)
+{
+    struct host_sem *s = *sem;
+
+    (void)pthread_cond_destroy(&s->cond);
+    (void)pthread_mutex_destroy(&s->lock);
+    free(s);
+    *sem = NULL;
+}
+
+void sys_sem_signal(sys_sem_t *sem)
+{
+    struct host_sem *s = *sem;
+
+    (void)pthread_mutex_lock(&s->lock);
+    s->count++;
+    (void)pthread_cond_signal(&s->cond);
+    (void)pthread_mutex_unlock(&s->lock);
+}
+
+u32_t sys_arch_sem_wait(sys_sem_t *sem, u32_t timeout)
+{
+    struct host_sem *s = *sem;
+    u32_t waited;
+
+    (void)pthread_mutex_lock(&s->lock);
+    waited = cond_wait(&s->cond, &s->lock, &s->count, timeout);
+    if (waited != SYS_ARCH_TIMEOUT) {
+        s->count--;
+    }
+    (void)pthread_mutex_unlock(&s->lock);
+
+    return waited;
+}
+
+/* Mutexes */
+
+err_t sys_mutex_new(sys_mutex_t *mutex)
+{
+    struct host_mutex *m = (struct host_mutex *)calloc(1U, sizeof(*m));
+
+    if (m == NULL) {
+        return ERR_MEM;
+    }
+    (void)pthread_mutex_init(&m->lock, NULL);
+    *mutex = m;
+    return ERR_OK;
+}
+
+void sys_mutex_free(sys_mutex_t *mutex)
+{
+    (void)pthread_mutex_destroy(&(*mutex)->lock);
+    free(*mutex);
+    *mutex = NULL;
+}
+
+void sys_mutex_lock(sys_mutex_t *mutex)
+{
+    (void)pthread_mutex_lock(&(*mutex)->lock);
+}
+
+void sys_mutex_unlock(sys_mutex_t *mutex)
+{
+    (void)pthread_mutex_unlock(&(*mutex)->lock);
+}
+
+/* Mailboxes */
+
+err_t sys_mbox_new(sys_mbox_t *mbox, int size)
+{
+    struct host_mbox *m = (struct host_mbox *)calloc(1U, sizeof(*m));
+
+    if (size <= 0) {
+        size = 128;
+    }
+    if (m != NULL) {
+        m->slots = (void **)calloc((size_t)size, sizeof(void *));
+    }
+    if ((m == NULL) || (m->slots == NULL)) {
+        free(m);
+        return ERR_MEM;
+    }
+    (void)pthread_mutex_init(&m->lock, NULL);
+    cond_init(&m->not_empty);
+    cond_init(&m->not_full);
+    m->size = (u32_t)size;
+    *mbox = m;
+    return ERR_OK;
+}
+
+void sys_mbox_free(sys_mbox_t *mbox)
+{
+    struct host_mbox *m = *mbox;
+
+    (void)pthread_cond_destroy(&m->not_full);
+    (void)pthread_cond_destroy(&m->not_empty);
+    (void)pthread_mutex_destroy(&m->lock);
+    free(m->slots);
+    free(m);
+    *mbox = NULL;
+}
+
+static void mbox_put(struct host_mbox *m, void *msg)
+{
+    m->slots[(m->head + m->count) % m->size] = msg;
+    m->count++;
+    (void)pthread_cond_signal(&m->not_empty);
+}
+
+void sys_mbox_post(sys_mbox_t *mbox, void *msg)
+{
+    struct host_mbox *m = *mbox;
+
+    (void)pthread_mutex_lock(&m->lock);
+    while (m->count >= m->size) {
+        (void)pthread_cond_wait(&m->not_full, &m->lock);
+    }
+    mbox_put(m, msg);
+    (void)pthread_mutex_unlock(&m->lock);
+}
+
+err_t sys_mbox_trypost(sys_mbox_t *mbox, void *msg)
+{
+    struct host_mbox *m = *mbox;
+    err_t err = ERR_MEM;
+
+    (void)pthread_mutex_lock(&m->lock);
+    if (m->count < m->size) {
+        mbox_put(m, msg);
+        err = ERR_OK;
+    }
+    (void)pthread_mutex_unlock(&m->lock);
+
+    return err;
+}
+
+err_t sys_mbox_trypost_fromisr(sys_mbox_t *mbox, void *msg)
+{
+    return sys_mbox_trypost(mbox, msg);
+}
+
+static void *mbox_take(struct host_mbox *m)
+{
+    void *msg = m->slots[m->head];
+
+    m->head = (m->head + 1U) % m->size;
+    m->count--;
+    (void)pthread_cond_signal(&m->not_full);
+    return msg;
+}
+
+u32_t sys_arch_mbox_fetch(sys_mbox_t *mbox, void **msg, u32_t timeout)
+{
+    struct host_mbox *m = *mbox;
+    void *taken;
+    u32_t waited;
+
+    (void)pthread_mutex_lock(&m->lock);
+    waited = cond_wait(&m->not_empty, &m->lock, &m->count, timeout);
+    if (waited != SYS_ARCH_TIMEOUT) {
+        taken = mbox_take(m);
+        if (msg != NULL) {
+            *msg = taken;
+        }
+    }
+    (void)pthread_mutex_unlock(&m->lock);
+
+    return waited;
+}
+
+u32_t sys_arch_mbox_tryfetch(sys_mbox_t *mbox, void **msg)
+{
+    struct host_mbox *m = *mbox;
+    void *taken;
+    u32_t result = SYS_MBOX_EMPTY;
+
+    (void)pthread_mutex_lock(&m->lock);
+    if (m->count > 0U) {
+        taken = mbox_take(m);
+        if (msg != NULL) {
+            *msg = taken;
+        }
+        result = 0U;
+    }
+    (void)pthread_mutex_unlock(&m->lock);
+
+    return result;
+}
+
+/* Threads */
+
+typedef struct {
+    lwip_thread_fn function;
+    void *arg;
+} host_thread_start_t;
+
+static void *thread_main(void *arg)
+{
+    host_thread_start_t start = *(host_thread_start_t *)arg;
+
+    free(arg);
+    start.function(start.arg);
+    return NULL;
+}
+
+sys_thread_t sys_thread_new(const char *name, lwip_thread_fn thread, void *arg,
+                            int stacksize, int prio)
+{
+    host_thread_start_t *start = (host_thread_start_t *)malloc(sizeof(*start));
+    pthread_t id;
+
+    (void)name;
+    (void)stacksize;
+    (void)prio;
+
+    LWIP_ASSERT("thread start", start != NULL);
+    start->function = thread;
+    start->arg = arg;
+    if (pthread_create(&id, NULL, thread_main, start) != 0) {
+        free(start);
+        LWIP_ASSERT("pthread_create", 0);
+        return 0UL;
+    }
+    (void)pthread_detach(id);
+
+    return (sys_thread_t)id;
+}
@@ -0,0 +1,58 @@
+#ifndef C40_IP_H
+#define C40_IP_H
+
+/* Host stand-in for the RTD C40_Ip driver header, only what
+ * flash_hal_c40.c calls. The prototypes follow the S32K3 RTD user manual;
+ * this lets the backend be compiled on a host, it is not a driver. */
+
+#include "Std_Types.h"
+
+typedef enum {
+    C40_IP_STATUS_SUCCESS               = 0x5AA5U,
+    C40_IP_STATUS_ERROR                 = 0x5AA6U,
+    C40_IP_STATUS_BUSY                  = 0x5AA7U,
+    C40_IP_STATUS_ERROR_TIMEOUT         = 0x5AA8U,
+    C40_IP_STATUS_ERROR_INPUT_PARAM     = 0x5AA9U,
+    C40_IP_STATUS_ERROR_BLANK_CHECK     = 0x5AAAU,
+    C40_IP_STATUS_ERROR_PROGRAM_VERIFY  = 0x5AABU,
+    C40_IP_STATUS_ERROR_USER_TEST_BREAK_SBC = 0x5AACU,
+    C40_IP_STATUS_ERROR_USER_TEST_BREAK_DBD = 0x5AADU,
+    C40_IP_STATUS_SECTOR_UNPROTECTED    = 0x5AAEU,
+    C40_IP_STATUS_SECTOR_PROTECTED      = 0x5AAFU
+} C40_Ip_StatusType;
+
+typedef uint32 C40_Ip_VirtualSectorsType;
+
+typedef struct {
+    void (*StartFlashAccessNotifPtr)(void);
+    void (*FinishedFlashAccessNotifPtr)(void);
+} C40_Ip_ConfigType;
+
+/* Generated by the configuration tool in C40_Ip_Cfg.c */
+extern const C40_Ip_ConfigType C40_Ip_InitCfg;
+
+C40_Ip_StatusType C40_Ip_Init(const C40_Ip_ConfigType *InitConfig);
+
+C40_Ip_StatusType C40_Ip_ClearLock(C40_Ip_VirtualSectorsType VirtualSector,
+                                   uint8 DomainIdValue);
+
+C40_Ip_StatusType C40_Ip_MainInterfaceSectorErase(
+    C40_Ip_VirtualSectorsType VirtualSector,
+    uint8 DomainIdValue);
+
+C40_Ip_StatusType C40_Ip_MainInterfaceSectorEraseStatus(void);
+
+C40_Ip_StatusType C40_Ip_MainInterfaceWrite(uint32 LogicalAddress,
+                                            uint32 Length,
+                                            const uint8 *SourceAddressPtr,
+                                            uint8 DomainIdValue);
+
+C40_Ip_StatusType C40_Ip_MainInterfaceWriteStatus(void);
+
+C40_Ip_StatusType C40_Ip_Read(uint32 LogicalAddress,
+                              uint32 Length,
+                              uint8 *DestAddressPtr);
+
+C40_Ip_VirtualSectorsType C40_Ip_GetSectorNumberFromAddress(uint32 LogicalAddress);
+
+#endif /* C40_IP_H */
@@ -0,0 +1,18 @@
+#ifndef STD_TYPES_H
+#define STD_TYPES_H
+
+/* Host stand-in for the AUTOSAR standard types of the RTD tree, only
+ * what the headers shared with the host build use */
+
+#include <stdint.h>
+
+typedef uint8_t boolean;
+typedef uint8_t uint8;
+typedef uint16_t uint16;
+typedef uint32_t uint32;
+typedef uint8_t Std_ReturnType;
+
+#define E_OK        ((Std_ReturnType)0x00U)
+#define E_NOT_OK    ((Std_ReturnType)0x01U)
+
+#endif /* STD_TYPES_H */
@@ -0,0 +1,46 @@
+#include "debug_print.h"
+#include <stdio.h>
+
+/* Host implementation of the LPUART debug output: everything goes to
+ * stderr, so test and benchmark results on stdout stay parseable */
+
+void debug_print_init(void)
+{
+}
+
+void debug_print(const char *format, ...)
+{
+    va_list args;
+
+    va_start(args, format);
+    (void)vfprintf(stderr, format, args);
+    va_end(args);
+}
+
+void debug_print_string(const char *str)
+{
+    (void)fputs(str, stderr);
+}
+
+void debug_print_hex(const uint8_t *buffer, uint32_t length, const char *prefix)
+{
+    uint32_t i;
+
+    if (prefix != NULL) {
+        (void)fputs(prefix, stderr);
+    }
+    for (i = 0U; i < length; i++) {
+        (void)fprintf(stderr, "%02X ", buffer[i]);
+    }
+    (void)fputc('\n', stderr);
+}
+
+void debug_print_char(char character)
+{
+    (void)fputc(character, stderr);
+}
+
+void debug_print_newline(void)
+{
+    (void)fputc('\n', stderr);
+}
@@ -0,0 +1,8 @@
+#ifndef LWIP_NETDB_H
+#define LWIP_NETDB_H
+
+/* Host stand-in for the lwIP name resolution API */
+
+#include <netdb.h>
+
+#endif /* LWIP_NETDB_H */
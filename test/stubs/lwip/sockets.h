@@ -0,0 +1,19 @@
+#ifndef LWIP_SOCKETS_H
+#define LWIP_SOCKETS_H
+
+/* Host stand-in for the lwIP socket layer. With LWIP_COMPAT_SOCKETS the
+ * target code calls lwIP through the BSD names, which map straight to
+ * the POSIX socket API here. */
+
+#include <sys/types.h>
+#include <sys/socket.h>
+#include <sys/select.h>
+#include <sys/uio.h>
+#include <netinet/in.h>
+#include <netinet/tcp.h>
+#include <arpa/inet.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <errno.h>
+
+#endif /* LWIP_SOCKETS_H */
@@ -0,0 +1,60 @@
+#include "test_util.h"
+#include "crc32.h"
+#include <string.h>
+
+/* Slicing-by-8 against the bytewise reference and against known values,
+ * for every alignment and for data fed in pieces */
+
+static uint8_t data[65536];
+
+int main(void)
+{
+    static const uint8_t check[] = "123456789";
+    uint32_t seed = 1U;
+    uint32_t i;
+    uint32_t offset;
+    uint32_t length;
+    crc32_t crc;
+
+    for (i = 0U; i < sizeof(data); i++) {
+        data[i] = (uint8_t)test_random(&seed);
+    }
+
+    CHECK(crc32_compute(check, 9U) == CRC32_CHECK_VALUE);
+    CHECK((crc32_update_bytewise(CRC32_INITIAL, check, 9U) ^ CRC32_FINAL_XOR) ==
+          CRC32_CHECK_VALUE);
+    CHECK(crc32_compute(data, 0U) == 0U);
+    CHECK(crc32_compute(NULL, 4U) == 0U);
+
+    /* 32 zero bytes, a second known value that covers whole 8 byte steps */
+    {
+        static const uint8_t zeros[32];
+        CHECK(crc32_compute(zeros, sizeof(zeros)) == 0x190A55ADU);
+    }
+
+    for (i = 0U; i < 20000U; i++) {
+        offset = test_random(&seed) % 64U;
+        length = test_random(&seed) % 300U;
+        if (crc32_update_slice8(CRC32_INITIAL, &data[offset], length) !=
+            crc32_update_bytewise(CRC32_INITIAL, &data[offset], length)) {
+            CHECK(false);
+            break;
+        }
+    }
+
+    /* Pieces of any size give the CRC of the whole */
+    crc32_init(&crc);
+    for (offset = 0U; offset < sizeof(data); offset += length) {
+        length = 1U + (test_random(&seed) % 4080U);
+        if (length > (sizeof(data) - offset)) {
+            length = sizeof(data) - offset;
+        }
+        crc32_update(&crc, &data[offset], length);
+    }
+    CHECK(crc.length == sizeof(data));
+    CHECK(crc32_value(&crc) == crc32_compute(data, sizeof(data)));
+    CHECK(crc32_value(&crc) ==
+          (crc32_update_bytewise(CRC32_INITIAL, data, sizeof(data)) ^ CRC32_FINAL_XOR));
+
+    return TEST_RESULT();
+}
@@ -0,0 +1,458 @@
+#include "test_util.h"
+#include "doip_dispatch.h"
+#include "app_doip_entity.h"
+#include <string.h>
+
+/* Payload type dispatch on random input: doip_dispatch() against a
+ * linear reference, then random datagrams and TCP messages through the
+ * entity, each answered with exactly the reply the tables call for */
+
+#define ENTITY_ADDRESS      0x1000U
+#define UDP_SOCKET          2
+#define LISTEN_SOCKET       3
+#define FIRST_TCP_SOCKET    10
+#define MAX_PAYLOAD         64U
+#define ROUNDS              20000U
+
+static uint32_t seed = 7U;
+
+/* Payload types worth hitting more often than a random one would */
+static const uint16_t known_types[] = {
+    0x0000U, 0x0001U, 0x0002U, 0x0003U, 0x0004U, 0x0005U, 0x0006U,
+    0x0007U, 0x0008U, 0x4001U, 0x4003U, 0x8001U, 0x8002U, 0x8003U
+};
+
+static uint16_t random_type(void)
+{
+    uint32_t r = test_random(&seed);
+
+    if ((r & 3U) != 0U) {
+        return known_types[(r >> 2) % (sizeof(known_types) / sizeof(known_types[0]))];
+    }
+    return (uint16_t)(r >> 16);
+}
+
+/* doip_dispatch() */
+
+static uint32_t handled_count;
+
+static void count_handler(void *context, const doip_dispatch_msg_t *msg)
+{
+    (void)context;
+    (void)msg;
+    handled_count++;
+}
+
+static const doip_dispatch_entry_t entries[] = {
+    { 0x0001U, DOIP_TRANSPORT_UDP, (uint8_t)DOIP_DISPATCH_NACK, 0U, 0U, count_handler },
+    { 0x0003U, DOIP_TRANSPORT_UDP, (uint8_t)DOIP_DISPATCH_DROP, 17U, 17U, count_handler },
+    { 0x0005U, DOIP_TRANSPORT_TCP, (uint8_t)DOIP_DISPATCH_NACK_CLOSE, 7U, 11U, count_handler },
+    { 0x0008U, DOIP_TRANSPORT_TCP, (uint8_t)DOIP_DISPATCH_NACK_CLOSE, 2U, 2U, NULL },
+    { 0x4001U, DOIP_TRANSPORT_UDP | DOIP_TRANSPORT_TCP, (uint8_t)DOIP_DISPATCH_NACK,
+      0U, 0U, count_handler },
+    { 0x8001U, DOIP_TRANSPORT_TCP, (uint8_t)DOIP_DISPATCH_NACK_CLOSE, 5U,
+      DOIP_DISPATCH_NO_LIMIT, count_handler }
+};
+
+static const doip_dispatch_table_t table = {
+    entries, (uint32_t)(sizeof(entries) / sizeof(entries[0])), (uint8_t)DOIP_DISPATCH_NACK
+};
+
+static void test_table(void)
+{
+    doip_dispatch_result_t result;
+    doip_dispatch_msg_t msg;
+    const doip_dispatch_entry_t *entry;
+    uint32_t expected_handled;
+    uint32_t mismatches = 0U;
+    uint32_t handled = 0U;
+    uint32_t round;
+    uint32_t i;
+
+    (void)memset(&msg, 0, sizeof(msg));
+    for (round = 0U; round < (ROUNDS * 10U); round++) {
+        msg.payload_type = random_type();
+        msg.transport = ((test_random(&seed) & 1U) != 0U) ? DOIP_TRANSPORT_UDP :
+                                                              DOIP_TRANSPORT_TCP;
+        msg.payload_length = test_random(&seed) % 24U;
+        if ((test_random(&seed) & 15U) == 0U) {
+            msg.payload_length = test_random(&seed);
+        }
+
+        entry = NULL;
+        for (i = 0U; i < table.count; i++) {
+            if (entries[i].payload_type == msg.payload_type) {
+                entry = &entries[i];
+            }
+        }
+        CHECK(doip_dispatch_find(&table, msg.payload_type) == entry);
+
+        expected_handled = handled_count;
+        result = doip_dispatch(&table, NULL, &msg);
+        if ((entry == NULL) || ((entry->transports & msg.transport) == 0U)) {
+            mismatches += ((result.action != DOIP_DISPATCH_NACK) ||
+                           (result.nack_code != DOIP_NACK_UNKNOWN_PAYLOAD_TYPE) ||
+                           result.handled) ? 1U : 0U;
+        } else if ((msg.payload_length < entry->min_length) ||
+                   (msg.payload_length > entry->max_length)) {
+            mismatches += ((result.action != (doip_dispatch_action_t)entry->invalid_action) ||
+                           (result.nack_code != DOIP_NACK_INVALID_PAYLOAD_LENGTH) ||
+                           result.handled) ? 1U : 0U;
+        } else {
+            mismatches += ((result.action != DOIP_DISPATCH_DROP) || !result.handled) ? 1U : 0U;
+            if (entry->handler != NULL) {
+                expected_handled++;
+            }
+            handled++;
+        }
+        mismatches += (handled_count != expected_handled) ? 1U : 0U;
+    }
+    CHECK(mismatches == 0U);
+    /* The random input reaches the handlers, not only the NACKs */
+    CHECK(handled > (ROUNDS / 10U));
+}
+
+/* The entity on mock sockets: one datagram or one TCP connection at a
+ * time, everything sent back is kept */
+
+static uint8_t input[8U + MAX_PAYLOAD];
+static uint32_t input_length;
+static uint32_t input_position;
+static bool datagram_pending;
+static bool connection_pending;
+static bool peer_closed;
+static int tcp_socket = FIRST_TCP_SOCKET - 1;
+static bool tcp_closed;
+static uint8_t output[256];
+static uint32_t output_length;
+
+static int mock_udp_bind(uint16_t port)
+{
+    (void)port;
+    return UDP_SOCKET;
+}
+
+static int mock_listen(uint16_t port)
+{
+    (void)port;
+    return LISTEN_SOCKET;
+}
+
+static int mock_udp_recvfrom(int sock, uint8_t *buf, uint32_t len,
+                             doip_endpoint_t *src)
+{
+    (void)sock;
+    if (!datagram_pending || (len < input_length)) {
+        return -1;
+    }
+    datagram_pending = false;
+    /* Sources change, so the rate limiter and duplicate filter stay out */
+    src->ip_addr = test_random(&seed);
+    src->port = (uint16_t)(49152U + (test_random(&seed) % 16384U));
+    (void)memcpy(buf, input, input_length);
+    return (int)input_length;
+}
+
+static int mock_accept(int listen_sock)
+{
+    (void)listen_sock;
+    if (!connection_pending) {
+        return -1;
+    }
+    connection_pending = false;
+    tcp_socket++;
+    tcp_closed = false;
+    return tcp_socket;
+}
+
+static int mock_recv(int sock, uint8_t *buf, uint32_t len)
+{
+    uint32_t n = input_length - input_position;
+
+    CHECK(sock == tcp_socket);
+    if (n == 0U) {
+        return peer_closed ? 0 : -1;
+    }
+    if (n > len) {
+        n = len;
+    }
+    (void)memcpy(buf, &input[input_position], n);
+    input_position += n;
+    return (int)n;
+}
+
+static int mock_output(const uint8_t *data, uint32_t len)
+{
+    if ((output_length + len) > sizeof(output)) {
+        return -1;
+    }
+    (void)memcpy(&output[output_length], data, len);
+    output_length += len;
+    return (int)len;
+}
+
+static int mock_send(int sock, const uint8_t *data, uint32_t len)
+{
+    CHECK(sock == tcp_socket);
+    return mock_output(data, len);
+}
+
+static int mock_udp_sendto(int sock, const uint8_t *data, uint32_t len,
+                           const doip_endpoint_t *dst)
+{
+    (void)dst;
+    CHECK(sock == UDP_SOCKET);
+    return mock_output(data, len);
+}
+
+static void mock_close(int sock)
+{
+    if (sock == tcp_socket) {
+        tcp_closed = true;
+    }
+}
+
+static int mock_select(const int *sockets, uint8_t *events, uint32_t count,
+                       uint32_t timeout_ms)
+{
+    int ready = 0;
+    uint32_t i;
+
+    (void)timeout_ms;
+    for (i = 0U; i < count; i++) {
+        events[i] = 0U;
+        if (((sockets[i] == UDP_SOCKET) && datagram_pending) ||
+            ((sockets[i] == LISTEN_SOCKET) && connection_pending) ||
+            ((sockets[i] == tcp_socket) &&
+             ((input_position < input_length) || peer_closed))) {
+            events[i] = DOIP_SOCKET_EVENT_READ;
+            ready++;
+        }
+    }
+    return ready;
+}
+
+static doip_network_ops_t ops;
+static doip_interface_t itf;
+static doip_entity_t entity;
+static uint32_t now_ms;
+
+static void entity_step(void)
+{
+    now_ms += 1000U;
+    doip_entity_run_timers(&entity, now_ms);
+    (void)doip_interface_wait(&itf, 0U);
+    (void)doip_entity_process(&entity, NULL);
+}
+
+static void entity_setup(void)
+{
+    doip_entity_config_t config;
+
+    (void)memset(&ops, 0, sizeof(ops));
+    ops.udp_bind = mock_udp_bind;
+    ops.udp_sendto = mock_udp_sendto;
+    ops.udp_recvfrom = mock_udp_recvfrom;
+    ops.tcp_listen = mock_listen;
+    ops.tcp_accept = mock_accept;
+    ops.tcp_recv = mock_recv;
+    ops.tcp_send = mock_send;
+    ops.close_socket = mock_close;
+    ops.socket_select = mock_select;
+
+    (void)memset(&config, 0, sizeof(config));
+    config.logical_address = ENTITY_ADDRESS;
+    (void)memcpy(config.vin, "WVWZZZ1KZ1A234567", DOIP_VIN_LENGTH);
+    config.general_inactivity_time = 300000U;
+    config.initial_inactivity_time = 300000U;
+    config.alive_check_time = 500U;
+    config.max_tester_connections = 1U;
+    CHECK(doip_interface_init(&itf, &ops) == DOIP_RESULT_OK);
+    CHECK(doip_entity_init(&entity, &config, &itf) == DOIP_RESULT_OK);
+    CHECK(doip_entity_start(&entity) == DOIP_RESULT_OK);
+
+    /* The announcements after start are not replies */
+    while (now_ms < 10000U) {
+        entity_step();
+    }
+    output_length = 0U;
+}
+
+/* Random message: mostly a valid header of a known type with a matching
+ * length, with the pattern, the length or the payload length off now
+ * and then. Returns the header as it was written. */
+static doip_header_t random_message(bool tcp)
+{
+    doip_header_t header;
+    uint32_t declared;
+    uint32_t i;
+
+    header.protocol_version = DOIP_PROTOCOL_VERSION_2012;
+    header.inverse_protocol_version = (uint8_t)~DOIP_PROTOCOL_VERSION_2012;
+    if ((test_random(&seed) & 15U) == 0U) {
+        header.protocol_version = (uint8_t)test_random(&seed);
+        header.inverse_protocol_version = (uint8_t)test_random(&seed);
+    }
+    header.payload_type = random_type();
+
+    input_length = 8U + (test_random(&seed) % (MAX_PAYLOAD + 1U));
+    if ((test_random(&seed) & 3U) == 0U) {
+        /* Lengths the table entries sit on */
+        input_length = 8U + (test_random(&seed) % 19U);
+    }
+    declared = input_length - 8U;
+    if (!tcp && ((test_random(&seed) & 7U) == 0U)) {
+        declared = test_random(&seed) % (MAX_PAYLOAD + 1U);
+    }
+    header.payload_length = declared;
+
+    input[0] = header.protocol_version;
+    input[1] = header.inverse_protocol_version;
+    input[2] = (uint8_t)(header.payload_type >> 8);
+    input[3] = (uint8_t)header.payload_type;
+    input[4] = (uint8_t)(declared >> 24);
+    input[5] = (uint8_t)(declared >> 16);
+    input[6] = (uint8_t)(declared >> 8);
+    input[7] = (uint8_t)declared;
+    for (i = 8U; i < input_length; i++) {
+        input[i] = (uint8_t)test_random(&seed);
+    }
+    input_position = 0U;
+    return header;
+}
+
+/* The output is one message of 'type', a generic NACK also has 'code' */
+static bool replied(uint16_t type, uint8_t code)
+{
+    doip_header_t header;
+
+    if ((output_length < 8U) ||
+        (doip_decode_header(output, output_length, &header) != DOIP_RESULT_OK) ||
+        !doip_validate_header(&header) ||
+        (output_length != (8U + header.payload_length)) ||
+        (header.payload_type != type)) {
+        return false;
+    }
+    return (type != DOIP_PAYLOAD_TYPE_GENERIC_NACK) ||
+           ((header.payload_length == 1U) && (output[8] == code));
+}
+
+static bool nacked(uint8_t code)
+{
+    return replied(DOIP_PAYLOAD_TYPE_GENERIC_NACK, code);
+}
+
+static void test_entity_udp(void)
+{
+    doip_header_t header;
+    uint32_t length;
+    uint32_t mismatches = 0U;
+    uint32_t answered = 0U;
+    uint32_t round;
+    bool ok;
+
+    for (round = 0U; round < ROUNDS; round++) {
+        header = random_message(false);
+        if ((test_random(&seed) & 31U) == 0U) {
+            input_length = test_random(&seed) % 8U;
+        }
+        length = input_length - 8U;
+        datagram_pending = true;
+        output_length = 0U;
+        entity_step();
+
+        if (input_length < 8U) {
+            ok = (output_length == 0U);
+        } else if (!doip_validate_header(&header)) {
+            ok = nacked(DOIP_NACK_INCORRECT_PATTERN);
+        } else if (header.payload_length != length) {
+            ok = nacked(DOIP_NACK_INVALID_PAYLOAD_LENGTH);
+        } else if ((header.payload_type != DOIP_PAYLOAD_TYPE_VEHICLE_ID_REQ) &&
+                   (header.payload_type != DOIP_PAYLOAD_TYPE_VEHICLE_ID_REQ_EID) &&
+                   (header.payload_type != DOIP_PAYLOAD_TYPE_VEHICLE_ID_REQ_VIN)) {
+            ok = nacked(DOIP_NACK_UNKNOWN_PAYLOAD_TYPE);
+        } else if ((header.payload_type == DOIP_PAYLOAD_TYPE_VEHICLE_ID_REQ) ?
+                   (length != 0U) :
+                   (length != ((header.payload_type == DOIP_PAYLOAD_TYPE_VEHICLE_ID_REQ_EID) ?
+                               DOIP_EID_LENGTH : DOIP_VIN_LENGTH))) {
+            ok = nacked(DOIP_NACK_INVALID_PAYLOAD_LENGTH);
+        } else if (header.payload_type == DOIP_PAYLOAD_TYPE_VEHICLE_ID_REQ) {
+            ok = replied(DOIP_PAYLOAD_TYPE_VEHICLE_ANNOUNCEMENT, 0U);
+            answered++;
+        } else {
+            /* Random EIDs and VINs are not this vehicle's */
+            ok = (output_length == 0U);
+        }
+        mismatches += ok ? 0U : 1U;
+    }
+    CHECK(mismatches == 0U);
+    CHECK(answered > 0U);
+    CHECK(entity.udp_stats.rate_limited == 0U);
+    CHECK(entity.udp_stats.collapsed == 0U);
+}
+
+static void test_entity_tcp(void)
+{
+    doip_header_t header;
+    uint32_t length;
+    uint32_t mismatches = 0U;
+    uint32_t activations = 0U;
+    uint32_t round;
+    uint32_t i;
+    bool close_expected;
+    bool ok;
+
+    for (round = 0U; round < ROUNDS; round++) {
+        header = random_message(true);
+        length = input_length - 8U;
+        connection_pending = true;
+        peer_closed = false;
+        output_length = 0U;
+        /* Accept, then read the message */
+        entity_step();
+        entity_step();
+
+        close_expected = false;
+        if (!doip_validate_header(&header)) {
+            ok = nacked(DOIP_NACK_INCORRECT_PATTERN);
+            close_expected = true;
+        } else if (header.payload_type == DOIP_PAYLOAD_TYPE_ROUTING_ACTIVATION_REQ) {
+            close_expected = (length < 7U) || (length > 11U);
+            ok = close_expected ? nacked(DOIP_NACK_INVALID_PAYLOAD_LENGTH) :
+                                  replied(DOIP_PAYLOAD_TYPE_ROUTING_ACTIVATION_RES, 0U);
+            activations += close_expected ? 0U : 1U;
+        } else if (header.payload_type == DOIP_PAYLOAD_TYPE_ALIVE_CHECK_RES) {
+            close_expected = (length != 2U);
+            ok = close_expected ? nacked(DOIP_NACK_INVALID_PAYLOAD_LENGTH) :
+                                  (output_length == 0U);
+        } else if (header.payload_type == DOIP_PAYLOAD_TYPE_DIAG_MESSAGE) {
+            /* The connection was never routed */
+            close_expected = (length < 5U);
+            ok = close_expected ? nacked(DOIP_NACK_INVALID_PAYLOAD_LENGTH) :
+                                  replied(DOIP_PAYLOAD_TYPE_DIAG_MESSAGE_NACK, 0U);
+        } else {
+            ok = nacked(DOIP_NACK_UNKNOWN_PAYLOAD_TYPE);
+        }
+        mismatches += ok ? 0U : 1U;
+        mismatches += (tcp_closed != close_expected) ? 1U : 0U;
+
+        /* The tester goes away, which frees its routing for the next one */
+        peer_closed = true;
+        for (i = 0U; (i < 3U) && !tcp_closed; i++) {
+            entity_step();
+        }
+        mismatches += tcp_closed ? 0U : 1U;
+    }
+    CHECK(mismatches == 0U);
+    CHECK(activations > 0U);
+}
+
+int main(void)
+{
+    test_table();
+    entity_setup();
+    test_entity_udp();
+    test_entity_tcp();
+
+    return TEST_RESULT();
+}
@@ -0,0 +1,459 @@
+#include "test_util.h"
+#include "uds_download_flash.h"
+#include "flash_sim.h"
+#include <string.h>
+
+/* RequestDownload, TransferData and RequestTransferExit: the sequence
+ * checks of the engine on a memory that completes writes on request, and
+ * whole downloads to the simulated flash bank */
+
+#define MEMORY_BASE         0x00600000U
+#define MEMORY_SIZE         0x00010000U
+
+static uds_context_t context;
+static uds_service_table_t table;
+static uds_download_t download;
+static uint8_t request[16384];
+static uint8_t response[64];
+static uint32_t response_length;
+static bool suppressed;
+
+static void call(uint32_t length)
+{
+    uds_request_t req;
+    uds_response_t rsp;
+
+    req.sid = request[0];
+    req.data = &request[1];
+    req.length = length - 1U;
+    rsp.buffer = response;
+    rsp.max_length = sizeof(response);
+    rsp.actual_length = 0U;
+    response_length = uds_process_request(&context, &req, &rsp) ?
+                      rsp.actual_length : 0U;
+    suppressed = rsp.suppressed;
+}
+
+static bool positive(uint8_t service_id)
+{
+    return (response_length > 0U) && (response[0] == (uint8_t)(service_id + 0x40U));
+}
+
+static bool negative(uint8_t nrc)
+{
+    return (response_length == 3U) && (response[0] == 0x7FU) && (response[2] == nrc);
+}
+
+static void programming_session(void)
+{
+    request[0] = 0x10U;
+    request[1] = 0x02U;
+    call(2U);
+    context.security_level = 1U;
+}
+
+static void build_request_download(uint32_t address, uint32_t size)
+{
+    uint32_t i;
+
+    request[0] = 0x34U;
+    request[1] = 0x00U;
+    request[2] = 0x44U;
+    for (i = 0U; i < 4U; i++) {
+        request[3U + i] = (uint8_t)(address >> (24U - (8U * i)));
+        request[7U + i] = (uint8_t)(size >> (24U - (8U * i)));
+    }
+}
+
+static void request_download(uint32_t address, uint32_t size)
+{
+    build_request_download(address, size);
+    call(11U);
+}
+
+static void transfer_data(uint8_t counter, const uint8_t *data, uint32_t length)
+{
+    request[0] = 0x36U;
+    request[1] = counter;
+    (void)memcpy(&request[2], data, length);
+    call(length + 2U);
+}
+
+static void transfer_exit(const uint32_t *crc)
+{
+    request[0] = 0x37U;
+    if (crc == NULL) {
+        call(1U);
+        return;
+    }
+    request[1] = (uint8_t)(*crc >> 24);
+    request[2] = (uint8_t)(*crc >> 16);
+    request[3] = (uint8_t)(*crc >> 8);
+    request[4] = (uint8_t)*crc;
+    call(5U);
+}
+
+static void setup(const uds_download_memory_t *memory,
+                  const uds_download_region_t *region)
+{
+    uds_init(&context);
+    uds_service_table_init(&table);
+    uds_register_core_services(&table);
+    uds_register_download_services(&table);
+    uds_set_service_table(&context, &table);
+    uds_download_init(&download, memory, region, 1U);
+    uds_download_attach(&context, &download);
+}
+
+/* Memory in RAM, a write stays busy for a few status polls */
+
+static uint8_t ram[MEMORY_SIZE];
+static uint32_t ram_busy;
+static bool ram_fail;
+static uint32_t ram_address;
+static const uint8_t *ram_data;
+static uint32_t ram_length;
+
+static bool ram_prepare(void *ctx, uint32_t address, uint32_t size)
+{
+    (void)ctx;
+    (void)address;
+    (void)size;
+    return true;
+}
+
+static bool ram_write_start(void *ctx, uint32_t address, const uint8_t *data,
+                            uint32_t length)
+{
+    (void)ctx;
+    ram_address = address;
+    ram_data = data;
+    ram_length = length;
+    ram_busy = 3U;
+    return true;
+}
+
+static uds_download_memory_status_t ram_write_status(void *ctx, bool wait)
+{
+    (void)ctx;
+    if ((ram_busy > 0U) && !wait) {
+        ram_busy--;
+        return UDS_DOWNLOAD_MEMORY_BUSY;
+    }
+    if (ram_length > 0U) {
+        (void)memcpy(&ram[ram_address - MEMORY_BASE], ram_data, ram_length);
+        ram_length = 0U;
+    }
+    ram_busy = 0U;
+    return ram_fail ? UDS_DOWNLOAD_MEMORY_ERROR : UDS_DOWNLOAD_MEMORY_IDLE;
+}
+
+static bool ram_finish(void *ctx)
+{
+    (void)ctx;
+    return true;
+}
+
+static uint8_t image[FLASH_BANK_SIZE];
+
+static void test_sequence(void)
+{
+    static const uds_download_memory_t memory = {
+        ram_prepare, ram_write_start, ram_write_status, ram_finish, NULL, NULL, NULL
+    };
+    static const uds_download_region_t region = { MEMORY_BASE, MEMORY_SIZE };
+    const uint32_t block = UDS_DOWNLOAD_BLOCK_SIZE;
+    uint32_t crc;
+    uint32_t i;
+
+    setup(&memory, &region);
+    programming_session();
+
+    /* A suppressed positive response is kept for a caller that already
+     * sent a response pending, a negative one is sent */
+    request[0] = 0x3EU;
+    request[1] = 0x80U;
+    call(2U);
+    CHECK((response_length == 0U) && suppressed && (response[0] == 0x7EU));
+    request[1] = 0x81U;
+    call(2U);
+    CHECK(negative(UDS_NRC_SUB_FUNCTION_NOT_SUPPORTED) && !suppressed);
+
+    request[0] = 0x36U;
+    request[1] = 1U;
+    call(3U);
+    CHECK(negative(UDS_NRC_REQUEST_SEQUENCE_ERROR));
+    transfer_exit(NULL);
+    CHECK(negative(UDS_NRC_REQUEST_SEQUENCE_ERROR));
+
+    /* Outside the region, past its end, compressed */
+    request_download(0x100U, 16U);
+    CHECK(negative(UDS_NRC_REQUEST_OUT_OF_RANGE));
+    request_download(MEMORY_BASE + MEMORY_SIZE - 8U, 16U);
+    CHECK(negative(UDS_NRC_REQUEST_OUT_OF_RANGE));
+    build_request_download(MEMORY_BASE, 16U);
+    request[1] = 0x11U;
+    call(11U);
+    CHECK(negative(UDS_NRC_REQUEST_OUT_OF_RANGE));
+
+    /* maxNumberOfBlockLength covers SID, counter and a block */
+    request_download(MEMORY_BASE, block + 32U);
+    CHECK(positive(0x34U) && (response[1] == 0x20U));
+    CHECK((((uint32_t)response[2] << 8) | response[3]) == (block + 2U));
+    request_download(MEMORY_BASE, 16U);
+    CHECK(negative(UDS_NRC_CONDITIONS_NOT_CORRECT));
+
+    transfer_data(2U, image, 16U);
+    CHECK(negative(UDS_NRC_WRONG_BLOCK_SEQUENCE_COUNTER));
+    transfer_data(1U, image, block + 1U);
+    CHECK(negative(UDS_NRC_INCORRECT_MESSAGE_LENGTH));
+    transfer_data(1U, image, block);
+    CHECK(positive(0x36U) && (response[1] == 1U));
+
+    /* A repeated block is answered again without writing it twice */
+    transfer_data(1U, image, block);
+    CHECK(positive(0x36U) && (response[1] == 1U));
+    CHECK(download.stats.repeated_blocks == 1U);
+    transfer_exit(NULL);
+    CHECK(negative(UDS_NRC_REQUEST_SEQUENCE_ERROR));
+    transfer_data(2U, &image[block], 64U);
+    CHECK(negative(UDS_NRC_TRANSFER_DATA_SUSPENDED));
+    transfer_data(2U, &image[block], 32U);
+    CHECK(positive(0x36U));
+
+    /* The CRC is optional, any other record is malformed */
+    request[0] = 0x37U;
+    call(3U);
+    CHECK(negative(UDS_NRC_INCORRECT_MESSAGE_LENGTH));
+    crc = crc32_compute(image, block + 32U);
+    transfer_exit(&crc);
+    CHECK(positive(0x37U) && (response_length == 5U) &&
+          (memcmp(&response[1], &request[1], 4U) == 0));
+    CHECK(memcmp(ram, image, block + 32U) == 0);
+    CHECK(download.stats.blocks == 2U);
+    CHECK(download.stats.bytes == (block + 32U));
+
+    /* A failed write fails the download, a new one replaces it */
+    request_download(MEMORY_BASE, 3U * block);
+    CHECK(positive(0x34U));
+    ram_fail = true;
+    for (i = 0U; i < 3U; i++) {
+        transfer_data((uint8_t)(i + 1U), &image[i * block], block);
+        if (!positive(0x36U)) {
+            break;
+        }
+    }
+    CHECK(negative(UDS_NRC_GENERAL_PROGRAMMING_FAILURE));
+    ram_fail = false;
+    transfer_data(download.next_counter, image, block);
+    CHECK(negative(UDS_NRC_GENERAL_PROGRAMMING_FAILURE));
+
+    /* Leaving the programming session drops a download */
+    request_download(MEMORY_BASE, block);
+    CHECK(positive(0x34U));
+    request[0] = 0x10U;
+    request[1] = 0x03U;
+    call(2U);
+    CHECK(!download.active);
+    programming_session();
+    transfer_data(1U, image, 16U);
+    CHECK(negative(UDS_NRC_REQUEST_SEQUENCE_ERROR));
+}
+
+/* A transport that delivers more than a staging buffer announces it, and
+ * blocks then span buffers */
+static void test_large_blocks(void)
+{
+    static const uds_download_memory_t memory = {
+        ram_prepare, ram_write_start, ram_write_status, ram_finish, NULL, NULL, NULL
+    };
+    static const uds_download_region_t region = { MEMORY_BASE, MEMORY_SIZE };
+    const uint32_t block = (2U * UDS_DOWNLOAD_BLOCK_SIZE) + 100U;
+    uint32_t crc;
+
+    setup(&memory, &region);
+    uds_download_set_max_block_length(&download, block + 2U);
+    programming_session();
+    (void)memset(ram, 0, sizeof(ram));
+
+    request_download(MEMORY_BASE, 2U * block);
+    CHECK(positive(0x34U) && (response[1] == 0x20U));
+    CHECK((((uint32_t)response[2] << 8) | response[3]) == (block + 2U));
+
+    transfer_data(1U, image, block + 1U);
+    CHECK(negative(UDS_NRC_INCORRECT_MESSAGE_LENGTH));
+    transfer_data(1U, image, block);
+    CHECK(positive(0x36U) && (response[1] == 1U));
+    transfer_data(2U, &image[block], block);
+    CHECK(positive(0x36U) && (response[1] == 2U));
+
+    crc = crc32_compute(image, 2U * block);
+    transfer_exit(&crc);
+    CHECK(positive(0x37U));
+    CHECK(memcmp(ram, image, 2U * block) == 0);
+    /* Three buffers per block, the last one short */
+    CHECK(download.stats.blocks == 6U);
+
+    /* Past 0xFFFF the length takes more bytes */
+    uds_download_set_max_block_length(&download, 0x10002U);
+    request_download(MEMORY_BASE, 16U);
+    CHECK(positive(0x34U) && (response_length == 5U) && (response[1] == 0x30U));
+    CHECK((response[2] == 0x01U) && (response[3] == 0x00U) && (response[4] == 0x02U));
+}
+
+/* The flash bank behind the download */
+
+static flash_sim_t sim;
+static flash_t flash;
+static uds_download_flash_t download_flash;
+static uds_download_memory_t flash_memory;
+static uint8_t readback[FLASH_BANK_SIZE];
+static uint32_t seed = 7U;
+
+/* Downloads 'total' bytes in blocks of 'low' to 'high' bytes */
+static void download_image(uint32_t low, uint32_t high, uint32_t total)
+{
+    uint32_t offset = 0U;
+    uint32_t length;
+    uint32_t crc;
+    uint8_t counter = 1U;
+
+    request_download(FLASH_BANK_B_ADDRESS, total);
+    CHECK(positive(0x34U));
+
+    while (offset < total) {
+        length = low + (test_random(&seed) % ((high - low) + 1U));
+        if (length > (total - offset)) {
+            length = total - offset;
+        }
+        transfer_data(counter, &image[offset], length);
+        if (!positive(0x36U)) {
+            CHECK(false);
+            return;
+        }
+        counter++;
+        offset += length;
+    }
+
+    crc = crc32_compute(image, total);
+    transfer_exit(&crc);
+    CHECK(positive(0x37U));
+    CHECK(download_flash.stats.bytes == total);
+    CHECK(flash_read(&flash, FLASH_BANK_B_ADDRESS, readback, total) == FLASH_RESULT_OK);
+    CHECK(memcmp(readback, image, total) == 0);
+}
+
+/* A download fails after it programmed some blocks: the retry must not
+ * trust the erase progress of the failed one */
+static void test_retry(void)
+{
+    static const uint8_t zeros[FLASH_PROGRAM_UNIT];
+    const uint32_t block = UDS_DOWNLOAD_BLOCK_SIZE;
+    const uint32_t total = 4U * block;
+    uint32_t i;
+
+    request_download(FLASH_BANK_B_ADDRESS, total);
+    CHECK(positive(0x34U));
+    transfer_data(1U, image, block);
+    CHECK(positive(0x36U));
+    while (uds_download_poll(&download)) {
+        (void)flash_wait(&flash);
+    }
+
+    /* Something else programmed the second sector after it was erased */
+    CHECK(flash_erase_covers(&download_flash.erase, FLASH_BANK_B_ADDRESS,
+                             2U * FLASH_SECTOR_SIZE));
+    CHECK(flash_program(&flash, FLASH_BANK_B_ADDRESS + FLASH_SECTOR_SIZE, zeros,
+                        sizeof(zeros)) == FLASH_RESULT_OK);
+    CHECK(flash_wait(&flash) == FLASH_RESULT_OK);
+    for (i = 1U; i < 4U; i++) {
+        transfer_data((uint8_t)(i + 1U), &image[i * block], block);
+        if (!positive(0x36U)) {
+            break;
+        }
+    }
+    if (i == 4U) {
+        transfer_exit(NULL);
+    }
+    CHECK(negative(UDS_NRC_GENERAL_PROGRAMMING_FAILURE));
+
+    /* Both sectors hold data now and are erased again */
+    download_image(block, block, total);
+    CHECK(download_flash.erase.stats.sectors_erased >= 2U);
+}
+
+static void test_flash(void)
+{
+    static const uds_download_region_t region = { FLASH_BANK_B_ADDRESS, FLASH_BANK_SIZE };
+    const uint32_t ideal = FLASH_BANK_SIZE / FLASH_QUAD_PAGE_SIZE;
+    uint32_t crc;
+
+    CHECK(flash_sim_open(&sim, NULL) == FLASH_RESULT_OK);
+    sim.erase_us = 200U;
+    sim.program_us = 2U;
+    sim.program_unit_us = 1U;
+    CHECK(flash_init(&flash, &g_flash_sim_ops, &sim) == FLASH_RESULT_OK);
+    uds_download_flash_init(&download_flash, &flash, &flash_memory);
+    setup(&flash_memory, &region);
+    programming_session();
+
+    /* Downloads start at a sector */
+    request_download(FLASH_BANK_B_ADDRESS + 16U, 64U);
+    CHECK(negative(UDS_NRC_UPLOAD_DOWNLOAD_NOT_ACCEPTED));
+
+    /* Blocks of any size are programmed a whole quad-page at a time */
+    download_image(UDS_DOWNLOAD_BLOCK_SIZE, UDS_DOWNLOAD_BLOCK_SIZE, FLASH_BANK_SIZE);
+    CHECK(uds_download_flash_programs_per_mb(&download_flash) == ideal);
+    download_image(1U, UDS_DOWNLOAD_BLOCK_SIZE, FLASH_BANK_SIZE);
+    CHECK(uds_download_flash_programs_per_mb(&download_flash) == ideal);
+    download_image(1U, 255U, FLASH_BANK_SIZE / 4U);
+    CHECK(uds_download_flash_programs_per_mb(&download_flash) == ideal);
+    uds_download_set_max_block_length(&download, sizeof(request));
+    download_image(1U, sizeof(request) - 2U, FLASH_BANK_SIZE);
+    CHECK(uds_download_flash_programs_per_mb(&download_flash) == ideal);
+    uds_download_set_max_block_length(&download, UDS_DOWNLOAD_BLOCK_SIZE + 2U);
+
+    /* Short blocks are combined and the tail padded on exit */
+    request_download(FLASH_BANK_B_ADDRESS, 84U);
+    CHECK(positive(0x34U));
+    (void)memset(image, 1, 40U);
+    (void)memset(&image[40], 2, 44U);
+    transfer_data(1U, image, 40U);
+    transfer_data(2U, &image[40], 44U);
+    transfer_exit(NULL);
+    CHECK(positive(0x37U));
+    CHECK(flash_read(&flash, FLASH_BANK_B_ADDRESS, readback, 96U) == FLASH_RESULT_OK);
+    CHECK((readback[39] == 1U) && (readback[40] == 2U) && (readback[83] == 2U));
+    CHECK((readback[84] == FLASH_ERASED_VALUE) && (readback[95] == FLASH_ERASED_VALUE));
+    CHECK(download_flash.stats.programs == 1U);
+    CHECK(download_flash.stats.combined == 1U);
+
+    /* A wrong CRC fails the exit */
+    request_download(FLASH_BANK_B_ADDRESS, 64U);
+    transfer_data(1U, image, 64U);
+    crc = crc32_compute(image, 64U) ^ 1U;
+    transfer_exit(&crc);
+    CHECK(negative(UDS_NRC_GENERAL_PROGRAMMING_FAILURE));
+
+    test_retry();
+
+    flash_sim_close(&sim);
+}
+
+int main(void)
+{
+    uint32_t i;
+
+    for (i = 0U; i < sizeof(image); i++) {
+        image[i] = (uint8_t)test_random(&seed);
+    }
+
+    test_sequence();
+    test_large_blocks();
+    for (i = 0U; i < sizeof(image); i++) {
+        image[i] = (uint8_t)test_random(&seed);
+    }
+    test_flash();
+
+    return TEST_RESULT();
+}
@@ -0,0 +1,440 @@
+#include "test_util.h"
+#include "app_doip_entity.h"
+#include "uds_download_flash.h"
+#include "flash_sim.h"
+#include <string.h>
+
+/* A download through the entity: TransferData blocks larger than the RX
+ * buffer are streamed into the download staging buffers, smaller ones
+ * are reassembled, and the image ends up on the simulated flash. The
+ * tester's side is scripted ahead and read in random pieces. */
+
+#define TESTER_ADDRESS      0x0E80U
+#define ENTITY_ADDRESS      0x1000U
+#define TESTER_SOCKET       5
+#define MAX_BLOCK_LENGTH    (65536U + 2U)
+#define MAX_RESPONSES       64U
+
+static uint8_t stream[1U << 20];
+static uint32_t stream_length;
+static uint32_t stream_position;
+static bool peer_closed;
+static uint32_t seed = 3U;
+
+static int mock_recv(int sock, uint8_t *buf, uint32_t len)
+{
+    uint32_t n = 1U + (test_random(&seed) % 3000U);
+
+    (void)sock;
+    if (stream_position >= stream_length) {
+        return peer_closed ? 0 : -1;
+    }
+    if (n > len) {
+        n = len;
+    }
+    if (n > (stream_length - stream_position)) {
+        n = stream_length - stream_position;
+    }
+    (void)memcpy(buf, &stream[stream_position], n);
+    stream_position += n;
+    return (int)n;
+}
+
+static bool accepted;
+
+static int mock_accept(int listen_sock)
+{
+    (void)listen_sock;
+    if (accepted) {
+        return -1;
+    }
+    accepted = true;
+    return TESTER_SOCKET;
+}
+
+static int mock_listen(uint16_t port)
+{
+    (void)port;
+    return 3;
+}
+
+static int mock_udp_bind(uint16_t port)
+{
+    (void)port;
+    return 2;
+}
+
+static int mock_udp_sendto(int sock, const uint8_t *data, uint32_t len,
+                           const doip_endpoint_t *dst)
+{
+    (void)sock;
+    (void)data;
+    (void)dst;
+    return (int)len;
+}
+
+static int mock_udp_recvfrom(int sock, uint8_t *buf, uint32_t len,
+                             doip_endpoint_t *src)
+{
+    (void)sock;
+    (void)buf;
+    (void)len;
+    (void)src;
+    return -1;
+}
+
+static void mock_close(int sock)
+{
+    (void)sock;
+}
+
+/* Everything the entity sent, split into messages afterwards */
+static uint8_t sent[1U << 16];
+static uint32_t sent_length;
+
+static int mock_send(int sock, const uint8_t *data, uint32_t len)
+{
+    CHECK(sock == TESTER_SOCKET);
+    if ((sent_length + len) > sizeof(sent)) {
+        return -1;
+    }
+    (void)memcpy(&sent[sent_length], data, len);
+    sent_length += len;
+    return (int)len;
+}
+
+static void put_header(uint16_t type, uint32_t length)
+{
+    uint8_t *h = &stream[stream_length];
+
+    h[0] = 0x03U;
+    h[1] = 0xFCU;
+    h[2] = (uint8_t)(type >> 8);
+    h[3] = (uint8_t)type;
+    h[4] = (uint8_t)(length >> 24);
+    h[5] = (uint8_t)(length >> 16);
+    h[6] = (uint8_t)(length >> 8);
+    h[7] = (uint8_t)length;
+    stream_length += 8U;
+}
+
+static void put_routing_activation(void)
+{
+    uint8_t *p;
+
+    put_header(DOIP_PAYLOAD_TYPE_ROUTING_ACTIVATION_REQ, 7U);
+    p = &stream[stream_length];
+    p[0] = (uint8_t)(TESTER_ADDRESS >> 8);
+    p[1] = (uint8_t)TESTER_ADDRESS;
+    (void)memset(&p[2], 0, 5U);
+    stream_length += 7U;
+}
+
+/* UDS request 'sid' with 'prefix' and 'data' after it */
+static void put_request(uint8_t sid, const uint8_t *prefix, uint32_t prefix_length,
+                        const uint8_t *data, uint32_t length)
+{
+    uint8_t *p;
+
+    put_header(DOIP_PAYLOAD_TYPE_DIAG_MESSAGE, 5U + prefix_length + length);
+    p = &stream[stream_length];
+    p[0] = (uint8_t)(TESTER_ADDRESS >> 8);
+    p[1] = (uint8_t)TESTER_ADDRESS;
+    p[2] = (uint8_t)(ENTITY_ADDRESS >> 8);
+    p[3] = (uint8_t)ENTITY_ADDRESS;
+    p[4] = sid;
+    (void)memcpy(&p[5], prefix, prefix_length);
+    if (length > 0U) {
+        (void)memcpy(&p[5U + prefix_length], data, length);
+    }
+    stream_length += 5U + prefix_length + length;
+}
+
+static void put_unlock(void)
+{
+    static const uint8_t session[1] = { 0x02U };
+    static const uint8_t seed_request[1] = { 0x01U };
+    /* Seed 0x12345678 xor 0xA5A5A5A5 */
+    static const uint8_t key[5] = { 0x02U, 0xB7U, 0x91U, 0xF3U, 0xDDU };
+
+    put_request(0x10U, session, 1U, NULL, 0U);
+    put_request(0x27U, seed_request, 1U, NULL, 0U);
+    put_request(0x27U, key, 5U, NULL, 0U);
+}
+
+static void put_request_download(uint32_t address, uint32_t size)
+{
+    uint8_t prefix[10];
+    uint32_t i;
+
+    prefix[0] = 0x00U;
+    prefix[1] = 0x44U;
+    for (i = 0U; i < 4U; i++) {
+        prefix[2U + i] = (uint8_t)(address >> (24U - (8U * i)));
+        prefix[6U + i] = (uint8_t)(size >> (24U - (8U * i)));
+    }
+    put_request(0x34U, prefix, sizeof(prefix), NULL, 0U);
+}
+
+static void put_transfer_data(uint8_t counter, const uint8_t *data, uint32_t length)
+{
+    put_request(0x36U, &counter, 1U, data, length);
+}
+
+static void put_transfer_exit(uint32_t crc)
+{
+    uint8_t record[4];
+
+    record[0] = (uint8_t)(crc >> 24);
+    record[1] = (uint8_t)(crc >> 16);
+    record[2] = (uint8_t)(crc >> 8);
+    record[3] = (uint8_t)crc;
+    put_request(0x37U, record, sizeof(record), NULL, 0U);
+}
+
+/* UDS server of the entity, answering in the entity task */
+
+static doip_entity_t entity;
+static doip_interface_t itf;
+static uds_context_t context;
+static uds_service_table_t table;
+static uds_download_t download;
+static uint8_t frame_response[64];
+
+static void on_request(uint16_t source_addr, uint16_t target_addr,
+                       const uint8_t *data, uint32_t length, void *user_data)
+{
+    uds_request_t request = { data[0], &data[1], length - 1U };
+    uds_response_t response = { frame_response, sizeof(frame_response), 0U, false };
+
+    (void)target_addr;
+    if (uds_process_request(&context, &request, &response)) {
+        (void)doip_entity_send_diagnostic_response((doip_entity_t *)user_data,
+            source_addr, frame_response, response.actual_length);
+    }
+}
+
+static uint32_t stream_aborts;
+
+static bool on_stream(doip_stream_event_t event, uint16_t source_addr,
+                      uint16_t target_addr, uint32_t total_length, uint32_t offset,
+                      const uint8_t *data, uint32_t length, void *user_data)
+{
+    uds_response_t response = { frame_response, sizeof(frame_response), 0U, false };
+
+    (void)target_addr;
+    (void)offset;
+    switch (event) {
+    case DOIP_STREAM_EVENT_START:
+        return uds_download_stream_start(&context, total_length);
+    case DOIP_STREAM_EVENT_DATA:
+        uds_download_stream_data(&context, data, length);
+        break;
+    case DOIP_STREAM_EVENT_END:
+        if (uds_download_stream_end(&context, &response)) {
+            (void)doip_entity_send_diagnostic_response((doip_entity_t *)user_data,
+                source_addr, frame_response, response.actual_length);
+        }
+        break;
+    default:
+        uds_download_stream_abort(&context);
+        stream_aborts++;
+        break;
+    }
+
+    return true;
+}
+
+/* UDS responses found in what was sent, in order */
+static uint8_t responses[MAX_RESPONSES][8];
+static uint32_t response_count;
+static uint32_t acks;
+
+static void collect_responses(void)
+{
+    uint32_t position = 0U;
+    uint32_t payload_length;
+    uint32_t uds_length;
+    uint16_t type;
+
+    response_count = 0U;
+    acks = 0U;
+    while ((position + 8U) <= sent_length) {
+        type = (uint16_t)(((uint16_t)sent[position + 2U] << 8) | sent[position + 3U]);
+        payload_length = ((uint32_t)sent[position + 4U] << 24) |
+                         ((uint32_t)sent[position + 5U] << 16) |
+                         ((uint32_t)sent[position + 6U] << 8) |
+                         (uint32_t)sent[position + 7U];
+        if (type == DOIP_PAYLOAD_TYPE_DIAG_MESSAGE_ACK) {
+            acks++;
+        }
+        if ((type == DOIP_PAYLOAD_TYPE_DIAG_MESSAGE) && (payload_length > 4U) &&
+            (response_count < MAX_RESPONSES)) {
+            uds_length = payload_length - 4U;
+            if (uds_length > sizeof(responses[0])) {
+                uds_length = sizeof(responses[0]);
+            }
+            (void)memcpy(responses[response_count], &sent[position + 12U], uds_length);
+            response_count++;
+        }
+        position += 8U + payload_length;
+    }
+}
+
+static void run_entity(void)
+{
+    uint32_t now = 0U;
+    uint32_t idle = 0U;
+    uint32_t consumed;
+
+    /* Until the whole script is read and answered */
+    while (idle < 4U) {
+        consumed = stream_position;
+        doip_entity_run_timers(&entity, now);
+        (void)doip_entity_process(&entity, on_request);
+        idle = ((stream_position == consumed) && (stream_position == stream_length)) ?
+               (idle + 1U) : 0U;
+        now++;
+        while (uds_download_poll(&download)) {
+        }
+    }
+}
+
+static flash_sim_t sim;
+static flash_t flash;
+static uds_download_flash_t download_flash;
+static uds_download_memory_t flash_memory;
+static uint8_t image[(3U * 65536U) + 21000U];
+static uint8_t readback[sizeof(image)];
+
+static void start(void)
+{
+    static const uds_download_region_t region = { FLASH_BANK_B_ADDRESS, FLASH_BANK_SIZE };
+    doip_network_ops_t ops;
+    doip_entity_config_t config;
+
+    (void)memset(&ops, 0, sizeof(ops));
+    ops.udp_bind = mock_udp_bind;
+    ops.udp_sendto = mock_udp_sendto;
+    ops.udp_recvfrom = mock_udp_recvfrom;
+    ops.tcp_listen = mock_listen;
+    ops.tcp_accept = mock_accept;
+    ops.tcp_recv = mock_recv;
+    ops.tcp_send = mock_send;
+    ops.close_socket = mock_close;
+
+    CHECK(flash_sim_open(&sim, NULL) == FLASH_RESULT_OK);
+    sim.erase_us = 50U;
+    sim.program_us = 1U;
+    sim.program_unit_us = 0U;
+    CHECK(flash_init(&flash, &g_flash_sim_ops, &sim) == FLASH_RESULT_OK);
+    uds_download_flash_init(&download_flash, &flash, &flash_memory);
+
+    uds_init(&context);
+    uds_service_table_init(&table);
+    uds_register_core_services(&table);
+    uds_register_download_services(&table);
+    uds_set_service_table(&context, &table);
+    uds_download_init(&download, &flash_memory, &region, 1U);
+    uds_download_set_max_block_length(&download, MAX_BLOCK_LENGTH);
+    uds_download_attach(&context, &download);
+
+    (void)memset(&config, 0, sizeof(config));
+    config.logical_address = ENTITY_ADDRESS;
+    config.general_inactivity_time = 300000U;
+    config.initial_inactivity_time = 2000U;
+    config.alive_check_time = 500U;
+    config.max_tester_connections = 1U;
+    CHECK(doip_interface_init(&itf, &ops) == DOIP_RESULT_OK);
+    CHECK(doip_entity_init(&entity, &config, &itf) == DOIP_RESULT_OK);
+    CHECK(doip_entity_start(&entity) == DOIP_RESULT_OK);
+    doip_entity_set_uds_stream_callback(&entity, on_stream);
+}
+
+static bool positive(uint32_t index, uint8_t sid)
+{
+    return (index < response_count) && (responses[index][0] == (uint8_t)(sid + 0x40U));
+}
+
+static void test_download(void)
+{
+    /* Streamed, reassembled, streamed, streamed, then a short last block */
+    static const uint32_t blocks[5] = { 65536U, 1000U, 65536U, 65536U, 12000U };
+    static const uint8_t wdbi[2] = { 0xF1U, 0x90U };
+    uint32_t offset = 0U;
+    uint32_t i;
+
+    put_routing_activation();
+    put_unlock();
+    put_request_download(FLASH_BANK_B_ADDRESS, sizeof(image));
+    for (i = 0U; i < 5U; i++) {
+        put_transfer_data((uint8_t)(i + 1U), &image[offset], blocks[i]);
+        offset += blocks[i];
+    }
+    /* Repeats of the last block are acknowledged, not written again */
+    put_transfer_data(5U, &image[offset - blocks[4]], blocks[4]);
+    put_transfer_data(6U, &image[offset], sizeof(image) - offset);
+    /* Only TransferData is taken in parts */
+    put_request(0x2EU, wdbi, sizeof(wdbi), image, 8000U);
+    put_transfer_exit(crc32_compute(image, sizeof(image)));
+
+    run_entity();
+    collect_responses();
+
+    CHECK(response_count == 13U);
+    CHECK(acks == 13U);
+    CHECK(positive(0U, 0x10U) && positive(1U, 0x27U) && positive(2U, 0x27U));
+    /* maxNumberOfBlockLength is what the stream path takes */
+    CHECK(positive(3U, 0x34U) && (responses[3][1] == 0x30U) &&
+          (responses[3][2] == 0x01U) && (responses[3][3] == 0x00U) &&
+          (responses[3][4] == 0x02U));
+    for (i = 0U; i < 7U; i++) {
+        CHECK(positive(4U + i, 0x36U) &&
+              (responses[4U + i][1] == (uint8_t)((i < 5U) ? (i + 1U) : i)));
+    }
+    CHECK((responses[11][0] == 0x7FU) && (responses[11][1] == 0x2EU));
+    CHECK(positive(12U, 0x37U));
+    CHECK(download.stats.repeated_blocks == 1U);
+    CHECK(download.stats.bytes == sizeof(image));
+    CHECK(stream_aborts == 0U);
+
+    CHECK(flash_read(&flash, FLASH_BANK_B_ADDRESS, readback, sizeof(image)) ==
+          FLASH_RESULT_OK);
+    CHECK(memcmp(readback, image, sizeof(image)) == 0);
+}
+
+/* The tester goes away in the middle of a streamed block */
+static void test_cut_off(void)
+{
+    sent_length = 0U;
+    stream_length = 0U;
+    stream_position = 0U;
+    put_request_download(FLASH_BANK_B_ADDRESS, sizeof(image));
+    put_transfer_data(1U, image, 65536U);
+    stream_length -= 30000U;
+    peer_closed = true;
+
+    run_entity();
+    collect_responses();
+
+    CHECK(positive(0U, 0x34U));
+    CHECK(response_count == 1U);
+    CHECK(stream_aborts == 1U);
+    CHECK(!download.active);
+}
+
+int main(void)
+{
+    uint32_t i;
+
+    for (i = 0U; i < sizeof(image); i++) {
+        image[i] = (uint8_t)test_random(&seed);
+    }
+
+    start();
+    test_download();
+    test_cut_off();
+    flash_sim_close(&sim);
+
+    return TEST_RESULT();
+}
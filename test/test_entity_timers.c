@@ -0,0 +1,285 @@
+#include "test_util.h"
+#include "app_doip_entity.h"
+#include <string.h>
+
+/* Entity timeouts under a jittery scheduler: the task sleeps until the
+ * next deadline, or an earlier event, and oversleeps by up to MAX_JITTER
+ * as if held up by the mutex or a slow UDS handler. Announcements and
+ * inactivity closes must never come early and never later than the
+ * jitter. The clock wraps during the run. */
+
+#define TESTER_ADDRESS      0x0E80U
+#define ENTITY_ADDRESS      0x1000U
+#define IDLE_SOCKET         5
+#define TESTER_SOCKET       6
+#define INITIAL_TIMEOUT     2000U
+#define GENERAL_TIMEOUT     5000U
+#define MAX_JITTER          200U
+#define MESSAGES            4U
+#define ROUNDS              200U
+
+static uint32_t seed = 11U;
+static uint32_t now_ms;
+
+/* Bytes waiting on each socket, the tester's are appended as it sends */
+static uint8_t tester_rx[256];
+static uint32_t tester_rx_length;
+static uint32_t tester_rx_position;
+static bool idle_pending;
+static bool tester_pending;
+static uint32_t idle_closed_at;
+static uint32_t tester_closed_at;
+static bool idle_closed;
+static bool tester_closed;
+static uint32_t announcements;
+static uint32_t announced_at[DOIP_ANNOUNCEMENT_COUNT + 1U];
+
+static int mock_udp_bind(uint16_t port)
+{
+    (void)port;
+    return 2;
+}
+
+static int mock_listen(uint16_t port)
+{
+    (void)port;
+    return 3;
+}
+
+static int mock_udp_recvfrom(int sock, uint8_t *buf, uint32_t len,
+                             doip_endpoint_t *src)
+{
+    (void)sock;
+    (void)buf;
+    (void)len;
+    (void)src;
+    return -1;
+}
+
+static int mock_udp_sendto(int sock, const uint8_t *data, uint32_t len,
+                           const doip_endpoint_t *dst)
+{
+    (void)sock;
+    (void)dst;
+    if ((len > 3U) && (data[3] == (uint8_t)DOIP_PAYLOAD_TYPE_VEHICLE_ANNOUNCEMENT)) {
+        if (announcements <= DOIP_ANNOUNCEMENT_COUNT) {
+            announced_at[announcements] = now_ms;
+        }
+        announcements++;
+    }
+    return (int)len;
+}
+
+static int mock_accept(int listen_sock)
+{
+    (void)listen_sock;
+    if (idle_pending) {
+        idle_pending = false;
+        return IDLE_SOCKET;
+    }
+    if (tester_pending) {
+        tester_pending = false;
+        return TESTER_SOCKET;
+    }
+    return -1;
+}
+
+static int mock_recv(int sock, uint8_t *buf, uint32_t len)
+{
+    uint32_t n = tester_rx_length - tester_rx_position;
+
+    if ((sock != TESTER_SOCKET) || (n == 0U)) {
+        return -1;
+    }
+    if (n > len) {
+        n = len;
+    }
+    (void)memcpy(buf, &tester_rx[tester_rx_position], n);
+    tester_rx_position += n;
+    return (int)n;
+}
+
+static int mock_send(int sock, const uint8_t *data, uint32_t len)
+{
+    (void)sock;
+    (void)data;
+    return (int)len;
+}
+
+static void mock_close(int sock)
+{
+    if (sock == IDLE_SOCKET) {
+        idle_closed = true;
+        idle_closed_at = now_ms;
+    } else if (sock == TESTER_SOCKET) {
+        tester_closed = true;
+        tester_closed_at = now_ms;
+    } else {
+        /* UDP and listener */
+    }
+}
+
+static int mock_select(const int *sockets, uint8_t *events, uint32_t count,
+                       uint32_t timeout_ms)
+{
+    int ready = 0;
+    uint32_t i;
+
+    (void)timeout_ms;
+    for (i = 0U; i < count; i++) {
+        events[i] = 0U;
+        if (((sockets[i] == 3) && (idle_pending || tester_pending)) ||
+            ((sockets[i] == TESTER_SOCKET) && (tester_rx_position < tester_rx_length))) {
+            events[i] = DOIP_SOCKET_EVENT_READ;
+            ready++;
+        }
+    }
+    return ready;
+}
+
+static void put_message(uint16_t type, const uint8_t *payload, uint32_t length)
+{
+    uint8_t *h = &tester_rx[tester_rx_length];
+
+    h[0] = 0x02U;
+    h[1] = 0xFDU;
+    h[2] = (uint8_t)(type >> 8);
+    h[3] = (uint8_t)type;
+    h[4] = 0U;
+    h[5] = 0U;
+    h[6] = 0U;
+    h[7] = (uint8_t)length;
+    (void)memcpy(&h[8], payload, length);
+    tester_rx_length += 8U + length;
+}
+
+static bool is_before(uint32_t a, uint32_t b)
+{
+    return (int32_t)(a - b) < 0;
+}
+
+/* 'at' is no earlier than 'deadline' and late by at most the jitter */
+static bool on_time(uint32_t at, uint32_t deadline)
+{
+    return !is_before(at, deadline) && ((at - deadline) <= MAX_JITTER);
+}
+
+static void run_round(uint32_t start)
+{
+    static const uint8_t activation[7] = {
+        (uint8_t)(TESTER_ADDRESS >> 8), (uint8_t)TESTER_ADDRESS, 0x00U, 0U, 0U, 0U, 0U
+    };
+    static const uint8_t tester_present[6] = {
+        (uint8_t)(TESTER_ADDRESS >> 8), (uint8_t)TESTER_ADDRESS,
+        (uint8_t)(ENTITY_ADDRESS >> 8), (uint8_t)ENTITY_ADDRESS, 0x3EU, 0x80U
+    };
+    static doip_interface_t itf;
+    static doip_entity_t entity;
+    doip_network_ops_t ops;
+    doip_entity_config_t config;
+    uint32_t events[2U + MESSAGES];
+    uint32_t event = 0U;
+    uint32_t idle_accepted = 0U;
+    uint32_t last_message = 0U;
+    uint32_t sleep;
+    uint32_t gap;
+    uint32_t i;
+
+    (void)memset(&ops, 0, sizeof(ops));
+    ops.udp_bind = mock_udp_bind;
+    ops.udp_sendto = mock_udp_sendto;
+    ops.udp_recvfrom = mock_udp_recvfrom;
+    ops.tcp_listen = mock_listen;
+    ops.tcp_accept = mock_accept;
+    ops.tcp_recv = mock_recv;
+    ops.tcp_send = mock_send;
+    ops.close_socket = mock_close;
+    ops.socket_select = mock_select;
+
+    (void)memset(&config, 0, sizeof(config));
+    config.logical_address = ENTITY_ADDRESS;
+    config.initial_inactivity_time = INITIAL_TIMEOUT;
+    config.general_inactivity_time = GENERAL_TIMEOUT;
+    config.alive_check_time = 500U;
+    config.max_tester_connections = 1U;
+
+    tester_rx_length = 0U;
+    tester_rx_position = 0U;
+    idle_closed = false;
+    tester_closed = false;
+    announcements = 0U;
+
+    /* A connection that never activates, then a tester that sends a few
+     * messages and goes quiet, at random times */
+    events[0] = start + (test_random(&seed) % 3000U);
+    events[1] = events[0] + (test_random(&seed) % 3000U);
+    for (i = 2U; i < (2U + MESSAGES); i++) {
+        events[i] = events[i - 1U] + 1U +
+                    (test_random(&seed) % (GENERAL_TIMEOUT - (2U * MAX_JITTER)));
+    }
+
+    now_ms = start;
+    CHECK(doip_interface_init(&itf, &ops) == DOIP_RESULT_OK);
+    CHECK(doip_entity_init(&entity, &config, &itf) == DOIP_RESULT_OK);
+    doip_entity_run_timers(&entity, now_ms);
+    CHECK(doip_entity_start(&entity) == DOIP_RESULT_OK);
+
+    while (!tester_closed && (test_failures == 0)) {
+        /* Sleep until the next deadline or event, plus scheduling jitter.
+         * A socket with something to read ends the sleep at once. */
+        sleep = doip_entity_get_next_timeout(&entity);
+        if (idle_pending || tester_pending || (tester_rx_position < tester_rx_length)) {
+            sleep = 0U;
+        }
+        if (event < (2U + MESSAGES)) {
+            gap = is_before(now_ms, events[event]) ? (events[event] - now_ms) : 0U;
+            if (gap < sleep) {
+                sleep = gap;
+            }
+        }
+        CHECK(sleep != DOIP_WAIT_FOREVER);
+        now_ms += sleep + (test_random(&seed) % (MAX_JITTER + 1U));
+
+        /* What became due while the task slept */
+        doip_entity_run_timers(&entity, now_ms);
+        if ((event < (2U + MESSAGES)) && !is_before(now_ms, events[event])) {
+            if (event == 0U) {
+                idle_pending = true;
+                idle_accepted = now_ms;
+            } else if (event == 1U) {
+                tester_pending = true;
+                put_message(DOIP_PAYLOAD_TYPE_ROUTING_ACTIVATION_REQ, activation,
+                            sizeof(activation));
+            } else {
+                put_message(DOIP_PAYLOAD_TYPE_DIAG_MESSAGE, tester_present,
+                            sizeof(tester_present));
+            }
+            last_message = now_ms;
+            event++;
+        }
+        (void)doip_interface_wait(&itf, 0U);
+        (void)doip_entity_process(&entity, NULL);
+    }
+
+    CHECK(announcements == DOIP_ANNOUNCEMENT_COUNT);
+    CHECK(on_time(announced_at[0], start));
+    for (i = 1U; i < DOIP_ANNOUNCEMENT_COUNT; i++) {
+        CHECK(on_time(announced_at[i], announced_at[i - 1U] + DOIP_ANNOUNCEMENT_INTERVAL));
+    }
+    CHECK(idle_closed && on_time(idle_closed_at, idle_accepted + INITIAL_TIMEOUT));
+    CHECK(event == (2U + MESSAGES));
+    CHECK(on_time(tester_closed_at, last_message + GENERAL_TIMEOUT));
+}
+
+int main(void)
+{
+    uint32_t start = 0xFFFF0000U;   /* Wraps within the first rounds */
+    uint32_t round;
+
+    for (round = 0U; (round < ROUNDS) && (test_failures == 0); round++) {
+        run_round(start);
+        start = now_ms + (test_random(&seed) % 100000U);
+    }
+
+    return TEST_RESULT();
+}
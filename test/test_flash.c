@@ -0,0 +1,123 @@
+#include "test_util.h"
+#include "flash_sim.h"
+#include "flash_erase.h"
+#include <string.h>
+
+/* Flash HAL on the simulated backend and the background eraser on top */
+
+static flash_sim_t sim;
+static flash_t flash;
+
+static void test_hal(void)
+{
+    const uint32_t a = FLASH_BANK_A_ADDRESS;
+    uint8_t data[FLASH_QUAD_PAGE_SIZE];
+    uint8_t unit[FLASH_PROGRAM_UNIT];
+    uint8_t read[FLASH_QUAD_PAGE_SIZE];
+
+    (void)memset(data, 0x5A, sizeof(data));
+
+    /* Any address inside the sector erases it, one operation at a time */
+    CHECK(flash_erase_sector(&flash, a + 5U) == FLASH_RESULT_OK);
+    CHECK(flash_get_status(&flash) == FLASH_RESULT_BUSY);
+    CHECK(flash_erase_sector(&flash, a) == FLASH_RESULT_BUSY);
+    CHECK(flash_wait(&flash) == FLASH_RESULT_OK);
+    CHECK(flash_blank_check(&flash, a, FLASH_SECTOR_SIZE) == FLASH_RESULT_OK);
+
+    /* Program units, within one quad-page, inside the flash */
+    CHECK(flash_program(&flash, a + 8U, data, 16U) == FLASH_RESULT_INVALID_PARAM);
+    CHECK(flash_program(&flash, a, data, 24U) == FLASH_RESULT_INVALID_PARAM);
+    CHECK(flash_program(&flash, a + 16U, data, 128U) == FLASH_RESULT_INVALID_PARAM);
+    CHECK(flash_program(&flash, 0x100U, data, 16U) == FLASH_RESULT_INVALID_PARAM);
+    CHECK(flash_program(&flash, FLASH_PFLASH_ADDRESS + FLASH_PFLASH_SIZE - 16U,
+                        data, 32U) == FLASH_RESULT_INVALID_PARAM);
+
+    CHECK(flash_program(&flash, a, data, 128U) == FLASH_RESULT_OK);
+    CHECK(flash_wait(&flash) == FLASH_RESULT_OK);
+    CHECK(flash_read(&flash, a, read, 128U) == FLASH_RESULT_OK);
+    CHECK(memcmp(read, data, 128U) == 0);
+    CHECK(flash_blank_check(&flash, a, FLASH_SECTOR_SIZE) == FLASH_RESULT_NOT_BLANK);
+
+    /* A unit that is not blank cannot be programmed again */
+    CHECK(flash_program(&flash, a + 16U, data, 16U) == FLASH_RESULT_OK);
+    CHECK(flash_wait(&flash) == FLASH_RESULT_ERROR);
+    CHECK(flash.stats.errors == 1U);
+
+    /* Data is taken when the operation completes, so it must stay put */
+    (void)memset(unit, 0x11, sizeof(unit));
+    CHECK(flash_program(&flash, a + 128U, unit, 16U) == FLASH_RESULT_OK);
+    (void)memset(unit, 0x22, sizeof(unit));
+    CHECK(flash_wait(&flash) == FLASH_RESULT_OK);
+    CHECK(flash_read(&flash, a + 128U, read, 16U) == FLASH_RESULT_OK);
+    CHECK(read[0] == 0x22U);
+}
+
+/* Program one unit in each of 'count' sectors from 'address' */
+static void dirty(uint32_t address, uint32_t count)
+{
+    static const uint8_t zeros[FLASH_PROGRAM_UNIT];
+    uint32_t i;
+
+    for (i = 0U; i < count; i++) {
+        (void)flash_program(&flash, address + (i * FLASH_SECTOR_SIZE), zeros,
+                            sizeof(zeros));
+        (void)flash_wait(&flash);
+    }
+}
+
+static void run_erase(flash_erase_t *erase)
+{
+    while (flash_erase_step(erase) == FLASH_RESULT_BUSY) {
+        (void)flash_wait(&flash);
+    }
+}
+
+static void test_erase(void)
+{
+    const uint32_t b = FLASH_BANK_B_ADDRESS;
+    flash_erase_t erase;
+
+    flash_erase_init(&erase, &flash);
+
+    /* Blank sectors are skipped, dirty ones erased */
+    dirty(b, 4U);
+    flash_erase_request(&erase, b, 8U * FLASH_SECTOR_SIZE);
+    CHECK(!flash_erase_covers(&erase, b, FLASH_PROGRAM_UNIT));
+    run_erase(&erase);
+    CHECK(erase.frontier == (b + (8U * FLASH_SECTOR_SIZE)));
+    CHECK(erase.stats.sectors_erased == 4U);
+    CHECK(erase.stats.sectors_skipped == 4U);
+    CHECK(flash_erase_covers(&erase, b, 8U * FLASH_SECTOR_SIZE));
+    CHECK(!flash_erase_covers(&erase, b, (8U * FLASH_SECTOR_SIZE) + 1U));
+    CHECK(flash_blank_check(&flash, b, 8U * FLASH_SECTOR_SIZE) == FLASH_RESULT_OK);
+
+    /* A range starting in the erased part keeps the progress */
+    flash_erase_request(&erase, b + FLASH_SECTOR_SIZE, 16U * FLASH_SECTOR_SIZE);
+    CHECK(erase.frontier == (b + (8U * FLASH_SECTOR_SIZE)));
+    CHECK(flash_erase_covers(&erase, b + FLASH_SECTOR_SIZE, FLASH_SECTOR_SIZE));
+
+    /* Size 0 drops it, the next request starts over */
+    flash_erase_request(&erase, 0U, 0U);
+    CHECK(!flash_erase_covers(&erase, b + FLASH_SECTOR_SIZE, FLASH_SECTOR_SIZE));
+    CHECK(flash_erase_step(&erase) == FLASH_RESULT_OK);
+    dirty(b, 1U);
+    flash_erase_request(&erase, b, FLASH_SECTOR_SIZE);
+    CHECK(erase.frontier == b);
+    run_erase(&erase);
+    CHECK(flash_blank_check(&flash, b, FLASH_SECTOR_SIZE) == FLASH_RESULT_OK);
+}
+
+int main(void)
+{
+    CHECK(flash_sim_open(&sim, NULL) == FLASH_RESULT_OK);
+    sim.erase_us = 200U;
+    sim.program_us = 2U;
+    sim.program_unit_us = 1U;
+    CHECK(flash_init(&flash, &g_flash_sim_ops, &sim) == FLASH_RESULT_OK);
+
+    test_hal();
+    test_erase();
+
+    flash_sim_close(&sim);
+    return TEST_RESULT();
+}
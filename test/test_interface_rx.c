@@ -0,0 +1,343 @@
+#include "test_util.h"
+#include "doip_interface.h"
+#include <string.h>
+
+/* TCP receive path of the interface: messages sent back to back and read
+ * in random pieces come out whole and in order, from the ring buffer or,
+ * for diagnostic messages larger than it, through the stream callback.
+ * A caller-supplied connection pool replaces the built-in one. */
+
+#define STREAM_SOCKET       5
+
+static uint8_t stream[1U << 22];
+static uint32_t stream_length;
+static uint32_t stream_position;
+static uint32_t seed = 1U;
+
+/* Hands out the stream in pieces of 1 to 3000 bytes, then would block */
+static int mock_recv(int sock, uint8_t *buf, uint32_t len)
+{
+    uint32_t n = 1U + (test_random(&seed) % 3000U);
+
+    (void)sock;
+    if (stream_position >= stream_length) {
+        return -1;
+    }
+    if (n > len) {
+        n = len;
+    }
+    if (n > (stream_length - stream_position)) {
+        n = stream_length - stream_position;
+    }
+    (void)memcpy(buf, &stream[stream_position], n);
+    stream_position += n;
+    return (int)n;
+}
+
+static bool accepted;
+
+static int mock_accept(int listen_sock)
+{
+    (void)listen_sock;
+    if (accepted) {
+        return -1;
+    }
+    accepted = true;
+    return STREAM_SOCKET;
+}
+
+static int mock_listen(uint16_t port)
+{
+    (void)port;
+    return 3;
+}
+
+static uint32_t closes;
+
+static void mock_close(int sock)
+{
+    (void)sock;
+    closes++;
+}
+
+static uint8_t sent[64];
+static uint32_t sent_length;
+
+static int mock_send(int sock, const uint8_t *data, uint32_t len)
+{
+    (void)sock;
+    if ((sent_length + len) > sizeof(sent)) {
+        return -1;
+    }
+    (void)memcpy(&sent[sent_length], data, len);
+    sent_length += len;
+    return (int)len;
+}
+
+static void put_header(uint16_t type, uint32_t length)
+{
+    uint8_t *h = &stream[stream_length];
+
+    h[0] = 0x03U;
+    h[1] = 0xFCU;
+    h[2] = (uint8_t)(type >> 8);
+    h[3] = (uint8_t)type;
+    h[4] = (uint8_t)(length >> 24);
+    h[5] = (uint8_t)(length >> 16);
+    h[6] = (uint8_t)(length >> 8);
+    h[7] = (uint8_t)length;
+    stream_length += 8U;
+}
+
+static void start(doip_interface_t *itf, doip_network_ops_t *ops)
+{
+    (void)memset(ops, 0, sizeof(*ops));
+    ops->tcp_recv = mock_recv;
+    ops->tcp_accept = mock_accept;
+    ops->tcp_listen = mock_listen;
+    ops->close_socket = mock_close;
+    ops->tcp_send = mock_send;
+
+    accepted = false;
+    closes = 0U;
+    sent_length = 0U;
+    stream_length = 0U;
+    stream_position = 0U;
+    CHECK(doip_interface_init(itf, ops) == DOIP_RESULT_OK);
+    CHECK(doip_interface_start_tcp_server(itf, 13400U) == DOIP_RESULT_OK);
+}
+
+/* Messages of 0 to 4000 bytes, most of them small */
+
+#define MESSAGE_MAX         200000U
+
+static uint32_t lengths[MESSAGE_MAX];
+static uint32_t messages_sent;
+static uint32_t messages_received;
+
+static void on_message(int connection_id, const uint8_t *data, uint32_t length,
+                       void *user_data)
+{
+    uint32_t n = messages_received;
+    uint32_t i;
+
+    (void)connection_id;
+    (void)user_data;
+    messages_received++;
+    if ((n >= messages_sent) || (length != (lengths[n] + 8U))) {
+        CHECK(false);
+        return;
+    }
+    for (i = 0U; i < lengths[n]; i++) {
+        if (data[8U + i] != (uint8_t)(n + i)) {
+            CHECK(false);
+            return;
+        }
+    }
+}
+
+static void test_reassembly(void)
+{
+    static doip_interface_t itf;
+    doip_network_ops_t ops;
+    uint32_t length;
+    uint32_t i;
+
+    start(&itf, &ops);
+    messages_sent = 0U;
+    messages_received = 0U;
+    while ((stream_length < (sizeof(stream) - 5000U)) && (messages_sent < MESSAGE_MAX)) {
+        length = ((test_random(&seed) % 4U) == 0U) ? (test_random(&seed) % 4000U) :
+                                                     (test_random(&seed) % 20U);
+        lengths[messages_sent] = length;
+        put_header(0x8001U, length);
+        for (i = 0U; i < length; i++) {
+            stream[stream_length + i] = (uint8_t)(messages_sent + i);
+        }
+        stream_length += length;
+        messages_sent++;
+    }
+
+    while (stream_position < stream_length) {
+        (void)doip_interface_process(&itf, NULL, on_message, NULL, NULL, NULL);
+    }
+    (void)doip_interface_process(&itf, NULL, on_message, NULL, NULL, NULL);
+
+    CHECK(messages_received == messages_sent);
+    CHECK(itf.rx_message_count == messages_sent);
+    /* Only a message across the ring end is copied out of it */
+    CHECK(itf.rx_linearized_count <= ((stream_length / DOIP_RX_BUFFER_SIZE) + 1U));
+}
+
+/* A 1 MB diagnostic message streamed, then a small message behind it */
+
+#define STREAM_DATA         (1U << 20)
+
+static uint32_t stream_received;
+static uint32_t stream_ends;
+static uint32_t small_messages;
+
+static bool on_stream(int connection_id, doip_stream_event_t event,
+                      const doip_stream_info_t *info, const uint8_t *data,
+                      uint32_t length, void *user_data)
+{
+    uint32_t i;
+
+    (void)connection_id;
+    (void)user_data;
+    switch (event) {
+    case DOIP_STREAM_EVENT_START:
+        CHECK(info->source_address == 0x0E80U);
+        CHECK(info->target_address == 0x1000U);
+        CHECK(info->user_data_length == STREAM_DATA);
+        break;
+    case DOIP_STREAM_EVENT_DATA:
+        CHECK(info->offset == stream_received);
+        for (i = 0U; i < length; i++) {
+            if (data[i] != (uint8_t)((stream_received + i) * 7U)) {
+                CHECK(false);
+                break;
+            }
+        }
+        stream_received += length;
+        break;
+    case DOIP_STREAM_EVENT_END:
+        stream_ends++;
+        break;
+    default:
+        CHECK(false);
+        break;
+    }
+    return true;
+}
+
+static void on_small(int connection_id, const uint8_t *data, uint32_t length,
+                     void *user_data)
+{
+    (void)connection_id;
+    (void)user_data;
+    CHECK((length == 8U) && (data[3] == 0x07U));
+    small_messages++;
+}
+
+static void test_streaming(void)
+{
+    static doip_interface_t itf;
+    doip_network_ops_t ops;
+    uint32_t i;
+
+    start(&itf, &ops);
+    doip_interface_set_stream_callback(&itf, on_stream, NULL);
+
+    put_header(0x8001U, STREAM_DATA + 4U);
+    stream[stream_length++] = 0x0EU;
+    stream[stream_length++] = 0x80U;
+    stream[stream_length++] = 0x10U;
+    stream[stream_length++] = 0x00U;
+    for (i = 0U; i < STREAM_DATA; i++) {
+        stream[stream_length++] = (uint8_t)(i * 7U);
+    }
+    put_header(0x0007U, 0U);
+
+    while (stream_position < stream_length) {
+        (void)doip_interface_process(&itf, NULL, on_small, NULL, NULL, NULL);
+    }
+
+    CHECK(stream_received == STREAM_DATA);
+    CHECK(stream_ends == 1U);
+    CHECK(small_messages == 1U);
+}
+
+/* Non-diagnostic messages too large for the ring are NACKed and skipped,
+ * one with a wrong pattern also closes the connection */
+
+static uint32_t disconnects;
+
+static void on_disconnected(int connection_id, void *user_data)
+{
+    (void)connection_id;
+    (void)user_data;
+    disconnects++;
+}
+
+static void test_oversized(void)
+{
+    static const uint8_t too_large[9] = {
+        0x03U, 0xFCU, 0x00U, 0x00U, 0x00U, 0x00U, 0x00U, 0x01U, 0x02U
+    };
+    static const uint8_t incorrect_pattern[9] = {
+        0x03U, 0xFCU, 0x00U, 0x00U, 0x00U, 0x00U, 0x00U, 0x01U, 0x00U
+    };
+    static doip_interface_t itf;
+    doip_network_ops_t ops;
+
+    start(&itf, &ops);
+    small_messages = 0U;
+    put_header(0x0005U, DOIP_RX_BUFFER_SIZE);
+    stream_length += DOIP_RX_BUFFER_SIZE;
+    put_header(0x0007U, 0U);
+
+    while (stream_position < stream_length) {
+        (void)doip_interface_process(&itf, NULL, on_small, NULL, NULL, NULL);
+    }
+    CHECK((sent_length == sizeof(too_large)) &&
+          (memcmp(sent, too_large, sizeof(too_large)) == 0));
+    CHECK(small_messages == 1U);
+    CHECK(closes == 0U);
+
+    start(&itf, &ops);
+    disconnects = 0U;
+    put_header(0x0005U, DOIP_RX_BUFFER_SIZE);
+    stream[stream_length - 7U] = 0xFDU;
+    stream_length += DOIP_RX_BUFFER_SIZE;
+
+    while ((stream_position < stream_length) && (closes == 0U)) {
+        (void)doip_interface_process(&itf, NULL, on_small, NULL, on_disconnected,
+                                     NULL);
+    }
+    CHECK((sent_length == sizeof(incorrect_pattern)) &&
+          (memcmp(sent, incorrect_pattern, sizeof(incorrect_pattern)) == 0));
+    CHECK((closes == 1U) && (disconnects == 1U));
+}
+
+static void test_connection_pool(void)
+{
+    static doip_interface_t itf;
+    static doip_tcp_connection_t pool[3];
+    doip_network_ops_t ops;
+    int ids[3];
+    uint32_t i;
+
+    start(&itf, &ops);
+    CHECK(itf.connection_count == DOIP_DEFAULT_CONNECTIONS);
+    CHECK(doip_interface_set_connection_pool(&itf, pool, 0U) == DOIP_RESULT_INVALID_PARAM);
+    CHECK(doip_interface_set_connection_pool(&itf, pool, 3U) == DOIP_RESULT_OK);
+    CHECK(itf.connections == pool);
+
+    /* Ids come from the pool, one more socket is refused */
+    for (i = 0U; i < 3U; i++) {
+        ids[i] = doip_interface_attach_socket(&itf, 10 + (int)i);
+        CHECK((ids[i] >= 0) && (ids[i] < 3));
+    }
+    CHECK(doip_interface_attach_socket(&itf, 13) < 0);
+    CHECK(doip_interface_set_connection_pool(&itf, itf.default_connections,
+                                             DOIP_DEFAULT_CONNECTIONS) == DOIP_RESULT_NOT_READY);
+
+    /* The runtime limit stays within the pool */
+    doip_interface_close_connection(&itf, ids[2]);
+    doip_interface_set_max_connections(&itf, 2U);
+    CHECK(doip_interface_attach_socket(&itf, 13) < 0);
+    doip_interface_set_max_connections(&itf, 100U);
+    CHECK(itf.max_connections == 3U);
+    CHECK(doip_interface_attach_socket(&itf, 13) == ids[2]);
+}
+
+int main(void)
+{
+    test_reassembly();
+    test_streaming();
+    test_oversized();
+    test_connection_pool();
+
+    return TEST_RESULT();
+}
@@ -0,0 +1,30 @@
+#ifndef TEST_LWIP_H
+#define TEST_LWIP_H
+
+#include "lwip/tcpip.h"
+#include "lwip/sys.h"
+
+/**
+ * @file test_lwip.h
+ * @brief Start of the host lwIP stack for tests and benchmarks
+ *
+ * The stack runs in its own tcpip thread as on the target, with the
+ * 127.0.0.1 loopback interface when LWIP_NETIF_LOOPBACK is on.
+ */
+
+static void test_lwip_started(void *arg)
+{
+    sys_sem_signal((sys_sem_t *)arg);
+}
+
+static inline void test_lwip_start(void)
+{
+    sys_sem_t started;
+
+    (void)sys_sem_new(&started, 0U);
+    tcpip_init(test_lwip_started, &started);
+    (void)sys_arch_sem_wait(&started, 0U);
+    sys_sem_free(&started);
+}
+
+#endif /* TEST_LWIP_H */
@@ -0,0 +1,66 @@
+#include "test_util.h"
+#include "doip_lwip_adapter.h"
+#include "lwip/sockets.h"
+#include <string.h>
+
+/* Socket backend on host sockets: socket_wake ends a select early and is
+ * not reported as a ready DoIP socket */
+
+static const doip_network_ops_t *ops = &g_lwip_net_ops;
+
+static int wait_one(int sock, uint8_t *event, uint32_t timeout_ms)
+{
+    *event = DOIP_SOCKET_EVENT_READ;
+    return ops->socket_select(&sock, event, 1U, timeout_ms);
+}
+
+static void test_wake(void)
+{
+    struct sockaddr_in addr;
+    socklen_t addr_len = sizeof(addr);
+    doip_endpoint_t self;
+    uint8_t event;
+    uint8_t data = 0x5AU;
+    uint32_t start;
+    int sock;
+
+    CHECK(ops->socket_wake != NULL);
+    sock = ops->udp_bind(0U);
+    CHECK(sock >= 0);
+    CHECK(getsockname(sock, (struct sockaddr *)&addr, &addr_len) == 0);
+
+    /* Nothing to read */
+    CHECK(wait_one(sock, &event, 0U) == 0);
+    CHECK(event == 0U);
+
+    /* Pending wake-ups end the next wait at once and are all drained */
+    ops->socket_wake();
+    ops->socket_wake();
+    start = test_now_ms();
+    CHECK(wait_one(sock, &event, 5000U) == 0);
+    CHECK(event == 0U);
+    CHECK((test_now_ms() - start) < 1000U);
+    start = test_now_ms();
+    CHECK(wait_one(sock, &event, 50U) == 0);
+    CHECK((test_now_ms() - start) >= 40U);
+
+    /* A datagram next to a wake-up counts once */
+    self.ip_addr = htonl(INADDR_LOOPBACK);
+    self.port = ntohs(addr.sin_port);
+    CHECK(ops->udp_sendto(sock, &data, 1U, &self) == 1);
+    ops->socket_wake();
+    start = test_now_ms();
+    while ((wait_one(sock, &event, 0U) == 0) && ((test_now_ms() - start) < 1000U)) {
+    }
+    CHECK(event == DOIP_SOCKET_EVENT_READ);
+    CHECK(wait_one(sock, &event, 0U) == 1);
+
+    ops->close_socket(sock);
+}
+
+int main(void)
+{
+    test_wake();
+
+    return TEST_RESULT();
+}
@@ -0,0 +1,126 @@
+#include "test_util.h"
+#include "test_lwip.h"
+#include "doip_lwip_adapter.h"
+#include "lwip/sockets.h"
+#include <string.h>
+
+/* Netconn backend on the host lwIP stack: an idle socket does not stay
+ * readable, so a select with nothing to read waits out its timeout, and
+ * data, connections and wake-ups still end it */
+
+#define PORT                13400U
+#define IDLE_WAIT_MS        100U
+
+static const doip_network_ops_t *ops = &g_lwip_netconn_net_ops;
+
+static int wait_read(int sock, uint32_t timeout_ms)
+{
+    uint8_t event = DOIP_SOCKET_EVENT_READ;
+
+    return ops->socket_select(&sock, &event, 1U, timeout_ms);
+}
+
+/* Nothing to read: the select lasts its timeout */
+static bool stays_idle(int sock)
+{
+    uint32_t start = test_now_ms();
+
+    return (wait_read(sock, IDLE_WAIT_MS) == 0) &&
+           ((test_now_ms() - start) >= (IDLE_WAIT_MS - 10U));
+}
+
+static void loopback(struct sockaddr_in *addr, uint16_t port)
+{
+    (void)memset(addr, 0, sizeof(*addr));
+    addr->sin_family = AF_INET;
+    addr->sin_port = htons(port);
+    addr->sin_addr.s_addr = htonl(INADDR_LOOPBACK);
+}
+
+static void test_udp(void)
+{
+    struct sockaddr_in addr;
+    doip_endpoint_t src;
+    uint8_t buf[16];
+    int udp;
+    int client;
+
+    udp = ops->udp_bind(PORT);
+    CHECK(udp >= 0);
+
+    /* A new handle reads once to find out there is nothing */
+    if (wait_read(udp, 0U) == 1) {
+        CHECK(ops->udp_recvfrom(udp, buf, sizeof(buf), &src) < 0);
+    }
+    CHECK(stays_idle(udp));
+
+    client = socket(AF_INET, SOCK_DGRAM, 0);
+    loopback(&addr, (uint16_t)PORT);
+    CHECK(sendto(client, "vehicle", 7U, 0, (struct sockaddr *)&addr, sizeof(addr)) == 7);
+    CHECK(wait_read(udp, 1000U) == 1);
+    CHECK(ops->udp_recvfrom(udp, buf, sizeof(buf), &src) == 7);
+    CHECK(stays_idle(udp));
+
+    (void)close(client);
+    ops->close_socket(udp);
+}
+
+static void test_tcp(void)
+{
+    struct sockaddr_in addr;
+    uint8_t buf[64];
+    int listener;
+    int conn;
+    int client;
+
+    listener = ops->tcp_listen(PORT);
+    CHECK(listener >= 0);
+    if (wait_read(listener, 0U) == 1) {
+        CHECK(ops->tcp_accept(listener) < 0);
+    }
+    CHECK(stays_idle(listener));
+
+    /* An accepted connection is counted once */
+    client = socket(AF_INET, SOCK_STREAM, 0);
+    loopback(&addr, (uint16_t)PORT);
+    CHECK(connect(client, (struct sockaddr *)&addr, sizeof(addr)) == 0);
+    CHECK(wait_read(listener, 1000U) == 1);
+    conn = ops->tcp_accept(listener);
+    CHECK(conn >= 0);
+    CHECK(ops->tcp_accept(listener) < 0);
+    CHECK(stays_idle(listener));
+
+    if (wait_read(conn, 0U) == 1) {
+        CHECK(ops->tcp_recv(conn, buf, sizeof(buf)) < 0);
+    }
+    CHECK(stays_idle(conn));
+
+    /* Data ends the wait, reading it makes the socket idle again */
+    CHECK(send(client, "diagnostic", 10U, 0) == 10);
+    CHECK(wait_read(conn, 1000U) == 1);
+    CHECK(ops->tcp_recv(conn, buf, sizeof(buf)) == 10);
+    CHECK(stays_idle(conn));
+
+    /* A wake-up ends it without a ready socket */
+    ops->socket_wake();
+    CHECK(wait_read(conn, 5000U) == 0);
+    CHECK(stays_idle(conn));
+
+    /* The peer closing reads as 0 */
+    (void)close(client);
+    CHECK(wait_read(conn, 1000U) == 1);
+    CHECK(ops->tcp_recv(conn, buf, sizeof(buf)) == 0);
+
+    ops->close_socket(conn);
+    ops->close_socket(listener);
+}
+
+int main(void)
+{
+    test_lwip_start();
+
+    test_udp();
+    test_tcp();
+
+    return TEST_RESULT();
+}
@@ -0,0 +1,83 @@
+#include "test_util.h"
+#include "test_lwip.h"
+#include "doip_lwip_adapter.h"
+
+/* Socket backend on a host lwIP stack built without the loopback
+ * interface, as on the target: socket_wake() still ends a select,
+ * whether it comes before or during the wait, and leaves nothing
+ * readable behind */
+
+#define PORT                13400U
+#define IDLE_WAIT_MS        100U
+#define WAKE_DELAY_MS       50U
+
+static const doip_network_ops_t *ops = &g_lwip_net_ops;
+static sys_sem_t waker_done;
+
+static int wait_read(int sock, uint32_t timeout_ms)
+{
+    uint8_t event = DOIP_SOCKET_EVENT_READ;
+
+    return ops->socket_select(&sock, &event, 1U, timeout_ms);
+}
+
+/* Nothing to read: the select lasts its timeout */
+static bool stays_idle(int sock)
+{
+    uint32_t start = test_now_ms();
+
+    return (wait_read(sock, IDLE_WAIT_MS) == 0) &&
+           ((test_now_ms() - start) >= (IDLE_WAIT_MS - 10U));
+}
+
+/* A select of 5 s that returns with nothing ready */
+static bool woken(int sock)
+{
+    uint32_t start = test_now_ms();
+
+    return (wait_read(sock, 5000U) == 0) && ((test_now_ms() - start) < 1000U);
+}
+
+static void waker(void *arg)
+{
+    (void)arg;
+    sys_msleep(WAKE_DELAY_MS);
+    ops->socket_wake();
+    sys_sem_signal(&waker_done);
+}
+
+int main(void)
+{
+    int listener;
+
+    test_lwip_start();
+    (void)sys_sem_new(&waker_done, 0U);
+    CHECK(ops->socket_wake != NULL);
+
+    listener = ops->tcp_listen(PORT);
+    CHECK(listener >= 0);
+    /* The first select opens the wake socket */
+    CHECK(stays_idle(listener));
+
+    /* A wake-up before the select ends the next one */
+    ops->socket_wake();
+    CHECK(woken(listener));
+    CHECK(stays_idle(listener));
+
+    /* Wake-ups not yet seen by a select are served by one */
+    ops->socket_wake();
+    ops->socket_wake();
+    ops->socket_wake();
+    CHECK(woken(listener));
+    CHECK(stays_idle(listener));
+
+    /* From another thread during the wait */
+    (void)sys_thread_new("waker", waker, NULL, 0, 0);
+    CHECK(woken(listener));
+    (void)sys_arch_sem_wait(&waker_done, 0U);
+    CHECK(stays_idle(listener));
+
+    ops->close_socket(listener);
+
+    return TEST_RESULT();
+}
@@ -0,0 +1,87 @@
+#include "test_util.h"
+#include "app_doip_tester.h"
+#include <string.h>
+
+/* Tester side of the entity's socket handling: an alive check request is
+ * answered with the tester's logical address */
+
+#define ENTITY_SOCKET       7
+
+static const uint8_t alive_check_request[8] = {
+    0x03U, 0xFCU, 0x00U, 0x07U, 0x00U, 0x00U, 0x00U, 0x00U
+};
+static bool delivered;
+static uint8_t sent[64];
+static uint32_t sent_length;
+
+static int mock_connect(const doip_endpoint_t *remote)
+{
+    (void)remote;
+    return ENTITY_SOCKET;
+}
+
+static int mock_recv(int sock, uint8_t *buf, uint32_t len)
+{
+    CHECK(sock == ENTITY_SOCKET);
+    if (delivered || (len < sizeof(alive_check_request))) {
+        return -1;
+    }
+    delivered = true;
+    (void)memcpy(buf, alive_check_request, sizeof(alive_check_request));
+    return (int)sizeof(alive_check_request);
+}
+
+static int mock_send(int sock, const uint8_t *data, uint32_t len)
+{
+    CHECK(sock == ENTITY_SOCKET);
+    if ((sent_length + len) > sizeof(sent)) {
+        return -1;
+    }
+    (void)memcpy(&sent[sent_length], data, len);
+    sent_length += len;
+    return (int)len;
+}
+
+static void mock_close(int sock)
+{
+    (void)sock;
+}
+
+static void test_alive_check(void)
+{
+    static const uint8_t response[10] = {
+        0x03U, 0xFCU, 0x00U, 0x08U, 0x00U, 0x00U, 0x00U, 0x02U, 0x0EU, 0x80U
+    };
+    static doip_interface_t itf;
+    doip_network_ops_t ops;
+    doip_tester_config_t config;
+    doip_tester_t tester;
+    doip_endpoint_t entity = { 0U, 13400U };
+
+    (void)memset(&ops, 0, sizeof(ops));
+    ops.tcp_connect = mock_connect;
+    ops.tcp_recv = mock_recv;
+    ops.tcp_send = mock_send;
+    ops.close_socket = mock_close;
+
+    (void)memset(&config, 0, sizeof(config));
+    config.logical_address = 0x0E80U;
+    config.activation_type = 0x00U;
+
+    CHECK(doip_interface_init(&itf, &ops) == DOIP_RESULT_OK);
+    CHECK(doip_tester_init(&tester, &config, &itf) == DOIP_RESULT_OK);
+    CHECK(doip_tester_connect(&tester, &entity) == DOIP_RESULT_OK);
+
+    (void)doip_tester_process(&tester, NULL);
+
+    CHECK(delivered);
+    CHECK((sent_length == sizeof(response)) &&
+          (memcmp(sent, response, sizeof(response)) == 0));
+}
+
+int main(void)
+{
+    test_alive_check();
+
+    return TEST_RESULT();
+}
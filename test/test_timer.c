@@ -0,0 +1,91 @@
+#include "test_util.h"
+#include "doip_timer.h"
+
+/* The timer heap against a plain array of deadlines, on a millisecond
+ * clock that wraps during the run */
+
+static doip_timer_queue_t queue;
+static uint32_t deadlines[DOIP_TIMER_MAX];
+static bool armed[DOIP_TIMER_MAX];
+
+static bool is_before(uint32_t a, uint32_t b)
+{
+    return (int32_t)(a - b) < 0;
+}
+
+/* The expired timer was due and no armed one is earlier */
+static bool expired_in_order(int id, uint32_t now)
+{
+    uint32_t k;
+
+    if (!armed[id] || is_before(now, deadlines[id])) {
+        return false;
+    }
+    for (k = 0U; k < DOIP_TIMER_MAX; k++) {
+        if (armed[k] && ((int)k != id) && is_before(deadlines[k], deadlines[id])) {
+            return false;
+        }
+    }
+    return true;
+}
+
+int main(void)
+{
+    uint32_t seed = 7U;
+    uint32_t now = 0xFFFF0000U;     /* Wraps after about a minute */
+    uint32_t step;
+    uint32_t k;
+    uint32_t count;
+    uint32_t next;
+    uint16_t id;
+    int expired;
+
+    doip_timer_init(&queue);
+    CHECK(!doip_timer_next_deadline(&queue, &next));
+    CHECK(doip_timer_expire(&queue, now) == -1);
+
+    for (step = 0U; step < 300000U; step++) {
+        id = (uint16_t)(test_random(&seed) % DOIP_TIMER_MAX);
+
+        switch (test_random(&seed) % 4U) {
+        case 0U:
+        case 1U:
+            deadlines[id] = now + (test_random(&seed) % 100000U);
+            armed[id] = true;
+            doip_timer_start(&queue, id, deadlines[id]);
+            break;
+        case 2U:
+            armed[id] = false;
+            doip_timer_stop(&queue, id);
+            break;
+        default:
+            now += test_random(&seed) % 3000U;
+            while ((expired = doip_timer_expire(&queue, now)) >= 0) {
+                CHECK(expired_in_order(expired, now));
+                armed[expired] = false;
+            }
+            for (k = 0U; k < DOIP_TIMER_MAX; k++) {
+                CHECK(!armed[k] || is_before(now, deadlines[k]));
+            }
+            break;
+        }
+
+        count = 0U;
+        for (k = 0U; k < DOIP_TIMER_MAX; k++) {
+            CHECK(doip_timer_is_active(&queue, (uint16_t)k) == armed[k]);
+            count += armed[k] ? 1U : 0U;
+        }
+        CHECK(queue.count == count);
+        if (count > 0U) {
+            CHECK(doip_timer_next_deadline(&queue, &next));
+            for (k = 0U; k < DOIP_TIMER_MAX; k++) {
+                CHECK(!armed[k] || !is_before(deadlines[k], next));
+            }
+        }
+        if (test_failures > 0) {
+            break;
+        }
+    }
+
+    return TEST_RESULT();
+}
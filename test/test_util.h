@@ -0,0 +1,57 @@
+#ifndef TEST_UTIL_H
+#define TEST_UTIL_H
+
+#include <stdio.h>
+#include <stdint.h>
+#include <stdbool.h>
+#include <time.h>
+
+/**
+ * @file test_util.h
+ * @brief Checks shared by the host tests
+ *
+ * A failed CHECK() prints the condition and carries on, so one run shows
+ * every failure. TEST_RESULT() is the exit status ctest looks at.
+ */
+
+static int test_failures;
+
+#define CHECK(condition) \
+    do { \
+        if (!(condition)) { \
+            test_failures++; \
+            printf("FAIL %s:%d: %s\n", __FILE__, __LINE__, #condition); \
+        } \
+    } while (0)
+
+#define TEST_RESULT() \
+    ((test_failures == 0) ? (printf("PASS\n"), 0) : \
+                            (printf("%d FAILED\n", test_failures), 1))
+
+/* Monotonic clock for timing and simulated network pacing */
+static inline uint64_t test_now_ns(void)
+{
+    struct timespec now;
+
+    (void)clock_gettime(CLOCK_MONOTONIC, &now);
+    return ((uint64_t)now.tv_sec * 1000000000U) + (uint64_t)now.tv_nsec;
+}
+
+static inline uint32_t test_now_ms(void)
+{
+    return (uint32_t)(test_now_ns() / 1000000U);
+}
+
+/* Reproducible pseudo random numbers, xorshift32 */
+static inline uint32_t test_random(uint32_t *state)
+{
+    uint32_t x = *state;
+
+    x ^= x << 13;
+    x ^= x >> 17;
+    x ^= x << 5;
+    *state = x;
+    return x;
+}
+
+#endif /* TEST_UTIL_H */